@@ -0,0 +1,20 @@
+#pragma once
+
+namespace fineftp
+{
+  /**
+   * @brief How uploaded files are flushed to stable storage
+   *
+   * The sync operations are executed on the worker threads of the server. The
+   * "226" reply of an upload is sent when the data has reached the
+   * durability level of the policy, so the client knows that a confirmed
+   * upload survives a power loss (unless the policy is None).
+   */
+  enum class UploadDurability : int
+  {
+    None,              /**< Leave flushing to the operating system. The "226" reply is sent as soon as the file has been closed. */
+    SyncOnClose,       /**< Flush the file (fdatasync / FlushFileBuffers) after it has been received completely. */
+    PeriodicWriteback, /**< Start the writeback of the data every N bytes while receiving (sync_file_range on Linux) and flush the file after it has been received. This avoids bursts of dirty pages and makes the final flush cheap. */
+    GroupCommit,       /**< Like SyncOnClose, but uploads that finish at the same time are flushed together (one syncfs per filesystem on Linux). */
+  };
+}
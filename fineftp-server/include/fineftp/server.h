@@ -1,5 +1,6 @@
 #pragma once
 
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
 #include <memory>
@@ -8,6 +9,7 @@
 
 // IWYU pragma: begin_exports
 #include <fineftp/permissions.h>
+#include <fineftp/durability.h>
 
 #include <fineftp/fineftp_version.h>
 #include <fineftp/fineftp_export.h>
@@ -135,6 +137,36 @@ namespace fineftp
      */
     FINEFTP_EXPORT bool addUser(const std::string &username, const std::string &password, const std::string &local_root_path, Permission permissions);
 
+    /**
+     * @brief Adds a new user whose password is stored as salted hash
+     *
+     * Like addUser(), but the password is not kept in plaintext. The hash
+     * has the format "$pbkdf2-sha256$<iterations>$<salt>$<hash>", as created
+     * by createPasswordHash() or by passlib's pbkdf2_sha256. Logins of such
+     * users are verified on separate threads, see setPasswordVerification().
+     *
+     * @param username:         The username for login
+     * @param password_hash:    The hash of the user's password
+     * @param local_root_path:  A path to any resource on the local filesystem that will be accessed by the user
+     * @param permissions:      A bit-mask of what the user will be able to do.
+     *
+     * @return True if adding the user was successful (i.e. it didn't exist already and the hash is valid).
+     */
+    FINEFTP_EXPORT bool addUserWithPasswordHash(const std::string &username, const std::string &password_hash, const std::string &local_root_path, Permission permissions);
+
+    /**
+     * @brief Creates a salted PBKDF2-HMAC-SHA256 hash of a password for addUserWithPasswordHash()
+     *
+     * The iteration count determines how long the verification of each login
+     * takes (roughly 100 ms for 100000 iterations in an optimized build).
+     *
+     * @param password:   The password
+     * @param iterations: The PBKDF2 iteration count. Defaults to 100000.
+     *
+     * @return The password hash
+     */
+    FINEFTP_EXPORT static std::string createPasswordHash(const std::string &password, std::uint32_t iterations = 100000);
+
     /**
      * @brief Adds the "anonymous" / "ftp" user that FTP clients use to access FTP servers without password
      *
@@ -145,6 +177,47 @@ namespace fineftp
      */
     FINEFTP_EXPORT bool addUserAnonymous(const std::string &local_root_path, Permission permissions);
 
+    /**
+     * @brief Removes a user
+     *
+     * The user cannot log in anymore. Sessions in which the user is already
+     * logged in are not affected. Users can be added and removed while the
+     * server is running, logins are not blocked by that.
+     *
+     * @param username:  The username of the user to remove. "anonymous" and "ftp" remove the anonymous user.
+     *
+     * @return True if the user has been removed (i.e. it existed).
+     */
+    FINEFTP_EXPORT bool removeUser(const std::string &username);
+
+    /**
+     * @brief Loads users from a file and reloads them whenever the file changes
+     *
+     * Each line of the file describes one user:
+     *
+     *   username:password_hash:permissions:local_root_path
+     *
+     * The password hash has the format of addUserWithPasswordHash() and can be
+     * created with createPasswordHash(). For the anonymous user it is ignored
+     * and may be empty. The permissions are the names of Permission flags,
+     * separated by '|', e.g. "FileRead|DirList" or "All". Empty lines and
+     * lines starting with '#' are ignored.
+     *
+     * After start(), the file is watched (with inotify on Linux) and the
+     * users are replaced atomically whenever it changes, without restarting
+     * the server. Sessions that are already logged in keep their user until
+     * they log out, so running transfers are not interrupted. A file that is
+     * invalid is rejected as a whole and the previous users are kept. Users
+     * that have been added with addUser() are not affected by the file.
+     *
+     * Must be called before start().
+     *
+     * @param path: The path of the user file
+     *
+     * @return True if the file has been loaded successfully
+     */
+    FINEFTP_EXPORT bool setUserFile(const std::string &path);
+
     /**
      * @brief Starts the FTP Server
      *
@@ -194,6 +267,222 @@ namespace fineftp
      */
     void setCommandCallback(const FtpCommandCallback &callback);
 
+    /**
+     * @brief Sets the default compression level for MODE Z transfers
+     *
+     * MODE Z compresses the data connection with deflate. Clients can change
+     * the level for their session with "OPTS MODE Z LEVEL <level>". Files
+     * that are compressed already (e.g. .gz, .zip, .jpg) are always sent
+     * with level 0 to save CPU time.
+     *
+     * If fineFTP has been built without zlib, MODE Z is not available and
+     * this setting has no effect.
+     *
+     * Must be called before start().
+     *
+     * @param level: The zlib compression level from 0 (no compression) to 9 (best compression). Defaults to 6.
+     */
+    FINEFTP_EXPORT void setModeZCompressionLevel(int level);
+
+    /**
+     * @brief Enables computing checksums of uploads while receiving them
+     *
+     * When enabled, each STOR computes the checksum of the received data with
+     * the algorithm the client has selected for the HASH command (default
+     * SHA-256, may be changed with "OPTS HASH <algorithm>"). A following HASH
+     * command for the uploaded file is then answered without reading the
+     * file again. This costs CPU time on the I/O threads for every upload,
+     * so it is disabled by default.
+     *
+     * Must be called before start().
+     *
+     * @param enabled: Whether upload checksums are computed. Defaults to false.
+     */
+    FINEFTP_EXPORT void setUploadChecksumsEnabled(bool enabled);
+
+    /**
+     * @brief Enables atomic uploads
+     *
+     * When enabled, STOR writes the data to a hidden temporary file in the
+     * target directory (".<filename>.fineftp-upload-<id>"). Only when the
+     * upload has completed successfully, the temporary file is renamed to
+     * the target filename, replacing an existing file atomically. Other
+     * processes therefore either see the old file or the complete new one,
+     * but never a partial upload. Temporary files of failed or aborted
+     * uploads are deleted.
+     *
+     * APPE always writes to the target file directly.
+     *
+     * Must be called before start().
+     *
+     * @param enabled: Whether uploads are atomic. Defaults to false.
+     */
+    FINEFTP_EXPORT void setAtomicUploadsEnabled(bool enabled);
+
+    /**
+     * @brief Sets when uploaded files are flushed to stable storage
+     *
+     * By default, the operating system decides when the data of uploads is
+     * written to disk, so a file may be lost on a power failure even after
+     * the client has received the "226" reply. With the other policies, the
+     * reply is only sent after the file has been flushed. The flush runs on
+     * the worker threads of the server, so it does not block other sessions.
+     * See UploadDurability for the available policies.
+     *
+     * Must be called before start().
+     *
+     * @param durability:         The durability policy. Defaults to UploadDurability::None.
+     * @param writeback_interval: Number of bytes after which the writeback is started while receiving the data with UploadDurability::PeriodicWriteback. Defaults to 8 MiB.
+     */
+    FINEFTP_EXPORT void setUploadDurability(UploadDurability durability, std::uint64_t writeback_interval = 8 * 1024 * 1024);
+
+    /**
+     * @brief Enables zero-copy uploads with splice() on Linux
+     *
+     * When enabled, STOR moves the received data from the data socket to the
+     * file through a pipe with splice(), so it is never copied to user space.
+     * Uploads that have to be processed by the server (MODE Z, upload
+     * checksums) and APPE always use the regular buffered path.
+     *
+     * On other operating systems, this setting has no effect.
+     *
+     * Must be called before start().
+     *
+     * @param enabled: Whether splice() is used for uploads. Defaults to false.
+     */
+    FINEFTP_EXPORT void setSpliceUploadsEnabled(bool enabled);
+
+    /**
+     * @brief Configures the verification of password hashes
+     *
+     * Password hashes (see addUserWithPasswordHash()) are verified on a
+     * separate pool of threads, so logins neither block the I/O threads nor
+     * the worker threads. The number of queued verifications is limited,
+     * logins beyond that limit fail.
+     *
+     * Successful logins are cached for the given time, so clients that
+     * reconnect frequently with the same credentials don't pay for the
+     * verification every time.
+     *
+     * Must be called before start().
+     *
+     * @param thread_count: Number of threads that verify password hashes. Defaults to 1.
+     * @param cache_ttl:    How long a successful login is cached. 0 disables the cache. Defaults to 60 seconds.
+     */
+    FINEFTP_EXPORT void setPasswordVerification(std::size_t thread_count, std::chrono::seconds cache_ttl = std::chrono::seconds(60));
+
+    /**
+     * @brief Limits the number of bytes that can be stored in a local root directory
+     *
+     * The quota applies to all users whose local root path is (or is inside
+     * of) the given directory. The path must be spelled like the local root
+     * path of the users.
+     *
+     * When the server is started, the directory tree is scanned once in the
+     * background. Afterwards, the usage is updated with every upload,
+     * deletion, rename and copy, so the tree is never scanned again. Until
+     * the scan has completed, the quota is not enforced. Changes that other
+     * processes make to the directory are not noticed.
+     *
+     * Uploads are rejected with "452 Quota exceeded" if the quota is used up
+     * (or the size announced with ALLO does not fit) and are aborted with the
+     * same reply when the quota is exceeded during the transfer.
+     *
+     * Must be called before start().
+     *
+     * @param local_root_path: The local root directory
+     * @param max_bytes:       The maximum total size of all files in the directory tree
+     */
+    FINEFTP_EXPORT void setStorageQuota(const std::string &local_root_path, std::uint64_t max_bytes);
+
+    /**
+     * @brief Rejects paths that lead out of the local root directory of the user through a symlink
+     *
+     * FTP paths can never leave the root directory with "..", but symlinks
+     * inside of the root directory may point anywhere. When enabled, each
+     * session opens the root directory of its user at login and lets the
+     * kernel check every path that a command accesses with
+     * openat2(RESOLVE_BENEATH). Commands on paths that lead out of the root
+     * directory through a symlink fail with "550 Permission denied". Such
+     * entries are skipped when a directory is downloaded or extracted as
+     * tar archive.
+     *
+     * This is a best-effort check, not a sandbox: the command accesses the
+     * path by its name after the check. A user who can replace a directory
+     * on the path with a symlink at the same time (e.g. through another
+     * session or a local account) may still escape the root directory. Use
+     * operating system means (e.g. a chroot or a mount namespace) if the
+     * root directory must be a security boundary.
+     *
+     * This needs Linux 5.6 or newer. On older kernels and other operating
+     * systems, this setting has no effect and an error is logged on start().
+     *
+     * Must be called before start().
+     *
+     * @param enabled: Whether paths are confined to the root directory. Defaults to false.
+     */
+    FINEFTP_EXPORT void setRootConfinementEnabled(bool enabled);
+
+    /**
+     * @brief Sets the timeouts after which sessions and data connections are closed
+     *
+     * - The login timeout closes sessions that have not logged in within the
+     *   given time after connecting.
+     * - The idle timeout closes sessions of logged in users that have not
+     *   sent any command for the given time. A running transfer keeps the
+     *   session alive.
+     * - The data connect timeout stops waiting for the data connection of a
+     *   passive mode transfer, if the client has not connected within the
+     *   given time after PASV or the transfer command.
+     *
+     * Sessions are closed with "421". The timeouts of all sessions are
+     * managed by a single timer with a resolution of one second, so they may
+     * expire up to a second late.
+     *
+     * Must be called before start().
+     *
+     * @param idle_timeout:         The idle timeout. 0 disables it. Defaults to 0.
+     * @param login_timeout:        The login timeout. 0 disables it. Defaults to 0.
+     * @param data_connect_timeout: The data connect timeout. 0 disables it. Defaults to 0.
+     */
+    FINEFTP_EXPORT void setTimeouts(std::chrono::seconds idle_timeout, std::chrono::seconds login_timeout, std::chrono::seconds data_connect_timeout);
+
+    /**
+     * @brief Limits the number of sessions
+     *
+     * The total number of sessions and the number of sessions from one IP
+     * address are checked as soon as a connection has been accepted. Excess
+     * connections are answered with "421" and closed right away, so they
+     * don't consume more than a socket for a moment.
+     *
+     * The number of sessions per user can only be checked at login. A login
+     * beyond the limit is answered with "421" and the session is closed.
+     * All names of the anonymous user count as the same user.
+     *
+     * Must be called before start().
+     *
+     * @param max_sessions:             Maximum number of sessions. 0 means unlimited. Defaults to 0.
+     * @param max_sessions_per_address: Maximum number of sessions from one IP address. 0 means unlimited. Defaults to 0.
+     * @param max_sessions_per_user:    Maximum number of sessions of one user. 0 means unlimited. Defaults to 0.
+     */
+    FINEFTP_EXPORT void setSessionLimits(std::size_t max_sessions, std::size_t max_sessions_per_address, std::size_t max_sessions_per_user);
+
+    /**
+     * @brief Sets how many pending connections are accepted at once
+     *
+     * By default, the server waits for each connection separately. With a
+     * batch size greater than 1, the connections that are pending already
+     * after a connection has been accepted are accepted right away (up to
+     * the batch size). This reduces the overhead when many clients connect
+     * at the same time, e.g. after a network outage or during a connection
+     * flood.
+     *
+     * Must be called before start().
+     *
+     * @param batch_size: Maximum number of connections accepted at once. Defaults to 1.
+     */
+    FINEFTP_EXPORT void setAcceptBatchSize(std::size_t batch_size);
+
   private:
     std::unique_ptr<FtpServerImpl> ftp_server_; /**< Implementation details */
   };
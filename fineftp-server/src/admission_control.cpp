@@ -0,0 +1,104 @@
+#include "admission_control.h"
+
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include <asio.hpp> // IWYU pragma: keep
+
+#include "server_settings.h"
+#include "user_database.h"
+
+namespace fineftp
+{
+  namespace
+  {
+    // Decrements the count of the key and removes it when it has dropped to 0, so the map doesn't grow with every client ever seen
+    template <typename Key>
+    void releaseCount(std::map<Key, std::size_t>& counts, const Key& key)
+    {
+      auto it = counts.find(key);
+      if (it == counts.end())
+        return;
+
+      if (--(it->second) == 0)
+        counts.erase(it);
+    }
+  }
+
+  AdmissionControl::AdmissionControl(const ServerSettings& settings, const UserDatabase& user_database)
+    : settings_        (settings)
+    , user_database_   (user_database)
+    , connection_count_(0)
+  {}
+
+  AdmissionControl::Result AdmissionControl::admitConnection(const asio::ip::address& address)
+  {
+    const std::lock_guard<std::mutex> lock(mutex_);
+
+    if ((settings_.max_sessions > 0) && (connection_count_ >= settings_.max_sessions))
+      return Result::TooManySessions;
+
+    if (settings_.max_sessions_per_address > 0)
+    {
+      std::size_t& address_count = address_session_counts_[address];
+      if (address_count >= settings_.max_sessions_per_address)
+        return Result::TooManySessionsFromAddress;
+      address_count++;
+    }
+
+    connection_count_++;
+    return Result::Admitted;
+  }
+
+  void AdmissionControl::releaseConnection(const asio::ip::address& address)
+  {
+    const std::lock_guard<std::mutex> lock(mutex_);
+
+    connection_count_--;
+
+    if (settings_.max_sessions_per_address > 0)
+      releaseCount(address_session_counts_, address);
+  }
+
+  bool AdmissionControl::admitUser(const std::string& username)
+  {
+    if (settings_.max_sessions_per_user == 0)
+      return true;
+
+    const std::string key = userKey(username);
+
+    const std::lock_guard<std::mutex> lock(mutex_);
+
+    std::size_t& user_count = user_session_counts_[key];
+    if (user_count >= settings_.max_sessions_per_user)
+      return false;
+
+    user_count++;
+    return true;
+  }
+
+  void AdmissionControl::releaseUser(const std::string& username)
+  {
+    if (settings_.max_sessions_per_user == 0)
+      return;
+
+    const std::string key = userKey(username);
+
+    const std::lock_guard<std::mutex> lock(mutex_);
+    releaseCount(user_session_counts_, key);
+  }
+
+  int AdmissionControl::connectionCount() const
+  {
+    const std::lock_guard<std::mutex> lock(mutex_);
+    return static_cast<int>(connection_count_);
+  }
+
+  std::string AdmissionControl::userKey(const std::string& username) const
+  {
+    // All names of the anonymous user count for the same user
+    return (user_database_.isUsernameAnonymousUser(username) ? "anonymous" : username);
+  }
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include <asio.hpp> // IWYU pragma: keep
+
+#include "server_settings.h"
+#include "user_database.h"
+
+namespace fineftp
+{
+  /**
+   * @brief Counts the sessions and enforces the session limits of the server
+   *
+   * Connections are admitted in the accept loop, before a session is
+   * created for them. Thus only the total and the per-address limit can be
+   * enforced there. The per-user limit is enforced when the user logs in.
+   * Each successful admit must be matched by exactly one release.
+   *
+   * Addresses and users are only counted if there is a limit for them.
+   * The limits are read from the settings, which must not change while the
+   * server is running.
+   *
+   * The AdmissionControl is thread safe.
+   */
+  class AdmissionControl
+  {
+  public:
+    enum class Result
+    {
+      Admitted,
+      TooManySessions,
+      TooManySessionsFromAddress,
+    };
+
+  public:
+    AdmissionControl(const ServerSettings& settings, const UserDatabase& user_database);
+
+    // Copy and move disabled, as sessions refer to us
+    AdmissionControl(const AdmissionControl&)            = delete;
+    AdmissionControl& operator=(const AdmissionControl&) = delete;
+    AdmissionControl(AdmissionControl&&)                 = delete;
+    AdmissionControl& operator=(AdmissionControl&&)      = delete;
+
+    ~AdmissionControl() = default;
+
+    Result admitConnection(const asio::ip::address& address);
+    void   releaseConnection(const asio::ip::address& address);
+
+    // Returns false if the user has too many sessions already
+    bool admitUser(const std::string& username);
+    void releaseUser(const std::string& username);
+
+    int connectionCount() const;
+
+  private:
+    std::string userKey(const std::string& username) const;
+
+  private:
+    const ServerSettings& settings_;
+    const UserDatabase&   user_database_;
+
+    mutable std::mutex                       mutex_;
+    std::size_t                              connection_count_;
+    std::map<asio::ip::address, std::size_t> address_session_counts_;
+    std::map<std::string, std::size_t>       user_session_counts_;
+  };
+}
@@ -0,0 +1,160 @@
+#include "ascii_filter.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+namespace fineftp
+{
+  ////////////////////////////////////////////////////////
+  // AsciiEncodeFilter
+  ////////////////////////////////////////////////////////
+
+  AsciiEncodeFilter::AsciiEncodeFilter(FinishedCallback finished_callback)
+    : last_was_cr_      (false)
+    , input_size_       (0)
+    , output_size_      (0)
+    , finished_callback_(std::move(finished_callback))
+  {}
+
+  bool AsciiEncodeFilter::process(std::vector<char>& data, bool finish)
+  {
+    input_size_ += data.size();
+    encode(data);
+    output_size_ += data.size();
+
+    if (finish && finished_callback_)
+    {
+      finished_callback_(input_size_, output_size_);
+      finished_callback_ = nullptr;
+    }
+    return true;
+  }
+
+  void AsciiEncodeFilter::encode(std::vector<char>& data)
+  {
+    if (data.empty())
+      return;
+
+    // Count the LFs without CR. memchr() is vectorized by the C library, so
+    // scanning text with long lines (or binary data without any LF) is cheap.
+    const char* const begin = data.data();
+    const char* const end   = begin + data.size();
+
+    std::size_t bare_lf_count = 0;
+    for (const char* lf = static_cast<const char*>(std::memchr(begin, '\n', data.size()));
+         lf != nullptr;
+         lf = static_cast<const char*>(std::memchr(lf + 1, '\n', static_cast<std::size_t>(end - lf - 1))))
+    {
+      const bool preceded_by_cr = ((lf == begin) ? last_was_cr_ : (*(lf - 1) == '\r'));
+      if (!preceded_by_cr)
+        bare_lf_count++;
+    }
+
+    const bool chunk_ends_with_cr = (data.back() == '\r');
+
+    if (bare_lf_count == 0)
+    {
+      last_was_cr_ = chunk_ends_with_cr;
+      return;
+    }
+
+    output_.clear();
+    output_.reserve(data.size() + bare_lf_count);
+
+    const char* segment_start = begin;
+    for (const char* lf = static_cast<const char*>(std::memchr(begin, '\n', data.size()));
+         lf != nullptr;
+         lf = static_cast<const char*>(std::memchr(lf + 1, '\n', static_cast<std::size_t>(end - lf - 1))))
+    {
+      const bool preceded_by_cr = ((lf == begin) ? last_was_cr_ : (*(lf - 1) == '\r'));
+      if (!preceded_by_cr)
+      {
+        output_.insert(output_.end(), segment_start, lf);
+        output_.push_back('\r');
+        segment_start = lf;
+      }
+    }
+    output_.insert(output_.end(), segment_start, end);
+
+    last_was_cr_ = chunk_ends_with_cr;
+    data.swap(output_);
+  }
+
+  ////////////////////////////////////////////////////////
+  // AsciiDecodeFilter
+  ////////////////////////////////////////////////////////
+
+#ifdef WIN32
+  AsciiDecodeFilter::AsciiDecodeFilter() = default;
+
+  bool AsciiDecodeFilter::process(std::vector<char>& data, bool finish)
+  {
+    // Windows uses CRLF locally, too, so we only have to fix bare LFs
+    return encode_filter_.process(data, finish);
+  }
+#else
+  AsciiDecodeFilter::AsciiDecodeFilter()
+    : pending_cr_(false)
+  {}
+
+  bool AsciiDecodeFilter::process(std::vector<char>& data, bool finish)
+  {
+    // The CR at the end of the previous chunk is dropped if this chunk starts with LF
+    if (pending_cr_)
+    {
+      pending_cr_ = false;
+      if (data.empty() || (data.front() != '\n'))
+        data.insert(data.begin(), '\r');
+    }
+
+    if (data.empty())
+      return true;
+
+    char* const begin = data.data();
+    char* const end   = begin + data.size();
+
+    char* cr = static_cast<char*>(std::memchr(begin, '\r', data.size()));
+    if (cr == nullptr)
+      return true;
+
+    // The output is never larger than the input, so we compact the data in-place
+    char* write_pos = cr;
+    char* read_pos  = cr;
+    while (cr != nullptr)
+    {
+      // Move the data in front of the CR
+      const std::size_t segment_size = static_cast<std::size_t>(cr - read_pos);
+      if (write_pos != read_pos)
+        std::memmove(write_pos, read_pos, segment_size);
+      write_pos += segment_size;
+      read_pos   = cr + 1;
+
+      if (read_pos == end)
+      {
+        // We don't know yet, whether this CR belongs to a CRLF
+        if (finish)
+          *(write_pos++) = '\r';
+        else
+          pending_cr_ = true;
+      }
+      else if (*read_pos != '\n')
+      {
+        *(write_pos++) = '\r';
+      }
+
+      cr = (read_pos == end ? nullptr : static_cast<char*>(std::memchr(read_pos, '\r', static_cast<std::size_t>(end - read_pos))));
+    }
+
+    const std::size_t remaining_size = static_cast<std::size_t>(end - read_pos);
+    if (write_pos != read_pos)
+      std::memmove(write_pos, read_pos, remaining_size);
+    write_pos += remaining_size;
+
+    data.resize(static_cast<std::size_t>(write_pos - begin));
+    return true;
+  }
+#endif // WIN32
+}
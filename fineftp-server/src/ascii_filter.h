@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "data_filter.h"
+
+namespace fineftp
+{
+  /**
+   * @brief Converts local text files to the network representation of TYPE A (RFC 959)
+   *
+   * Line endings on the wire are always CRLF. Each LF that is not preceded
+   * by a CR is replaced by CRLF, existing CRLF sequences are kept. Thus the
+   * filter works for files with LF (POSIX) and CRLF (Windows) line endings.
+   */
+  class AsciiEncodeFilter : public DataFilter
+  {
+  public:
+    // Called with the total input and output size, when the last chunk has been processed
+    using FinishedCallback = std::function<void(std::uint64_t input_size, std::uint64_t output_size)>;
+
+    explicit AsciiEncodeFilter(FinishedCallback finished_callback = nullptr);
+
+    bool process(std::vector<char>& data, bool finish) override;
+
+  private:
+    void encode(std::vector<char>& data);
+
+  private:
+    bool              last_was_cr_;   // The last byte of the previous chunk was a CR
+    std::vector<char> output_;        // Reused for each chunk to avoid allocations
+    std::uint64_t     input_size_;
+    std::uint64_t     output_size_;
+    FinishedCallback  finished_callback_;
+  };
+
+  /**
+   * @brief Converts TYPE A data received from the network to local line endings
+   *
+   * On Windows, line endings are normalized to CRLF. On all other systems,
+   * CRLF is replaced by LF. A CR that is not followed by LF is kept.
+   */
+  class AsciiDecodeFilter : public DataFilter
+  {
+  public:
+    AsciiDecodeFilter();
+
+    bool process(std::vector<char>& data, bool finish) override;
+
+  private:
+#ifdef WIN32
+    AsciiEncodeFilter encode_filter_;
+#else
+    bool pending_cr_;   // The last byte of the previous chunk was a CR that has not been written, yet
+#endif // WIN32
+  };
+}
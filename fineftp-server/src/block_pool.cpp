@@ -0,0 +1,54 @@
+#include "block_pool.h"
+
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace fineftp
+{
+  BlockPool::BlockPool(std::size_t max_free_blocks)
+    : max_free_blocks_(max_free_blocks)
+    , block_size_     (0)
+  {}
+
+  BlockPool::~BlockPool()
+  {
+    for (void* block : free_blocks_)
+      ::operator delete(block);
+  }
+
+  void* BlockPool::allocate(std::size_t size)
+  {
+    {
+      const std::lock_guard<std::mutex> lock(mutex_);
+
+      if (block_size_ == 0)
+        block_size_ = size;
+
+      if ((size == block_size_) && !free_blocks_.empty())
+      {
+        void* block = free_blocks_.back();
+        free_blocks_.pop_back();
+        return block;
+      }
+    }
+
+    return ::operator new(size);
+  }
+
+  void BlockPool::deallocate(void* block, std::size_t size)
+  {
+    {
+      const std::lock_guard<std::mutex> lock(mutex_);
+
+      if ((size == block_size_) && (free_blocks_.size() < max_free_blocks_))
+      {
+        free_blocks_.push_back(block);
+        return;
+      }
+    }
+
+    ::operator delete(block);
+  }
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace fineftp
+{
+  /**
+   * @brief Recycles memory blocks of a single size
+   *
+   * Sessions are created and destroyed all the time and all of them have the
+   * same size. The pool keeps the memory of destroyed sessions for the next
+   * ones instead of returning it to the heap, which also keeps the heap from
+   * being fragmented by many long lived sessions. At most max_free_blocks
+   * blocks are kept, the rest is freed.
+   *
+   * The block size is determined by the first allocation. Allocations of any
+   * other size are passed through to the heap.
+   *
+   * The BlockPool is thread safe.
+   */
+  class BlockPool
+  {
+  public:
+    explicit BlockPool(std::size_t max_free_blocks);
+
+    // Copy and move disabled, as we own the blocks
+    BlockPool(const BlockPool&)            = delete;
+    BlockPool& operator=(const BlockPool&) = delete;
+    BlockPool(BlockPool&&)                 = delete;
+    BlockPool& operator=(BlockPool&&)      = delete;
+
+    ~BlockPool();
+
+    void* allocate(std::size_t size);
+    void  deallocate(void* block, std::size_t size);
+
+  private:
+    const std::size_t  max_free_blocks_;
+
+    std::mutex         mutex_;
+    std::size_t        block_size_;       // 0 until the first allocation
+    std::vector<void*> free_blocks_;
+  };
+
+  /**
+   * @brief Allocator for std::allocate_shared that takes single objects from a BlockPool
+   *
+   * The pool is shared, so objects may outlive the owner of the allocator.
+   */
+  template <typename T>
+  class PoolAllocator
+  {
+  public:
+    using value_type = T;
+
+    explicit PoolAllocator(std::shared_ptr<BlockPool> pool)
+      : pool_(std::move(pool))
+    {}
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>& other) // NOLINT(google-explicit-constructor) Reason: Allocators must be implicitly convertible after being rebound
+      : pool_(other.pool())
+    {}
+
+    T* allocate(std::size_t n)
+    {
+      static_assert(alignof(T) <= alignof(std::max_align_t), "The BlockPool does not support over-aligned types");
+
+      if (n != 1)
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+      return static_cast<T*>(pool_->allocate(sizeof(T)));
+    }
+
+    void deallocate(T* p, std::size_t n)
+    {
+      if (n != 1)
+        ::operator delete(p);
+      else
+        pool_->deallocate(p, sizeof(T));
+    }
+
+    const std::shared_ptr<BlockPool>& pool() const { return pool_; }
+
+    template <typename U>
+    bool operator==(const PoolAllocator<U>& other) const { return pool_ == other.pool(); }
+
+    template <typename U>
+    bool operator!=(const PoolAllocator<U>& other) const { return pool_ != other.pool(); }
+
+  private:
+    std::shared_ptr<BlockPool> pool_;
+  };
+}
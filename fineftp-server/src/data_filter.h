@@ -0,0 +1,80 @@
+#pragma once
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace fineftp
+{
+  /**
+   * @brief A stateful transformation of the data sent or received on the data connection
+   *
+   * Filters are used for transfer modes and types that change the
+   * representation of the data on the wire (e.g. MODE Z, TYPE A). A filter is created for one transfer
+   * and is fed with all chunks of that transfer in order.
+   */
+  class DataFilter
+  {
+  public:
+    DataFilter() = default;
+
+    // Copy (disabled, as filters usually own native stream states)
+    DataFilter(const DataFilter&)            = delete;
+    DataFilter& operator=(const DataFilter&) = delete;
+
+    // Move (disabled)
+    DataFilter(DataFilter&&)                 = delete;
+    DataFilter& operator=(DataFilter&&)      = delete;
+
+    virtual ~DataFilter() = default;
+
+    /**
+     * @brief Transforms the given chunk of data in-place
+     *
+     * The output may be smaller or larger than the input and may even be
+     * empty, if the filter needs more input to produce output.
+     *
+     * @param data:   The chunk to transform. Will contain the output afterwards.
+     * @param finish: True for the last chunk of the transfer. The filter must flush all buffered data.
+     *
+     * @return False if the data could not be transformed (e.g. corrupt input). The filter cannot be used anymore, then.
+     */
+    virtual bool process(std::vector<char>& data, bool finish) = 0;
+
+    /**
+     * @brief Checks whether the filter holds back input that will produce more output
+     *
+     * Filters that may expand the data a lot (e.g. decompression) only
+     * return a bounded amount of output per call. As long as this returns
+     * true, process() has to be called again with an empty chunk to fetch
+     * the rest of the output.
+     */
+    virtual bool hasPendingOutput() const { return false; }
+  };
+
+  /**
+   * @brief Applies two filters one after another (e.g. TYPE A conversion and MODE Z compression)
+   */
+  class DataFilterChain : public DataFilter
+  {
+  public:
+    DataFilterChain(std::shared_ptr<DataFilter> first, std::shared_ptr<DataFilter> second)
+      : first_ (std::move(first))
+      , second_(std::move(second))
+    {}
+
+    bool process(std::vector<char>& data, bool finish) override
+    {
+      return first_->process(data, finish) && second_->process(data, finish);
+    }
+
+    bool hasPendingOutput() const override
+    {
+      return first_->hasPendingOutput() || second_->hasPendingOutput();
+    }
+
+  private:
+    const std::shared_ptr<DataFilter> first_;
+    const std::shared_ptr<DataFilter> second_;
+  };
+}
@@ -0,0 +1,201 @@
+#include "deflate_filter.h"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+namespace fineftp
+{
+  namespace
+  {
+    // The output buffer grows in steps of this size while (de)compressing
+    constexpr std::size_t output_chunk_size = 64 * 1024;
+
+    // The maximum output of one InflateFilter::process() call
+    constexpr std::size_t max_inflate_output_size = 1024 * 1024;
+  }
+
+  ////////////////////////////////////////////////////////
+  // Deflate
+  ////////////////////////////////////////////////////////
+
+  DeflateFilter::DeflateFilter(int level)
+    : stream_(std::make_unique<z_stream_s>())
+    , ok_(false)
+  {
+    level = std::max(Z_NO_COMPRESSION, std::min(Z_BEST_COMPRESSION, level));
+    ok_ = (deflateInit(stream_.get(), level) == Z_OK);
+  }
+
+  DeflateFilter::~DeflateFilter()
+  {
+    deflateEnd(stream_.get());
+  }
+
+  bool DeflateFilter::process(std::vector<char>& data, bool finish)
+  {
+    output_.clear();
+
+    if (!ok_)
+    {
+      data.clear();
+      return false;
+    }
+
+    stream_->next_in  = reinterpret_cast<Bytef*>(data.data());
+    stream_->avail_in = static_cast<uInt>(data.size());
+
+    const int flush = (finish ? Z_FINISH : Z_NO_FLUSH);
+    int result = Z_OK;
+
+    do
+    {
+      const std::size_t output_pos = output_.size();
+      output_.resize(output_pos + output_chunk_size);
+
+      stream_->next_out  = reinterpret_cast<Bytef*>(&output_[output_pos]);
+      stream_->avail_out = static_cast<uInt>(output_chunk_size);
+
+      result = deflate(stream_.get(), flush);
+
+      output_.resize(output_.size() - stream_->avail_out);
+
+      if (result == Z_STREAM_ERROR)
+      {
+        ok_ = false;
+        data.clear();
+        return false;
+      }
+    } while (stream_->avail_out == 0);  // The output buffer was too small, there is more to come
+
+    if (finish && (result != Z_STREAM_END))
+    {
+      ok_ = false;
+      data.clear();
+      return false;
+    }
+
+    // Swap the buffers, so we can re-use the input buffer's memory for the next chunk
+    data.swap(output_);
+    return true;
+  }
+
+  ////////////////////////////////////////////////////////
+  // Inflate
+  ////////////////////////////////////////////////////////
+
+  InflateFilter::InflateFilter()
+    : stream_(std::make_unique<z_stream_s>())
+    , ok_(false)
+    , stream_end_(false)
+    , output_full_(false)
+  {
+    ok_ = (inflateInit(stream_.get()) == Z_OK);
+  }
+
+  InflateFilter::~InflateFilter()
+  {
+    inflateEnd(stream_.get());
+  }
+
+  bool InflateFilter::process(std::vector<char>& data, bool finish)
+  {
+    output_.clear();
+
+    if (!ok_)
+    {
+      data.clear();
+      return false;
+    }
+
+    if (!data.empty())
+    {
+      if (stream_->avail_in > 0)
+      {
+        // Append the new data to the input that is still pending
+        pending_input_.erase(pending_input_.begin(), pending_input_.end() - stream_->avail_in);
+        pending_input_.insert(pending_input_.end(), data.begin(), data.end());
+      }
+      else
+      {
+        pending_input_.swap(data);
+      }
+
+      stream_->next_in  = reinterpret_cast<Bytef*>(pending_input_.data());
+      stream_->avail_in = static_cast<uInt>(pending_input_.size());
+    }
+
+    while (((stream_->avail_in > 0) || output_full_) && !stream_end_ && (output_.size() < max_inflate_output_size))
+    {
+      const std::size_t output_pos = output_.size();
+      output_.resize(output_pos + output_chunk_size);
+
+      stream_->next_out  = reinterpret_cast<Bytef*>(&output_[output_pos]);
+      stream_->avail_out = static_cast<uInt>(output_chunk_size);
+
+      const int result = inflate(stream_.get(), Z_NO_FLUSH);
+
+      output_full_ = (stream_->avail_out == 0);
+      output_.resize(output_.size() - stream_->avail_out);
+
+      if (result == Z_STREAM_END)
+      {
+        stream_end_ = true;
+      }
+      else if ((result != Z_OK) && (result != Z_BUF_ERROR))
+      {
+        // Z_DATA_ERROR, Z_NEED_DICT, Z_MEM_ERROR etc.
+        ok_ = false;
+        data.clear();
+        return false;
+      }
+    }
+
+    // A truncated stream means that the client didn't send all data
+    if (finish && !stream_end_ && !hasPendingOutput())
+    {
+      ok_ = false;
+      data.clear();
+      return false;
+    }
+
+    data.swap(output_);
+    return true;
+  }
+
+  bool InflateFilter::hasPendingOutput() const
+  {
+    return ok_ && !stream_end_ && ((stream_->avail_in > 0) || output_full_);
+  }
+
+  ////////////////////////////////////////////////////////
+  // Helpers
+  ////////////////////////////////////////////////////////
+
+  bool isCompressedFileFormat(const std::string& path)
+  {
+    static const std::array<std::string, 24> compressed_extensions =
+    {
+      // Archives and compressed streams
+      ".gz", ".tgz", ".bz2", ".xz", ".txz", ".zst", ".lz4", ".lzma", ".zip", ".7z", ".rar", ".jar",
+      // Images, audio & video
+      ".jpg", ".jpeg", ".png", ".gif", ".webp", ".mp3", ".aac", ".ogg", ".mp4", ".mkv", ".avi", ".mov",
+    };
+
+    const size_t dot_pos = path.find_last_of('.');
+    if ((dot_pos == std::string::npos) || (path.find_first_of("/\\", dot_pos) != std::string::npos))
+      return false;
+
+    std::string extension = path.substr(dot_pos);
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](char c)
+                   { return static_cast<char>(std::tolower(static_cast<unsigned char>(c))); });
+
+    return std::find(compressed_extensions.begin(), compressed_extensions.end(), extension) != compressed_extensions.end();
+  }
+}
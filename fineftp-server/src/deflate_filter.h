@@ -0,0 +1,82 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "data_filter.h"
+
+struct z_stream_s;
+
+namespace fineftp
+{
+  /**
+   * @brief Compresses the data to a zlib stream (RFC 1950), as used by MODE Z
+   */
+  class DeflateFilter : public DataFilter
+  {
+  public:
+    /**
+     * @param level: The zlib compression level (0 = no compression, 1 = fastest, 9 = best compression)
+     */
+    explicit DeflateFilter(int level);
+    ~DeflateFilter() override;
+
+    // Copy & Move (disabled)
+    DeflateFilter(const DeflateFilter&)            = delete;
+    DeflateFilter& operator=(const DeflateFilter&) = delete;
+    DeflateFilter(DeflateFilter&&)                 = delete;
+    DeflateFilter& operator=(DeflateFilter&&)      = delete;
+
+    bool process(std::vector<char>& data, bool finish) override;
+
+  private:
+    std::unique_ptr<z_stream_s> stream_;
+    bool                        ok_;
+    std::vector<char>           output_;
+  };
+
+  /**
+   * @brief Decompresses a zlib stream (RFC 1950), as used by MODE Z
+   *
+   * A small stream can decompress to a huge amount of data, so each call of
+   * process() returns at most 1 MiB. The input that has not been
+   * decompressed, yet, is kept until it is fetched with further calls.
+   */
+  class InflateFilter : public DataFilter
+  {
+  public:
+    InflateFilter();
+    ~InflateFilter() override;
+
+    // Copy & Move (disabled)
+    InflateFilter(const InflateFilter&)            = delete;
+    InflateFilter& operator=(const InflateFilter&) = delete;
+    InflateFilter(InflateFilter&&)                 = delete;
+    InflateFilter& operator=(InflateFilter&&)      = delete;
+
+    bool process(std::vector<char>& data, bool finish) override;
+
+    bool hasPendingOutput() const override;
+
+  private:
+    std::unique_ptr<z_stream_s> stream_;
+    bool                        ok_;
+    bool                        stream_end_;
+    bool                        output_full_;     // zlib may hold back output, even if all input has been consumed
+    std::vector<char>           pending_input_;
+    std::vector<char>           output_;
+  };
+
+  /**
+   * @brief Checks whether the file extension denotes a file format that is already compressed
+   *
+   * Compressing those files again only burns CPU time, so MODE Z transfers
+   * of such files are sent with compression level 0.
+   *
+   * @param path: The path or filename to check
+   *
+   * @return True if the file is most likely compressed already
+   */
+  bool isCompressedFileFormat(const std::string& path);
+}
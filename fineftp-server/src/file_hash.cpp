@@ -0,0 +1,271 @@
+#include "file_hash.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <utility>
+
+#include <sys/stat.h>
+
+#include <file_man.h>
+
+#include "hasher.h"
+
+#ifdef WIN32
+  #include <win_str_convert.h>
+#endif // WIN32
+
+namespace fineftp
+{
+namespace FileHash
+{
+  namespace
+  {
+    // File identity: device, inode (on Windows: the path), mtime, ctime, size
+    using FileKey = std::tuple<std::uint64_t, std::uint64_t, std::string, std::int64_t, std::int64_t, std::uint64_t>;
+
+    // File identity, algorithm, range start, range end
+    using CacheKey = std::tuple<FileKey, int, std::uint64_t, std::uint64_t>;
+
+    constexpr std::size_t max_cache_entries = 4096;
+
+    // Used instead of an algorithm in the CacheKey for the TYPE A size
+    constexpr int ascii_size_cache_id = -1;
+
+    // LRU cache: The list is ordered from the most recently used to the least
+    // recently used entry, the map points into the list.
+    using CacheList = std::list<std::pair<CacheKey, std::string>>;
+
+    std::mutex                              cache_mutex;
+    CacheList                               cache_list;
+    std::map<CacheKey, CacheList::iterator> cache_map;
+
+    bool getFileKey(const std::string& local_path, FileKey& key, std::uint64_t& file_size)
+    {
+#ifdef WIN32
+      struct __stat64 file_status {};
+      const std::wstring w_path = StrConvert::Utf8ToWide(local_path);
+      if (_wstat64(w_path.c_str(), &file_status) != 0)
+        return false;
+
+      // Windows does not provide inode numbers via stat(), so we have to use the path instead
+      const std::int64_t mtime_ns = static_cast<std::int64_t>(file_status.st_mtime) * 1000000000;
+      const std::int64_t ctime_ns = static_cast<std::int64_t>(file_status.st_ctime) * 1000000000;
+      key = FileKey(0, 0, local_path, mtime_ns, ctime_ns, static_cast<std::uint64_t>(file_status.st_size));
+#else // WIN32
+      struct stat file_status {};
+      if (stat(local_path.c_str(), &file_status) != 0)
+        return false;
+
+  #ifdef __APPLE__
+      const std::int64_t mtime_ns = static_cast<std::int64_t>(file_status.st_mtimespec.tv_sec) * 1000000000 + file_status.st_mtimespec.tv_nsec;
+      const std::int64_t ctime_ns = static_cast<std::int64_t>(file_status.st_ctimespec.tv_sec) * 1000000000 + file_status.st_ctimespec.tv_nsec;
+  #else
+      const std::int64_t mtime_ns = static_cast<std::int64_t>(file_status.st_mtim.tv_sec) * 1000000000 + file_status.st_mtim.tv_nsec;
+      const std::int64_t ctime_ns = static_cast<std::int64_t>(file_status.st_ctim.tv_sec) * 1000000000 + file_status.st_ctim.tv_nsec;
+  #endif
+      key = FileKey(static_cast<std::uint64_t>(file_status.st_dev), static_cast<std::uint64_t>(file_status.st_ino), std::string(), mtime_ns, ctime_ns, static_cast<std::uint64_t>(file_status.st_size));
+#endif // WIN32
+
+      if ((file_status.st_mode & S_IFMT) != S_IFREG)
+        return false;
+
+      file_size = static_cast<std::uint64_t>(file_status.st_size);
+      return true;
+    }
+
+    bool lookup(const CacheKey& key, std::string& hash)
+    {
+      const std::lock_guard<std::mutex> lock(cache_mutex);
+
+      auto cache_it = cache_map.find(key);
+      if (cache_it == cache_map.end())
+        return false;
+
+      // Move the entry to the front, as it is the most recently used one now
+      cache_list.splice(cache_list.begin(), cache_list, cache_it->second);
+      hash = cache_it->second->second;
+      return true;
+    }
+
+    void insert(const CacheKey& key, const std::string& hash)
+    {
+      const std::lock_guard<std::mutex> lock(cache_mutex);
+
+      // Another thread may have computed the same hash in the meantime
+      if (cache_map.find(key) != cache_map.end())
+        return;
+
+      cache_list.emplace_front(key, hash);
+      cache_map[key] = cache_list.begin();
+
+      if (cache_list.size() > max_cache_entries)
+      {
+        cache_map.erase(cache_list.back().first);
+        cache_list.pop_back();
+      }
+    }
+  }
+
+  Result hashFile(const std::string& local_path, HashAlgorithm algorithm, std::uint64_t range_start, std::uint64_t range_end)
+  {
+    Result result;
+
+    FileKey       file_key;
+    std::uint64_t file_size = 0;
+    if (!getFileKey(local_path, file_key, file_size))
+    {
+      result.status = Status::FileError;
+      return result;
+    }
+
+    if (range_end > file_size)
+      range_end = file_size;
+
+    if (range_start > range_end)
+    {
+      result.status = Status::InvalidRange;
+      return result;
+    }
+
+    result.range_start = range_start;
+    result.range_end   = range_end;
+
+    const CacheKey cache_key(file_key, static_cast<int>(algorithm), range_start, range_end);
+    if (lookup(cache_key, result.hash))
+    {
+      result.status = Status::Ok;
+      return result;
+    }
+
+#if defined(WIN32) && !defined(__GNUG__)
+    const auto file = ReadableFile::get(StrConvert::Utf8ToWide(local_path));
+#else
+    const auto file = ReadableFile::get(local_path);
+#endif
+
+    // If the file has been modified since we have stat'ed it, we rather fail
+    // than caching a checksum for the wrong file content.
+    if (!file || (file->size() != file_size))
+    {
+      result.status = Status::FileError;
+      return result;
+    }
+
+    auto hasher = createHasher(algorithm);
+    if (range_end > range_start)
+      hasher->update(file->data() + range_start, static_cast<std::size_t>(range_end - range_start));
+    result.hash   = hasher->finish();
+    result.status = Status::Ok;
+
+    insert(cache_key, result.hash);
+    return result;
+  }
+
+  Status asciiTransferSize(const std::string& local_path, std::uint64_t& size)
+  {
+    FileKey       file_key;
+    std::uint64_t file_size = 0;
+    if (!getFileKey(local_path, file_key, file_size))
+      return Status::FileError;
+
+    const CacheKey cache_key(file_key, ascii_size_cache_id, 0, file_size);
+    std::string    cached_size;
+    if (lookup(cache_key, cached_size))
+    {
+      size = std::stoull(cached_size);
+      return Status::Ok;
+    }
+
+#if defined(WIN32) && !defined(__GNUG__)
+    const auto file = ReadableFile::get(StrConvert::Utf8ToWide(local_path));
+#else
+    const auto file = ReadableFile::get(local_path);
+#endif
+
+    if (!file || (file->size() != file_size))
+      return Status::FileError;
+
+    // memchr() is vectorized by the C library, so this is about as fast as reading the file
+    std::uint64_t bare_lf_count = 0;
+    if (file_size > 0)
+    {
+      const char* const begin = reinterpret_cast<const char*>(file->data());
+      const char* const end   = begin + file->size();
+      for (const char* lf = static_cast<const char*>(std::memchr(begin, '\n', file->size()));
+           lf != nullptr;
+           lf = static_cast<const char*>(std::memchr(lf + 1, '\n', static_cast<std::size_t>(end - lf - 1))))
+      {
+        if ((lf == begin) || (*(lf - 1) != '\r'))
+          bare_lf_count++;
+      }
+    }
+
+    size = file_size + bare_lf_count;
+
+    insert(cache_key, std::to_string(size));
+    return Status::Ok;
+  }
+
+  bool cachedAsciiTransferSize(const std::string& local_path, std::uint64_t& size)
+  {
+    FileKey       file_key;
+    std::uint64_t file_size = 0;
+    if (!getFileKey(local_path, file_key, file_size))
+      return false;
+
+    std::string cached_size;
+    if (!lookup(CacheKey(file_key, ascii_size_cache_id, 0, file_size), cached_size))
+      return false;
+
+    size = std::stoull(cached_size);
+    return true;
+  }
+
+  std::function<void(std::uint64_t, std::uint64_t)> asciiTransferSizeRecorder(const std::string& local_path)
+  {
+    FileKey       file_key;
+    std::uint64_t file_size = 0;
+    if (!getFileKey(local_path, file_key, file_size))
+      return [](std::uint64_t, std::uint64_t) {};
+
+    return [file_key, file_size](std::uint64_t converted_file_size, std::uint64_t ascii_size)
+           {
+             // If the file has been changed before it was opened, we didn't convert this version
+             if (converted_file_size == file_size)
+               insert(CacheKey(file_key, ascii_size_cache_id, 0, file_size), std::to_string(ascii_size));
+           };
+  }
+
+  UploadHasher::UploadHasher(const std::string& local_path, HashAlgorithm algorithm)
+    : local_path_(local_path)
+    , algorithm_ (algorithm)
+    , hasher_    (createHasher(algorithm))
+    , size_      (0)
+  {}
+
+  void UploadHasher::update(const char* data, std::size_t size)
+  {
+    hasher_->update(data, size);
+    size_ += size;
+  }
+
+  void UploadHasher::commit()
+  {
+    FileKey       file_key;
+    std::uint64_t file_size = 0;
+
+    // If the file could not be written completely, we didn't hash what is on disk
+    if (!getFileKey(local_path_, file_key, file_size) || (file_size != size_))
+      return;
+
+    insert(CacheKey(file_key, static_cast<int>(algorithm_), 0, file_size), hasher_->finish());
+  }
+}
+}
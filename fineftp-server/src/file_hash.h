@@ -0,0 +1,137 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <string>
+
+#include "hasher.h"
+
+namespace fineftp
+{
+  namespace FileHash
+  {
+    enum class Status
+    {
+      Ok,
+      FileError,     // The file does not exist, is no regular file or cannot be read
+      InvalidRange,  // The range starts behind the end of the file
+    };
+
+    struct Result
+    {
+      Status        status      = Status::FileError;
+      std::string   hash;                            // Lowercase hex string
+      std::uint64_t range_start = 0;
+      std::uint64_t range_end   = 0;                 // Exclusive, i.e. the file size for whole files
+    };
+
+    // Used as range_end to hash until the end of the file
+    constexpr std::uint64_t end_of_file = (std::numeric_limits<std::uint64_t>::max)();
+
+    /**
+     * @brief Computes the checksum of the byte range [range_start, range_end) of a file
+     *
+     * The file is hashed from its memory mapping (see ReadableFile). Results
+     * are cached per file identity (device & inode, modification time, change
+     * time and size), so verifying an unchanged file again does not read it
+     * at all. A range_end behind the end of the file is truncated to the file
+     * size.
+     *
+     * This function is thread safe. As it may take a long time for large
+     * files, it should not be called from the io_context threads.
+     *
+     * @param local_path: The (UTF-8 encoded) path of the file
+     *
+     * @return The checksum and the range it has been computed for
+     */
+    Result hashFile(const std::string& local_path, HashAlgorithm algorithm, std::uint64_t range_start, std::uint64_t range_end);
+
+    /**
+     * @brief Computes the number of bytes that are sent for a file in TYPE A (ASCII mode)
+     *
+     * Each LF that is not preceded by a CR is sent as CRLF, so the size is
+     * the file size plus the number of those LFs. They are counted from the
+     * memory mapping of the file and the result is stored in the same cache
+     * as the checksums, see cachedAsciiTransferSize().
+     *
+     * This function is thread safe, but it should not be called from the
+     * io_context threads.
+     *
+     * @param local_path: The (UTF-8 encoded) path of the file
+     * @param size:       Set to the TYPE A size of the file
+     *
+     * @return Ok or FileError
+     */
+    Status asciiTransferSize(const std::string& local_path, std::uint64_t& size);
+
+    /**
+     * @brief Returns the TYPE A size of a file, if it is known already
+     *
+     * The file is not opened, only a single stat() is needed. The TYPE A
+     * size is known if asciiTransferSize() has been called for the same
+     * version of the file before, or if it has been downloaded in TYPE A
+     * (see asciiTransferSizeRecorder()).
+     *
+     * This function is thread safe and may be called from the io_context threads.
+     *
+     * @param local_path: The (UTF-8 encoded) path of the file
+     * @param size:       Set to the TYPE A size, if it is known
+     *
+     * @return True if the TYPE A size is known
+     */
+    bool cachedAsciiTransferSize(const std::string& local_path, std::uint64_t& size);
+
+    /**
+     * @brief Prepares storing the TYPE A size of a file that is being downloaded in TYPE A
+     *
+     * The identity of the file is taken now, so this must be called before
+     * the file is opened. The returned function has to be called with the
+     * number of bytes read from the file and the number of bytes they have
+     * been converted to, once the whole file has been converted. The TYPE A
+     * size is only stored if the file had exactly that size when this
+     * function was called.
+     *
+     * @param local_path: The (UTF-8 encoded) path of the file
+     *
+     * @return The function that stores the size. It is thread safe.
+     */
+    std::function<void(std::uint64_t file_size, std::uint64_t ascii_size)> asciiTransferSizeRecorder(const std::string& local_path);
+
+    /**
+     * @brief Computes the checksum of a file while it is being uploaded
+     *
+     * All data written to the file must be passed to update(). After the file
+     * has been closed, commit() stores the checksum in the cache of
+     * hashFile(), so a following HASH command does not have to read the file
+     * again. The checksum is only stored if the file on disk has exactly the
+     * size of the data passed to update().
+     *
+     * @note The implementation is NOT thread safe!
+     */
+    class UploadHasher
+    {
+    public:
+      UploadHasher(const std::string& local_path, HashAlgorithm algorithm);
+
+      // Copy and move disabled
+      UploadHasher(const UploadHasher&)            = delete;
+      UploadHasher& operator=(const UploadHasher&) = delete;
+      UploadHasher(UploadHasher&&)                 = delete;
+      UploadHasher& operator=(UploadHasher&&)      = delete;
+
+      ~UploadHasher() = default;
+
+      void update(const char* data, std::size_t size);
+      void commit();
+
+    private:
+      const std::string       local_path_;
+      const HashAlgorithm     algorithm_;
+      std::unique_ptr<Hasher> hasher_;
+      std::uint64_t           size_;
+    };
+  }
+}
@@ -1,9 +1,9 @@
 #include "filesystem.h"
 
 #include <array>
+#include <cstddef>
 #include <cstdint>
 #include <iomanip>
-#include <list>
 #include <mutex> // IWYU pragma: keep
 #include <sstream>
 
@@ -11,8 +11,8 @@
 #include <ctime>
 #include <iostream>
 #include <map>
-#include <regex>
 #include <string>
+#include <vector>
 
 #include <sys/stat.h>
 
@@ -32,6 +32,18 @@
 #include <cerrno>
 #include <cstring>
 #include <dirent.h>
+#include <fcntl.h>
+#include <sys/statvfs.h>
+#include <unistd.h>
+
+#ifdef __linux__
+  #include <linux/fs.h>
+  #include <sys/ioctl.h>
+#endif // __linux__
+
+#ifdef __APPLE__
+  #include <copyfile.h>
+#endif // __APPLE__
 
 #endif // WIN32
 
@@ -247,6 +259,65 @@ namespace Filesystem
 
     return month_names.at(file_timeinfo.tm_mon) + date.str();
   }
+  std::string FileStatus::modificationTimeString() const
+  {
+    if (!is_ok_)
+      return "19700101000000";
+
+    std::tm file_timeinfo{};
+
+#if defined(__unix__)
+    gmtime_r(&file_status_.st_mtime, &file_timeinfo);
+#elif defined(_MSC_VER)
+    gmtime_s(&file_timeinfo, &file_status_.st_mtime);
+#else
+    static std::mutex mtx;
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      file_timeinfo = *std::gmtime(&file_status_.st_mtime);
+    }
+#endif
+
+    std::stringstream date;
+    date << std::setfill('0')
+         << std::setw(4) << (file_timeinfo.tm_year + 1900)
+         << std::setw(2) << (file_timeinfo.tm_mon + 1)
+         << std::setw(2) << file_timeinfo.tm_mday
+         << std::setw(2) << file_timeinfo.tm_hour
+         << std::setw(2) << file_timeinfo.tm_min
+         << std::setw(2) << file_timeinfo.tm_sec;
+
+#ifndef WIN32
+  #ifdef __APPLE__
+    long nanoseconds = file_status_.st_mtimespec.tv_nsec;
+  #else
+    long nanoseconds = file_status_.st_mtim.tv_nsec;
+  #endif
+
+    if (nanoseconds > 0)
+    {
+      // Remove trailing zeros, e.g. ".5" instead of ".500000000"
+      int digits = 9;
+      while ((nanoseconds % 10) == 0)
+      {
+        nanoseconds /= 10;
+        digits--;
+      }
+      date << "." << std::setw(digits) << nanoseconds;
+    }
+#endif // !WIN32
+
+    return date.str();
+  }
+
+  std::int64_t FileStatus::modificationTime() const
+  {
+    if (!is_ok_)
+      return 0;
+
+    return static_cast<std::int64_t>(file_status_.st_mtime);
+  }
+
 
   bool FileStatus::canOpenDir() const
   {
@@ -326,141 +397,397 @@ namespace Filesystem
     return content;
   }
 
-  std::string cleanPath(const std::string& path, bool path_is_windows_path, const char output_separator)
+  bool parseTimeVal(const std::string& time_val, std::int64_t& seconds, std::uint32_t& nanoseconds)
   {
-    if (path.empty())
+    if ((time_val.size() < 14) || ((time_val.size() > 14) && ((time_val[14] != '.') || (time_val.size() == 15))))
+      return false;
+
+    for (size_t i = 0; i < time_val.size(); i++)
     {
-      return ".";
+      if ((i != 14) && ((time_val[i] < '0') || (time_val[i] > '9')))
+        return false;
     }
 
-    // Find the root for absolute paths
+    const auto number = [&time_val](size_t pos, size_t length) { return std::stoi(time_val.substr(pos, length)); };
 
-    std::string absolute_root;
+    std::tm timeinfo{};
+    timeinfo.tm_year = number(0, 4) - 1900;
+    timeinfo.tm_mon  = number(4, 2) - 1;
+    timeinfo.tm_mday = number(6, 2);
+    timeinfo.tm_hour = number(8, 2);
+    timeinfo.tm_min  = number(10, 2);
+    timeinfo.tm_sec  = number(12, 2);
 
-    if (path_is_windows_path)
+    if ((timeinfo.tm_mon < 0) || (timeinfo.tm_mon > 11)
+        || (timeinfo.tm_mday < 1) || (timeinfo.tm_mday > 31)
+        || (timeinfo.tm_hour > 23) || (timeinfo.tm_min > 59) || (timeinfo.tm_sec > 60))
     {
-      /* On Windows, a root folder can be:
-       *    C:\
-       *    //Host
-       *    \\Host
-       */
+      return false;
+    }
 
-      const std::regex win_local_drive(R"(^[a-zA-Z]\:)");             // Local drive
-      const std::regex win_network_drive(R"(^[/\\]{2}[^/\\]+)");      // Network path starting with two slashes or backslashes followed by a hostname
+#ifdef WIN32
+    const std::int64_t utc_seconds = _mkgmtime64(&timeinfo);
+#else
+    const std::int64_t utc_seconds = timegm(&timeinfo);
+#endif // WIN32
+    if (utc_seconds == -1)
+      return false;
 
-      if (std::regex_search(path, win_local_drive))
-      {
-        // Windows local drive, consisting of drive-letter and colon
-        absolute_root = path.substr(0, 2);
-      }
-      else if (std::regex_search(path, win_network_drive))
-      {
-        // Window network drive, consisting of \\ and hostname
-        const size_t sep_pos = path.find_first_of("/\\", 2);
-        absolute_root = path.substr(0, sep_pos); // If no seperator was found, this will return the entire string
-      }
+    // Fraction of the second, padded or truncated to 9 digits
+    std::uint32_t fraction = 0;
+    for (size_t i = 15; i < 24; i++)
+    {
+      fraction *= 10;
+      if (i < time_val.size())
+        fraction += static_cast<std::uint32_t>(time_val[i] - '0');
     }
-    else
+
+    seconds     = utc_seconds;
+    nanoseconds = fraction;
+    return true;
+  }
+
+  bool setModificationTime(const std::string& path, std::int64_t seconds, std::uint32_t nanoseconds)
+  {
+#ifdef WIN32
+    // FILETIME counts 100 ns intervals since 1601-01-01
+    constexpr std::int64_t filetime_unix_epoch = 116444736000000000LL;
+    const std::int64_t filetime = filetime_unix_epoch + (seconds * 10000000LL) + (nanoseconds / 100);
+
+    FILETIME modification_time;
+    modification_time.dwLowDateTime  = static_cast<DWORD>(filetime & 0xFFFFFFFF);
+    modification_time.dwHighDateTime = static_cast<DWORD>(filetime >> 32);
+
+    const HANDLE file_handle = ::CreateFileW(StrConvert::Utf8ToWide(path).c_str(), FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+    if (file_handle == INVALID_HANDLE_VALUE)
+      return false;
+
+    const bool success = (::SetFileTime(file_handle, nullptr, nullptr, &modification_time) != FALSE);
+    ::CloseHandle(file_handle);
+    return success;
+#else // WIN32
+    // Leave the access time unchanged
+    struct timespec times[2] {};
+    times[0].tv_nsec = UTIME_OMIT;
+    times[1].tv_sec  = static_cast<time_t>(seconds);
+    times[1].tv_nsec = static_cast<long>(nanoseconds);
+
+    return (utimensat(AT_FDCWD, path.c_str(), times, 0) == 0);
+#endif // WIN32
+  }
+
+  bool createDirectory(const std::string& path)
+  {
+#ifdef WIN32
+    return (CreateDirectoryW(StrConvert::Utf8ToWide(path).c_str(), nullptr) != 0);
+#else // WIN32
+    const mode_t mode = 0755;
+    return (mkdir(path.c_str(), mode) == 0);
+#endif // WIN32
+  }
+
+  bool availableSpace(const std::string& path, std::uint64_t& bytes)
+  {
+    // A file that is about to be created is on the filesystem of its directory
+    std::string existing_path = path;
+    if (!FileStatus(path).isOk())
     {
-      // On Unix there is only one root and it is '/'
-      if (path[0] == '/')
-      {
-        absolute_root = '/';
-      }
+#ifdef WIN32
+      const size_t separator_pos = path.find_last_of("/\\");
+#else // WIN32
+      const size_t separator_pos = path.find_last_of('/');
+#endif // WIN32
+      existing_path = (separator_pos == std::string::npos ? std::string(".") : path.substr(0, separator_pos + 1));
+    }
+
+#ifdef WIN32
+    // GetDiskFreeSpaceExW only accepts directories
+    if (FileStatus(existing_path).type() != FileType::Dir)
+    {
+      const size_t separator_pos = existing_path.find_last_of("/\\");
+      existing_path = (separator_pos == std::string::npos ? std::string(".") : existing_path.substr(0, separator_pos + 1));
     }
 
-    // Split the path
-    std::list<std::string> components;
+    ULARGE_INTEGER free_bytes_available {};
+    if (::GetDiskFreeSpaceExW(StrConvert::Utf8ToWide(existing_path).c_str(), &free_bytes_available, nullptr, nullptr) == FALSE)
+      return false;
+
+    bytes = static_cast<std::uint64_t>(free_bytes_available.QuadPart);
+    return true;
+#else // WIN32
+    struct statvfs filesystem_status {};
+    if (statvfs(existing_path.c_str(), &filesystem_status) != 0)
+      return false;
+
+    bytes = static_cast<std::uint64_t>(filesystem_status.f_bavail) * static_cast<std::uint64_t>(filesystem_status.f_frsize);
+    return true;
+#endif // WIN32
+  }
 
-    if (path.size() >= (absolute_root.size() + 1))
+  bool copyFile(const std::string& from_path, const std::string& to_path)
+  {
+#ifdef WIN32
+    // Fails if the target exists. Windows clones the file on ReFS by itself.
+    return (::CopyFileW(StrConvert::Utf8ToWide(from_path).c_str(), StrConvert::Utf8ToWide(to_path).c_str(), TRUE) != FALSE);
+#elif defined(__APPLE__)
+    return (copyfile(from_path.c_str(), to_path.c_str(), nullptr, COPYFILE_ALL | COPYFILE_CLONE | COPYFILE_EXCL) == 0);
+#else
+    int from_fd = -1;
+    do
     {
-      size_t start = 0;
-      size_t end   = 0;
-      
-      if (absolute_root.empty())
-        start = 0;
-      else
-        start = absolute_root.size();
+      from_fd = ::open(from_path.c_str(), O_RDONLY | O_CLOEXEC);
+    } while ((from_fd == -1) && (errno == EINTR));
 
-      do
+    if (from_fd == -1)
+      return false;
+
+    struct stat from_status {};
+    if ((fstat(from_fd, &from_status) != 0) || ((from_status.st_mode & S_IFMT) != S_IFREG))
+    {
+      ::close(from_fd);
+      return false;
+    }
+
+    // O_EXCL makes sure that we never overwrite a file that has been created in the meantime
+    int to_fd = -1;
+    do
+    {
+      to_fd = ::open(to_path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, from_status.st_mode & 07777);
+    } while ((to_fd == -1) && (errno == EINTR));
+
+    if (to_fd == -1)
+    {
+      ::close(from_fd);
+      return false;
+    }
+
+    bool success      = false;
+    bool try_fallback = true;
+
+  #ifdef __linux__
+    // A reflink shares the data blocks of both files until one of them is modified
+    success = (::ioctl(to_fd, FICLONE, from_fd) == 0);
+
+    if (!success)
+    {
+      // copy_file_range() copies within the kernel (or on the server for NFS / SMB)
+      off_t copied_size = 0;
+      while (copied_size < from_status.st_size)
       {
-        if (path_is_windows_path)
-          end = path.find_first_of("/\\", start);
-        else
-          end = path.find_first_of('/', start);
+        const ssize_t copied = ::copy_file_range(from_fd, nullptr, to_fd, nullptr, static_cast<size_t>(from_status.st_size - copied_size), 0);
+        if ((copied < 0) && (errno == EINTR))
+          continue;
+        if (copied <= 0)
+          break;
 
-        std::string this_component;
-        if (end == std::string::npos)
-          this_component = path.substr(start);
-        else
-          this_component = path.substr(start, end - start);
-        
-        // The components-stack that will increase and shrink depending on the folders and .. elements in the splitted path
-        if (this_component.empty() || (this_component == "."))
+        copied_size += copied;
+      }
+      success = (copied_size == from_status.st_size);
+
+      // Older kernels don't support copy_file_range() across filesystems
+      // (EXDEV) and some filesystems don't support it at all. Then nothing
+      // has been copied and we copy the data ourselves.
+      try_fallback = (!success && (copied_size == 0));
+    }
+  #endif // __linux__
+
+    if (!success && try_fallback)
+    {
+      std::vector<char> buffer(1024 * 1024);
+      success = true;
+      for (;;)
+      {
+        const ssize_t bytes_read = ::read(from_fd, buffer.data(), buffer.size());
+        if (bytes_read < 0)
         {
+          if (errno == EINTR)
+            continue;
+          success = false;
+          break;
         }
-        else if (this_component == "..")
+        if (bytes_read == 0)
+          break;
+
+        const char* data = buffer.data();
+        size_t      size = static_cast<size_t>(bytes_read);
+        while (size > 0)
         {
-          if (!absolute_root.empty())
+          const ssize_t written = ::write(to_fd, data, size);
+          if (written < 0)
           {
-            if (!components.empty())
-            {
-              // Move one folder up if we are not already at the root
-              components.pop_back();
-            }
+            if (errno == EINTR)
+              continue;
+            success = false;
+            break;
           }
-          else
-          {
-            if (!components.empty() && (components.back() != ".."))
-            {
-              // Move one folder up by removing it. We must not remove ".." elements that we were not able to resolve previously.
-              components.pop_back();
-            }
-            else
-            {
-              components.emplace_back("..");
-            }
-          }
-        }
-        else
-        {
-          components.push_back(this_component);
+          data += written;
+          size -= static_cast<size_t>(written);
         }
-
-        if (end == std::string::npos)
+        if (!success)
           break;
+      }
+    }
+
+    ::close(from_fd);
+    if ((::close(to_fd) != 0) && (errno != EINTR))
+      success = false;
+
+    if (!success)
+      (void)::unlink(to_path.c_str());
+
+    return success;
+#endif // WIN32
+  }
+
+  namespace
+  {
+    // The offsets of the components in the cleaned path, so ".." can remove
+    // the last one. Paths rarely have more components than fit into the
+    // inline buffer, so usually nothing is allocated.
+    class ComponentStack
+    {
+    public:
+      ComponentStack() : size_(0) {}
+
+      bool        empty() const { return size_ == 0; }
+      std::size_t back()  const { return (size_ <= inline_offsets_.size() ? inline_offsets_[size_ - 1] : overflow_offsets_.back()); }
+
+      void push(std::size_t offset)
+      {
+        if (size_ < inline_offsets_.size())
+          inline_offsets_[size_] = offset;
         else
-          start = end + 1;
+          overflow_offsets_.push_back(offset);
+        size_++;
+      }
+
+      void pop()
+      {
+        if (size_ > inline_offsets_.size())
+          overflow_offsets_.pop_back();
+        size_--;
+      }
 
-      } while (start < path.size());
+    private:
+      std::array<std::size_t, 32> inline_offsets_;
+      std::vector<std::size_t>    overflow_offsets_;
+      std::size_t                 size_;
+    };
 
-      // Join the components again
-      if (components.empty() && absolute_root.empty())
+    bool isSeparator(char c, bool path_is_windows_path)
+    {
+      return ((c == '/') || (path_is_windows_path && (c == '\\')));
+    }
+
+    // Returns the length of the root of an absolute path, or 0 for relative paths
+    std::size_t absoluteRootSize(const std::string& path, bool path_is_windows_path)
+    {
+      if (!path_is_windows_path)
       {
-          return ".";
+        // On Unix there is only one root and it is '/'
+        return (path[0] == '/' ? 1 : 0);
       }
+
+      /* On Windows, a root folder can be:
+       *    C:\
+       *    //Host
+       *    \\Host
+       */
+
+      // Windows local drive, consisting of drive-letter and colon
+      if ((path.size() >= 2)
+          && (((path[0] >= 'a') && (path[0] <= 'z')) || ((path[0] >= 'A') && (path[0] <= 'Z')))
+          && (path[1] == ':'))
+      {
+        return 2;
+      }
+
+      // Windows network drive, consisting of two slashes or backslashes followed by a hostname
+      if ((path.size() >= 3)
+          && isSeparator(path[0], true)
+          && isSeparator(path[1], true)
+          && !isSeparator(path[2], true))
+      {
+        const std::size_t sep_pos = path.find_first_of("/\\", 2);
+        return (sep_pos == std::string::npos ? path.size() : sep_pos);
+      }
+
+      return 0;
     }
+  }
 
-    std::stringstream path_ss;
-    path_ss << absolute_root;
+  std::string cleanPath(const std::string& path, bool path_is_windows_path, const char output_separator)
+  {
+    if (path.empty())
+    {
+      return ".";
+    }
 
-    if (path_is_windows_path && !absolute_root.empty())
+    // The cleaned path is never longer than the input plus the separator after a Windows root, so it is built in a single buffer
+    std::string cleaned_path;
+    cleaned_path.reserve(path.size() + 1);
+
+    const std::size_t root_size = absoluteRootSize(path, path_is_windows_path);
+    cleaned_path.append(path, 0, root_size);
+
+    if (path_is_windows_path && (root_size > 0))
     {
-      path_ss << output_separator; // The windows drive must be followed by a separator. When referencing a network drive.
+      cleaned_path.push_back(output_separator); // The windows drive must be followed by a separator. When referencing a network drive.
     }
 
-    auto comp_it = components.begin();
-    while (comp_it != components.end())
+    const std::size_t components_start = cleaned_path.size();
+    ComponentStack    components;
+
+    const auto append_component = [&](std::size_t start, std::size_t length)
+                                  {
+                                    if (cleaned_path.size() > components_start)
+                                      cleaned_path.push_back(output_separator);
+                                    components.push(cleaned_path.size());
+                                    cleaned_path.append(path, start, length);
+                                  };
+
+    std::size_t start = root_size;
+    while (start < path.size())
     {
-      if (comp_it != components.begin())
-        path_ss << output_separator;
-      
-      path_ss << *comp_it;
+      std::size_t end = start;
+      while ((end < path.size()) && !isSeparator(path[end], path_is_windows_path))
+        end++;
+
+      const std::size_t length = end - start;
+
+      if ((length == 0) || ((length == 1) && (path[start] == '.')))
+      {
+        // Empty components and "." don't change the path
+      }
+      else if ((length == 2) && (path[start] == '.') && (path[start + 1] == '.'))
+      {
+        // We must not remove ".." elements that we were not able to resolve previously
+        if (!components.empty() && (cleaned_path.compare(components.back(), std::string::npos, "..") != 0))
+        {
+          // Move one folder up by removing the last component and its separator
+          cleaned_path.resize(components.back() > components_start ? components.back() - 1 : components_start);
+          components.pop();
+        }
+        else if (root_size == 0)
+        {
+          append_component(start, length);
+        }
+        // Absolute paths stay at the root
+      }
+      else
+      {
+        append_component(start, length);
+      }
+
+      start = end + 1;
+    }
 
-      comp_it++;
+    if (cleaned_path.empty())
+    {
+      return ".";
     }
 
-    return path_ss.str();
+    return cleaned_path;
   }
 
   std::string cleanPathNative(const std::string& path)
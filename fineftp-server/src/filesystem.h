@@ -55,6 +55,20 @@ namespace fineftp
 
       std::string timeString() const;
 
+      /**
+       * @brief Returns the modification time as "YYYYMMDDHHMMSS[.sss]" in UTC, as used by MDTM (RFC 3659)
+       *
+       * The fraction of the second is only added if it is not zero. It has
+       * as many digits as needed, up to nanoseconds. On Windows, the time has
+       * a precision of one second.
+       */
+      std::string modificationTimeString() const;
+
+      /**
+       * @brief Returns the modification time in seconds since the Unix epoch
+       */
+      std::int64_t modificationTime() const;
+
       bool canOpenDir() const;
 
 
@@ -71,6 +85,62 @@ namespace fineftp
 
     std::map<std::string, FileStatus> dirContent(const std::string& path, std::ostream& error);
 
+    /**
+     * @brief Parses a time-val (RFC 3659), i.e. "YYYYMMDDHHMMSS[.sss]" in UTC
+     *
+     * @param time_val:    The string to parse
+     * @param seconds:     Set to the seconds since the Unix epoch
+     * @param nanoseconds: Set to the fraction of the second. Digits beyond nanoseconds are ignored.
+     *
+     * @return False if the string is no valid time-val
+     */
+    bool parseTimeVal(const std::string& time_val, std::int64_t& seconds, std::uint32_t& nanoseconds);
+
+    /**
+     * @brief Copies a regular file on the local filesystem
+     *
+     * The data is copied by the kernel without passing through user space:
+     * On Linux, the file is cloned (reflink) if the filesystem supports it
+     * (e.g. XFS, btrfs), which takes constant time. Otherwise
+     * copy_file_range() is used, which lets network filesystems copy
+     * server-side. On macOS, copyfile() clones the file on APFS. The
+     * permissions of the source are applied to the target.
+     *
+     * This may take a long time and should not be called from the io_context threads.
+     *
+     * @param from_path: The (UTF-8 encoded) source file
+     * @param to_path:   The (UTF-8 encoded) target file. Must not exist.
+     *
+     * @return False if the file could not be copied. An incomplete target file is removed.
+     */
+    bool copyFile(const std::string& from_path, const std::string& to_path);
+
+    /**
+     * @brief Sets the modification time of a file
+     *
+     * On Windows, the time is rounded down to the 100 ns resolution of the filesystem.
+     *
+     * @return False if the time could not be set
+     */
+    bool setModificationTime(const std::string& path, std::int64_t seconds, std::uint32_t nanoseconds);
+
+    /**
+     * @brief Creates a directory with default permissions. The parent directory must exist.
+     *
+     * @return False if the directory could not be created, e.g. because it exists already
+     */
+    bool createDirectory(const std::string& path);
+
+    /**
+     * @brief Returns the disk space that unprivileged users can still use on the filesystem of a path
+     *
+     * @param path:  The (UTF-8 encoded) file or directory. If it does not exist, the filesystem of its parent directory is used.
+     * @param bytes: Set to the available space
+     *
+     * @return False if the available space cannot be determined
+     */
+    bool availableSpace(const std::string& path, std::uint64_t& bytes);
+
     std::string cleanPath(const std::string& path, bool path_is_windows_path, char output_separator);
 
     std::string cleanPathNative(const std::string& path);
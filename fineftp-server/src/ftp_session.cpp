@@ -3,11 +3,14 @@
 #include <asio.hpp>
 
 #include <algorithm>
+#include <atomic>
 #include <cassert> // assert
 #include <cctype>  // std::iscntrl, toupper
+#include <cerrno>
 #include <chrono>  // IWYU pragma: keep (it is used for special preprocessor defines)
 #include <cstddef>
 #include <cstdio>
+#include <cstring>
 #include <fstream>
 #include <functional>
 #include <iomanip>
@@ -15,6 +18,7 @@
 #include <iterator>
 #include <map>
 #include <memory>
+#include <random>
 #include <sstream>
 #include <string>
 #include <sys/types.h>
@@ -22,11 +26,22 @@
 
 #include <file_man.h>
 
+#include "ascii_filter.h"
+#include "data_filter.h"
+#include "file_hash.h"
 #include "filesystem.h"
 #include "ftp_message.h"
-#include "user_database.h"
+#include "hasher.h"
+#include "server_settings.h"
+#include "tar_extractor.h"
+#include "tar_writer.h"
+#include "password_verifier.h"
 #include <fineftp/permissions.h>
 
+#if FINEFTP_SERVER_MODE_Z
+#include "deflate_filter.h"
+#endif // FINEFTP_SERVER_MODE_Z
+
 #include <sys/stat.h>
 
 #ifdef WIN32
@@ -42,9 +57,19 @@
 
 namespace fineftp
 {
+  namespace
+  {
+    // Longer command lines are not accepted, so a client cannot make the command buffer grow without limit
+    constexpr std::size_t max_command_line_size = 8 * 1024;
+  }
+
+  // Most sessions are idle, so their size matters. About half of a session is
+  // the HandlerMemory. The limit leaves room for the larger types of other
+  // standard libraries, but catches buffers that are embedded by accident.
+  static_assert(sizeof(FtpSession) <= 3 * 1024, "FtpSession has grown. Allocate large members on demand instead.");
 
-  FtpSession::FtpSession(asio::io_context &io_context, const UserDatabase &user_database, const std::function<void()> &completion_handler, std::ostream &output, std::ostream &error)
-      : completion_handler_(completion_handler), user_database_(user_database), io_context_(io_context), command_strand_(io_context), command_socket_(io_context), data_type_binary_(false), shutdown_requested_(false), ftp_working_directory_("/"), data_acceptor_(io_context), data_socket_strand_(io_context), timer_(io_context), output_(output), error_(error)
+  FtpSession::FtpSession(asio::io_context &io_context, asio::ip::tcp::socket command_socket, asio::thread_pool &worker_pool, UploadCommitter &upload_committer, PasswordVerifier &password_verifier, QuotaManager &quota_manager, AdmissionControl &admission_control, const std::shared_ptr<TimerWheel> &timer_wheel, const ServerSettings &settings, const std::function<void()> &completion_handler, std::ostream &output, std::ostream &error)
+      : completion_handler_(completion_handler), password_verifier_(password_verifier), settings_(settings), io_context_(io_context), worker_pool_(worker_pool), upload_committer_(upload_committer), quota_manager_(quota_manager), admission_control_(admission_control), command_strand_(io_context), command_socket_(std::move(command_socket)), command_input_stream_(max_command_line_size), data_type_binary_(false), transfer_mode_z_(false), mode_z_level_(settings.mode_z_compression_level), shutdown_requested_(false), close_after_sending_(false), command_reading_suspended_(false), hash_algorithm_(HashAlgorithm::Sha256), range_start_(0), range_end_(FileHash::end_of_file), allocation_size_(0), ftp_working_directory_("/"), data_socket_strand_(io_context), control_timer_(timer_wheel), data_connect_timer_(timer_wheel), output_(output), error_(error)
   {
   }
 
@@ -68,9 +93,9 @@ namespace fineftp
     {
       // Close data acceptor if open
       asio::error_code ec;
-      if (data_acceptor_.is_open())
+      if (isDataAcceptorOpen())
       {
-        data_acceptor_.close(ec);
+        data_acceptor_->close(ec);
       }
     }
 
@@ -83,6 +108,8 @@ namespace fineftp
       command_socket_.close(ec);
     }
 
+    logoutUser();
+
     completion_handler_();
   }
 
@@ -93,9 +120,36 @@ namespace fineftp
     if (ec)
       error_ << "Unable to set socket option tcp::no_delay: " << ec.message() << std::endl;
 
-    asio::post(command_strand_, [me = shared_from_this()]()
-               { me->readFtpCommand(); });
+    // The callbacks are only set if they are needed, as they allocate memory.
+    // They must not keep the session alive.
+    const std::weak_ptr<FtpSession> weak_me = shared_from_this();
+    if ((settings_.login_timeout.count() > 0) || (settings_.idle_timeout.count() > 0))
+    {
+      control_timer_.setCallback([weak_me](std::uint64_t generation)
+                                 {
+                                   auto me = weak_me.lock();
+                                   if (me)
+                                     asio::post(me->command_strand_, makeAllocHandler(me->handler_memory_, [me, generation]() { me->handleControlTimeout(generation); }));
+                                 });
+    }
+    if (settings_.data_connect_timeout.count() > 0)
+    {
+      data_connect_timer_.setCallback([weak_me](std::uint64_t generation)
+                                      {
+                                        auto me = weak_me.lock();
+                                        if (me)
+                                          asio::post(me->command_strand_, makeAllocHandler(me->handler_memory_, [me, generation]() { me->handleDataConnectTimeout(generation); }));
+                                      });
+    }
+
+    if (settings_.login_timeout.count() > 0)
+      control_timer_.expiresAfter(settings_.login_timeout);
+
+    // The welcome message must be queued before the first command is read,
+    // or the reply to a command that is sent right away may overtake it.
     sendFtpMessage(FtpMessage(FtpReplyCode::SERVICE_READY_FOR_NEW_USER, "Welcome to fineFTP Server"));
+    asio::post(command_strand_, makeAllocHandler(handler_memory_, [me = shared_from_this()]()
+               { me->readFtpCommand(); }));
   }
 
   asio::ip::tcp::socket &FtpSession::getSocket()
@@ -103,6 +157,19 @@ namespace fineftp
     return command_socket_;
   }
 
+  bool FtpSession::isDataAcceptorOpen() const
+  {
+    return (data_acceptor_ && data_acceptor_->is_open());
+  }
+
+  asio::ip::tcp::acceptor &FtpSession::dataAcceptor()
+  {
+    // Most sessions never transfer any data, so the acceptor is only created when it is needed
+    if (!data_acceptor_)
+      data_acceptor_ = std::make_unique<asio::ip::tcp::acceptor>(io_context_);
+    return *data_acceptor_;
+  }
+
   void FtpSession::sendFtpMessage(const FtpMessage &message)
   {
     if (command_callback_ && !last_command_.empty())
@@ -119,14 +186,40 @@ namespace fineftp
 
   void FtpSession::sendRawFtpMessage(const std::string &raw_message)
   {
-    asio::post(command_strand_, [me = shared_from_this(), raw_message]()
+    asio::post(command_strand_, makeAllocHandler(handler_memory_, [me = shared_from_this(), raw_message]()
                {
                            const bool write_in_progress = !me->command_output_queue_.empty();
                            me->command_output_queue_.push_back(raw_message);
                            if (!write_in_progress)
                            {
                              me->startSendingMessages();
-                           } });
+                           } }));
+  }
+
+  void FtpSession::sendFinalFtpMessage(FtpReplyCode code, const std::string &message)
+  {
+    shutdown_requested_ = true; // No further commands are read
+    sendFtpMessage(code, message);
+
+    // The reply has been posted to the command_strand_ before, so it is
+    // queued (or even sent) by now. Earlier replies that are still in the
+    // queue are sent first.
+    asio::post(command_strand_, makeAllocHandler(handler_memory_, [me = shared_from_this()]()
+               {
+                 me->close_after_sending_ = true;
+                 if (me->command_output_queue_.empty())
+                   me->closeCommandSocket();
+               }));
+  }
+
+  void FtpSession::closeCommandSocket()
+  {
+    asio::error_code ec;
+    if (command_socket_.is_open())
+    {
+      command_socket_.shutdown(asio::ip::tcp::socket::shutdown_both, ec);
+      command_socket_.close(ec);
+    }
   }
 
   void FtpSession::startSendingMessages()
@@ -143,22 +236,17 @@ namespace fineftp
       return;
     }
 
-    asio::async_write(command_socket_, asio::buffer(command_output_queue_.front()), command_strand_.wrap([me = shared_from_this()](asio::error_code ec, std::size_t /*bytes_to_transfer*/)
+    asio::async_write(command_socket_, asio::buffer(command_output_queue_.front()), makeAllocHandler(handler_memory_, command_strand_.wrap([me = shared_from_this()](asio::error_code ec, std::size_t /*bytes_to_transfer*/)
                                                                                                          {
                         if (!ec)
                         {
                           me->command_output_queue_.pop_front();
 
-                          // Handle the QUIT command
-                          if (me->shutdown_requested_)
+                          // Handle the QUIT command. Replies that have been queued before
+                          // the QUIT command (and the QUIT reply itself) are sent first.
+                          if (me->close_after_sending_ && me->command_output_queue_.empty())
                           {
-                            // Properly close command socket
-                            asio::error_code ec_;
-                            if (me->command_socket_.is_open())
-                            {
-                              me->command_socket_.shutdown(asio::ip::tcp::socket::shutdown_both, ec_);
-                              me->command_socket_.close(ec_);
-                            }
+                            me->closeCommandSocket();
                             return;
                           }
               
@@ -180,13 +268,13 @@ namespace fineftp
                           {
                             me->startSendingMessages();
                           }
-                        } }));
+                        } })));
   }
 
   void FtpSession::readFtpCommand()
   {
     asio::async_read_until(command_socket_, command_input_stream_, "\r\n",
-                           command_strand_.wrap([me = shared_from_this()](asio::error_code ec, std::size_t length)
+                           makeAllocHandler(handler_memory_, command_strand_.wrap([me = shared_from_this()](asio::error_code ec, std::size_t length)
                                                 {
                           if (ec)
                           {
@@ -203,10 +291,11 @@ namespace fineftp
        // Close the data connection, if it is open
                             {
                               asio::error_code ec_;
-                              me->data_acceptor_.close(ec_);
+                              if (me->data_acceptor_)
+                                me->data_acceptor_->close(ec_);
                             }
 
-                            asio::post(me->data_socket_strand_, [me]()
+                            asio::post(me->data_socket_strand_, makeAllocHandler(me->handler_memory_, [me]()
                             {
                               auto data_socket = me->data_socket_weakptr_.lock();
                               if (data_socket)
@@ -214,7 +303,7 @@ namespace fineftp
                                 asio::error_code ec_;
                                 data_socket->close(ec_);
                               }
-                            });
+                            }));
 
                             return;
                           }
@@ -228,7 +317,7 @@ namespace fineftp
                           me->output_ << "FTP << " << packet_string << std::endl;
 #endif
 
-                          me->handleFtpCommand(packet_string); }));
+                          me->handleFtpCommand(packet_string); })));
   }
 
   void FtpSession::handleFtpCommand(const std::string &command)
@@ -247,55 +336,67 @@ namespace fineftp
       parameters = command.substr(space_index + 1, std::string::npos);
     }
 
-    const std::map<std::string, std::function<void(std::string)>> command_map{
+    // Built once, so handling a command doesn't allocate a table of handlers
+    static const std::map<std::string, void (FtpSession::*)(const std::string &)> command_map{
         // Access control commands
-        {"USER", std::bind(&FtpSession::handleFtpCommandUSER, this, std::placeholders::_1)},
-        {"PASS", std::bind(&FtpSession::handleFtpCommandPASS, this, std::placeholders::_1)},
-        {"ACCT", std::bind(&FtpSession::handleFtpCommandACCT, this, std::placeholders::_1)},
-        {"CWD", std::bind(&FtpSession::handleFtpCommandCWD, this, std::placeholders::_1)},
-        {"CDUP", std::bind(&FtpSession::handleFtpCommandCDUP, this, std::placeholders::_1)},
-        {"REIN", std::bind(&FtpSession::handleFtpCommandREIN, this, std::placeholders::_1)},
-        {"QUIT", std::bind(&FtpSession::handleFtpCommandQUIT, this, std::placeholders::_1)},
+        {"USER", &FtpSession::handleFtpCommandUSER},
+        {"PASS", &FtpSession::handleFtpCommandPASS},
+        {"ACCT", &FtpSession::handleFtpCommandACCT},
+        {"CWD", &FtpSession::handleFtpCommandCWD},
+        {"CDUP", &FtpSession::handleFtpCommandCDUP},
+        {"REIN", &FtpSession::handleFtpCommandREIN},
+        {"QUIT", &FtpSession::handleFtpCommandQUIT},
 
         // Transfer parameter commands
-        {"PORT", std::bind(&FtpSession::handleFtpCommandPORT, this, std::placeholders::_1)},
-        {"PASV", std::bind(&FtpSession::handleFtpCommandPASV, this, std::placeholders::_1)},
-        {"TYPE", std::bind(&FtpSession::handleFtpCommandTYPE, this, std::placeholders::_1)},
-        {"STRU", std::bind(&FtpSession::handleFtpCommandSTRU, this, std::placeholders::_1)},
-        {"MODE", std::bind(&FtpSession::handleFtpCommandMODE, this, std::placeholders::_1)},
+        {"PORT", &FtpSession::handleFtpCommandPORT},
+        {"PASV", &FtpSession::handleFtpCommandPASV},
+        {"TYPE", &FtpSession::handleFtpCommandTYPE},
+        {"STRU", &FtpSession::handleFtpCommandSTRU},
+        {"MODE", &FtpSession::handleFtpCommandMODE},
 
         // Ftp service commands
-        {"RETR", std::bind(&FtpSession::handleFtpCommandRETR, this, std::placeholders::_1)},
-        {"STOR", std::bind(&FtpSession::handleFtpCommandSTOR, this, std::placeholders::_1)},
-        {"STOU", std::bind(&FtpSession::handleFtpCommandSTOU, this, std::placeholders::_1)},
-        {"APPE", std::bind(&FtpSession::handleFtpCommandAPPE, this, std::placeholders::_1)},
-        {"ALLO", std::bind(&FtpSession::handleFtpCommandALLO, this, std::placeholders::_1)},
-        {"REST", std::bind(&FtpSession::handleFtpCommandREST, this, std::placeholders::_1)},
-        {"RNFR", std::bind(&FtpSession::handleFtpCommandRNFR, this, std::placeholders::_1)},
-        {"RNTO", std::bind(&FtpSession::handleFtpCommandRNTO, this, std::placeholders::_1)},
-        {"ABOR", std::bind(&FtpSession::handleFtpCommandABOR, this, std::placeholders::_1)},
-        {"DELE", std::bind(&FtpSession::handleFtpCommandDELE, this, std::placeholders::_1)},
-        {"RMD", std::bind(&FtpSession::handleFtpCommandRMD, this, std::placeholders::_1)},
-        {"MKD", std::bind(&FtpSession::handleFtpCommandMKD, this, std::placeholders::_1)},
-        {"PWD", std::bind(&FtpSession::handleFtpCommandPWD, this, std::placeholders::_1)},
-        {"LIST", std::bind(&FtpSession::handleFtpCommandLIST, this, std::placeholders::_1)},
-        {"NLST", std::bind(&FtpSession::handleFtpCommandNLST, this, std::placeholders::_1)},
-        {"SITE", std::bind(&FtpSession::handleFtpCommandSITE, this, std::placeholders::_1)},
-        {"SYST", std::bind(&FtpSession::handleFtpCommandSYST, this, std::placeholders::_1)},
-        {"STAT", std::bind(&FtpSession::handleFtpCommandSTAT, this, std::placeholders::_1)},
-        {"HELP", std::bind(&FtpSession::handleFtpCommandHELP, this, std::placeholders::_1)},
-        {"NOOP", std::bind(&FtpSession::handleFtpCommandNOOP, this, std::placeholders::_1)},
+        {"RETR", &FtpSession::handleFtpCommandRETR},
+        {"STOR", &FtpSession::handleFtpCommandSTOR},
+        {"STOU", &FtpSession::handleFtpCommandSTOU},
+        {"APPE", &FtpSession::handleFtpCommandAPPE},
+        {"ALLO", &FtpSession::handleFtpCommandALLO},
+        {"REST", &FtpSession::handleFtpCommandREST},
+        {"RNFR", &FtpSession::handleFtpCommandRNFR},
+        {"RNTO", &FtpSession::handleFtpCommandRNTO},
+        {"ABOR", &FtpSession::handleFtpCommandABOR},
+        {"DELE", &FtpSession::handleFtpCommandDELE},
+        {"RMD", &FtpSession::handleFtpCommandRMD},
+        {"MKD", &FtpSession::handleFtpCommandMKD},
+        {"PWD", &FtpSession::handleFtpCommandPWD},
+        {"LIST", &FtpSession::handleFtpCommandLIST},
+        {"NLST", &FtpSession::handleFtpCommandNLST},
+        {"SITE", &FtpSession::handleFtpCommandSITE},
+        {"SYST", &FtpSession::handleFtpCommandSYST},
+        {"STAT", &FtpSession::handleFtpCommandSTAT},
+        {"HELP", &FtpSession::handleFtpCommandHELP},
+        {"NOOP", &FtpSession::handleFtpCommandNOOP},
 
         // Modern FTP Commands
-        {"FEAT", std::bind(&FtpSession::handleFtpCommandFEAT, this, std::placeholders::_1)},
-        {"OPTS", std::bind(&FtpSession::handleFtpCommandOPTS, this, std::placeholders::_1)},
-        {"SIZE", std::bind(&FtpSession::handleFtpCommandSIZE, this, std::placeholders::_1)},
+        {"FEAT", &FtpSession::handleFtpCommandFEAT},
+        {"OPTS", &FtpSession::handleFtpCommandOPTS},
+        {"SIZE", &FtpSession::handleFtpCommandSIZE},
+        {"MDTM", &FtpSession::handleFtpCommandMDTM},
+        {"MFMT", &FtpSession::handleFtpCommandMFMT},
+
+        // Checksum commands
+        {"HASH", &FtpSession::handleFtpCommandHASH},
+        {"RANG", &FtpSession::handleFtpCommandRANG},
+        {"XCRC", &FtpSession::handleFtpCommandXCRC},
+        {"XMD5", &FtpSession::handleFtpCommandXMD5},
+        {"XSHA", &FtpSession::handleFtpCommandXSHA1},
+        {"XSHA1", &FtpSession::handleFtpCommandXSHA1},
+        {"XSHA256", &FtpSession::handleFtpCommandXSHA256},
     };
 
     auto command_it = command_map.find(ftp_command);
     if (command_it != command_map.end())
     {
-      command_it->second(parameters);
+      (this->*command_it->second)(parameters);
     }
     else
     {
@@ -305,13 +406,111 @@ namespace fineftp
     last_command_ = ftp_command;
     last_param_ = parameters;
 
+    // ALLO only applies to the next upload
+    if ((ftp_command == "STOR") || (ftp_command == "APPE"))
+    {
+      allocation_size_ = 0;
+    }
+
+    // Any command shows that the client is still there
+    restartIdleTimeout();
+
     // Wait for next command
+    if (!shutdown_requested_ && !command_reading_suspended_)
+    {
+      readFtpCommand();
+    }
+  }
+
+  void FtpSession::suspendCommandReading()
+  {
+    command_reading_suspended_ = true;
+  }
+
+  void FtpSession::resumeCommandReading()
+  {
+    // Must be called on the command_strand_ after the reply has been sent
+    // with sendFtpMessage(). The reply is queued before the next command is
+    // handled, as both are posted to the command_strand_.
+    command_reading_suspended_ = false;
     if (!shutdown_requested_)
     {
       readFtpCommand();
     }
   }
 
+  ////////////////////////////////////////////////////////
+  // Timeouts
+  ////////////////////////////////////////////////////////
+
+  void FtpSession::restartIdleTimeout()
+  {
+    // Until the user has logged in, the login timeout keeps running
+    if (logged_in_user_ && (settings_.idle_timeout.count() > 0))
+      control_timer_.expiresAfter(settings_.idle_timeout);
+  }
+
+  void FtpSession::restartDataConnectTimeout()
+  {
+    if (settings_.data_connect_timeout.count() > 0)
+      data_connect_timer_.expiresAfter(settings_.data_connect_timeout);
+  }
+
+  void FtpSession::handleControlTimeout(std::uint64_t generation)
+  {
+    // The expiry may have been collected right before the timer was
+    // restarted (e.g. by a command or by the login)
+    if (!control_timer_.hasExpired(generation) || shutdown_requested_)
+      return;
+
+    if (command_reading_suspended_)
+    {
+      // The client waits for us (e.g. for a password verification or a checksum), so check again later
+      control_timer_.expiresAfter(std::chrono::seconds(1));
+      return;
+    }
+
+    if (!logged_in_user_)
+    {
+      sendFinalFtpMessage(FtpReplyCode::SERVICE_NOT_AVAILABLE, "Login timeout, closing control connection");
+      return;
+    }
+
+    // The client doesn't send any commands during a transfer. Only the
+    // data_socket_strand_ knows whether a transfer is running.
+    asio::post(data_socket_strand_, makeAllocHandler(handler_memory_, [me = shared_from_this(), generation]()
+               {
+                 if (me->data_socket_weakptr_.lock())
+                 {
+                   me->control_timer_.expiresAfter(me->settings_.idle_timeout);
+                   return;
+                 }
+
+                 asio::post(me->command_strand_, makeAllocHandler(me->handler_memory_, [me, generation]()
+                            {
+                              // A command that has arrived in the meantime has restarted the idle timeout
+                              if (me->control_timer_.hasExpired(generation) && !me->shutdown_requested_ && !me->command_reading_suspended_)
+                                me->sendFinalFtpMessage(FtpReplyCode::SERVICE_NOT_AVAILABLE, "Idle timeout, closing control connection");
+                            }));
+               }));
+  }
+
+  void FtpSession::handleDataConnectTimeout(std::uint64_t generation)
+  {
+    // The timer may have been cancelled by a connection that came in right
+    // after the expiry had been collected
+    if (!data_connect_timer_.hasExpired(generation))
+      return;
+
+    // Closing the acceptor aborts a transfer that still waits for the client
+    // to connect. Transfers that are running already are not affected.
+    if (isDataAcceptorOpen())
+    {
+      asio::error_code ec;
+      data_acceptor_->close(ec);
+    }
+  }
+
   ////////////////////////////////////////////////////////
   // FTP Commands
   ////////////////////////////////////////////////////////
@@ -320,7 +519,7 @@ namespace fineftp
 
   void FtpSession::handleFtpCommandUSER(const std::string &param)
   {
-    logged_in_user_ = nullptr;
+    logoutUser();
     username_for_login_ = param;
     ftp_working_directory_ = "/";
 
@@ -345,18 +544,34 @@ namespace fineftp
     }
     else
     {
-      auto user = user_database_.getUser(username_for_login_, param);
-      if (user)
-      {
-        logged_in_user_ = user;
-        sendFtpMessage(FtpReplyCode::USER_LOGGED_IN, "Login successful");
-        return;
-      }
-      else
-      {
-        sendFtpMessage(FtpReplyCode::NOT_LOGGED_IN, "Failed to log in");
-        return;
-      }
+      // Verifying a password hash takes long, so the reply may be sent from another thread
+      suspendCommandReading();
+      password_verifier_.verify(username_for_login_, param, [me = shared_from_this()](const std::shared_ptr<FtpUser> &user)
+                                {
+                                  asio::post(me->command_strand_, makeAllocHandler(me->handler_memory_, [me, user]()
+                                             {
+                                               if (user && !me->admission_control_.admitUser(me->username_for_login_))
+                                               {
+                                                 me->sendFinalFtpMessage(FtpReplyCode::SERVICE_NOT_AVAILABLE, "Too many sessions for this user, closing control connection");
+                                               }
+                                               else if (user)
+                                               {
+                                                 me->logged_in_user_ = user;
+                                                 if (me->settings_.root_confinement_enabled)
+                                                   me->root_directory_ = std::make_shared<RootDirectory>(user->local_root_path_, me->error_);
+
+                                                 // Replace the login timeout by the idle timeout
+                                                 me->control_timer_.cancel();
+                                                 me->restartIdleTimeout();
+                                                 me->sendFtpMessage(FtpReplyCode::USER_LOGGED_IN, "Login successful");
+                                               }
+                                               else
+                                               {
+                                                 me->sendFtpMessage(FtpReplyCode::NOT_LOGGED_IN, "Failed to log in");
+                                               }
+                                               me->resumeCommandReading();
+                                             }));
+                                });
     }
   }
 
@@ -413,15 +628,15 @@ namespace fineftp
 
   void FtpSession::handleFtpCommandQUIT(const std::string & /*param*/)
   {
-    logged_in_user_ = nullptr;
+    logoutUser();
     
     // Clean up data connection resources before shutting down
     {
       asio::error_code ec;
       // Close data acceptor if open
-      if (data_acceptor_.is_open())
+      if (isDataAcceptorOpen())
       {
-        data_acceptor_.close(ec);
+        data_acceptor_->close(ec);
       }
       
       // Make sure data socket is closed
@@ -436,8 +651,7 @@ namespace fineftp
       data_socket_weakptr_.reset();
     }
     
-    shutdown_requested_ = true; // This will cause the control connection to be closed after the next message
-    sendFtpMessage(FtpReplyCode::SERVICE_CLOSING_CONTROL_CONNECTION, "Connection shutting down");
+    sendFinalFtpMessage(FtpReplyCode::SERVICE_CLOSING_CONTROL_CONNECTION, "Connection shutting down");
   }
 
   // Transfer parameter commands
@@ -455,10 +669,10 @@ namespace fineftp
       return;
     }
 
-    if (data_acceptor_.is_open())
+    if (isDataAcceptorOpen())
     {
       asio::error_code ec;
-      data_acceptor_.close(ec);
+      data_acceptor_->close(ec);
       if (ec)
       {
         error_ << "Error closing data acceptor: " << ec.message() << std::endl;
@@ -469,7 +683,7 @@ namespace fineftp
 
     {
       asio::error_code ec;
-      data_acceptor_.open(endpoint.protocol(), ec);
+      dataAcceptor().open(endpoint.protocol(), ec);
       if (ec)
       {
         error_ << "Error opening data acceptor: " << ec.message() << std::endl;
@@ -479,7 +693,7 @@ namespace fineftp
     }
     {
       asio::error_code ec;
-      data_acceptor_.bind(endpoint, ec);
+      dataAcceptor().bind(endpoint, ec);
       if (ec)
       {
         error_ << "Error binding data acceptor: " << ec.message() << std::endl;
@@ -489,7 +703,7 @@ namespace fineftp
     }
     {
       asio::error_code ec;
-      data_acceptor_.listen(asio::socket_base::max_listen_connections, ec);
+      dataAcceptor().listen(asio::socket_base::max_listen_connections, ec);
       if (ec)
       {
         error_ << "Error listening on data acceptor: " << ec.message() << std::endl;
@@ -500,7 +714,7 @@ namespace fineftp
 
     // Split address and port into bytes and get the port the OS chose for us
     auto ip_bytes = command_socket_.local_endpoint().address().to_v4().to_bytes();
-    auto port = data_acceptor_.local_endpoint().port();
+    auto port = dataAcceptor().local_endpoint().port();
 
     // Form reply string
     std::stringstream stream;
@@ -511,6 +725,7 @@ namespace fineftp
     }
     stream << ((port >> 8) & 0xff) << "," << (port & 0xff) << ")";
 
+    restartDataConnectTimeout();
     sendFtpMessage(FtpReplyCode::ENTERING_PASSIVE_MODE, "Entering passive mode " + stream.str());
   }
 
@@ -524,10 +739,8 @@ namespace fineftp
 
     if (param == "A")
     {
+      // Line endings are converted to CRLF on the wire (see AsciiEncodeFilter / AsciiDecodeFilter)
       data_type_binary_ = false;
-      // TODO: The ASCII mode currently does not work as RFC 959 demands it. It
-      // should perform line ending conversion, which it doesn't. But as we are
-      // living in the 21st centry, nobody should use ASCII mode anyways.
       sendFtpMessage(FtpReplyCode::COMMAND_OK, "Switching to ASCII mode");
       return;
     }
@@ -549,9 +762,33 @@ namespace fineftp
     sendFtpMessage(FtpReplyCode::SYNTAX_ERROR_UNRECOGNIZED_COMMAND, "Unsupported command");
   }
 
-  void FtpSession::handleFtpCommandMODE(const std::string & /*param*/)
+  void FtpSession::handleFtpCommandMODE(const std::string &param)
   {
-    sendFtpMessage(FtpReplyCode::SYNTAX_ERROR_UNRECOGNIZED_COMMAND, "Unsupported command");
+    if (!logged_in_user_)
+    {
+      sendFtpMessage(FtpReplyCode::NOT_LOGGED_IN, "Not logged in");
+      return;
+    }
+
+    if ((param == "S") || (param == "s"))
+    {
+      transfer_mode_z_ = false;
+      sendFtpMessage(FtpReplyCode::COMMAND_OK, "Switching to stream mode");
+      return;
+    }
+#if FINEFTP_SERVER_MODE_Z
+    else if ((param == "Z") || (param == "z"))
+    {
+      transfer_mode_z_ = true;
+      sendFtpMessage(FtpReplyCode::COMMAND_OK, "Switching to deflate mode");
+      return;
+    }
+#endif // FINEFTP_SERVER_MODE_Z
+    else
+    {
+      sendFtpMessage(FtpReplyCode::COMMAND_NOT_IMPLEMENTED_FOR_PARAMETER, "Unknown or unsupported mode");
+      return;
+    }
   }
 
   // Ftp service commands
@@ -567,13 +804,61 @@ namespace fineftp
       sendFtpMessage(FtpReplyCode::ACTION_NOT_TAKEN, "Permission denied");
       return;
     }
-    if (!data_acceptor_.is_open())
+    if (!isDataAcceptorOpen())
     {
       sendFtpMessage(FtpReplyCode::ERROR_OPENING_DATA_CONNECTION, "Error opening data connection");
       return;
     }
 
     const std::string local_path = toLocalPath(param);
+    if (!isBeneathRoot(local_path))
+    {
+      sendFtpMessage(FtpReplyCode::ACTION_NOT_TAKEN, "Permission denied");
+      return;
+    }
+
+    // "RETR <dir>.tar" downloads the directory as tar archive, unless a file with that name exists
+    const std::string tar_suffix = ".tar";
+    if ((param.size() > tar_suffix.size())
+        && (param.compare(param.size() - tar_suffix.size(), tar_suffix.size(), tar_suffix) == 0)
+        && !Filesystem::FileStatus(local_path).isOk())
+    {
+      const std::string dir_ftp_path   = toAbsoluteFtpPath(param.substr(0, param.size() - tar_suffix.size()));
+      const std::string dir_local_path = toLocalPath(dir_ftp_path);
+      if (!isBeneathRoot(dir_local_path))
+      {
+        sendFtpMessage(FtpReplyCode::ACTION_NOT_TAKEN, "Permission denied");
+        return;
+      }
+      const Filesystem::FileStatus dir_status(dir_local_path);
+
+      if (dir_status.isOk() && (dir_status.type() == Filesystem::FileType::Dir))
+      {
+        if (static_cast<int>(logged_in_user_->permissions_ & Permission::DirList) == 0)
+        {
+          sendFtpMessage(FtpReplyCode::ACTION_NOT_TAKEN, "Permission denied");
+          return;
+        }
+        if (!dir_status.canOpenDir())
+        {
+          sendFtpMessage(FtpReplyCode::ACTION_NOT_TAKEN, "Can't open directory");
+          return;
+        }
+
+        // The archive contains the directory itself, except for the root directory
+        const std::string archive_root_name = dir_ftp_path.substr(dir_ftp_path.find_last_of('/') + 1);
+
+        sendFtpMessage(FtpReplyCode::FILE_STATUS_OK_OPENING_DATA_CONNECTION, "Sending directory as tar archive");
+
+        // The archive is binary data, so TYPE A is ignored
+        sendTarArchive(std::make_shared<TarWriter>(dir_local_path, archive_root_name, root_directory_, error_), createSendFilter(""));
+        return;
+      }
+    }
+
+    // In ASCII mode, the filter counts the line endings for the SIZE
+    // command. It identifies the file before opening it.
+    const std::shared_ptr<DataFilter> filter = createSendFilter(local_path);
 
 #if defined(WIN32) && !defined(__GNUG__)
     const auto file = ReadableFile::get(StrConvert::Utf8ToWide(local_path));
@@ -588,7 +873,7 @@ namespace fineftp
     }
 
     sendFtpMessage(FtpReplyCode::FILE_STATUS_OK_OPENING_DATA_CONNECTION, "Sending file");
-    sendFile(file);
+    sendFile(file, filter);
   }
 
   void FtpSession::handleFtpCommandSIZE(const std::string &param)
@@ -607,39 +892,152 @@ namespace fineftp
     }
 
     const std::string local_path = toLocalPath(param);
-
-    const std::ios::openmode open_mode =
-        std::ios::ate | (data_type_binary_ ? (std::ios::in | std::ios::binary) : (std::ios::in));
-    std::fstream::pos_type file_size;
+    if (!isBeneathRoot(local_path))
     {
-#if defined(WIN32) && !defined(__GNUG__)
-      std::ifstream file(StrConvert::Utf8ToWide(local_path), open_mode);
-#else
-      std::ifstream file(local_path, open_mode);
-#endif
+      sendFtpMessage(FtpReplyCode::ACTION_NOT_TAKEN, "Permission denied");
+      return;
+    }
 
-      if (!file.good())
+    // A single stat() answers the SIZE command. Sync clients issue SIZE for
+    // every file, so we must not open the file for it. In ASCII mode, the
+    // size depends on the number of line endings that have to be converted.
+    // Downloads in ASCII mode count them, so they are usually known.
+    if (!data_type_binary_)
+    {
+      std::uint64_t ascii_size = 0;
+      if (FileHash::cachedAsciiTransferSize(local_path, ascii_size))
       {
-        sendFtpMessage(FtpReplyCode::ACTION_ABORTED_LOCAL_ERROR, "Error opening file for size retrieval");
+        sendFtpMessage(FtpReplyCode::FILE_STATUS, std::to_string(ascii_size));
         return;
       }
+    }
 
-      // RFC 3659 actually states that the returned size should depend on the STRU, MODE, and TYPE and that
-      // the returned size should be exact. We don't comply with this here. The size returned is the
-      // size for TYPE=I.
-      file_size = file.tellg();
-      if (std::fstream::pos_type(-1) == file_size)
-      {
-        sendFtpMessage(FtpReplyCode::ACTION_ABORTED_LOCAL_ERROR, "Error getting file size");
-        return;
-      }
+    const Filesystem::FileStatus file_status(local_path);
+    if (!file_status.isOk())
+    {
+      sendFtpMessage(FtpReplyCode::ACTION_ABORTED_LOCAL_ERROR, "Error opening file for size retrieval");
+      return;
+    }
+    if (file_status.type() != Filesystem::FileType::RegularFile)
+    {
+      // Not 550, as clients (e.g. curl) would take that as "file does not exist"
+      sendFtpMessage(FtpReplyCode::ACTION_ABORTED_LOCAL_ERROR, "Not a regular file");
+      return;
     }
 
-    // Form reply string
-    std::stringstream rep;
-    rep << file_size;
+    // RFC 3659 actually states that the returned size should depend on the STRU and MODE, too. We
+    // don't comply with this here, as the size of a MODE Z transfer is unknown before compressing it.
+    if (data_type_binary_)
+    {
+      sendFtpMessage(FtpReplyCode::FILE_STATUS, std::to_string(file_status.fileSize()));
+      return;
+    }
+
+    // The line endings have not been counted, yet. That requires reading the
+    // whole file, so we must not block the io_context.
+    suspendCommandReading();
+    asio::post(worker_pool_, [me = shared_from_this(), local_path]()
+               {
+                 std::uint64_t ascii_size = 0;
+                 const FileHash::Status status = FileHash::asciiTransferSize(local_path, ascii_size);
+
+                 asio::post(me->command_strand_, makeAllocHandler(me->handler_memory_, [me, status, ascii_size]()
+                            {
+                              if (status == FileHash::Status::Ok)
+                                me->sendFtpMessage(FtpReplyCode::FILE_STATUS, std::to_string(ascii_size));
+                              else
+                                me->sendFtpMessage(FtpReplyCode::ACTION_ABORTED_LOCAL_ERROR, "Error opening file for size retrieval");
+                              me->resumeCommandReading();
+                            }));
+               });
+  }
+
+  void FtpSession::handleFtpCommandMDTM(const std::string &param)
+  {
+    if (!logged_in_user_)
+    {
+      sendFtpMessage(FtpReplyCode::NOT_LOGGED_IN, "Not logged in");
+      return;
+    }
+
+    // Like SIZE, we allow the MDTM command both for FileRead and DirList permissions.
+    if (static_cast<int>(logged_in_user_->permissions_ & (Permission::FileRead | Permission::DirList)) == 0)
+    {
+      sendFtpMessage(FtpReplyCode::ACTION_NOT_TAKEN, "Permission denied");
+      return;
+    }
+
+    const std::string local_path = toLocalPath(param);
+    if (!isBeneathRoot(local_path))
+    {
+      sendFtpMessage(FtpReplyCode::ACTION_NOT_TAKEN, "Permission denied");
+      return;
+    }
+
+    const Filesystem::FileStatus file_status(local_path);
+    if (!file_status.isOk() || (file_status.type() != Filesystem::FileType::RegularFile))
+    {
+      sendFtpMessage(FtpReplyCode::ACTION_NOT_TAKEN, "File does not exist");
+      return;
+    }
+
+    sendFtpMessage(FtpReplyCode::FILE_STATUS, file_status.modificationTimeString());
+  }
+
+  void FtpSession::handleFtpCommandMFMT(const std::string &param)
+  {
+    if (!logged_in_user_)
+    {
+      sendFtpMessage(FtpReplyCode::NOT_LOGGED_IN, "Not logged in");
+      return;
+    }
+
+    // Changing the modification time is a modification of the file
+    if (static_cast<int>(logged_in_user_->permissions_ & Permission::FileWrite) == 0)
+    {
+      sendFtpMessage(FtpReplyCode::ACTION_NOT_TAKEN, "Permission denied");
+      return;
+    }
+
+    // MFMT <time-val> <path>
+    const size_t separator_pos = param.find(' ');
+    if ((separator_pos == std::string::npos) || (separator_pos + 1 >= param.size()))
+    {
+      sendFtpMessage(FtpReplyCode::SYNTAX_ERROR_PARAMETERS, "Syntax: MFMT <YYYYMMDDHHMMSS[.sss]> <path>");
+      return;
+    }
+
+    const std::string time_val = param.substr(0, separator_pos);
+    const std::string ftp_path = param.substr(separator_pos + 1);
+
+    std::int64_t  seconds     = 0;
+    std::uint32_t nanoseconds = 0;
+    if (!Filesystem::parseTimeVal(time_val, seconds, nanoseconds))
+    {
+      sendFtpMessage(FtpReplyCode::SYNTAX_ERROR_PARAMETERS, "Invalid time value");
+      return;
+    }
+
+    const std::string local_path = toLocalPath(ftp_path);
+    if (!isBeneathRoot(local_path))
+    {
+      sendFtpMessage(FtpReplyCode::ACTION_NOT_TAKEN, "Permission denied");
+      return;
+    }
+    if (!Filesystem::FileStatus(local_path).isOk())
+    {
+      sendFtpMessage(FtpReplyCode::ACTION_NOT_TAKEN, "File does not exist");
+      return;
+    }
+
+    if (!Filesystem::setModificationTime(local_path, seconds, nanoseconds))
+    {
+      sendFtpMessage(FtpReplyCode::ACTION_NOT_TAKEN, "Error setting modification time");
+      return;
+    }
 
-    sendFtpMessage(FtpReplyCode::FILE_STATUS, rep.str());
+    // Reply with the time that the filesystem has actually stored
+    sendFtpMessage(FtpReplyCode::FILE_STATUS, "Modify=" + Filesystem::FileStatus(local_path).modificationTimeString() + "; " + ftp_path);
   }
 
   void FtpSession::handleFtpCommandSTOR(const std::string &param)
@@ -659,13 +1057,52 @@ namespace fineftp
       sendFtpMessage(FtpReplyCode::ACTION_NOT_TAKEN, "Permission denied");
       return;
     }
-    if (!data_acceptor_.is_open())
+    if (!isDataAcceptorOpen())
     {
       sendFtpMessage(FtpReplyCode::ERROR_OPENING_DATA_CONNECTION, "Error opening data connection");
       return;
     }
 
     const std::string local_path = toLocalPath(param);
+    if (!isBeneathRoot(local_path))
+    {
+      sendFtpMessage(FtpReplyCode::ACTION_NOT_TAKEN, "Permission denied");
+      return;
+    }
+
+    // "STOR <dir>.untar" extracts a tar archive into the directory, unless a file with that name exists
+    const std::string untar_suffix = ".untar";
+    if ((param.size() > untar_suffix.size())
+        && (param.compare(param.size() - untar_suffix.size(), untar_suffix.size(), untar_suffix) == 0)
+        && !Filesystem::FileStatus(local_path).isOk())
+    {
+      const std::string dir_local_path = toLocalPath(param.substr(0, param.size() - untar_suffix.size()));
+      if (!isBeneathRoot(dir_local_path))
+      {
+        sendFtpMessage(FtpReplyCode::ACTION_NOT_TAKEN, "Permission denied");
+        return;
+      }
+      const Filesystem::FileStatus dir_status(dir_local_path);
+
+      if (dir_status.isOk() && (dir_status.type() == Filesystem::FileType::Dir))
+      {
+        // The permissions and the quota are checked for each entry of the archive
+        const QuotaSet quotas = quota_manager_.quotasFor(dir_local_path);
+        if (quotas.available() <= 0)
+        {
+          sendFtpMessage(FtpReplyCode::ACTION_NOT_TAKEN_INSUFFICIENT_STORAGE_SPACE, "Quota exceeded");
+          return;
+        }
+
+        TarExtractor::TempPathGenerator temp_path_generator;
+        if (settings_.atomic_uploads_enabled)
+          temp_path_generator = &FtpSession::createTempUploadPath;
+
+        sendFtpMessage(FtpReplyCode::FILE_STATUS_OK_OPENING_DATA_CONNECTION, "Receiving tar archive");
+        receiveTarArchive(std::make_shared<TarExtractor>(dir_local_path, logged_in_user_->permissions_, temp_path_generator, quotas, root_directory_, error_), createReceiveFilter(true));
+        return;
+      }
+    }
 
     auto existing_file_filestatus = Filesystem::FileStatus(local_path);
     if (existing_file_filestatus.isOk())
@@ -682,8 +1119,34 @@ namespace fineftp
       }
     }
 
+    // The upload needs at least the size announced by ALLO. The file that
+    // is overwritten frees its space, but atomic uploads only replace it
+    // when they are complete.
+    QuotaSet quotas = quota_manager_.quotasFor(local_path);
+    const std::int64_t replaced_size = (existing_file_filestatus.isOk() ? existing_file_filestatus.fileSize() : 0);
+    if (!quotas.empty())
+    {
+      const std::int64_t required_size = std::max<std::int64_t>(1, static_cast<std::int64_t>(allocation_size_)) - (settings_.atomic_uploads_enabled ? 0 : replaced_size);
+      if (required_size > quotas.available())
+      {
+        sendFtpMessage(FtpReplyCode::ACTION_NOT_TAKEN_INSUFFICIENT_STORAGE_SPACE, "Quota exceeded");
+        return;
+      }
+    }
+
+    // Atomic uploads preallocate their temporary file and leave the target
+    // file alone until they are committed
+    if (!settings_.atomic_uploads_enabled && !hasSpaceForAllocation(local_path, replaced_size))
+    {
+      sendFtpMessage(FtpReplyCode::ACTION_NOT_TAKEN_INSUFFICIENT_STORAGE_SPACE, "Insufficient storage space");
+      return;
+    }
+
+    // Atomic uploads are written to a temporary file and renamed when complete
+    const std::string temp_path = (settings_.atomic_uploads_enabled ? createTempUploadPath(local_path) : std::string());
+
     const std::ios::openmode open_mode = (data_type_binary_ ? std::ios::binary : std::ios::openmode{});
-    const std::shared_ptr<WriteableFile> file = std::make_shared<WriteableFile>(local_path, open_mode);
+    const std::shared_ptr<WriteableFile> file = std::make_shared<WriteableFile>(local_path, temp_path, open_mode);
 
     if (!file->good())
     {
@@ -696,9 +1159,35 @@ namespace fineftp
       return;
     }
 
-    sendFtpMessage(FtpReplyCode::FILE_STATUS_OK_OPENING_DATA_CONNECTION, "Receiving file");
-    receiveFile(file);
-  }
+    if ((allocation_size_ > 0) && !file->preallocate(allocation_size_))
+    {
+      // Another writer has used up the space since it has been checked. The
+      // file has been truncated anyways, unless it is an atomic upload.
+      if (!quotas.empty() && !settings_.atomic_uploads_enabled)
+        quotas.add(-replaced_size);
+
+      sendFtpMessage(FtpReplyCode::ACTION_NOT_TAKEN_INSUFFICIENT_STORAGE_SPACE, "Insufficient storage space");
+      return;
+    }
+
+    std::shared_ptr<UploadQuota> upload_quota;
+    if (!quotas.empty())
+    {
+      // Opening the file has truncated it, unless it is an atomic upload
+      if (!settings_.atomic_uploads_enabled)
+        quotas.add(-replaced_size);
+
+      upload_quota = std::make_shared<UploadQuota>(quotas, settings_.atomic_uploads_enabled, replaced_size);
+    }
+
+    if (upload_committer_.durability() == UploadDurability::PeriodicWriteback)
+    {
+      file->setWritebackInterval(settings_.upload_writeback_interval);
+    }
+
+    sendFtpMessage(FtpReplyCode::FILE_STATUS_OK_OPENING_DATA_CONNECTION, "Receiving file");
+    receiveFile(file, createReceiveFilter(), createUploadHasher(local_path), upload_quota);
+  }
 
   void FtpSession::handleFtpCommandSTOU(const std::string & /*param*/)
   {
@@ -715,6 +1204,11 @@ namespace fineftp
 
     // Check whether the file exists. This determines whether we need Append or Write Permissions
     const std::string local_path = toLocalPath(param);
+    if (!isBeneathRoot(local_path))
+    {
+      sendFtpMessage(FtpReplyCode::ACTION_NOT_TAKEN, "Permission denied");
+      return;
+    }
     auto existing_file_filestatus = Filesystem::FileStatus(local_path);
 
     if (existing_file_filestatus.isOk())
@@ -743,12 +1237,26 @@ namespace fineftp
       }
     }
 
-    if (!data_acceptor_.is_open())
+    if (!isDataAcceptorOpen())
     {
       sendFtpMessage(FtpReplyCode::ERROR_OPENING_DATA_CONNECTION, "Error opening data connection");
       return;
     }
 
+    const QuotaSet quotas = quota_manager_.quotasFor(local_path);
+    if (!quotas.empty() && (std::max<std::int64_t>(1, static_cast<std::int64_t>(allocation_size_)) > quotas.available()))
+    {
+      sendFtpMessage(FtpReplyCode::ACTION_NOT_TAKEN_INSUFFICIENT_STORAGE_SPACE, "Quota exceeded");
+      return;
+    }
+
+    // Don't create a new file that cannot be preallocated
+    if (!hasSpaceForAllocation(local_path, 0))
+    {
+      sendFtpMessage(FtpReplyCode::ACTION_NOT_TAKEN_INSUFFICIENT_STORAGE_SPACE, "Insufficient storage space");
+      return;
+    }
+
     // If the file did not exist, we create a new one. Otherwise, we open it in append mode.
     std::ios::openmode open_mode{};
     if (existing_file_filestatus.isOk())
@@ -768,13 +1276,43 @@ namespace fineftp
       return;
     }
 
+    if ((allocation_size_ > 0) && !file->preallocate(allocation_size_))
+    {
+      sendFtpMessage(FtpReplyCode::ACTION_NOT_TAKEN_INSUFFICIENT_STORAGE_SPACE, "Insufficient storage space");
+      return;
+    }
+
+    if (upload_committer_.durability() == UploadDurability::PeriodicWriteback)
+    {
+      file->setWritebackInterval(settings_.upload_writeback_interval);
+    }
+
     sendFtpMessage(FtpReplyCode::FILE_STATUS_OK_OPENING_DATA_CONNECTION, "Receiving file");
-    receiveFile(file);
+
+    // We only see the appended data, so we cannot compute the checksum of the whole file
+    receiveFile(file, createReceiveFilter(), nullptr, (quotas.empty() ? nullptr : std::make_shared<UploadQuota>(quotas, false, 0)));
   }
 
-  void FtpSession::handleFtpCommandALLO(const std::string & /*param*/)
+  void FtpSession::handleFtpCommandALLO(const std::string &param)
   {
-    sendFtpMessage(FtpReplyCode::SYNTAX_ERROR_UNRECOGNIZED_COMMAND, "Command not implemented");
+    if (!logged_in_user_)
+    {
+      sendFtpMessage(FtpReplyCode::NOT_LOGGED_IN, "Not logged in");
+      return;
+    }
+
+    // ALLO <size> [R <record size>]. The record size is irrelevant for us.
+    const std::string size_string = param.substr(0, param.find(' '));
+    if (size_string.empty() || (size_string.size() > 19)
+        || !std::all_of(size_string.begin(), size_string.end(), [](char c) { return (c >= '0') && (c <= '9'); }))
+    {
+      sendFtpMessage(FtpReplyCode::SYNTAX_ERROR_PARAMETERS, "Invalid size");
+      return;
+    }
+
+    // The space is reserved when the next upload opens the file
+    allocation_size_ = std::stoull(size_string);
+    sendFtpMessage(FtpReplyCode::COMMAND_OK, "OK, reserving " + size_string + " bytes for the next upload");
   }
 
   void FtpSession::handleFtpCommandREST(const std::string & /*param*/)
@@ -832,6 +1370,11 @@ namespace fineftp
     {
       const std::string local_from_path = toLocalPath(rename_from_path_);
       const std::string local_to_path = toLocalPath(param);
+      if (!isBeneathRoot(local_from_path) || !isBeneathRoot(local_to_path))
+      {
+        sendFtpMessage(FtpReplyCode::ACTION_NOT_TAKEN, "Permission denied");
+        return;
+      }
 
       // Check if the source file exists already. We simple disallow overwriting a
       // file be renaming (the bahavior of the native rename command on Windows
@@ -842,10 +1385,35 @@ namespace fineftp
         return;
       }
 
+      // Moving a path between root directories with different quotas moves
+      // its size from one quota to the other. Only then the size of a
+      // directory has to be determined.
+      QuotaSet released_quotas = quota_manager_.quotasFor(local_from_path);
+      QuotaSet charged_quotas  = quota_manager_.quotasFor(local_to_path);
+      std::int64_t moved_size  = 0;
+      {
+        const QuotaSet from_quotas = released_quotas;
+        released_quotas = released_quotas.without(charged_quotas);
+        charged_quotas  = charged_quotas.without(from_quotas);
+      }
+      if (!released_quotas.empty() || !charged_quotas.empty())
+      {
+        const Filesystem::FileStatus from_status(local_from_path);
+        moved_size = (from_status.type() == Filesystem::FileType::Dir ? QuotaManager::directorySize(local_from_path, error_) : from_status.fileSize());
+
+        if (moved_size > charged_quotas.available())
+        {
+          sendFtpMessage(FtpReplyCode::ACTION_NOT_TAKEN_INSUFFICIENT_STORAGE_SPACE, "Quota exceeded");
+          return;
+        }
+      }
+
 #ifdef WIN32
 
       if (MoveFileW(StrConvert::Utf8ToWide(local_from_path).c_str(), StrConvert::Utf8ToWide(local_to_path).c_str()) != 0)
       {
+        released_quotas.add(-moved_size);
+        charged_quotas.add(moved_size);
         sendFtpMessage(FtpReplyCode::FILE_ACTION_COMPLETED, "OK");
         return;
       }
@@ -857,6 +1425,8 @@ namespace fineftp
 #else  // WIN32
       if (rename(local_from_path.c_str(), local_to_path.c_str()) == 0)
       {
+        released_quotas.add(-moved_size);
+        charged_quotas.add(moved_size);
         sendFtpMessage(FtpReplyCode::FILE_ACTION_COMPLETED, "OK");
         return;
       }
@@ -876,7 +1446,43 @@ namespace fineftp
 
   void FtpSession::handleFtpCommandABOR(const std::string & /*param*/)
   {
-    sendFtpMessage(FtpReplyCode::COMMAND_NOT_IMPLEMENTED, "Command not implemented");
+    // Stop accepting a data connection for a transfer that has not started, yet.
+    if (isDataAcceptorOpen())
+    {
+      asio::error_code ec;
+      data_acceptor_->close(ec);
+    }
+
+    // The replies are sent from the data_socket_strand_, so the next command
+    // must wait until they have been queued.
+    suspendCommandReading();
+
+    // The data socket is registered for the entire lifetime of a transfer
+    // (including the time we wait for the client to connect). Unregistering
+    // it tells all pending completion handlers that they must not send any
+    // reply on their own, as the ABOR command takes care of that.
+    asio::post(data_socket_strand_, makeAllocHandler(handler_memory_, [me = shared_from_this()]()
+               {
+                 auto data_socket = me->data_socket_weakptr_.lock();
+                 me->data_socket_weakptr_.reset();
+
+                 if (data_socket)
+                 {
+                   // Closing the socket cancels the outstanding async_write /
+                   // async_read. Their handlers will then release the file.
+                   asio::error_code ec;
+                   data_socket->shutdown(asio::ip::tcp::socket::shutdown_both, ec);
+                   data_socket->close(ec);
+
+                   // RFC 959: Reply 426 for the aborted transfer, followed by 226 for the ABOR command
+                   me->sendFtpMessage(FtpReplyCode::TRANSFER_ABORTED, "Connection closed; transfer aborted");
+                 }
+
+                 me->sendFtpMessage(FtpReplyCode::CLOSING_DATA_CONNECTION, "ABOR command successful");
+
+                 asio::post(me->command_strand_, makeAllocHandler(me->handler_memory_, [me]()
+                            { me->resumeCommandReading(); }));
+               }));
   }
 
   void FtpSession::handleFtpCommandDELE(const std::string &param)
@@ -887,6 +1493,11 @@ namespace fineftp
       return;
     }
     const std::string local_path = toLocalPath(param);
+    if (!isBeneathRoot(local_path))
+    {
+      sendFtpMessage(FtpReplyCode::ACTION_NOT_TAKEN, "Permission denied");
+      return;
+    }
 
     auto file_status = Filesystem::FileStatus(local_path);
 
@@ -912,6 +1523,7 @@ namespace fineftp
 #ifdef WIN32
         if (DeleteFileW(StrConvert::Utf8ToWide(local_path).c_str()) != 0)
         {
+          quota_manager_.quotasFor(local_path).add(-file_status.fileSize());
           sendFtpMessage(FtpReplyCode::FILE_ACTION_COMPLETED, "Successfully deleted file");
           return;
         }
@@ -923,6 +1535,7 @@ namespace fineftp
 #else
         if (unlink(local_path.c_str()) == 0)
         {
+          quota_manager_.quotasFor(local_path).add(-file_status.fileSize());
           sendFtpMessage(FtpReplyCode::FILE_ACTION_COMPLETED, "Successfully deleted file");
           return;
         }
@@ -950,6 +1563,11 @@ namespace fineftp
     }
 
     const std::string local_path = toLocalPath(param);
+    if (!isBeneathRoot(local_path))
+    {
+      sendFtpMessage(FtpReplyCode::ACTION_NOT_TAKEN, "Permission denied");
+      return;
+    }
 
 #ifdef WIN32
     if (RemoveDirectoryW(StrConvert::Utf8ToWide(local_path).c_str()) != 0)
@@ -996,6 +1614,11 @@ namespace fineftp
     }
 
     auto local_path = toLocalPath(param);
+    if (!isBeneathRoot(local_path))
+    {
+      sendFtpMessage(FtpReplyCode::ACTION_NOT_TAKEN, "Permission denied");
+      return;
+    }
 
 #ifdef WIN32
     LPSECURITY_ATTRIBUTES security_attributes = nullptr; // => Default security attributes
@@ -1098,6 +1721,11 @@ namespace fineftp
     }
 
     const std::string local_path = toLocalPath(path2dst);
+    if (!isBeneathRoot(local_path))
+    {
+      sendFtpMessage(FtpReplyCode::ACTION_NOT_TAKEN, "Permission denied");
+      return;
+    }
     auto dir_status = Filesystem::FileStatus(local_path);
 
     if (dir_status.isOk())
@@ -1107,7 +1735,7 @@ namespace fineftp
         if (dir_status.canOpenDir())
         {
           sendFtpMessage(FtpReplyCode::FILE_STATUS_OK_OPENING_DATA_CONNECTION, "Sending directory listing");
-          sendDirectoryListing(Filesystem::dirContent(local_path, error_));
+          sendDirectoryListing(Filesystem::dirContent(local_path, error_), createSendFilter(""));
           return;
         }
         else
@@ -1146,6 +1774,11 @@ namespace fineftp
     }
 
     const std::string local_path = toLocalPath(param);
+    if (!isBeneathRoot(local_path))
+    {
+      sendFtpMessage(FtpReplyCode::ACTION_NOT_TAKEN, "Permission denied");
+      return;
+    }
     auto dir_status = Filesystem::FileStatus(local_path);
 
     if (dir_status.isOk())
@@ -1155,7 +1788,7 @@ namespace fineftp
         if (dir_status.canOpenDir())
         {
           sendFtpMessage(FtpReplyCode::FILE_STATUS_OK_OPENING_DATA_CONNECTION, "Sending name list");
-          sendNameList(Filesystem::dirContent(local_path, error_));
+          sendNameList(Filesystem::dirContent(local_path, error_), createSendFilter(""));
           return;
         }
         else
@@ -1178,8 +1811,106 @@ namespace fineftp
     }
   }
 
-  void FtpSession::handleFtpCommandSITE(const std::string & /*param*/)
+  void FtpSession::handleFtpCommandSITE(const std::string &param)
   {
+    // Server-side copy, compatible with the SITE CPFR / CPTO commands of ProFTPD's mod_copy
+    const size_t separator_pos = param.find(' ');
+    std::string  site_command  = param.substr(0, separator_pos);
+    const std::string site_param = (separator_pos == std::string::npos ? std::string() : param.substr(separator_pos + 1));
+    std::transform(site_command.begin(), site_command.end(), site_command.begin(), [](char c) { return static_cast<char>(std::toupper(static_cast<unsigned char>(c))); });
+
+    if (site_command == "CPFR")
+    {
+      copy_from_path_.clear();
+
+      auto is_copyable_error = checkIfPathIsCopyable(site_param);
+      if (is_copyable_error.replyCode() == FtpReplyCode::COMMAND_OK)
+      {
+        copy_from_path_ = site_param;
+        sendFtpMessage(FtpReplyCode::FILE_ACTION_NEEDS_FURTHER_INFO, "File exists, ready for destination name");
+      }
+      else
+      {
+        sendFtpMessage(is_copyable_error);
+      }
+      return;
+    }
+    else if (site_command == "CPTO")
+    {
+      const std::string copy_from_path = copy_from_path_;
+      copy_from_path_.clear();
+
+      if (last_command_ != "SITE" || copy_from_path.empty())
+      {
+        sendFtpMessage(FtpReplyCode::COMMANDS_BAD_SEQUENCE, "Please specify source file first");
+        return;
+      }
+      if (site_param.empty())
+      {
+        sendFtpMessage(FtpReplyCode::SYNTAX_ERROR_PARAMETERS, "No target name given");
+        return;
+      }
+
+      // The file may have been changed since CPFR
+      auto is_copyable_error = checkIfPathIsCopyable(copy_from_path);
+      if (is_copyable_error.replyCode() != FtpReplyCode::COMMAND_OK)
+      {
+        sendFtpMessage(is_copyable_error);
+        return;
+      }
+
+      // Copying creates a new file, so we need the same permission as STOR
+      if (static_cast<int>(logged_in_user_->permissions_ & Permission::FileWrite) == 0)
+      {
+        sendFtpMessage(FtpReplyCode::ACTION_NOT_TAKEN, "Permission denied");
+        return;
+      }
+
+      const std::string local_from_path = toLocalPath(copy_from_path);
+      const std::string local_to_path   = toLocalPath(site_param);
+      if (!isBeneathRoot(local_from_path) || !isBeneathRoot(local_to_path))
+      {
+        sendFtpMessage(FtpReplyCode::ACTION_NOT_TAKEN, "Permission denied");
+        return;
+      }
+
+      // Like RNTO, we don't overwrite existing files
+      if (Filesystem::FileStatus(local_to_path).isOk())
+      {
+        sendFtpMessage(FtpReplyCode::FILE_ACTION_NOT_TAKEN, "Target path exists already.");
+        return;
+      }
+
+      // Reflinks share the data on disk, but the quota counts the size of each file
+      QuotaSet quotas = quota_manager_.quotasFor(local_to_path);
+      const std::int64_t copy_size = Filesystem::FileStatus(local_from_path).fileSize();
+      if (copy_size > quotas.available())
+      {
+        sendFtpMessage(FtpReplyCode::ACTION_NOT_TAKEN_INSUFFICIENT_STORAGE_SPACE, "Quota exceeded");
+        return;
+      }
+      quotas.add(copy_size);
+
+      // Even with reflinks, copying may take long (e.g. across filesystems), so we must not block the io_context
+      suspendCommandReading();
+      asio::post(worker_pool_, [me = shared_from_this(), local_from_path, local_to_path, quotas, copy_size]() mutable
+                 {
+                   const bool success = Filesystem::copyFile(local_from_path, local_to_path);
+                   if (!success)
+                     quotas.add(-copy_size);
+
+                   asio::post(me->command_strand_, makeAllocHandler(me->handler_memory_, [me, success]()
+                              {
+                                if (success)
+                                  me->sendFtpMessage(FtpReplyCode::FILE_ACTION_COMPLETED, "Copy successful");
+                                else
+                                  me->sendFtpMessage(FtpReplyCode::FILE_ACTION_NOT_TAKEN, "Error copying file");
+                                me->resumeCommandReading();
+                              }));
+                 });
+      return;
+    }
+
     sendFtpMessage(FtpReplyCode::SYNTAX_ERROR_UNRECOGNIZED_COMMAND, "Command not implemented");
   }
 
@@ -1217,7 +1948,17 @@ namespace fineftp
     ss << "211- Feature List:\r\n";
     ss << " UTF8\r\n";
     ss << " SIZE\r\n";
+    ss << " MDTM\r\n";
+    ss << " MFMT\r\n";
     ss << " LANG EN\r\n";
+#if FINEFTP_SERVER_MODE_Z
+    ss << " MODE Z\r\n";
+#endif // FINEFTP_SERVER_MODE_Z
+    ss << " HASH " << hashAlgorithmFeatList(hash_algorithm_) << "\r\n";
+    ss << " XCRC\r\n";
+    ss << " XMD5\r\n";
+    ss << " XSHA1\r\n";
+    ss << " XSHA256\r\n";
     ss << "211 END\r\n";
 
     sendRawFtpMessage(ss.str());
@@ -1235,27 +1976,176 @@ namespace fineftp
       return;
     }
 
+    // OPTS HASH [<algorithm>]
+    if ((param_upper == "HASH") || (param_upper.compare(0, 5, "HASH ") == 0))
+    {
+      if (param_upper.size() > 5)
+      {
+        HashAlgorithm algorithm = hash_algorithm_;
+        if (!parseHashAlgorithm(param_upper.substr(5), algorithm))
+        {
+          sendFtpMessage(FtpReplyCode::SYNTAX_ERROR_PARAMETERS, "Unknown algorithm");
+          return;
+        }
+        hash_algorithm_ = algorithm;
+      }
+      sendFtpMessage(FtpReplyCode::COMMAND_OK, hashAlgorithmName(hash_algorithm_));
+      return;
+    }
+
+#if FINEFTP_SERVER_MODE_Z
+    // OPTS MODE Z LEVEL <level>
+    const std::string mode_z_level_option = "MODE Z LEVEL ";
+    if (param_upper.compare(0, mode_z_level_option.size(), mode_z_level_option) == 0)
+    {
+      const std::string level_string = param_upper.substr(mode_z_level_option.size());
+      if ((level_string.size() == 1) && (level_string[0] >= '0') && (level_string[0] <= '9'))
+      {
+        mode_z_level_ = level_string[0] - '0';
+        sendFtpMessage(FtpReplyCode::COMMAND_OK, "MODE Z LEVEL set to " + level_string);
+        return;
+      }
+      else
+      {
+        sendFtpMessage(FtpReplyCode::SYNTAX_ERROR_PARAMETERS, "Invalid compression level");
+        return;
+      }
+    }
+#endif // FINEFTP_SERVER_MODE_Z
+
     sendFtpMessage(FtpReplyCode::COMMAND_NOT_IMPLEMENTED_FOR_PARAMETER, "Unrecognized parameter");
   }
 
+  // Checksum commands
+  void FtpSession::handleFtpCommandHASH(const std::string &param)
+  {
+    // Reply as of draft-bryan-ftpext-hash: 213 <algorithm> <start>-<end> <hash> <path>
+    computeFileHash(param, hash_algorithm_, [me = shared_from_this(), algorithm = hash_algorithm_, param](const FileHash::Result &result)
+                    {
+                      std::stringstream ss;
+                      ss << hashAlgorithmName(algorithm) << " " << result.range_start << "-" << result.range_end << " " << result.hash << " " << param;
+                      me->sendFtpMessage(FtpReplyCode::FILE_STATUS, ss.str());
+                    });
+  }
+
+  void FtpSession::handleFtpCommandRANG(const std::string &param)
+  {
+    if (!logged_in_user_)
+    {
+      sendFtpMessage(FtpReplyCode::NOT_LOGGED_IN, "Not logged in");
+      return;
+    }
+
+    // RANG <start> <end>, both inclusive. "RANG 1 0" resets the range.
+    const size_t space_index = param.find(' ');
+    const std::string start_string = param.substr(0, space_index);
+    const std::string end_string   = (space_index == std::string::npos ? "" : param.substr(space_index + 1));
+
+    const auto is_number = [](const std::string &str)
+                           { return !str.empty() && (str.size() <= 19) && std::all_of(str.begin(), str.end(), [](char c) { return (c >= '0') && (c <= '9'); }); };
+
+    if (!is_number(start_string) || !is_number(end_string))
+    {
+      sendFtpMessage(FtpReplyCode::SYNTAX_ERROR_PARAMETERS, "Invalid range");
+      return;
+    }
+
+    const std::uint64_t start = std::stoull(start_string);
+    const std::uint64_t end   = std::stoull(end_string);
+
+    if ((start == 1) && (end == 0))
+    {
+      range_start_ = 0;
+      range_end_   = FileHash::end_of_file;
+      sendFtpMessage(FtpReplyCode::FILE_ACTION_NEEDS_FURTHER_INFO, "Byte range reset");
+      return;
+    }
+    if (start > end)
+    {
+      sendFtpMessage(FtpReplyCode::SYNTAX_ERROR_PARAMETERS, "Invalid range");
+      return;
+    }
+
+    range_start_ = start;
+    range_end_   = end + 1;
+    sendFtpMessage(FtpReplyCode::FILE_ACTION_NEEDS_FURTHER_INFO, "Restarting at " + start_string + ". End byte range at " + end_string);
+  }
+
+  void FtpSession::handleFtpCommandXCRC(const std::string &param)
+  {
+    computeFileHash(param, HashAlgorithm::Crc32, [me = shared_from_this()](const FileHash::Result &result)
+                    { me->sendFtpMessage(FtpReplyCode::FILE_ACTION_COMPLETED, result.hash); });
+  }
+
+  void FtpSession::handleFtpCommandXMD5(const std::string &param)
+  {
+    computeFileHash(param, HashAlgorithm::Md5, [me = shared_from_this()](const FileHash::Result &result)
+                    { me->sendFtpMessage(FtpReplyCode::FILE_ACTION_COMPLETED, result.hash); });
+  }
+
+  void FtpSession::handleFtpCommandXSHA1(const std::string &param)
+  {
+    computeFileHash(param, HashAlgorithm::Sha1, [me = shared_from_this()](const FileHash::Result &result)
+                    { me->sendFtpMessage(FtpReplyCode::FILE_ACTION_COMPLETED, result.hash); });
+  }
+
+  void FtpSession::handleFtpCommandXSHA256(const std::string &param)
+  {
+    computeFileHash(param, HashAlgorithm::Sha256, [me = shared_from_this()](const FileHash::Result &result)
+                    { me->sendFtpMessage(FtpReplyCode::FILE_ACTION_COMPLETED, result.hash); });
+  }
+
+  void FtpSession::logoutUser()
+  {
+    if (logged_in_user_)
+      admission_control_.releaseUser(username_for_login_);
+
+    logged_in_user_ = nullptr;
+    root_directory_ = nullptr;
+  }
+
   ////////////////////////////////////////////////////////
   // FTP data-socket send
   ////////////////////////////////////////////////////////
 
-  void FtpSession::sendDirectoryListing(const std::map<std::string, Filesystem::FileStatus> &directory_content)
+  std::shared_ptr<asio::ip::tcp::socket> FtpSession::createDataSocket()
   {
     auto data_socket = std::make_shared<asio::ip::tcp::socket>(io_context_);
 
-    data_acceptor_.async_accept(*data_socket, data_socket_strand_.wrap([data_socket, directory_content, me = shared_from_this()](auto ec)
+    // Register the socket right away (and not only when the client has
+    // connected), so an ABOR command can also abort a transfer that is still
+    // waiting for the data connection.
+    asio::post(data_socket_strand_, makeAllocHandler(handler_memory_, [me = shared_from_this(), data_socket]()
+               { me->data_socket_weakptr_ = data_socket; }));
+
+    // The client may connect to a passive mode acceptor once per transfer
+    restartDataConnectTimeout();
+
+    return data_socket;
+  }
+
+  void FtpSession::sendDirectoryListing(const std::map<std::string, Filesystem::FileStatus> &directory_content, const std::shared_ptr<DataFilter> &filter)
+  {
+    auto data_socket = createDataSocket();
+
+    dataAcceptor().async_accept(*data_socket, makeAllocHandler(handler_memory_, data_socket_strand_.wrap([data_socket, directory_content, filter, me = shared_from_this()](auto ec)
                                                                        {
+                                                                         if (me->data_socket_weakptr_.lock() != data_socket)
+                                                                         {
+                                                                           // The transfer has been aborted by the client
+                                                                           return;
+                                                                         }
+
+                                                                         // The client has connected (or the accept failed), the timeout is over
+                                                                         me->data_connect_timer_.cancel();
+
                                                                          if (ec)
                                                                          {
+                                                                           me->data_socket_weakptr_.reset();
                                                                            me->sendFtpMessage(FtpReplyCode::TRANSFER_ABORTED, "Data transfer aborted: " + ec.message());
                                                                            return;
                                                                          }
 
-                                                                         me->data_socket_weakptr_ = data_socket;
-
                                                                          // TODO: close acceptor after connect?
                                                                          // Create a Unix-like file list
                                                                          std::stringstream stream; // NOLINT(misc-const-correctness) Reason: False detection, this cannot be made const
@@ -1278,26 +2168,41 @@ namespace fineftp
                                                                          dir_listing_rawdata->reserve(dir_listing_string.size());
                                                                          std::copy(dir_listing_string.begin(), dir_listing_string.end(), std::back_inserter(*dir_listing_rawdata));
 
+                                                                         if (filter && !filter->process(*dir_listing_rawdata, true))
+                                                                         {
+                                                                           me->data_socket_weakptr_.reset();
+                                                                           me->sendFtpMessage(FtpReplyCode::ACTION_ABORTED_LOCAL_ERROR, "Error encoding directory listing");
+                                                                           return;
+                                                                         }
+
                                                                          // Send the string out
                                                                          me->addDataToBufferAndSend(dir_listing_rawdata, data_socket);
                                                                          me->addDataToBufferAndSend(std::shared_ptr<std::vector<char>>(), data_socket); // Nullpointer indicates end of transmission
-                                                                       }));
+                                                                       })));
   }
 
-  void FtpSession::sendNameList(const std::map<std::string, Filesystem::FileStatus> &directory_content)
+  void FtpSession::sendNameList(const std::map<std::string, Filesystem::FileStatus> &directory_content, const std::shared_ptr<DataFilter> &filter)
   {
-    auto data_socket = std::make_shared<asio::ip::tcp::socket>(io_context_);
+    auto data_socket = createDataSocket();
 
-    data_acceptor_.async_accept(*data_socket, data_socket_strand_.wrap([data_socket, directory_content, me = shared_from_this()](auto ec)
+    dataAcceptor().async_accept(*data_socket, makeAllocHandler(handler_memory_, data_socket_strand_.wrap([data_socket, directory_content, filter, me = shared_from_this()](auto ec)
                                                                        {
+                                                                         if (me->data_socket_weakptr_.lock() != data_socket)
+                                                                         {
+                                                                           // The transfer has been aborted by the client
+                                                                           return;
+                                                                         }
+
+                                                                         // The client has connected (or the accept failed), the timeout is over
+                                                                         me->data_connect_timer_.cancel();
+
                                                                          if (ec)
                                                                          {
+                                                                           me->data_socket_weakptr_.reset();
                                                                            me->sendFtpMessage(FtpReplyCode::TRANSFER_ABORTED, "Data transfer aborted: " + ec.message());
                                                                            return;
                                                                          }
 
-                                                                         me->data_socket_weakptr_ = data_socket;
-
                                                                          // Create a file list
                                                                          std::stringstream stream; // NOLINT(misc-const-correctness) Reason: False detection, this cannot be made const
                                                                          for (const auto &entry : directory_content)
@@ -1312,43 +2217,75 @@ namespace fineftp
                                                                          dir_listing_rawdata->reserve(dir_listing_string.size());
                                                                          std::copy(dir_listing_string.begin(), dir_listing_string.end(), std::back_inserter(*dir_listing_rawdata));
 
+                                                                         if (filter && !filter->process(*dir_listing_rawdata, true))
+                                                                         {
+                                                                           me->data_socket_weakptr_.reset();
+                                                                           me->sendFtpMessage(FtpReplyCode::ACTION_ABORTED_LOCAL_ERROR, "Error encoding directory listing");
+                                                                           return;
+                                                                         }
+
                                                                          // Send the string out
                                                                          me->addDataToBufferAndSend(dir_listing_rawdata, data_socket);
                                                                          me->addDataToBufferAndSend(std::shared_ptr<std::vector<char>>(), data_socket); // Nullpointer indicates end of transmission
-                                                                       }));
+                                                                       })));
   }
 
-  void FtpSession::sendFile(const std::shared_ptr<ReadableFile> &file)
+  void FtpSession::sendFile(const std::shared_ptr<ReadableFile> &file, const std::shared_ptr<DataFilter> &filter)
   {
-    auto data_socket = std::make_shared<asio::ip::tcp::socket>(io_context_);
+    auto data_socket = createDataSocket();
 
-    data_acceptor_.async_accept(*data_socket, data_socket_strand_.wrap([data_socket, file, me = shared_from_this()](auto ec)
+    dataAcceptor().async_accept(*data_socket, makeAllocHandler(handler_memory_, data_socket_strand_.wrap([data_socket, file, filter, me = shared_from_this()](auto ec)
                                                                        {
+                                  if (me->data_socket_weakptr_.lock() != data_socket)
+                                  {
+                                    // The transfer has been aborted by the client
+                                    return;
+                                  }
+
+                                  // The client has connected (or the accept failed), the timeout is over
+                                  me->data_connect_timer_.cancel();
+
                                   if (ec)
                                   {
+                                    me->data_socket_weakptr_.reset();
                                     me->sendFtpMessage(FtpReplyCode::TRANSFER_ABORTED, "Data transfer aborted: " + ec.message());
                                     return;
                                   }
 
-                                  if (file->size() == 0U)
+                                  if (filter)
                                   {
+                                    // The data has to be transformed, so we cannot send the mapped file directly
+                                    me->sendFileChunk(file, 0, filter, data_socket);
+                                  }
+                                  else if (file->size() == 0U)
+                                  {
+                                    me->data_socket_weakptr_.reset();
                                     me->sendFtpMessage(FtpReplyCode::CLOSING_DATA_CONNECTION, "Done");
                                   }
                                   else if (file->data() == nullptr)
                                   {
                                     // Error that should never happen. If it does, it's a bug in the server.
                                     // Usually, if the data is null, the file size should be 0.
+                                    me->data_socket_weakptr_.reset();
                                     me->sendFtpMessage(FtpReplyCode::TRANSFER_ABORTED, "Data transfer aborted: File data is null");
                                   }
                                   else
                                   {
-                                    me->data_socket_weakptr_ = data_socket;
-
                                     // Send the file
                                     asio::async_write(*data_socket
                                                     , asio::buffer(file->data(), file->size())
-                                                    , [me, file, data_socket](asio::error_code ec, std::size_t /*bytes_to_transfer*/)
+                                                    , makeAllocHandler(me->handler_memory_, me->data_socket_strand_.wrap([me, file, data_socket](asio::error_code ec, std::size_t /*bytes_to_transfer*/)
                                                       {
+                                                        if (me->data_socket_weakptr_.lock() != data_socket)
+                                                        {
+                                                          // The transfer has been aborted by the client. The
+                                                          // file mapping is released with this handler.
+                                                          return;
+                                                        }
+
+                                                        // Clear weak_ptr to data socket
+                                                        me->data_socket_weakptr_.reset();
+
                                                         if (ec)
                                                         {
                                                           me->sendFtpMessage(FtpReplyCode::TRANSFER_ABORTED, "Data transfer aborted: " + ec.message());
@@ -1366,38 +2303,182 @@ namespace fineftp
                                                             }
                                                           }
 
-                                                          // Clear weak_ptr to data socket
-                                                          asio::post(me->data_socket_strand_, [me]()
-                                                          {
-                                                              me->data_socket_weakptr_.reset();
-                                                          });
+                                                          me->sendFileSentMessage();
+                                                        }
+                                                      })));
+                                  } })));
+  }
 
-// Ugly work-around:
-// An FTP client implementation has been observed to close the data connection
-// as soon as it receives the 226 status code - even though it hasn't received
-// all data, yet. To improve interoperability with such buggy clients, sending
-// of the 226 status code can be delayed a bit. The delay is defined through a
-// preprocessor definition. If the delay is 0, no delay is introduced at all.
+  void FtpSession::sendFileChunk(const std::shared_ptr<ReadableFile> &file, std::size_t offset, const std::shared_ptr<DataFilter> &filter, const std::shared_ptr<asio::ip::tcp::socket> &data_socket)
+  {
+    // Transformed files are sent in chunks, so the memory consumption doesn't depend on the file size
+    constexpr std::size_t chunk_size = 1024 * 1024;
+
+    const std::size_t this_chunk_size = std::min(chunk_size, file->size() - offset);
+    const bool        last_chunk      = (offset + this_chunk_size >= file->size());
+
+    const std::shared_ptr<std::vector<char>> buffer = std::make_shared<std::vector<char>>();
+    if (this_chunk_size > 0)
+    {
+      const char* chunk_start = reinterpret_cast<const char*>(file->data()) + offset;
+      buffer->assign(chunk_start, chunk_start + this_chunk_size);
+    }
+
+    if (!filter->process(*buffer, last_chunk))
+    {
+      data_socket_weakptr_.reset();
+
+      asio::error_code ec;
+      data_socket->shutdown(asio::ip::tcp::socket::shutdown_both, ec);
+      data_socket->close(ec);
+
+      sendFtpMessage(FtpReplyCode::ACTION_ABORTED_LOCAL_ERROR, "Data transfer aborted: Error encoding data");
+      return;
+    }
+
+    asio::async_write(*data_socket, asio::buffer(*buffer), makeAllocHandler(handler_memory_, data_socket_strand_.wrap([me = shared_from_this(), file, offset, this_chunk_size, last_chunk, filter, data_socket, buffer](asio::error_code ec, std::size_t /*bytes_to_transfer*/)
+                      {
+                        if (me->data_socket_weakptr_.lock() != data_socket)
+                        {
+                          // The transfer has been aborted by the client
+                          return;
+                        }
+
+                        if (ec)
+                        {
+                          me->data_socket_weakptr_.reset();
+                          me->sendFtpMessage(FtpReplyCode::TRANSFER_ABORTED, "Data transfer aborted: " + ec.message());
+                          return;
+                        }
+
+                        if (!last_chunk)
+                        {
+                          me->sendFileChunk(file, offset + this_chunk_size, filter, data_socket);
+                          return;
+                        }
+
+                        me->data_socket_weakptr_.reset();
+
+                        {
+                          asio::error_code errc;
+                          data_socket->shutdown(asio::socket_base::shutdown_both, errc);
+                          data_socket->close(errc);
+                        }
+
+                        me->sendFileSentMessage();
+                      })));
+  }
+
+  void FtpSession::sendTarArchive(const std::shared_ptr<TarWriter> &tar_writer, const std::shared_ptr<DataFilter> &filter)
+  {
+    auto data_socket = createDataSocket();
+
+    dataAcceptor().async_accept(*data_socket, makeAllocHandler(handler_memory_, data_socket_strand_.wrap([data_socket, tar_writer, filter, me = shared_from_this()](auto ec)
+                                {
+                                  if (me->data_socket_weakptr_.lock() != data_socket)
+                                  {
+                                    // The transfer has been aborted by the client
+                                    return;
+                                  }
+
+                                  // The client has connected (or the accept failed), the timeout is over
+                                  me->data_connect_timer_.cancel();
+
+                                  if (ec)
+                                  {
+                                    me->data_socket_weakptr_.reset();
+                                    me->sendFtpMessage(FtpReplyCode::TRANSFER_ABORTED, "Data transfer aborted: " + ec.message());
+                                    return;
+                                  }
+
+                                  me->sendTarArchiveChunk(tar_writer, filter, data_socket);
+                                })));
+  }
+
+  void FtpSession::sendTarArchiveChunk(const std::shared_ptr<TarWriter> &tar_writer, const std::shared_ptr<DataFilter> &filter, const std::shared_ptr<asio::ip::tcp::socket> &data_socket)
+  {
+    // Only one chunk of the archive is kept in memory, regardless of the size of the directory
+    constexpr std::size_t chunk_size = 1024 * 1024;
+
+    const std::shared_ptr<std::vector<char>> buffer = std::make_shared<std::vector<char>>();
+    buffer->reserve(chunk_size);
+    tar_writer->read(*buffer, chunk_size);
+
+    const bool last_chunk = tar_writer->finished();
+
+    if (filter && !filter->process(*buffer, last_chunk))
+    {
+      data_socket_weakptr_.reset();
+
+      asio::error_code ec;
+      data_socket->shutdown(asio::ip::tcp::socket::shutdown_both, ec);
+      data_socket->close(ec);
+
+      sendFtpMessage(FtpReplyCode::ACTION_ABORTED_LOCAL_ERROR, "Data transfer aborted: Error encoding data");
+      return;
+    }
+
+    asio::async_write(*data_socket, asio::buffer(*buffer), makeAllocHandler(handler_memory_, data_socket_strand_.wrap([me = shared_from_this(), tar_writer, last_chunk, filter, data_socket, buffer](asio::error_code ec, std::size_t /*bytes_to_transfer*/)
+                      {
+                        if (me->data_socket_weakptr_.lock() != data_socket)
+                        {
+                          // The transfer has been aborted by the client
+                          return;
+                        }
+
+                        if (ec)
+                        {
+                          me->data_socket_weakptr_.reset();
+                          me->sendFtpMessage(FtpReplyCode::TRANSFER_ABORTED, "Data transfer aborted: " + ec.message());
+                          return;
+                        }
+
+                        if (!last_chunk)
+                        {
+                          me->sendTarArchiveChunk(tar_writer, filter, data_socket);
+                          return;
+                        }
+
+                        me->data_socket_weakptr_.reset();
+
+                        {
+                          asio::error_code errc;
+                          data_socket->shutdown(asio::socket_base::shutdown_both, errc);
+                          data_socket->close(errc);
+                        }
+
+                        me->sendFileSentMessage();
+                      })));
+  }
+
+  void FtpSession::sendFileSentMessage()
+  {
+// Ugly work-around:
+// An FTP client implementation has been observed to close the data connection
+// as soon as it receives the 226 status code - even though it hasn't received
+// all data, yet. To improve interoperability with such buggy clients, sending
+// of the 226 status code can be delayed a bit. The delay is defined through a
+// preprocessor definition. If the delay is 0, no delay is introduced at all.
 #if (0 == DELAY_226_RESP_MS)
-                                                            me->sendFtpMessage(FtpReplyCode::CLOSING_DATA_CONNECTION, "Done");
+    sendFtpMessage(FtpReplyCode::CLOSING_DATA_CONNECTION, "Done");
 #else
-                                                            me->timer_.expires_after(std::chrono::milliseconds{DELAY_226_RESP_MS});
-                                                            me->timer_.async_wait(me->data_socket_strand_.wrap([me](const asio::error_code& ec)
-                                                                                  {
-                                                                                    if (ec != asio::error::operation_aborted)
-                                                                                    {
-                                                                                      me->sendFtpMessage(FtpReplyCode::CLOSING_DATA_CONNECTION, "Done");
-                                                                                    }
-                                                                                  }));
+    if (!timer_)
+      timer_ = std::make_unique<asio::steady_timer>(io_context_);
+
+    timer_->expires_after(std::chrono::milliseconds{DELAY_226_RESP_MS});
+    timer_->async_wait(makeAllocHandler(handler_memory_, data_socket_strand_.wrap([me = shared_from_this()](const asio::error_code& ec)
+                      {
+                        if (ec != asio::error::operation_aborted)
+                        {
+                          me->sendFtpMessage(FtpReplyCode::CLOSING_DATA_CONNECTION, "Done");
+                        }
+                      })));
 #endif
-                                                        }
-                                                      });
-                                  } }));
   }
 
   void FtpSession::addDataToBufferAndSend(const std::shared_ptr<std::vector<char>> &data, const std::shared_ptr<asio::ip::tcp::socket> &data_socket)
   {
-    asio::post(data_socket_strand_, [me = shared_from_this(), data, data_socket]()
+    asio::post(data_socket_strand_, makeAllocHandler(handler_memory_, [me = shared_from_this(), data, data_socket]()
                {
                               const bool write_in_progress = (!me->data_buffer_.empty());
 
@@ -1406,33 +2487,41 @@ namespace fineftp
                               if (!write_in_progress)
                               {
                                 me->writeDataToSocket(data_socket);
-                              } });
+                              } }));
   }
 
   void FtpSession::writeDataToSocket(const std::shared_ptr<asio::ip::tcp::socket> &data_socket)
   {
     asio::post(data_socket_strand_,
-               [me = shared_from_this(), data_socket]()
+               makeAllocHandler(handler_memory_, [me = shared_from_this(), data_socket]()
                {
                  auto data = me->data_buffer_.front();
 
                  if (data)
                  {
                    // Send out the buffer
-                   asio::async_write(*data_socket, asio::buffer(*data), me->data_socket_strand_.wrap([me, data, data_socket](asio::error_code ec, std::size_t /*bytes_to_transfer*/)
+                   asio::async_write(*data_socket, asio::buffer(*data), makeAllocHandler(me->handler_memory_, me->data_socket_strand_.wrap([me, data, data_socket](asio::error_code ec, std::size_t /*bytes_to_transfer*/)
                                                                                                      {
-                                me->data_buffer_.pop_front();
-
                                 if (ec)
                                 {
-                                  me->error_ << "Data write error: " << ec.message() << std::endl;
+                                  // Nothing queued for this socket can be sent anymore
+                                  me->data_buffer_.clear();
+
+                                  if (me->data_socket_weakptr_.lock() == data_socket)
+                                  {
+                                    me->data_socket_weakptr_.reset();
+                                    me->error_ << "Data write error: " << ec.message() << std::endl;
+                                    me->sendFtpMessage(FtpReplyCode::TRANSFER_ABORTED, "Data transfer aborted: " + ec.message());
+                                  }
                                   return;
                                 }
 
+                                me->data_buffer_.pop_front();
+
                                 if (!me->data_buffer_.empty())
                                 {
                                   me->writeDataToSocket(data_socket);
-                                } }));
+                                } })));
                  }
                  else
                  {
@@ -1446,83 +2535,437 @@ namespace fineftp
                      data_socket->close(ec);
                    }
 
-                   me->sendFtpMessage(FtpReplyCode::CLOSING_DATA_CONNECTION, "Done");
+                   // Only reply if the transfer has not been aborted by the client
+                   if (me->data_socket_weakptr_.lock() == data_socket)
+                   {
+                     me->data_socket_weakptr_.reset();
+                     me->sendFtpMessage(FtpReplyCode::CLOSING_DATA_CONNECTION, "Done");
+                   }
                  }
-               });
+               }));
   }
 
   ////////////////////////////////////////////////////////
   // FTP data-socket receive
   ////////////////////////////////////////////////////////
 
-  void FtpSession::receiveFile(const std::shared_ptr<WriteableFile> &file)
+  void FtpSession::receiveFile(const std::shared_ptr<WriteableFile> &file, const std::shared_ptr<DataFilter> &filter, const std::shared_ptr<FileHash::UploadHasher> &upload_hasher, const std::shared_ptr<UploadQuota> &upload_quota)
   {
-    auto data_socket = std::make_shared<asio::ip::tcp::socket>(io_context_);
+    auto data_socket = createDataSocket();
 
-    data_acceptor_.async_accept(*data_socket, data_socket_strand_.wrap([data_socket, file, me = shared_from_this()](auto ec)
+    dataAcceptor().async_accept(*data_socket, makeAllocHandler(handler_memory_, data_socket_strand_.wrap([data_socket, file, filter, upload_hasher, upload_quota, me = shared_from_this()](auto ec)
                                                                        {
+                                  if (me->data_socket_weakptr_.lock() != data_socket)
+                                  {
+                                    // The transfer has been aborted by the client
+                                    file->close();
+                                    return;
+                                  }
+
+                                  // The client has connected (or the accept failed), the timeout is over
+                                  me->data_connect_timer_.cancel();
+
                                   if (ec)
                                   {
+                                    me->data_socket_weakptr_.reset();
                                     me->error_ << "Data transfer aborted: " << ec.message() << std::endl;
                                     me->sendFtpMessage(FtpReplyCode::TRANSFER_ABORTED, "Data transfer aborted");
                                     return;
                                   }
 
-                                  me->data_socket_weakptr_ = data_socket;
-                                  me->receiveDataFromSocketAndWriteToFile(file, data_socket); }));
+#ifdef __linux__
+                                  // Data that has to be processed by us cannot bypass user space
+                                  if (me->settings_.splice_uploads_enabled && !filter && !upload_hasher && file->supportsSplice())
+                                  {
+                                    asio::error_code non_blocking_ec;
+                                    data_socket->native_non_blocking(true, non_blocking_ec);
+                                    if (!non_blocking_ec)
+                                    {
+                                      me->spliceDataFromSocketToFile(file, upload_quota, data_socket);
+                                      return;
+                                    }
+                                  }
+#endif // __linux__
+
+                                  me->receiveDataFromSocketAndWriteToFile(file, filter, upload_hasher, upload_quota, data_socket, std::make_shared<std::vector<char>>(), std::make_shared<std::vector<char>>()); })));
   }
 
-  void FtpSession::receiveDataFromSocketAndWriteToFile(const std::shared_ptr<WriteableFile> &file, const std::shared_ptr<asio::ip::tcp::socket> &data_socket)
+  void FtpSession::receiveDataFromSocketAndWriteToFile(const std::shared_ptr<WriteableFile> &file, const std::shared_ptr<DataFilter> &filter, const std::shared_ptr<FileHash::UploadHasher> &upload_hasher, const std::shared_ptr<UploadQuota> &upload_quota, const std::shared_ptr<asio::ip::tcp::socket> &data_socket, const std::shared_ptr<std::vector<char>> &buffer, const std::shared_ptr<std::vector<char>> &spare_buffer)
   {
-    const std::shared_ptr<std::vector<char>> buffer = std::make_shared<std::vector<char>>(1024 * 1024 * 1);
+    // The two buffers take turns: One receives the next chunk, while the
+    // previous chunk is written from the other one. Thus a transfer only
+    // allocates them once.
+    buffer->resize(1024 * 1024 * 1);
 
-    asio::async_read(*data_socket, asio::buffer(*buffer), asio::transfer_at_least(buffer->size()), data_socket_strand_.wrap([me = shared_from_this(), file, data_socket, buffer](asio::error_code ec, std::size_t length)
+    asio::async_read(*data_socket, asio::buffer(*buffer), asio::transfer_at_least(buffer->size()), makeAllocHandler(handler_memory_, data_socket_strand_.wrap([me = shared_from_this(), file, filter, upload_hasher, upload_quota, data_socket, buffer, spare_buffer](asio::error_code ec, std::size_t length)
                                                                                                                             {
                         buffer->resize(length);
-                        if (ec)
-                        {
-                          if (length > 0)
-                          {
-                            me->writeDataToFile(buffer, file);
-                          }
-                          me->endDataReceiving(file, data_socket);
-                          return;
-                        }
-                        else if (length > 0)
-                        {
-                          me->writeDataToFile(buffer, file, [me, file, data_socket]() { me->receiveDataFromSocketAndWriteToFile(file, data_socket); });
-                        } }));
+                        me->writeReceivedDataToFile(file, filter, upload_hasher, upload_quota, data_socket, buffer, spare_buffer, ec);
+                      })));
   }
 
+  void FtpSession::writeReceivedDataToFile(const std::shared_ptr<WriteableFile> &file, const std::shared_ptr<DataFilter> &filter, const std::shared_ptr<FileHash::UploadHasher> &upload_hasher, const std::shared_ptr<UploadQuota> &upload_quota, const std::shared_ptr<asio::ip::tcp::socket> &data_socket, const std::shared_ptr<std::vector<char>> &buffer, const std::shared_ptr<std::vector<char>> &spare_buffer, asio::error_code ec)
+  {
+    if (filter && (!buffer->empty() || filter->hasPendingOutput()) && !filter->process(*buffer, false))
+    {
+      // The data cannot be decoded. There is no point in receiving any more data.
+      endDataReceiving(file, filter, upload_hasher, upload_quota, data_socket, false);
+      return;
+    }
+
+    if (upload_quota && !buffer->empty())
+    {
+      if (static_cast<std::int64_t>(buffer->size()) > upload_quota->available())
+      {
+        // The buffer is not written, so the quota is not exceeded
+        file->close();
+        sendDataReceivedMessage(data_socket, FtpReplyCode::ACTION_NOT_TAKEN_INSUFFICIENT_STORAGE_SPACE, "Quota exceeded");
+        return;
+      }
+      upload_quota->addWrittenBytes(buffer->size());
+    }
+
+    if (upload_hasher && !buffer->empty())
+    {
+      upload_hasher->update(buffer->data(), buffer->size());
+    }
+
+    // The filter returns its output in bounded pieces (e.g. a decompression
+    // bomb), so we fetch the rest of it before receiving more data. Each
+    // piece is handled in a separate handler, so other transfers get their
+    // share of the thread.
+    if (filter && filter->hasPendingOutput() && (!ec || (ec == asio::error::eof)))
+    {
+      writeDataToFile(buffer, file, [me = shared_from_this(), file, filter, upload_hasher, upload_quota, data_socket, buffer, spare_buffer, ec]()
+                      {
+                        asio::post(me->data_socket_strand_, makeAllocHandler(me->handler_memory_, [me, file, filter, upload_hasher, upload_quota, data_socket, buffer, spare_buffer, ec]()
+                                   {
+                                     if (me->data_socket_weakptr_.lock() != data_socket)
+                                     {
+                                       // The transfer has been aborted by the client
+                                       me->endDataReceiving(file, filter, upload_hasher, upload_quota, data_socket, false);
+                                       return;
+                                     }
+                                     spare_buffer->clear();
+                                     me->writeReceivedDataToFile(file, filter, upload_hasher, upload_quota, data_socket, spare_buffer, buffer, ec);
+                                   }));
+                      });
+      return;
+    }
+
+    if (ec)
+    {
+      // The client signals the end of the file by closing the connection (EOF).
+      // Any other error means that we haven't received the complete file.
+      const bool connection_error = (ec != asio::error::eof);
+      if (connection_error)
+      {
+        error_ << "Data transfer aborted: " << ec.message() << std::endl;
+      }
+
+      if (!buffer->empty())
+      {
+        writeDataToFile(buffer, file);
+      }
+      endDataReceiving(file, filter, upload_hasher, upload_quota, data_socket, connection_error);
+      return;
+    }
+
+    writeDataToFile(buffer, file, [me = shared_from_this(), file, filter, upload_hasher, upload_quota, data_socket, buffer, spare_buffer]() { me->receiveDataFromSocketAndWriteToFile(file, filter, upload_hasher, upload_quota, data_socket, spare_buffer, buffer); });
+  }
+
+#ifdef __linux__
+  void FtpSession::spliceDataFromSocketToFile(const std::shared_ptr<WriteableFile> &file, const std::shared_ptr<UploadQuota> &upload_quota, const std::shared_ptr<asio::ip::tcp::socket> &data_socket)
+  {
+    data_socket->async_wait(asio::ip::tcp::socket::wait_read, makeAllocHandler(handler_memory_, data_socket_strand_.wrap([me = shared_from_this(), file, upload_quota, data_socket](asio::error_code ec)
+                            {
+                              if (ec)
+                              {
+                                me->error_ << "Data transfer aborted: " << ec.message() << std::endl;
+                                me->endDataReceiving(file, nullptr, nullptr, upload_quota, data_socket, true);
+                                return;
+                              }
+
+                              // Move at most 1 MiB before waiting again, so other transfers get their share of the thread
+                              std::size_t total_size = 0;
+                              while (total_size < 1024 * 1024)
+                              {
+                                // We don't see the data, so we never move more than the quota allows
+                                std::size_t max_size = 1024 * 1024;
+                                if (upload_quota)
+                                {
+                                  const std::int64_t available = upload_quota->available();
+                                  if (available <= 0)
+                                  {
+                                    file->close();
+                                    me->sendDataReceivedMessage(data_socket, FtpReplyCode::ACTION_NOT_TAKEN_INSUFFICIENT_STORAGE_SPACE, "Quota exceeded");
+                                    return;
+                                  }
+                                  max_size = static_cast<std::size_t>(std::min<std::int64_t>(available, static_cast<std::int64_t>(max_size)));
+                                }
+
+                                const ssize_t size = file->spliceFromSocket(data_socket->native_handle(), max_size);
+                                if (size > 0)
+                                {
+                                  if (upload_quota)
+                                    upload_quota->addWrittenBytes(static_cast<std::uint64_t>(size));
+
+                                  total_size += static_cast<std::size_t>(size);
+                                  continue;
+                                }
+
+                                if (size == 0)
+                                {
+                                  // The client signals the end of the file by closing the connection (EOF)
+                                  me->endDataReceiving(file, nullptr, nullptr, upload_quota, data_socket, false);
+                                  return;
+                                }
+
+                                if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+                                  break;
+
+                                if (errno == EINTR)
+                                  continue;
+
+                                if (!file->good())
+                                {
+                                  // Writing the file has failed. Committing it will fail, too, which sends the error reply.
+                                  me->endDataReceiving(file, nullptr, nullptr, upload_quota, data_socket, false);
+                                }
+                                else
+                                {
+                                  me->error_ << "Data transfer aborted: " << std::strerror(errno) << std::endl;
+                                  me->endDataReceiving(file, nullptr, nullptr, upload_quota, data_socket, true);
+                                }
+                                return;
+                              }
+
+                              me->spliceDataFromSocketToFile(file, upload_quota, data_socket);
+                            })));
+  }
+#endif // __linux__
+
   void FtpSession::writeDataToFile(const std::shared_ptr<std::vector<char>> &data, const std::shared_ptr<WriteableFile> &file, const std::function<void(void)> &fetch_more)
   {
     fetch_more();
     file->write(data->data(), data->size());
   }
 
-  void FtpSession::endDataReceiving(const std::shared_ptr<WriteableFile> &file, const std::shared_ptr<asio::ip::tcp::socket> &data_socket)
+  void FtpSession::endDataReceiving(const std::shared_ptr<WriteableFile> &file, const std::shared_ptr<DataFilter> &filter, const std::shared_ptr<FileHash::UploadHasher> &upload_hasher, const std::shared_ptr<UploadQuota> &upload_quota, const std::shared_ptr<asio::ip::tcp::socket> &data_socket, bool connection_error)
   {
-    asio::post(data_socket_strand_, [me = shared_from_this(), file, data_socket]()
+    asio::post(data_socket_strand_, makeAllocHandler(handler_memory_, [me = shared_from_this(), file, filter, upload_hasher, upload_quota, data_socket, connection_error]()
                {
-                 // Close the file first
-                 file->close();
-                 
-                 // Close the data socket only if it's open
-                 if (data_socket->is_open())
+                 const bool transfer_aborted = (me->data_socket_weakptr_.lock() != data_socket);
+
+                 // Flush the data that the filter may still hold back
+                 bool filter_ok = true;
+                 if (filter && !transfer_aborted && !connection_error)
                  {
-                   asio::error_code ec;
-                   data_socket->shutdown(asio::ip::tcp::socket::shutdown_both, ec);
-                   data_socket->close(ec);
+                   std::vector<char> remaining_data;
+                   do
+                   {
+                     filter_ok = filter->process(remaining_data, true);
+                     if (filter_ok && !remaining_data.empty())
+                     {
+                       if (upload_hasher)
+                       {
+                         upload_hasher->update(remaining_data.data(), remaining_data.size());
+                       }
+                       if (upload_quota)
+                       {
+                         upload_quota->addWrittenBytes(remaining_data.size());
+                       }
+                       file->write(remaining_data.data(), remaining_data.size());
+                     }
+                     remaining_data.clear();
+                   } while (filter_ok && filter->hasPendingOutput());
                  }
-                 
-                 // Clear the weak pointer to the data socket
-                 me->data_socket_weakptr_.reset();
-                 
-                 // Send message after everything is closed
-                 me->sendFtpMessage(FtpReplyCode::CLOSING_DATA_CONNECTION, "Done");
-               });
+
+                 if (transfer_aborted || connection_error || !filter_ok)
+                 {
+                   file->close();
+
+                   if (connection_error)
+                     me->sendDataReceivedMessage(data_socket, FtpReplyCode::TRANSFER_ABORTED, "Data transfer aborted");
+                   else
+                     me->sendDataReceivedMessage(data_socket, FtpReplyCode::ACTION_ABORTED_LOCAL_ERROR, "Data transfer aborted: Error decoding data");
+                   return;
+                 }
+
+                 // Only complete files are committed, which moves atomic uploads
+                 // from their temporary file to the target path. Depending on
+                 // the durability policy, the file is flushed on a worker
+                 // thread first, so the reply is only sent when the data is
+                 // safe on disk.
+                 me->upload_committer_.commit(file, [me, upload_hasher, upload_quota, data_socket](bool file_ok)
+                                              {
+                                                asio::dispatch(me->data_socket_strand_, [me, upload_hasher, upload_quota, data_socket, file_ok]()
+                                                              {
+                                                                if (upload_quota && file_ok)
+                                                                {
+                                                                  upload_quota->committed();
+                                                                }
+
+                                                                // Remember the checksum of the complete file for the HASH command
+                                                                if (upload_hasher && file_ok)
+                                                                {
+                                                                  upload_hasher->commit();
+                                                                }
+
+                                                                if (file_ok)
+                                                                  me->sendDataReceivedMessage(data_socket, FtpReplyCode::CLOSING_DATA_CONNECTION, "Done");
+                                                                else
+                                                                  me->sendDataReceivedMessage(data_socket, FtpReplyCode::ACTION_ABORTED_LOCAL_ERROR, "Data transfer aborted: Error writing file");
+                                                              });
+                                              });
+               }));
+  }
+
+  void FtpSession::receiveTarArchive(const std::shared_ptr<TarExtractor> &tar_extractor, const std::shared_ptr<DataFilter> &filter)
+  {
+    auto data_socket = createDataSocket();
+
+    dataAcceptor().async_accept(*data_socket, makeAllocHandler(handler_memory_, data_socket_strand_.wrap([data_socket, tar_extractor, filter, me = shared_from_this()](auto ec)
+                                {
+                                  if (me->data_socket_weakptr_.lock() != data_socket)
+                                  {
+                                    // The transfer has been aborted by the client
+                                    return;
+                                  }
+
+                                  // The client has connected (or the accept failed), the timeout is over
+                                  me->data_connect_timer_.cancel();
+
+                                  if (ec)
+                                  {
+                                    me->data_socket_weakptr_.reset();
+                                    me->error_ << "Data transfer aborted: " << ec.message() << std::endl;
+                                    me->sendFtpMessage(FtpReplyCode::TRANSFER_ABORTED, "Data transfer aborted");
+                                    return;
+                                  }
+
+                                  me->receiveTarArchiveData(tar_extractor, filter, data_socket, std::make_shared<std::vector<char>>());
+                                })));
   }
 
+  void FtpSession::receiveTarArchiveData(const std::shared_ptr<TarExtractor> &tar_extractor, const std::shared_ptr<DataFilter> &filter, const std::shared_ptr<asio::ip::tcp::socket> &data_socket, const std::shared_ptr<std::vector<char>> &buffer)
+  {
+    // The data is extracted before the next chunk is received, so the buffer is reused for the whole archive
+    buffer->resize(1024 * 1024 * 1);
+
+    asio::async_read(*data_socket, asio::buffer(*buffer), asio::transfer_at_least(buffer->size()), makeAllocHandler(handler_memory_, data_socket_strand_.wrap([me = shared_from_this(), tar_extractor, filter, data_socket, buffer](asio::error_code ec, std::size_t length)
+                     {
+                       buffer->resize(length);
+                       me->extractReceivedTarArchiveData(tar_extractor, filter, data_socket, buffer, ec);
+                     })));
+  }
+
+  void FtpSession::extractReceivedTarArchiveData(const std::shared_ptr<TarExtractor> &tar_extractor, const std::shared_ptr<DataFilter> &filter, const std::shared_ptr<asio::ip::tcp::socket> &data_socket, const std::shared_ptr<std::vector<char>> &buffer, asio::error_code ec)
+  {
+    if (data_socket_weakptr_.lock() != data_socket)
+    {
+      // The transfer has been aborted by the client. Files that have been extracted completely are kept.
+      return;
+    }
+
+    // A corrupt archive cannot be extracted any further, so there is no point in receiving more data
+    if ((filter && (!buffer->empty() || filter->hasPendingOutput()) && !filter->process(*buffer, false))
+        || !tar_extractor->process(buffer->data(), buffer->size()))
+    {
+      endTarArchiveReceiving(tar_extractor, filter, data_socket, false);
+      return;
+    }
+
+    // Fetch the rest of the filter's output piece by piece before receiving more data, see writeReceivedDataToFile()
+    if (filter && filter->hasPendingOutput() && (!ec || (ec == asio::error::eof)))
+    {
+      buffer->clear();
+      asio::post(data_socket_strand_, makeAllocHandler(handler_memory_, [me = shared_from_this(), tar_extractor, filter, data_socket, buffer, ec]()
+                 {
+                   me->extractReceivedTarArchiveData(tar_extractor, filter, data_socket, buffer, ec);
+                 }));
+      return;
+    }
+
+    if (ec)
+    {
+      // The client signals the end of the archive by closing the connection (EOF)
+      const bool connection_error = (ec != asio::error::eof);
+      if (connection_error)
+      {
+        error_ << "Data transfer aborted: " << ec.message() << std::endl;
+      }
+      endTarArchiveReceiving(tar_extractor, filter, data_socket, connection_error);
+      return;
+    }
+
+    receiveTarArchiveData(tar_extractor, filter, data_socket, buffer);
+  }
+
+  void FtpSession::endTarArchiveReceiving(const std::shared_ptr<TarExtractor> &tar_extractor, const std::shared_ptr<DataFilter> &filter, const std::shared_ptr<asio::ip::tcp::socket> &data_socket, bool connection_error)
+  {
+    if (connection_error)
+    {
+      sendDataReceivedMessage(data_socket, FtpReplyCode::TRANSFER_ABORTED, "Data transfer aborted");
+      return;
+    }
+
+    // Extract the data that the filter may still hold back
+    if (filter)
+    {
+      std::vector<char> remaining_data;
+      do
+      {
+        if (!filter->process(remaining_data, true))
+        {
+          sendDataReceivedMessage(data_socket, FtpReplyCode::ACTION_ABORTED_LOCAL_ERROR, "Data transfer aborted: Error decoding data");
+          return;
+        }
+        tar_extractor->process(remaining_data.data(), remaining_data.size());
+        remaining_data.clear();
+      } while (filter->hasPendingOutput());
+    }
+
+    if (!tar_extractor->finish())
+    {
+      sendDataReceivedMessage(data_socket, FtpReplyCode::ACTION_ABORTED_LOCAL_ERROR, "Data transfer aborted: " + tar_extractor->errorMessage());
+      return;
+    }
+
+    const std::string summary = std::to_string(tar_extractor->extractedFiles()) + " files and "
+                              + std::to_string(tar_extractor->extractedDirectories()) + " directories extracted";
+
+    if (tar_extractor->rejectedEntries() > 0)
+      sendDataReceivedMessage(data_socket, FtpReplyCode::ACTION_ABORTED_LOCAL_ERROR, "Extraction incomplete: " + summary + ", " + std::to_string(tar_extractor->rejectedEntries()) + " entries rejected");
+    else
+      sendDataReceivedMessage(data_socket, FtpReplyCode::CLOSING_DATA_CONNECTION, "Done: " + summary);
+  }
+
+  void FtpSession::sendDataReceivedMessage(const std::shared_ptr<asio::ip::tcp::socket> &data_socket, FtpReplyCode reply_code, const std::string &message)
+  {
+    // Close the data socket only if it's open
+    if (data_socket->is_open())
+    {
+      asio::error_code ec;
+      data_socket->shutdown(asio::ip::tcp::socket::shutdown_both, ec);
+      data_socket->close(ec);
+    }
+
+    // If the transfer has been aborted by the client, the ABOR command has
+    // already sent the reply.
+    if (data_socket_weakptr_.lock() != data_socket)
+    {
+      return;
+    }
+
+    // Clear the weak pointer to the data socket
+    data_socket_weakptr_.reset();
+
+    // Send message after everything is closed
+    sendFtpMessage(reply_code, message);
+  }
+
+
   ////////////////////////////////////////////////////////
   // Helpers
   ////////////////////////////////////////////////////////
@@ -1557,6 +3000,11 @@ namespace fineftp
     return fineftp::Filesystem::cleanPathNative(logged_in_user_->local_root_path_ + "/" + absolute_ftp_path);
   }
 
+  bool FtpSession::isBeneathRoot(const std::string &local_path) const
+  {
+    return (!root_directory_ || root_directory_->isBeneath(local_path));
+  }
+
   std::string FtpSession::createQuotedFtpPath(const std::string &unquoted_ftp_path)
   {
     std::string output;
@@ -1575,6 +3023,127 @@ namespace fineftp
     return output;
   }
 
+  std::string FtpSession::createTempUploadPath(const std::string &local_path)
+  {
+    // A process-wide counter makes the name unique within this process, the
+    // random part makes it unique across processes that serve the same directory.
+    static std::atomic<std::uint64_t> upload_counter(0);
+    static const std::uint32_t        process_id = std::random_device{}();
+
+#ifdef WIN32
+    const size_t separator_pos = local_path.find_last_of("/\\");
+#else
+    const size_t separator_pos = local_path.find_last_of('/');
+#endif // WIN32
+
+    const std::string directory = (separator_pos == std::string::npos ? std::string() : local_path.substr(0, separator_pos + 1));
+    const std::string filename  = (separator_pos == std::string::npos ? local_path : local_path.substr(separator_pos + 1));
+
+    std::stringstream ss;
+    ss << directory << "." << filename << ".fineftp-upload-" << std::hex << process_id << "-" << upload_counter++;
+    return ss.str();
+  }
+
+  bool FtpSession::hasSpaceForAllocation(const std::string &local_path, std::int64_t replaced_size) const
+  {
+    if (allocation_size_ == 0)
+      return true;
+
+    std::uint64_t available_space = 0;
+    if (!Filesystem::availableSpace(local_path, available_space))
+      return true;
+
+    return (available_space + static_cast<std::uint64_t>(std::max<std::int64_t>(0, replaced_size)) >= allocation_size_);
+  }
+
+  std::shared_ptr<DataFilter> FtpSession::createSendFilter(const std::string &local_path) const
+  {
+    // Line endings are converted before compressing the data
+    std::shared_ptr<DataFilter> ascii_filter;
+    if (!data_type_binary_ && !local_path.empty())
+    {
+      // The converted size of the whole file answers the SIZE command in ASCII mode
+      ascii_filter = std::make_shared<AsciiEncodeFilter>(FileHash::asciiTransferSizeRecorder(local_path));
+    }
+
+#if FINEFTP_SERVER_MODE_Z
+    if (transfer_mode_z_)
+    {
+      // Compressing a file that is compressed already is a waste of CPU time.
+      // MODE Z still requires a deflate stream, so we only store the data.
+      const int level = (isCompressedFileFormat(local_path) ? 0 : mode_z_level_);
+      auto deflate_filter = std::make_shared<DeflateFilter>(level);
+
+      if (ascii_filter)
+        return std::make_shared<DataFilterChain>(ascii_filter, deflate_filter);
+      else
+        return deflate_filter;
+    }
+#endif // FINEFTP_SERVER_MODE_Z
+
+    return ascii_filter;
+  }
+
+  std::shared_ptr<DataFilter> FtpSession::createReceiveFilter(bool binary_data) const
+  {
+    // Line endings are converted after decompressing the data
+    std::shared_ptr<DataFilter> ascii_filter;
+    if (!data_type_binary_ && !binary_data)
+    {
+      ascii_filter = std::make_shared<AsciiDecodeFilter>();
+    }
+
+#if FINEFTP_SERVER_MODE_Z
+    if (transfer_mode_z_)
+    {
+      auto inflate_filter = std::make_shared<InflateFilter>();
+
+      if (ascii_filter)
+        return std::make_shared<DataFilterChain>(inflate_filter, ascii_filter);
+      else
+        return inflate_filter;
+    }
+#endif // FINEFTP_SERVER_MODE_Z
+
+    return ascii_filter;
+  }
+
+  std::shared_ptr<FileHash::UploadHasher> FtpSession::createUploadHasher(const std::string &local_path) const
+  {
+    if (!settings_.upload_checksums_enabled)
+    {
+      return nullptr;
+    }
+
+    // We compute the checksum that the client would get from the HASH command
+    return std::make_shared<FileHash::UploadHasher>(local_path, hash_algorithm_);
+  }
+
+  FtpMessage FtpSession::checkIfPathIsCopyable(const std::string &ftp_path) const
+  {
+    if (!logged_in_user_)
+      return FtpMessage(FtpReplyCode::NOT_LOGGED_IN, "Not logged in");
+
+    if (ftp_path.empty())
+      return FtpMessage(FtpReplyCode::SYNTAX_ERROR_PARAMETERS, "Empty path");
+
+    const std::string local_path = toLocalPath(ftp_path);
+    if (!isBeneathRoot(local_path))
+      return FtpMessage(FtpReplyCode::ACTION_NOT_TAKEN, "Permission denied");
+
+    auto file_status = Filesystem::FileStatus(local_path);
+    if (!file_status.isOk())
+      return FtpMessage(FtpReplyCode::ACTION_NOT_TAKEN, "File does not exist");
+
+    if (file_status.type() != Filesystem::FileType::RegularFile)
+      return FtpMessage(FtpReplyCode::ACTION_NOT_TAKEN, "Only regular files can be copied");
+
+    if (static_cast<int>(logged_in_user_->permissions_ & Permission::FileRead) == 0)
+      return FtpMessage(FtpReplyCode::ACTION_NOT_TAKEN, "Permission denied");
+
+    return FtpMessage(FtpReplyCode::COMMAND_OK, "");
+  }
+
   FtpMessage FtpSession::checkIfPathIsRenamable(const std::string &ftp_path) const
   {
     if (!logged_in_user_)
@@ -1582,8 +3151,12 @@ namespace fineftp
 
     if (!ftp_path.empty())
     {
+      const std::string local_path = toLocalPath(ftp_path);
+      if (!isBeneathRoot(local_path))
+        return FtpMessage(FtpReplyCode::ACTION_NOT_TAKEN, "Permission denied");
+
       // Is the given path a file or a directory?
-      auto file_status = Filesystem::FileStatus(toLocalPath(ftp_path));
+      auto file_status = Filesystem::FileStatus(local_path);
 
       if (file_status.isOk())
       {
@@ -1647,6 +3220,11 @@ namespace fineftp
     }
 
     auto local_path = toLocalPath(absolute_new_working_dir);
+    if (!isBeneathRoot(local_path))
+    {
+      return FtpMessage(FtpReplyCode::ACTION_NOT_TAKEN, "Permission denied");
+    }
+
     const Filesystem::FileStatus file_status(local_path);
 
     if (!file_status.isOk())
@@ -1665,6 +3243,63 @@ namespace fineftp
     return FtpMessage(FtpReplyCode::FILE_ACTION_COMPLETED, "Working directory changed to " + ftp_working_directory_);
   }
 
+  void FtpSession::computeFileHash(const std::string &ftp_path, HashAlgorithm algorithm, const std::function<void(const FileHash::Result &)> &completion_handler)
+  {
+    if (!logged_in_user_)
+    {
+      sendFtpMessage(FtpReplyCode::NOT_LOGGED_IN, "Not logged in");
+      return;
+    }
+    if (static_cast<int>(logged_in_user_->permissions_ & Permission::FileRead) == 0)
+    {
+      sendFtpMessage(FtpReplyCode::ACTION_NOT_TAKEN, "Permission denied");
+      return;
+    }
+    if (ftp_path.empty())
+    {
+      sendFtpMessage(FtpReplyCode::SYNTAX_ERROR_PARAMETERS, "No path given");
+      return;
+    }
+
+    const std::string   local_path  = toLocalPath(ftp_path);
+    if (!isBeneathRoot(local_path))
+    {
+      sendFtpMessage(FtpReplyCode::ACTION_NOT_TAKEN, "Permission denied");
+      return;
+    }
+    const std::uint64_t range_start = range_start_;
+    const std::uint64_t range_end   = range_end_;
+
+    // The range only applies to the next checksum command
+    range_start_ = 0;
+    range_end_   = FileHash::end_of_file;
+
+    // Hashing large files takes a while, so we must not block the io_context
+    suspendCommandReading();
+    asio::post(worker_pool_, [me = shared_from_this(), local_path, algorithm, range_start, range_end, completion_handler]()
+               {
+                 const FileHash::Result result = FileHash::hashFile(local_path, algorithm, range_start, range_end);
+
+                 asio::post(me->command_strand_, makeAllocHandler(me->handler_memory_, [me, result, completion_handler]()
+                            {
+                              switch (result.status)
+                              {
+                              case FileHash::Status::Ok:
+                                completion_handler(result);
+                                break;
+                              case FileHash::Status::InvalidRange:
+                                me->sendFtpMessage(FtpReplyCode::SYNTAX_ERROR_PARAMETERS, "Invalid range");
+                                break;
+                              case FileHash::Status::FileError:
+                              default:
+                                me->sendFtpMessage(FtpReplyCode::ACTION_NOT_TAKEN, "Error opening file for checksum computation");
+                                break;
+                              }
+                              me->resumeCommandReading();
+                            }));
+               });
+  }
+
 #ifdef WIN32
   std::string FtpSession::GetLastErrorStr()
   {
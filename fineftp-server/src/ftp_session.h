@@ -2,7 +2,8 @@
 
 #include <asio.hpp> // IWYU pragma: keep
 
-#include <deque>
+#include <cstdint>
+#include <list>
 #include <functional>
 #include <map>
 #include <memory>
@@ -12,8 +13,20 @@
 #include "ftp_message.h"
 #include <fineftp/callback_types.h>
 
+#include "admission_control.h"
+#include "data_filter.h"
+#include "file_hash.h"
 #include "filesystem.h"
-#include "user_database.h"
+#include "handler_memory.h"
+#include "hasher.h"
+#include "password_verifier.h"
+#include "root_directory.h"
+#include "server_settings.h"
+#include "storage_quota.h"
+#include "tar_extractor.h"
+#include "tar_writer.h"
+#include "timer_wheel.h"
+#include "upload_committer.h"
 #include "ftp_user.h"
 
 #ifdef WIN32
@@ -33,7 +46,7 @@ namespace fineftp
     // Public API
     ////////////////////////////////////////////////////////
   public:
-    FtpSession(asio::io_context &io_context, const UserDatabase &user_database, const std::function<void()> &completion_handler, std::ostream &output, std::ostream &error);
+    FtpSession(asio::io_context &io_context, asio::ip::tcp::socket command_socket, asio::thread_pool &worker_pool, UploadCommitter &upload_committer, PasswordVerifier &password_verifier, QuotaManager &quota_manager, AdmissionControl &admission_control, const std::shared_ptr<TimerWheel> &timer_wheel, const ServerSettings &settings, const std::function<void()> &completion_handler, std::ostream &output, std::ostream &error);
 
     // Copy (disabled, as we are inheriting from shared_from_this)
     FtpSession(const FtpSession &) = delete;
@@ -58,11 +71,32 @@ namespace fineftp
     void sendFtpMessage(const FtpMessage &message);
     void sendFtpMessage(FtpReplyCode code, const std::string &message);
     void sendRawFtpMessage(const std::string &raw_message);
+    void sendFinalFtpMessage(FtpReplyCode code, const std::string &message);
+    void closeCommandSocket();
     void startSendingMessages();
     void readFtpCommand();
 
     void handleFtpCommand(const std::string &command);
 
+    // Commands that reply asynchronously (e.g. from the worker pool) suspend
+    // reading further commands until their reply has been queued, so the
+    // replies of pipelined commands keep their order.
+    void suspendCommandReading();
+    void resumeCommandReading();
+
+    ////////////////////////////////////////////////////////
+    // Timeouts
+    ////////////////////////////////////////////////////////
+  private:
+    // The control timer runs the login timeout until the user has logged in and the idle timeout afterwards
+    void restartIdleTimeout();
+    void restartDataConnectTimeout();
+
+    // Called on the command_strand_ when the timers have expired. Stale expiries
+    // of a timer that has been restarted in the meantime are ignored.
+    void handleControlTimeout(std::uint64_t generation);
+    void handleDataConnectTimeout(std::uint64_t generation);
+
     ////////////////////////////////////////////////////////
     // FTP Commands
     ////////////////////////////////////////////////////////
@@ -86,6 +120,8 @@ namespace fineftp
     // Ftp service commands
     void handleFtpCommandRETR(const std::string &param);
     void handleFtpCommandSIZE(const std::string &param);
+    void handleFtpCommandMDTM(const std::string &param);
+    void handleFtpCommandMFMT(const std::string &param);
     void handleFtpCommandSTOR(const std::string &param);
     void handleFtpCommandSTOU(const std::string &param);
     void handleFtpCommandAPPE(const std::string &param);
@@ -111,14 +147,36 @@ namespace fineftp
 
     void handleFtpCommandOPTS(const std::string &param);
 
+    // Checksum commands
+    void handleFtpCommandHASH(const std::string &param);
+    void handleFtpCommandRANG(const std::string &param);
+    void handleFtpCommandXCRC(const std::string &param);
+    void handleFtpCommandXMD5(const std::string &param);
+    void handleFtpCommandXSHA1(const std::string &param);
+    void handleFtpCommandXSHA256(const std::string &param);
+
+    // Logs out the current user (if any) and releases its session count
+    void logoutUser();
+
     ////////////////////////////////////////////////////////
     // FTP data-socket send
     ////////////////////////////////////////////////////////
   private:
-    void sendDirectoryListing(const std::map<std::string, Filesystem::FileStatus> &directory_content);
-    void sendNameList(const std::map<std::string, Filesystem::FileStatus> &directory_content);
+    std::shared_ptr<asio::ip::tcp::socket> createDataSocket();
+
+    void sendDirectoryListing(const std::map<std::string, Filesystem::FileStatus> &directory_content, const std::shared_ptr<DataFilter> &filter);
+    void sendNameList(const std::map<std::string, Filesystem::FileStatus> &directory_content, const std::shared_ptr<DataFilter> &filter);
 
-    void sendFile(const std::shared_ptr<ReadableFile> &file);
+    void sendFile(const std::shared_ptr<ReadableFile> &file, const std::shared_ptr<DataFilter> &filter);
+
+    void sendFileChunk(const std::shared_ptr<ReadableFile> &file, std::size_t offset, const std::shared_ptr<DataFilter> &filter, const std::shared_ptr<asio::ip::tcp::socket> &data_socket);
+
+    void sendFileSentMessage();
+
+    // Sends a tar archive of a directory that is generated while sending, see TarWriter
+    void sendTarArchive(const std::shared_ptr<TarWriter> &tar_writer, const std::shared_ptr<DataFilter> &filter);
+
+    void sendTarArchiveChunk(const std::shared_ptr<TarWriter> &tar_writer, const std::shared_ptr<DataFilter> &filter, const std::shared_ptr<asio::ip::tcp::socket> &data_socket);
 
     void addDataToBufferAndSend(const std::shared_ptr<std::vector<char>> &data, const std::shared_ptr<asio::ip::tcp::socket> &data_socket);
 
@@ -128,23 +186,100 @@ namespace fineftp
     // FTP data-socket receive
     ////////////////////////////////////////////////////////
   private:
-    void receiveFile(const std::shared_ptr<WriteableFile> &file);
+    void receiveFile(const std::shared_ptr<WriteableFile> &file, const std::shared_ptr<DataFilter> &filter, const std::shared_ptr<FileHash::UploadHasher> &upload_hasher, const std::shared_ptr<UploadQuota> &upload_quota);
 
-    void receiveDataFromSocketAndWriteToFile(const std::shared_ptr<WriteableFile> &file, const std::shared_ptr<asio::ip::tcp::socket> &data_socket);
+    void receiveDataFromSocketAndWriteToFile(const std::shared_ptr<WriteableFile> &file, const std::shared_ptr<DataFilter> &filter, const std::shared_ptr<FileHash::UploadHasher> &upload_hasher, const std::shared_ptr<UploadQuota> &upload_quota, const std::shared_ptr<asio::ip::tcp::socket> &data_socket, const std::shared_ptr<std::vector<char>> &buffer, const std::shared_ptr<std::vector<char>> &spare_buffer);
+
+    void writeReceivedDataToFile(const std::shared_ptr<WriteableFile> &file, const std::shared_ptr<DataFilter> &filter, const std::shared_ptr<FileHash::UploadHasher> &upload_hasher, const std::shared_ptr<UploadQuota> &upload_quota, const std::shared_ptr<asio::ip::tcp::socket> &data_socket, const std::shared_ptr<std::vector<char>> &buffer, const std::shared_ptr<std::vector<char>> &spare_buffer, asio::error_code ec);
+
+#ifdef __linux__
+    void spliceDataFromSocketToFile(const std::shared_ptr<WriteableFile> &file, const std::shared_ptr<UploadQuota> &upload_quota, const std::shared_ptr<asio::ip::tcp::socket> &data_socket);
+#endif // __linux__
 
     void writeDataToFile(const std::shared_ptr<std::vector<char>> &data, const std::shared_ptr<WriteableFile> &file, const std::function<void(void)> &fetch_more = []()
                                                                                                                      { return; });
 
-    void endDataReceiving(const std::shared_ptr<WriteableFile> &file, const std::shared_ptr<asio::ip::tcp::socket> &data_socket);
+    void endDataReceiving(const std::shared_ptr<WriteableFile> &file, const std::shared_ptr<DataFilter> &filter, const std::shared_ptr<FileHash::UploadHasher> &upload_hasher, const std::shared_ptr<UploadQuota> &upload_quota, const std::shared_ptr<asio::ip::tcp::socket> &data_socket, bool connection_error);
+
+    // Receives a tar archive and extracts it while receiving, see TarExtractor
+    void receiveTarArchive(const std::shared_ptr<TarExtractor> &tar_extractor, const std::shared_ptr<DataFilter> &filter);
+
+    void receiveTarArchiveData(const std::shared_ptr<TarExtractor> &tar_extractor, const std::shared_ptr<DataFilter> &filter, const std::shared_ptr<asio::ip::tcp::socket> &data_socket, const std::shared_ptr<std::vector<char>> &buffer);
+
+    void extractReceivedTarArchiveData(const std::shared_ptr<TarExtractor> &tar_extractor, const std::shared_ptr<DataFilter> &filter, const std::shared_ptr<asio::ip::tcp::socket> &data_socket, const std::shared_ptr<std::vector<char>> &buffer, asio::error_code ec);
+
+    void endTarArchiveReceiving(const std::shared_ptr<TarExtractor> &tar_extractor, const std::shared_ptr<DataFilter> &filter, const std::shared_ptr<asio::ip::tcp::socket> &data_socket, bool connection_error);
+
+    // Closes the data socket and sends the reply, unless the transfer has been aborted. Must be called from the data_socket_strand_.
+    void sendDataReceivedMessage(const std::shared_ptr<asio::ip::tcp::socket> &data_socket, FtpReplyCode reply_code, const std::string &message);
 
     ////////////////////////////////////////////////////////
     // Helpers
     ////////////////////////////////////////////////////////
   private:
+    bool isDataAcceptorOpen() const;
+    asio::ip::tcp::acceptor &dataAcceptor();
+
     std::string toAbsoluteFtpPath(const std::string &rel_or_abs_ftp_path) const;
     std::string toLocalPath(const std::string &ftp_path) const;
+
+    // Returns false if the local path leads out of the user's root directory through a symlink. Always true if paths are not confined.
+    // Best-effort only, as the path is resolved again when it is accessed (see RootDirectory).
+    bool isBeneathRoot(const std::string &local_path) const;
     static std::string createQuotedFtpPath(const std::string &unquoted_ftp_path);
 
+    /**
+     * @brief Creates a unique name for the hidden temporary file of an atomic upload
+     *
+     * The temporary file is located in the same directory as the target file,
+     * so it can be renamed atomically.
+     *
+     * @param local_path: The target file of the upload
+     *
+     * @return The path of the temporary file
+     */
+    static std::string createTempUploadPath(const std::string &local_path);
+
+    /**
+     * @brief Checks whether the disk can hold the size announced by ALLO before the target file is touched
+     *
+     * The file can only be preallocated once it has been opened, which
+     * truncates it. If that fails, the file is lost already.
+     *
+     * @param local_path:    The target file of the upload
+     * @param replaced_size: The size that is freed when the target file is opened
+     *
+     * @return False if there is not enough space. True if there is, or if the space cannot be determined.
+     */
+    bool hasSpaceForAllocation(const std::string &local_path, std::int64_t replaced_size) const;
+
+    /**
+     * @brief Creates the filter for sending data in the current transfer mode and type
+     *
+     * @param local_path: The file that will be sent. Empty for directory listings, which always use CRLF line endings.
+     *
+     * @return The filter or nullptr, if the data is sent as-is (MODE S, TYPE I).
+     */
+    std::shared_ptr<DataFilter> createSendFilter(const std::string &local_path) const;
+
+    /**
+     * @brief Creates the filter for receiving data in the current transfer mode and type
+     *
+     * @param binary_data: The data is binary regardless of the TYPE (e.g. an archive), so line endings are not converted
+     *
+     * @return The filter or nullptr, if the data is received as-is (MODE S, TYPE I).
+     */
+    std::shared_ptr<DataFilter> createReceiveFilter(bool binary_data = false) const;
+
+    /**
+     * @brief Creates the hasher that computes the checksum of an upload on the fly
+     *
+     * @param local_path: The file that will be written
+     *
+     * @return The hasher or nullptr, if upload checksums are disabled.
+     */
+    std::shared_ptr<FileHash::UploadHasher> createUploadHasher(const std::string &local_path) const;
+
     /** @brief Checks if a path is renamable
      *
      * Checks if the current user can rename the given path. A path is renameable
@@ -157,8 +292,34 @@ namespace fineftp
      */
     FtpMessage checkIfPathIsRenamable(const std::string &ftp_path) const;
 
+    /**
+     * @brief Checks if the given path can be copied by SITE CPFR / CPTO
+     *
+     * A path is copyable if it is an existing regular file and the user has
+     * the permission to read it.
+     *
+     * @param ftp_path: The source path
+     *
+     * @return (COMMAND_OK, "") if the path can be copied or any other meaningfull error message if not.
+     */
+    FtpMessage checkIfPathIsCopyable(const std::string &ftp_path) const;
+
     FtpMessage executeCWD(const std::string &param);
 
+    /**
+     * @brief Computes the checksum of a file in the background
+     *
+     * The checksum is computed on the worker pool over the range set by RANG
+     * (or the whole file). The RANG range is reset afterwards. Errors are
+     * replied to the client directly, the completion handler is only called
+     * (in the command_strand_) if the checksum has been computed successfully.
+     *
+     * @param ftp_path:           The file to compute the checksum for
+     * @param algorithm:          The checksum algorithm
+     * @param completion_handler: Sends the reply with the checksum
+     */
+    void computeFileHash(const std::string &ftp_path, HashAlgorithm algorithm, const std::function<void(const FileHash::Result &)> &completion_handler);
+
 #ifdef WIN32
     /**
      * @brief Returns Windows' GetLastError() as human readable string
@@ -175,37 +336,71 @@ namespace fineftp
     const std::function<void()> completion_handler_;
 
     // User management
-    const UserDatabase &user_database_;
+    PasswordVerifier &password_verifier_;
     std::shared_ptr<FtpUser> logged_in_user_;
+    std::shared_ptr<const RootDirectory> root_directory_;   // Only set if paths are confined to the root directory
+
+    const ServerSettings &settings_;
 
     // "Global" io service
     asio::io_context &io_context_;
 
+    // Worker threads for long running tasks
+    asio::thread_pool &worker_pool_;
+
+    // Flushes and closes uploaded files according to the durability policy
+    UploadCommitter &upload_committer_;
+
+    // Storage quotas of the local root directories
+    QuotaManager &quota_manager_;
+
+    // Session limits of the server. The session has been admitted already, the user is admitted at login.
+    AdmissionControl &admission_control_;
+
     // Command Socket.
-    // Note that the command_strand_ is used to serialize access to all of the 9 member variables following it.
+    // Note that the command_strand_ is used to serialize access to all of the 17 member variables following it.
     asio::io_context::strand command_strand_;
     asio::ip::tcp::socket command_socket_;
     asio::streambuf command_input_stream_;
-    std::deque<std::string> command_output_queue_;
+    std::list<std::string> command_output_queue_;   // A list doesn't allocate anything while it is empty, which it is for idle sessions
 
     std::string last_command_;
     std::string rename_from_path_;
+    std::string copy_from_path_;    // Source path set by SITE CPFR
     std::string username_for_login_;
     bool data_type_binary_;
+    bool transfer_mode_z_;      // MODE Z (deflate compressed transfers)
+    int  mode_z_level_;         // Compression level for MODE Z, may be changed by OPTS MODE Z LEVEL
     bool shutdown_requested_; // Set to true when the client sends a QUIT command.
+    bool close_after_sending_;  // Set on the command_strand_ once the final reply has been queued
+    bool command_reading_suspended_; // Set while a command waits for its asynchronous reply
+    HashAlgorithm hash_algorithm_;  // Algorithm for the HASH command, may be changed by OPTS HASH
+    std::uint64_t range_start_;     // Byte range set by the RANG command (range_end_ is exclusive)
+    std::uint64_t range_end_;
+    std::uint64_t allocation_size_; // Size announced by ALLO for the next upload, 0 if none
 
     // Current state
     std::string ftp_working_directory_;
 
-    // Data Socket (=> passive mode)
-    asio::ip::tcp::acceptor data_acceptor_;
+    // Data Socket (=> passive mode). Created on demand, see dataAcceptor().
+    std::unique_ptr<asio::ip::tcp::acceptor> data_acceptor_;
 
     // Note that the data_socket_strand_ is used to serialize access to the 2 member variables following it.
+    // The data_socket_weakptr_ refers to the socket of the current transfer. Completion
+    // handlers only send a reply to the client if their socket is still registered there,
+    // otherwise the transfer has been aborted and the ABOR command has replied already.
     asio::io_context::strand data_socket_strand_;
     std::weak_ptr<asio::ip::tcp::socket> data_socket_weakptr_;
-    std::deque<std::shared_ptr<std::vector<char>>> data_buffer_;
+    std::list<std::shared_ptr<std::vector<char>>> data_buffer_;
+
+    std::unique_ptr<asio::steady_timer> timer_;   // Delays the 226 reply, created on first use
+
+    // Timeouts in the TimerWheel of the server. Unlike the timer_ above, they don't cost an operation in the io_context while they are restarted.
+    TimerWheel::Timer control_timer_;        // Login and idle timeout
+    TimerWheel::Timer data_connect_timer_;   // Time the client has to connect to the data acceptor
 
-    asio::steady_timer timer_;
+    // Memory for the asynchronous operations of the command and data path
+    HandlerMemory handler_memory_;
 
     std::ostream &output_; /* Normal output log */
     std::ostream &error_;  /* Error output log */
@@ -1,8 +1,11 @@
 #pragma once
 
 #include <fineftp/permissions.h>
+#include <memory>
 #include <string>
 
+#include "password_hash.h"
+
 namespace fineftp
 {
   struct FtpUser
@@ -13,8 +16,15 @@ namespace fineftp
       , permissions_    (permissions)
     {}
 
-    const std::string password_;
-    const std::string local_root_path_;
+    FtpUser(const std::shared_ptr<const PasswordHash>& password_hash, const std::string& local_root_path, const Permission permissions)
+      : password_hash_  (password_hash)
+      , local_root_path_(local_root_path)
+      , permissions_    (permissions)
+    {}
+
+    const std::string                         password_;        // Plaintext password, if the user has no password_hash_
+    const std::shared_ptr<const PasswordHash> password_hash_;
+    const std::string                         local_root_path_;
     const Permission permissions_;
   };
-}
\ No newline at end of file
+}
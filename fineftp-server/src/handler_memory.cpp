@@ -0,0 +1,45 @@
+#include "handler_memory.h"
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+
+namespace fineftp
+{
+  HandlerMemory::HandlerMemory()
+    : fallback_allocations_(0)
+  {
+    for (auto& in_use : in_use_)
+      in_use.store(false, std::memory_order_relaxed);
+  }
+
+  void* HandlerMemory::allocate(std::size_t size)
+  {
+    if (size <= slot_size)
+    {
+      for (std::size_t i = 0; i < slot_count; i++)
+      {
+        bool expected = false;
+        if (in_use_[i].compare_exchange_strong(expected, true, std::memory_order_acquire, std::memory_order_relaxed))
+          return slots_[i].storage;
+      }
+    }
+
+    fallback_allocations_.fetch_add(1, std::memory_order_relaxed);
+    return ::operator new(size);
+  }
+
+  void HandlerMemory::deallocate(void* pointer)
+  {
+    for (std::size_t i = 0; i < slot_count; i++)
+    {
+      if (pointer == slots_[i].storage)
+      {
+        in_use_[i].store(false, std::memory_order_release);
+        return;
+      }
+    }
+
+    ::operator delete(pointer);
+  }
+}
@@ -0,0 +1,198 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include <asio.hpp> // IWYU pragma: keep
+
+namespace fineftp
+{
+  /**
+   * @brief Recycled memory for the completion handlers of one session
+   *
+   * asio allocates the memory of each asynchronous operation (and of each
+   * posted handler) from the allocator that is associated with its
+   * completion handler. A session only has a few operations in flight at
+   * any time, so it owns a HandlerMemory with a few fixed-size slots that
+   * are used over and over again. Thus a NOOP loop or a long transfer
+   * doesn't allocate any memory for its handlers. Handlers that are larger
+   * than a slot or that are allocated while all slots are in use fall back
+   * to the heap.
+   *
+   * The memory of an operation is freed right before its handler is
+   * dispatched to the strand, i.e. maybe on another thread than the one
+   * that allocated it, so the slots are managed with atomics.
+   *
+   * The HandlerMemory must outlive all operations that use it. Each handler
+   * of a session keeps the session alive, so this is guaranteed for a
+   * member of the session.
+   *
+   * Only the outermost handler of an operation is covered. A handler that
+   * is wrapped with strand::wrap() is dispatched to the strand by a second,
+   * internal operation. That operation is allocated for the inner handler,
+   * which has no allocator of its own, so it comes from asio's default
+   * allocator (which recycles small blocks per thread). Posts to the worker
+   * pool are not wrapped at all. They are issued once per command (e.g.
+   * for checksums or copies), not once per buffer, and run on threads that
+   * don't belong to the io_context.
+   */
+  class HandlerMemory
+  {
+  public:
+    HandlerMemory();
+
+    // Copy and move disabled, as the operations refer to the slots
+    HandlerMemory(const HandlerMemory&)            = delete;
+    HandlerMemory& operator=(const HandlerMemory&) = delete;
+    HandlerMemory(HandlerMemory&&)                 = delete;
+    HandlerMemory& operator=(HandlerMemory&&)      = delete;
+
+    ~HandlerMemory() = default;
+
+    void* allocate(std::size_t size);
+    void  deallocate(void* pointer);
+
+    // Number of allocations that did not get a slot and came from the heap
+    std::size_t fallbackAllocations() const { return fallback_allocations_.load(std::memory_order_relaxed); }
+
+  private:
+    static constexpr std::size_t slot_size  = 320;
+    static constexpr std::size_t slot_count = 3;
+
+    struct Slot
+    {
+      alignas(std::max_align_t) unsigned char storage[slot_size];
+    };
+
+    std::array<Slot, slot_count>              slots_;
+    std::array<std::atomic<bool>, slot_count> in_use_;
+    std::atomic<std::size_t>                  fallback_allocations_;
+  };
+
+  /**
+   * @brief Allocator that takes its memory from a HandlerMemory
+   */
+  template <typename T>
+  class HandlerAllocator
+  {
+  public:
+    using value_type = T;
+
+    explicit HandlerAllocator(HandlerMemory& memory)
+      : memory_(&memory)
+    {}
+
+    template <typename U>
+    HandlerAllocator(const HandlerAllocator<U>& other) noexcept // NOLINT(google-explicit-constructor) Reason: Allocators must be implicitly convertible after being rebound
+      : memory_(other.memory())
+    {}
+
+    T* allocate(std::size_t n)
+    {
+      return static_cast<T*>(memory_->allocate(sizeof(T) * n));
+    }
+
+    void deallocate(T* p, std::size_t /*n*/)
+    {
+      memory_->deallocate(p);
+    }
+
+    HandlerMemory* memory() const { return memory_; }
+
+    template <typename U>
+    bool operator==(const HandlerAllocator<U>& other) const { return memory_ == other.memory(); }
+
+    template <typename U>
+    bool operator!=(const HandlerAllocator<U>& other) const { return memory_ != other.memory(); }
+
+  private:
+    HandlerMemory* memory_;
+  };
+
+  /**
+   * @brief A completion handler that associates a HandlerAllocator with the wrapped handler
+   *
+   * Everything else is forwarded to the wrapped handler: its executor and,
+   * for asio versions that still have them, the invocation hooks. The
+   * wrapped handler is usually created by strand::wrap(), which relies on
+   * those hooks to run the intermediate handlers of composed operations
+   * (e.g. async_read) on the strand.
+   */
+  template <typename Handler>
+  class AllocHandler
+  {
+  public:
+    using allocator_type = HandlerAllocator<Handler>;
+
+    AllocHandler(HandlerMemory& memory, Handler handler)
+      : memory_ (memory)
+      , handler_(std::move(handler))
+    {}
+
+    allocator_type get_allocator() const noexcept
+    {
+      return allocator_type(memory_);
+    }
+
+    template <typename... Args>
+    void operator()(Args&&... args)
+    {
+      handler_(std::forward<Args>(args)...);
+    }
+
+    Handler&       handler()       { return handler_; }
+    const Handler& handler() const { return handler_; }
+
+  private:
+    HandlerMemory& memory_;
+    Handler        handler_;
+  };
+
+#if !defined(ASIO_NO_DEPRECATED) && (ASIO_VERSION < 102900)
+  // The handler hooks have been removed in asio 1.29. They are found via ADL.
+
+  template <typename Function, typename Handler>
+  inline void asio_handler_invoke(Function& function, AllocHandler<Handler>* this_handler)
+  {
+    asio_handler_invoke_helpers::invoke(function, this_handler->handler());
+  }
+
+  template <typename Function, typename Handler>
+  inline void asio_handler_invoke(const Function& function, AllocHandler<Handler>* this_handler)
+  {
+    asio_handler_invoke_helpers::invoke(function, this_handler->handler());
+  }
+
+  template <typename Handler>
+  inline bool asio_handler_is_continuation(AllocHandler<Handler>* this_handler)
+  {
+    return asio_handler_cont_helpers::is_continuation(this_handler->handler());
+  }
+#endif // !ASIO_NO_DEPRECATED && ASIO_VERSION < 102900
+
+  /**
+   * @brief Wraps the handler, so asio allocates the memory of its operation from the HandlerMemory
+   */
+  template <typename Handler>
+  AllocHandler<typename std::decay<Handler>::type> makeAllocHandler(HandlerMemory& memory, Handler&& handler)
+  {
+    return AllocHandler<typename std::decay<Handler>::type>(memory, std::forward<Handler>(handler));
+  }
+}
+
+// Inherits from the trait of the wrapped handler, so asio still sees when
+// that one is unspecialized (and then keeps using the handler hooks).
+// Declared with the qualified name, so asio may also be a namespace alias.
+template <typename Handler, typename Executor>
+struct asio::associated_executor<fineftp::AllocHandler<Handler>, Executor>
+  : asio::associated_executor<Handler, Executor>
+{
+  static typename asio::associated_executor<Handler, Executor>::type get(const fineftp::AllocHandler<Handler>& handler, const Executor& executor = Executor()) noexcept
+  {
+    return asio::associated_executor<Handler, Executor>::get(handler.handler(), executor);
+  }
+};
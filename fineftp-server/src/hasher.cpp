@@ -0,0 +1,734 @@
+#include "hasher.h"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+  #include <nmmintrin.h>
+  #define FINEFTP_CRC32C_SSE42 1
+#elif defined(_M_X64) && defined(_MSC_VER)
+  #include <intrin.h>
+  #include <nmmintrin.h>
+  #define FINEFTP_CRC32C_SSE42 1
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+  #include <arm_acle.h>
+  #define FINEFTP_CRC32C_ARMV8 1
+#endif
+
+namespace fineftp
+{
+  namespace
+  {
+    ////////////////////////////////////////////////////////
+    // Helpers
+    ////////////////////////////////////////////////////////
+
+    std::string toHex(const std::uint8_t* data, std::size_t size)
+    {
+      static const char hex_digits[] = "0123456789abcdef";
+
+      std::string hex(size * 2, '0');
+      for (std::size_t i = 0; i < size; i++)
+      {
+        hex[2 * i]     = hex_digits[data[i] >> 4];
+        hex[2 * i + 1] = hex_digits[data[i] & 0x0F];
+      }
+      return hex;
+    }
+
+    inline std::uint32_t rotl(std::uint32_t value, int bits)
+    {
+      return (value << bits) | (value >> (32 - bits));
+    }
+
+    inline std::uint32_t rotr(std::uint32_t value, int bits)
+    {
+      return (value >> bits) | (value << (32 - bits));
+    }
+
+    inline std::uint32_t loadBigEndian32(const std::uint8_t* data)
+    {
+      return (static_cast<std::uint32_t>(data[0]) << 24)
+           | (static_cast<std::uint32_t>(data[1]) << 16)
+           | (static_cast<std::uint32_t>(data[2]) << 8)
+           | (static_cast<std::uint32_t>(data[3]));
+    }
+
+    inline std::uint32_t loadLittleEndian32(const std::uint8_t* data)
+    {
+      return (static_cast<std::uint32_t>(data[3]) << 24)
+           | (static_cast<std::uint32_t>(data[2]) << 16)
+           | (static_cast<std::uint32_t>(data[1]) << 8)
+           | (static_cast<std::uint32_t>(data[0]));
+    }
+
+    inline void storeBigEndian32(std::uint32_t value, std::uint8_t* data)
+    {
+      data[0] = static_cast<std::uint8_t>(value >> 24);
+      data[1] = static_cast<std::uint8_t>(value >> 16);
+      data[2] = static_cast<std::uint8_t>(value >> 8);
+      data[3] = static_cast<std::uint8_t>(value);
+    }
+
+    inline void storeLittleEndian32(std::uint32_t value, std::uint8_t* data)
+    {
+      data[0] = static_cast<std::uint8_t>(value);
+      data[1] = static_cast<std::uint8_t>(value >> 8);
+      data[2] = static_cast<std::uint8_t>(value >> 16);
+      data[3] = static_cast<std::uint8_t>(value >> 24);
+    }
+
+    ////////////////////////////////////////////////////////
+    // CRC-32 and CRC-32C (slicing-by-8 fallback)
+    ////////////////////////////////////////////////////////
+
+    struct CrcTables
+    {
+      explicit CrcTables(std::uint32_t reflected_polynomial)
+      {
+        for (std::uint32_t i = 0; i < 256; i++)
+        {
+          std::uint32_t crc = i;
+          for (int bit = 0; bit < 8; bit++)
+            crc = (crc >> 1) ^ ((crc & 1) ? reflected_polynomial : 0);
+          table[0][i] = crc;
+        }
+
+        for (std::uint32_t i = 0; i < 256; i++)
+        {
+          for (std::size_t slice = 1; slice < 8; slice++)
+            table[slice][i] = (table[slice - 1][i] >> 8) ^ table[0][table[slice - 1][i] & 0xFF];
+        }
+      }
+
+      std::array<std::array<std::uint32_t, 256>, 8> table {};
+    };
+
+    std::uint32_t crcSlicingBy8(const CrcTables& tables, std::uint32_t crc, const std::uint8_t* data, std::size_t size)
+    {
+      const auto& t = tables.table;
+
+      while (size >= 8)
+      {
+        const std::uint32_t low  = loadLittleEndian32(data) ^ crc;
+        const std::uint32_t high = loadLittleEndian32(data + 4);
+
+        crc = t[7][low & 0xFF]          ^ t[6][(low >> 8) & 0xFF]
+            ^ t[5][(low >> 16) & 0xFF]  ^ t[4][low >> 24]
+            ^ t[3][high & 0xFF]         ^ t[2][(high >> 8) & 0xFF]
+            ^ t[1][(high >> 16) & 0xFF] ^ t[0][high >> 24];
+
+        data += 8;
+        size -= 8;
+      }
+
+      while (size > 0)
+      {
+        crc = (crc >> 8) ^ t[0][(crc ^ *data) & 0xFF];
+        data++;
+        size--;
+      }
+
+      return crc;
+    }
+
+    const CrcTables& crc32Tables()
+    {
+      static const CrcTables tables(0xEDB88320);
+      return tables;
+    }
+
+    const CrcTables& crc32cTables()
+    {
+      static const CrcTables tables(0x82F63B78);
+      return tables;
+    }
+
+#if FINEFTP_CRC32C_SSE42
+  #if defined(__GNUC__) || defined(__clang__)
+    __attribute__((target("sse4.2")))
+  #endif
+    std::uint32_t crc32cHardware(std::uint32_t crc, const std::uint8_t* data, std::size_t size)
+    {
+      std::uint64_t crc64 = crc;
+      while (size >= 8)
+      {
+        std::uint64_t value = 0;
+        std::memcpy(&value, data, sizeof(value));
+        crc64 = _mm_crc32_u64(crc64, value);
+        data += 8;
+        size -= 8;
+      }
+
+      crc = static_cast<std::uint32_t>(crc64);
+      while (size > 0)
+      {
+        crc = _mm_crc32_u8(crc, *data);
+        data++;
+        size--;
+      }
+      return crc;
+    }
+
+    bool cpuSupportsCrc32c()
+    {
+  #if defined(__GNUC__) || defined(__clang__)
+      return __builtin_cpu_supports("sse4.2");
+  #else
+      int cpu_info[4] = {};
+      __cpuid(cpu_info, 1);
+      return (cpu_info[2] & (1 << 20)) != 0;
+  #endif
+    }
+#elif FINEFTP_CRC32C_ARMV8
+    std::uint32_t crc32cHardware(std::uint32_t crc, const std::uint8_t* data, std::size_t size)
+    {
+      while (size >= 8)
+      {
+        std::uint64_t value = 0;
+        std::memcpy(&value, data, sizeof(value));
+        crc = __crc32cd(crc, value);
+        data += 8;
+        size -= 8;
+      }
+
+      while (size > 0)
+      {
+        crc = __crc32cb(crc, *data);
+        data++;
+        size--;
+      }
+      return crc;
+    }
+
+    bool cpuSupportsCrc32c()
+    {
+      // The compiler has been told that the target CPU supports the CRC extension
+      return true;
+    }
+#endif
+
+    class CrcHasher : public Hasher
+    {
+    public:
+      explicit CrcHasher(bool castagnoli)
+        : castagnoli_(castagnoli)
+        , crc_(0xFFFFFFFF)
+      {}
+
+      void update(const void* data, std::size_t size) override
+      {
+        const auto* bytes = static_cast<const std::uint8_t*>(data);
+
+        if (!castagnoli_)
+        {
+          crc_ = crcSlicingBy8(crc32Tables(), crc_, bytes, size);
+          return;
+        }
+
+#if FINEFTP_CRC32C_SSE42 || FINEFTP_CRC32C_ARMV8
+        static const bool hardware_support = cpuSupportsCrc32c();
+        if (hardware_support)
+        {
+          crc_ = crc32cHardware(crc_, bytes, size);
+          return;
+        }
+#endif
+        crc_ = crcSlicingBy8(crc32cTables(), crc_, bytes, size);
+      }
+
+      std::string finish() override
+      {
+        std::array<std::uint8_t, 4> digest {};
+        storeBigEndian32(crc_ ^ 0xFFFFFFFF, digest.data());
+        return toHex(digest.data(), digest.size());
+      }
+
+    private:
+      const bool    castagnoli_;
+      std::uint32_t crc_;
+    };
+
+    ////////////////////////////////////////////////////////
+    // Merkle–Damgård hashes with 64 byte blocks (MD5, SHA-1, SHA-256)
+    ////////////////////////////////////////////////////////
+
+    class BlockHasher : public Hasher
+    {
+    public:
+      explicit BlockHasher(bool little_endian_length)
+        : little_endian_length_(little_endian_length)
+        , buffer_size_(0)
+        , total_size_(0)
+      {}
+
+      void update(const void* data, std::size_t size) override
+      {
+        const auto* bytes = static_cast<const std::uint8_t*>(data);
+        total_size_ += size;
+
+        // Fill up a partial block first
+        if (buffer_size_ > 0)
+        {
+          const std::size_t to_copy = std::min(size, buffer_.size() - buffer_size_);
+          std::memcpy(&buffer_[buffer_size_], bytes, to_copy);
+          buffer_size_ += to_copy;
+          bytes        += to_copy;
+          size         -= to_copy;
+
+          if (buffer_size_ < buffer_.size())
+            return;
+
+          processBlock(buffer_.data());
+          buffer_size_ = 0;
+        }
+
+        // Process full blocks directly from the input
+        while (size >= buffer_.size())
+        {
+          processBlock(bytes);
+          bytes += buffer_.size();
+          size  -= buffer_.size();
+        }
+
+        if (size > 0)
+        {
+          std::memcpy(buffer_.data(), bytes, size);
+          buffer_size_ = size;
+        }
+      }
+
+    protected:
+      // Adds the padding and the message length and processes the last block(s)
+      void pad()
+      {
+        const std::uint64_t total_bits = total_size_ * 8;
+
+        buffer_[buffer_size_++] = 0x80;
+        if (buffer_size_ > 56)
+        {
+          std::fill(buffer_.begin() + static_cast<std::ptrdiff_t>(buffer_size_), buffer_.end(), std::uint8_t(0));
+          processBlock(buffer_.data());
+          buffer_size_ = 0;
+        }
+        std::fill(buffer_.begin() + static_cast<std::ptrdiff_t>(buffer_size_), buffer_.begin() + 56, std::uint8_t(0));
+
+        for (int i = 0; i < 8; i++)
+        {
+          const int shift = (little_endian_length_ ? i : (7 - i)) * 8;
+          buffer_[56 + i] = static_cast<std::uint8_t>(total_bits >> shift);
+        }
+        processBlock(buffer_.data());
+      }
+
+      virtual void processBlock(const std::uint8_t* block) = 0;
+
+    private:
+      const bool                   little_endian_length_;
+      std::array<std::uint8_t, 64> buffer_ {};
+      std::size_t                  buffer_size_;
+      std::uint64_t                total_size_;
+    };
+
+    class Md5Hasher : public BlockHasher
+    {
+    public:
+      Md5Hasher()
+        : BlockHasher(true)
+        , state_{ 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 }
+      {}
+
+      std::string finish() override
+      {
+        pad();
+
+        std::array<std::uint8_t, 16> digest {};
+        for (std::size_t i = 0; i < state_.size(); i++)
+          storeLittleEndian32(state_[i], &digest[i * 4]);
+        return toHex(digest.data(), digest.size());
+      }
+
+    protected:
+      void processBlock(const std::uint8_t* block) override
+      {
+        static const std::array<std::uint32_t, 64> k =
+        {
+          0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+          0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+          0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+          0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+          0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+          0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+          0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+          0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+        };
+        static const std::array<int, 64> shifts =
+        {
+          7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+          5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20,
+          4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+          6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21,
+        };
+
+        std::array<std::uint32_t, 16> m {};
+        for (std::size_t i = 0; i < m.size(); i++)
+          m[i] = loadLittleEndian32(block + i * 4);
+
+        std::uint32_t a = state_[0];
+        std::uint32_t b = state_[1];
+        std::uint32_t c = state_[2];
+        std::uint32_t d = state_[3];
+
+        for (std::size_t i = 0; i < 64; i++)
+        {
+          std::uint32_t f = 0;
+          std::size_t   g = 0;
+          if (i < 16)      { f = (b & c) | (~b & d);  g = i;                }
+          else if (i < 32) { f = (d & b) | (~d & c);  g = (5 * i + 1) % 16; }
+          else if (i < 48) { f = b ^ c ^ d;           g = (3 * i + 5) % 16; }
+          else             { f = c ^ (b | ~d);        g = (7 * i) % 16;     }
+
+          f = f + a + k[i] + m[g];
+          a = d;
+          d = c;
+          c = b;
+          b = b + rotl(f, shifts[i]);
+        }
+
+        state_[0] += a;
+        state_[1] += b;
+        state_[2] += c;
+        state_[3] += d;
+      }
+
+    private:
+      std::array<std::uint32_t, 4> state_;
+    };
+
+    class Sha1Hasher : public BlockHasher
+    {
+    public:
+      Sha1Hasher()
+        : BlockHasher(false)
+        , state_{ 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 }
+      {}
+
+      std::string finish() override
+      {
+        pad();
+
+        std::array<std::uint8_t, 20> digest {};
+        for (std::size_t i = 0; i < state_.size(); i++)
+          storeBigEndian32(state_[i], &digest[i * 4]);
+        return toHex(digest.data(), digest.size());
+      }
+
+    protected:
+      void processBlock(const std::uint8_t* block) override
+      {
+        std::array<std::uint32_t, 80> w {};
+        for (std::size_t i = 0; i < 16; i++)
+          w[i] = loadBigEndian32(block + i * 4);
+        for (std::size_t i = 16; i < 80; i++)
+          w[i] = rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+        std::uint32_t a = state_[0];
+        std::uint32_t b = state_[1];
+        std::uint32_t c = state_[2];
+        std::uint32_t d = state_[3];
+        std::uint32_t e = state_[4];
+
+        for (std::size_t i = 0; i < 80; i++)
+        {
+          std::uint32_t f = 0;
+          std::uint32_t k = 0;
+          if (i < 20)      { f = (b & c) | (~b & d);          k = 0x5A827999; }
+          else if (i < 40) { f = b ^ c ^ d;                   k = 0x6ED9EBA1; }
+          else if (i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+          else             { f = b ^ c ^ d;                   k = 0xCA62C1D6; }
+
+          const std::uint32_t temp = rotl(a, 5) + f + e + k + w[i];
+          e = d;
+          d = c;
+          c = rotl(b, 30);
+          b = a;
+          a = temp;
+        }
+
+        state_[0] += a;
+        state_[1] += b;
+        state_[2] += c;
+        state_[3] += d;
+        state_[4] += e;
+      }
+
+    private:
+      std::array<std::uint32_t, 5> state_;
+    };
+
+    using Sha256State = std::array<std::uint32_t, 8>;
+
+    const Sha256State sha256_initial_state = {{ 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 }};
+
+    // The SHA-256 compression function. It is used by the Sha256Hasher and directly by PBKDF2, which hashes fixed size blocks only.
+    void sha256ProcessBlock(Sha256State& state, const std::uint8_t* block)
+    {
+      static const std::array<std::uint32_t, 64> k =
+      {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+      };
+
+      std::array<std::uint32_t, 64> w {};
+      for (std::size_t i = 0; i < 16; i++)
+        w[i] = loadBigEndian32(block + i * 4);
+      for (std::size_t i = 16; i < 64; i++)
+      {
+        const std::uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        const std::uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+      }
+
+      std::uint32_t a = state[0];
+      std::uint32_t b = state[1];
+      std::uint32_t c = state[2];
+      std::uint32_t d = state[3];
+      std::uint32_t e = state[4];
+      std::uint32_t f = state[5];
+      std::uint32_t g = state[6];
+      std::uint32_t h = state[7];
+
+      for (std::size_t i = 0; i < 64; i++)
+      {
+        const std::uint32_t s1    = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
+        const std::uint32_t ch    = (e & f) ^ (~e & g);
+        const std::uint32_t temp1 = h + s1 + ch + k[i] + w[i];
+        const std::uint32_t s0    = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
+        const std::uint32_t maj   = (a & b) ^ (a & c) ^ (b & c);
+        const std::uint32_t temp2 = s0 + maj;
+
+        h = g;
+        g = f;
+        f = e;
+        e = d + temp1;
+        d = c;
+        c = b;
+        b = a;
+        a = temp1 + temp2;
+      }
+
+      state[0] += a;
+      state[1] += b;
+      state[2] += c;
+      state[3] += d;
+      state[4] += e;
+      state[5] += f;
+      state[6] += g;
+      state[7] += h;
+    }
+
+    // Hashes the remaining data of a message and returns the digest. The state must have processed exactly processed_size bytes (a multiple of 64) already.
+    std::array<std::uint8_t, 32> sha256Finish(Sha256State state, std::uint64_t processed_size, const std::uint8_t* data, std::size_t size)
+    {
+      const std::uint64_t total_bits = (processed_size + size) * 8;
+
+      while (size >= 64)
+      {
+        sha256ProcessBlock(state, data);
+        data += 64;
+        size -= 64;
+      }
+
+      std::array<std::uint8_t, 128> last_blocks {};
+      if (size > 0)
+        std::memcpy(last_blocks.data(), data, size);
+      last_blocks[size] = 0x80;
+
+      const std::size_t padded_size = (size < 56 ? 64 : 128);
+      for (std::size_t i = 0; i < 8; i++)
+        last_blocks[padded_size - 1 - i] = static_cast<std::uint8_t>(total_bits >> (i * 8));
+
+      sha256ProcessBlock(state, last_blocks.data());
+      if (padded_size == 128)
+        sha256ProcessBlock(state, last_blocks.data() + 64);
+
+      std::array<std::uint8_t, 32> digest {};
+      for (std::size_t i = 0; i < state.size(); i++)
+        storeBigEndian32(state[i], &digest[i * 4]);
+      return digest;
+    }
+
+    class Sha256Hasher : public BlockHasher
+    {
+    public:
+      Sha256Hasher()
+        : BlockHasher(false)
+        , state_(sha256_initial_state)
+      {}
+
+      std::string finish() override
+      {
+        pad();
+
+        std::array<std::uint8_t, 32> digest {};
+        for (std::size_t i = 0; i < state_.size(); i++)
+          storeBigEndian32(state_[i], &digest[i * 4]);
+        return toHex(digest.data(), digest.size());
+      }
+
+    protected:
+      void processBlock(const std::uint8_t* block) override
+      {
+        sha256ProcessBlock(state_, block);
+      }
+
+    private:
+      Sha256State state_;
+    };
+
+    struct AlgorithmName
+    {
+      HashAlgorithm algorithm;
+      const char*   name;
+    };
+
+    // In order of preference, as advertised in the FEAT reply
+    const std::array<AlgorithmName, 5> algorithm_names =
+    {{
+      { HashAlgorithm::Sha256, "SHA-256" },
+      { HashAlgorithm::Sha1,   "SHA-1"   },
+      { HashAlgorithm::Md5,    "MD5"     },
+      { HashAlgorithm::Crc32,  "CRC32"   },
+      { HashAlgorithm::Crc32c, "CRC32C"  },
+    }};
+  }
+
+  std::unique_ptr<Hasher> createHasher(HashAlgorithm algorithm)
+  {
+    switch (algorithm)
+    {
+    case HashAlgorithm::Crc32:  return std::make_unique<CrcHasher>(false);
+    case HashAlgorithm::Crc32c: return std::make_unique<CrcHasher>(true);
+    case HashAlgorithm::Md5:    return std::make_unique<Md5Hasher>();
+    case HashAlgorithm::Sha1:   return std::make_unique<Sha1Hasher>();
+    case HashAlgorithm::Sha256: return std::make_unique<Sha256Hasher>();
+    }
+    return nullptr;
+  }
+
+  std::string pbkdf2HmacSha256(const std::string& password, const std::string& salt, std::uint32_t iterations, std::size_t key_size)
+  {
+    // HMAC key block. Keys longer than the block size are hashed first.
+    std::array<std::uint8_t, 64> key_block {};
+    if (password.size() > key_block.size())
+    {
+      const auto password_digest = sha256Finish(sha256_initial_state, 0, reinterpret_cast<const std::uint8_t*>(password.data()), password.size());
+      std::memcpy(key_block.data(), password_digest.data(), password_digest.size());
+    }
+    else if (!password.empty())
+    {
+      std::memcpy(key_block.data(), password.data(), password.size());
+    }
+
+    // The states after hashing the inner and outer key blocks are the same
+    // for all HMAC computations, so each iteration only needs to hash the
+    // 32 byte message (two compressions).
+    Sha256State inner_state = sha256_initial_state;
+    Sha256State outer_state = sha256_initial_state;
+    {
+      std::array<std::uint8_t, 64> padded_key {};
+      for (std::size_t i = 0; i < padded_key.size(); i++)
+        padded_key[i] = static_cast<std::uint8_t>(key_block[i] ^ 0x36);
+      sha256ProcessBlock(inner_state, padded_key.data());
+
+      for (std::size_t i = 0; i < padded_key.size(); i++)
+        padded_key[i] = static_cast<std::uint8_t>(key_block[i] ^ 0x5c);
+      sha256ProcessBlock(outer_state, padded_key.data());
+    }
+
+    const auto hmac = [&inner_state, &outer_state](const std::uint8_t* data, std::size_t size)
+                      {
+                        const auto inner_digest = sha256Finish(inner_state, 64, data, size);
+                        return sha256Finish(outer_state, 64, inner_digest.data(), inner_digest.size());
+                      };
+
+    std::string derived_key;
+    derived_key.reserve(key_size);
+
+    std::vector<std::uint8_t> first_message(salt.begin(), salt.end());
+    first_message.resize(salt.size() + 4);
+
+    for (std::uint32_t block_index = 1; derived_key.size() < key_size; block_index++)
+    {
+      storeBigEndian32(block_index, &first_message[salt.size()]);
+
+      auto u      = hmac(first_message.data(), first_message.size());
+      auto result = u;
+      for (std::uint32_t i = 1; i < iterations; i++)
+      {
+        u = hmac(u.data(), u.size());
+        for (std::size_t j = 0; j < result.size(); j++)
+          result[j] ^= u[j];
+      }
+
+      derived_key.append(reinterpret_cast<const char*>(result.data()), std::min(result.size(), key_size - derived_key.size()));
+    }
+
+    return derived_key;
+  }
+
+  std::string hashAlgorithmName(HashAlgorithm algorithm)
+  {
+    for (const auto& algorithm_name : algorithm_names)
+    {
+      if (algorithm_name.algorithm == algorithm)
+        return algorithm_name.name;
+    }
+    return "";
+  }
+
+  bool parseHashAlgorithm(const std::string& name, HashAlgorithm& algorithm)
+  {
+    std::string name_upper = name;
+    std::transform(name_upper.begin(), name_upper.end(), name_upper.begin(), [](char c)
+                   { return static_cast<char>(std::toupper(static_cast<unsigned char>(c))); });
+
+    for (const auto& algorithm_name : algorithm_names)
+    {
+      if (name_upper == algorithm_name.name)
+      {
+        algorithm = algorithm_name.algorithm;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  std::string hashAlgorithmFeatList(HashAlgorithm selected_algorithm)
+  {
+    std::string feat_list;
+    for (const auto& algorithm_name : algorithm_names)
+    {
+      if (!feat_list.empty())
+        feat_list += ';';
+
+      feat_list += algorithm_name.name;
+      if (algorithm_name.algorithm == selected_algorithm)
+        feat_list += '*';
+    }
+    return feat_list;
+  }
+}
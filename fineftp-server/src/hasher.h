@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace fineftp
+{
+  enum class HashAlgorithm
+  {
+    Crc32,   // CRC-32 (IEEE 802.3, as used by zip / XCRC)
+    Crc32c,  // CRC-32C (Castagnoli), hardware accelerated if the CPU supports it
+    Md5,
+    Sha1,
+    Sha256,
+  };
+
+  /**
+   * @brief Incremental checksum / hash computation
+   *
+   * Data is fed with update() in arbitrary chunks. finish() returns the
+   * checksum as lowercase hex string. A Hasher must not be used anymore after
+   * finish() has been called.
+   */
+  class Hasher
+  {
+  public:
+    Hasher() = default;
+    virtual ~Hasher() = default;
+
+    // Copy and move disabled, hashers are used via pointers
+    Hasher(const Hasher&)            = delete;
+    Hasher& operator=(const Hasher&) = delete;
+    Hasher(Hasher&&)                 = delete;
+    Hasher& operator=(Hasher&&)      = delete;
+
+    virtual void update(const void* data, std::size_t size) = 0;
+    virtual std::string finish() = 0;
+  };
+
+  /**
+   * @brief Creates a new hasher for the given algorithm
+   */
+  std::unique_ptr<Hasher> createHasher(HashAlgorithm algorithm);
+
+  /**
+   * @brief Derives a key from a password with PBKDF2-HMAC-SHA256 (RFC 8018)
+   *
+   * This is deliberately slow (2 SHA-256 compressions per iteration) and
+   * must not be called from the io_context threads.
+   *
+   * @param password:   The password
+   * @param salt:       The salt (binary)
+   * @param iterations: The iteration count. Must not be 0.
+   * @param key_size:   The size of the derived key in bytes
+   *
+   * @return The derived key (binary)
+   */
+  std::string pbkdf2HmacSha256(const std::string& password, const std::string& salt, std::uint32_t iterations, std::size_t key_size);
+
+  /**
+   * @brief Returns the name of the algorithm as used by the HASH command (e.g. "SHA-256")
+   */
+  std::string hashAlgorithmName(HashAlgorithm algorithm);
+
+  /**
+   * @brief Parses an algorithm name as used by the HASH command (case insensitive)
+   *
+   * @param name:      The name, e.g. "SHA-256"
+   * @param algorithm: Receives the algorithm if the name is known
+   *
+   * @return true if the name is known
+   */
+  bool parseHashAlgorithm(const std::string& name, HashAlgorithm& algorithm);
+
+  /**
+   * @brief Returns the FEAT line parameter of all algorithms, with the selected one marked by a '*'
+   *
+   * e.g. "SHA-256*;SHA-1;MD5;CRC32;CRC32C"
+   */
+  std::string hashAlgorithmFeatList(HashAlgorithm selected_algorithm);
+}
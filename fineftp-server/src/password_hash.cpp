@@ -0,0 +1,143 @@
+#include "password_hash.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
+
+#include "hasher.h"
+
+namespace fineftp
+{
+  namespace
+  {
+    const std::string hash_prefix = "$pbkdf2-sha256$";
+
+    // The adapted base64 alphabet of passlib ('.' instead of '+')
+    const char* const ab64_alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789./";
+
+    std::string ab64Encode(const std::string& data)
+    {
+      std::string encoded;
+      encoded.reserve((data.size() * 4 + 2) / 3);
+
+      for (std::size_t i = 0; i < data.size(); i += 3)
+      {
+        const std::size_t chunk_size = std::min<std::size_t>(3, data.size() - i);
+
+        std::uint32_t chunk = 0;
+        for (std::size_t j = 0; j < 3; j++)
+        {
+          chunk <<= 8U;
+          if (j < chunk_size)
+            chunk |= static_cast<unsigned char>(data[i + j]);
+        }
+
+        // Without padding, n bytes are encoded with n + 1 characters
+        for (std::size_t j = 0; j < chunk_size + 1; j++)
+          encoded.push_back(ab64_alphabet[(chunk >> (18 - 6 * j)) & 0x3FU]);
+      }
+      return encoded;
+    }
+
+    bool ab64Decode(const std::string& encoded, std::string& data)
+    {
+      // 1 remaining character can never be valid
+      if ((encoded.size() % 4) == 1)
+        return false;
+
+      data.clear();
+      data.reserve(encoded.size() * 3 / 4);
+
+      std::uint32_t bits       = 0;
+      int           bit_count  = 0;
+      for (const char c : encoded)
+      {
+        const char* const pos = std::char_traits<char>::find(ab64_alphabet, 64, c);
+        if (pos == nullptr)
+          return false;
+
+        bits       = (bits << 6U) | static_cast<std::uint32_t>(pos - ab64_alphabet);
+        bit_count += 6;
+        if (bit_count >= 8)
+        {
+          bit_count -= 8;
+          data.push_back(static_cast<char>((bits >> static_cast<unsigned int>(bit_count)) & 0xFFU));
+        }
+      }
+      return true;
+    }
+
+    // Compares without leaking the position of the first difference through the timing
+    bool constantTimeEquals(const std::string& a, const std::string& b)
+    {
+      if (a.size() != b.size())
+        return false;
+
+      unsigned char difference = 0;
+      for (std::size_t i = 0; i < a.size(); i++)
+        difference |= static_cast<unsigned char>(a[i] ^ b[i]);
+      return (difference == 0);
+    }
+  }
+
+  PasswordHash::PasswordHash(std::uint32_t iterations, std::string salt, std::string hash)
+    : iterations_(iterations)
+    , salt_      (std::move(salt))
+    , hash_      (std::move(hash))
+  {}
+
+  std::shared_ptr<const PasswordHash> PasswordHash::parse(const std::string& hash_string)
+  {
+    if (hash_string.compare(0, hash_prefix.size(), hash_prefix) != 0)
+      return nullptr;
+
+    const std::size_t salt_pos = hash_string.find('$', hash_prefix.size());
+    if (salt_pos == std::string::npos)
+      return nullptr;
+
+    const std::size_t hash_pos = hash_string.find('$', salt_pos + 1);
+    if (hash_pos == std::string::npos)
+      return nullptr;
+
+    const std::string iterations_string = hash_string.substr(hash_prefix.size(), salt_pos - hash_prefix.size());
+    if (iterations_string.empty() || (iterations_string.size() > 9) || (iterations_string.find_first_not_of("0123456789") != std::string::npos))
+      return nullptr;
+
+    const auto iterations = static_cast<std::uint32_t>(std::stoul(iterations_string));
+    if (iterations == 0)
+      return nullptr;
+
+    std::string salt;
+    std::string hash;
+    if (!ab64Decode(hash_string.substr(salt_pos + 1, hash_pos - salt_pos - 1), salt)
+        || !ab64Decode(hash_string.substr(hash_pos + 1), hash)
+        || hash.empty())
+    {
+      return nullptr;
+    }
+
+    return std::shared_ptr<const PasswordHash>(new PasswordHash(iterations, std::move(salt), std::move(hash)));
+  }
+
+  std::string PasswordHash::create(const std::string& password, std::uint32_t iterations)
+  {
+    std::random_device random_device;
+
+    std::string salt(16, '\0');
+    for (char& c : salt)
+      c = static_cast<char>(random_device() & 0xFFU);
+
+    return hash_prefix + std::to_string(iterations)
+         + "$" + ab64Encode(salt)
+         + "$" + ab64Encode(pbkdf2HmacSha256(password, salt, iterations, 32));
+  }
+
+  bool PasswordHash::verify(const std::string& password) const
+  {
+    return constantTimeEquals(pbkdf2HmacSha256(password, salt_, iterations_, hash_.size()), hash_);
+  }
+}
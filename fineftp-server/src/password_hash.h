@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace fineftp
+{
+  /**
+   * @brief A salted PBKDF2-HMAC-SHA256 password hash
+   *
+   * The hash is stored in the modular crypt format used by passlib:
+   * "$pbkdf2-sha256$<iterations>$<salt>$<hash>", where salt and hash are
+   * encoded in base64 with '.' instead of '+' and without padding. Hashes
+   * created with passlib (e.g. by "passlib.hash.pbkdf2_sha256.hash()") can be
+   * used directly.
+   */
+  class PasswordHash
+  {
+  public:
+    /**
+     * @brief Parses a hash string
+     *
+     * @return The hash or nullptr, if the string is no valid hash
+     */
+    static std::shared_ptr<const PasswordHash> parse(const std::string& hash_string);
+
+    /**
+     * @brief Hashes a password with a random salt
+     *
+     * @return The hash string
+     */
+    static std::string create(const std::string& password, std::uint32_t iterations);
+
+    /**
+     * @brief Checks if the password matches the hash
+     *
+     * This takes as long as the iteration count demands and should not be
+     * called from the io_context threads.
+     */
+    bool verify(const std::string& password) const;
+
+  private:
+    PasswordHash(std::uint32_t iterations, std::string salt, std::string hash);
+
+    const std::uint32_t iterations_;
+    const std::string   salt_;   // Binary
+    const std::string   hash_;   // Binary
+  };
+}
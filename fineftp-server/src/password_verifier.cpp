@@ -0,0 +1,147 @@
+#include "password_verifier.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <random>
+#include <string>
+
+#include <asio.hpp> // IWYU pragma: keep
+
+#include "ftp_user.h"
+#include "hasher.h"
+#include "user_database.h"
+
+namespace fineftp
+{
+  namespace
+  {
+    // Entries are only evicted when the cache grows beyond this size
+    constexpr std::size_t max_cache_size = 4096;
+
+    std::string createCacheKey()
+    {
+      std::random_device random_device;
+
+      std::string key(32, '\0');
+      for (char& c : key)
+        c = static_cast<char>(random_device() & 0xFFU);
+      return key;
+    }
+  }
+
+  PasswordVerifier::PasswordVerifier(const UserDatabase& user_database, std::size_t thread_count, std::chrono::steady_clock::duration cache_ttl, std::ostream& error)
+    : user_database_            (user_database)
+    , verification_pool_        (thread_count)
+    , max_pending_verifications_(thread_count * 64)
+    , pending_verifications_    (0)
+    , cache_ttl_                (cache_ttl)
+    , cache_key_                (createCacheKey())
+    , error_                    (error)
+  {}
+
+  PasswordVerifier::~PasswordVerifier()
+  {
+    stop();
+  }
+
+  void PasswordVerifier::verify(const std::string& username, const std::string& password, const CompletionHandler& completion_handler)
+  {
+    auto user = user_database_.findUser(username);
+    if (!user || !user->password_hash_ || user_database_.isUsernameAnonymousUser(username))
+    {
+      completion_handler(user_database_.getUser(username, password));
+      return;
+    }
+
+    const std::string credential_digest = credentialDigest(username, password);
+    if (isCached(credential_digest, user))
+    {
+      completion_handler(user);
+      return;
+    }
+
+    if (pending_verifications_.fetch_add(1) >= max_pending_verifications_)
+    {
+      pending_verifications_--;
+      error_ << "Login of user \"" << username << "\" rejected: Too many pending password verifications" << std::endl;
+      completion_handler(nullptr);
+      return;
+    }
+
+    asio::post(verification_pool_, [this, user, password, credential_digest, completion_handler]()
+                                   {
+                                     const bool password_ok = user->password_hash_->verify(password);
+                                     if (password_ok)
+                                       addToCache(credential_digest, user);
+
+                                     pending_verifications_--;
+                                     completion_handler(password_ok ? user : nullptr);
+                                   });
+  }
+
+  void PasswordVerifier::stop()
+  {
+    verification_pool_.stop();
+    verification_pool_.join();
+  }
+
+  std::string PasswordVerifier::credentialDigest(const std::string& username, const std::string& password) const
+  {
+    auto hasher = createHasher(HashAlgorithm::Sha256);
+    hasher->update(cache_key_.data(), cache_key_.size());
+    hasher->update(username.c_str(), username.size() + 1);   // Including the terminating '\0' as separator
+    hasher->update(password.data(), password.size());
+    return hasher->finish();
+  }
+
+  bool PasswordVerifier::isCached(const std::string& credential_digest, const std::shared_ptr<FtpUser>& user)
+  {
+    if (cache_ttl_ <= std::chrono::steady_clock::duration::zero())
+      return false;
+
+    const std::lock_guard<std::mutex> lock(cache_mutex_);
+
+    auto cache_it = cache_.find(credential_digest);
+    if (cache_it == cache_.end())
+      return false;
+
+    // The user may have been replaced (e.g. with a new password) in the meantime
+    if ((cache_it->second.user != user) || (cache_it->second.expiry < std::chrono::steady_clock::now()))
+    {
+      cache_.erase(cache_it);
+      return false;
+    }
+    return true;
+  }
+
+  void PasswordVerifier::addToCache(const std::string& credential_digest, const std::shared_ptr<FtpUser>& user)
+  {
+    if (cache_ttl_ <= std::chrono::steady_clock::duration::zero())
+      return;
+
+    const auto now = std::chrono::steady_clock::now();
+
+    const std::lock_guard<std::mutex> lock(cache_mutex_);
+
+    if (cache_.size() >= max_cache_size)
+    {
+      for (auto cache_it = cache_.begin(); cache_it != cache_.end();)
+      {
+        if (cache_it->second.expiry < now)
+          cache_it = cache_.erase(cache_it);
+        else
+          ++cache_it;
+      }
+
+      // All entries are still valid. Dropping them only costs a verification.
+      if (cache_.size() >= max_cache_size)
+        cache_.clear();
+    }
+
+    cache_[credential_digest] = CacheEntry{user, now + cache_ttl_};
+  }
+}
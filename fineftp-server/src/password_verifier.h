@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <asio.hpp> // IWYU pragma: keep
+
+#include "ftp_user.h"
+#include "user_database.h"
+
+namespace fineftp
+{
+  /**
+   * @brief Checks the passwords of logins without blocking the io_context
+   *
+   * Plaintext passwords are compared directly. Password hashes are verified
+   * on a dedicated thread pool, as this deliberately takes a lot of CPU
+   * time. The pool has a fixed number of threads and the number of queued
+   * verifications is limited, so a login storm cannot exhaust the CPU or
+   * memory. Logins beyond that limit fail.
+   *
+   * Successful logins are cached for a short time, so clients that connect
+   * over and over again with the same credentials don't pay for the hash
+   * every time. The cache only stores a digest of the credentials, salted
+   * with a random key of this process. A cached login is only valid as long
+   * as the user has not been replaced or removed.
+   *
+   * The PasswordVerifier is shared by all sessions and thread safe.
+   */
+  class PasswordVerifier
+  {
+  public:
+    using CompletionHandler = std::function<void(const std::shared_ptr<FtpUser>&)>;
+
+    PasswordVerifier(const UserDatabase& user_database, std::size_t thread_count, std::chrono::steady_clock::duration cache_ttl, std::ostream& error);
+
+    // Copy and move disabled (as we are storing the this pointer in lambda captures)
+    PasswordVerifier(const PasswordVerifier&)            = delete;
+    PasswordVerifier& operator=(const PasswordVerifier&) = delete;
+    PasswordVerifier(PasswordVerifier&&)                 = delete;
+    PasswordVerifier& operator=(PasswordVerifier&&)      = delete;
+
+    ~PasswordVerifier();
+
+    /**
+     * @brief Checks the credentials of a login
+     *
+     * If the password can be checked quickly (plaintext password, cached
+     * login), the completion handler is called before this function
+     * returns. Otherwise, it is called from a verification thread.
+     *
+     * @param username:           The username
+     * @param password:           The password
+     * @param completion_handler: Called with the user, or nullptr if the login failed
+     */
+    void verify(const std::string& username, const std::string& password, const CompletionHandler& completion_handler);
+
+    /**
+     * @brief Abandons all verifications that have not been started and waits for the running ones
+     */
+    void stop();
+
+  private:
+    struct CacheEntry
+    {
+      std::shared_ptr<FtpUser>              user;
+      std::chrono::steady_clock::time_point expiry;
+    };
+
+    std::string credentialDigest(const std::string& username, const std::string& password) const;
+
+    bool isCached(const std::string& credential_digest, const std::shared_ptr<FtpUser>& user);
+    void addToCache(const std::string& credential_digest, const std::shared_ptr<FtpUser>& user);
+
+  private:
+    const UserDatabase&                        user_database_;
+    asio::thread_pool                          verification_pool_;
+    const std::size_t                          max_pending_verifications_;
+    std::atomic<std::size_t>                   pending_verifications_;
+
+    const std::chrono::steady_clock::duration  cache_ttl_;
+    const std::string                          cache_key_;     // Random, so the cached digests cannot be attacked offline
+    std::mutex                                 cache_mutex_;
+    std::unordered_map<std::string, CacheEntry> cache_;
+
+    std::ostream& error_;   /* Error output log */
+  };
+}
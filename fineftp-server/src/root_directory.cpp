@@ -0,0 +1,147 @@
+#include "root_directory.h"
+
+#include <ostream>
+#include <string>
+
+#include "filesystem.h"
+
+#ifdef __linux__
+  #include <cerrno>
+  #include <cstdint>
+  #include <cstring>
+
+  #include <fcntl.h>
+  #include <sys/syscall.h>
+  #include <unistd.h>
+#endif // __linux__
+
+namespace fineftp
+{
+#ifdef __linux__
+
+  namespace
+  {
+    // Declared here, as glibc has no wrapper for openat2() and older kernel headers lack <linux/openat2.h>
+    struct OpenHow
+    {
+      std::uint64_t flags;
+      std::uint64_t mode;
+      std::uint64_t resolve;
+    };
+
+    constexpr std::uint64_t resolve_no_magiclinks = 0x02;
+    constexpr std::uint64_t resolve_beneath       = 0x08;
+
+    // openat2() has the same syscall number on all architectures
+    constexpr long sys_openat2 = 437;
+
+    int openBeneath(int dir_fd, const char* relative_path)
+    {
+      OpenHow how{};
+      how.flags   = O_PATH | O_CLOEXEC;
+      how.resolve = resolve_beneath | resolve_no_magiclinks;
+
+      long fd = -1;
+      do
+      {
+        fd = ::syscall(sys_openat2, dir_fd, relative_path, &how, sizeof(how));
+      } while ((fd < 0) && (errno == EINTR));
+
+      return static_cast<int>(fd);
+    }
+  }
+
+  RootDirectory::RootDirectory(const std::string& local_root_path, std::ostream& error)
+    : local_root_path_(Filesystem::cleanPathNative(local_root_path))
+    , root_fd_        (::open(local_root_path_.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC))
+  {
+    if (root_fd_ < 0)
+      error << "Error opening root directory " << local_root_path_ << ": " << std::strerror(errno) << std::endl;
+  }
+
+  RootDirectory::~RootDirectory()
+  {
+    if (root_fd_ >= 0)
+      ::close(root_fd_);
+  }
+
+  bool RootDirectory::isBeneath(const std::string& local_path) const
+  {
+    if (root_fd_ < 0)
+      return false;
+
+    if (!isSupported())
+      return true;
+
+    // Strip the root directory, as openat2() resolves the path relative to it
+    std::string relative_path;
+    if (local_path == local_root_path_)
+    {
+      relative_path = ".";
+    }
+    else if (local_root_path_ == ".")
+    {
+      relative_path = local_path;
+    }
+    else if ((local_path.compare(0, local_root_path_.size(), local_root_path_) == 0)
+             && ((local_root_path_.back() == '/') || (local_path[local_root_path_.size()] == '/')))
+    {
+      const std::size_t start = local_path.find_first_not_of('/', local_root_path_.size());
+      relative_path = (start == std::string::npos ? "." : local_path.substr(start));
+    }
+    else
+    {
+      return false;
+    }
+
+    // A path that doesn't exist yet is confined if its parent directory is
+    for (;;)
+    {
+      const int fd = openBeneath(root_fd_, relative_path.c_str());
+      if (fd >= 0)
+      {
+        ::close(fd);
+        return true;
+      }
+
+      if ((errno != ENOENT) || (relative_path == "."))
+        return false;
+
+      const std::size_t last_separator = relative_path.find_last_of('/');
+      relative_path = (last_separator == std::string::npos ? "." : relative_path.substr(0, last_separator));
+    }
+  }
+
+  bool RootDirectory::isSupported()
+  {
+    static const bool supported = []()
+                                  {
+                                    const int fd = openBeneath(AT_FDCWD, ".");
+                                    if (fd < 0)
+                                      return false;
+                                    ::close(fd);
+                                    return true;
+                                  }();
+    return supported;
+  }
+
+#else // __linux__
+
+  RootDirectory::RootDirectory(const std::string& local_root_path, std::ostream& /*error*/)
+    : local_root_path_(Filesystem::cleanPathNative(local_root_path))
+  {}
+
+  RootDirectory::~RootDirectory() = default;
+
+  bool RootDirectory::isBeneath(const std::string& /*local_path*/) const
+  {
+    return true;
+  }
+
+  bool RootDirectory::isSupported()
+  {
+    return false;
+  }
+
+#endif // __linux__
+}
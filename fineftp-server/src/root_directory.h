@@ -0,0 +1,71 @@
+#pragma once
+
+#include <ostream>
+#include <string>
+
+namespace fineftp
+{
+  /**
+   * @brief The local root directory of a logged in user, used to check that paths don't lead out of it
+   *
+   * The FTP paths are cleaned before they are mapped to local paths, so they
+   * can never leave the root directory with "..". Symlinks inside of the
+   * root directory may point anywhere, though, and the string-level
+   * cleaning cannot notice that.
+   *
+   * On Linux, the RootDirectory holds an O_PATH file descriptor of the
+   * directory and lets the kernel resolve each path beneath it with
+   * openat2(RESOLVE_BENEATH). The resolution fails for every path that
+   * would leave the directory, no matter whether through "..", an absolute
+   * symlink or a relative symlink. Paths that don't exist (yet) are checked
+   * up to their deepest existing parent directory, so a file that is about
+   * to be created is checked as well.
+   *
+   * The check is best-effort: the callers access the path by its name
+   * afterwards, which resolves it again. If a directory on the path is
+   * replaced by a symlink in between, the access follows that symlink.
+   *
+   * openat2() is available since Linux 5.6. On older kernels and on other
+   * operating systems, paths are not confined (see isSupported()).
+   *
+   * The RootDirectory is thread safe.
+   */
+  class RootDirectory
+  {
+  public:
+    /**
+     * @param local_root_path: The local root path of the user
+     * @param error:           Stream for logging an error when the directory cannot be opened
+     */
+    RootDirectory(const std::string& local_root_path, std::ostream& error);
+
+    // Copy and move disabled, as we own the file descriptor
+    RootDirectory(const RootDirectory&)            = delete;
+    RootDirectory& operator=(const RootDirectory&) = delete;
+    RootDirectory(RootDirectory&&)                 = delete;
+    RootDirectory& operator=(RootDirectory&&)      = delete;
+
+    ~RootDirectory();
+
+    /**
+     * @brief Checks that the local path doesn't lead out of the root directory
+     *
+     * @param local_path: A clean local path inside the root directory, as created by the FtpSession
+     *
+     * @return False if the path leaves the root directory or cannot be
+     *         resolved. Always false if the root directory could not be
+     *         opened, and always true if paths cannot be confined.
+     */
+    bool isBeneath(const std::string& local_path) const;
+
+    /** @brief Returns true if this system can confine paths to a directory */
+    static bool isSupported();
+
+  private:
+    const std::string local_root_path_;   // Cleaned, so it is a prefix of all local paths of the user
+
+#ifdef __linux__
+    int               root_fd_;
+#endif // __linux__
+  };
+}
@@ -2,8 +2,10 @@
 
 #include "server_impl.h"
 #include "ftp_message.h"
+#include "password_hash.h"
 
 #include <cassert> // assert
+#include <chrono>
 #include <cstddef> // size_t
 #include <cstdint> // uint16_t
 #include <memory>
@@ -41,11 +43,31 @@ namespace fineftp
     return ftp_server_->addUser(username, password, local_root_path, permissions);
   }
 
+  bool FtpServer::addUserWithPasswordHash(const std::string &username, const std::string &password_hash, const std::string &local_root_path, const Permission permissions)
+  {
+    return ftp_server_->addUserWithPasswordHash(username, password_hash, local_root_path, permissions);
+  }
+
+  std::string FtpServer::createPasswordHash(const std::string &password, std::uint32_t iterations)
+  {
+    return PasswordHash::create(password, iterations);
+  }
+
   bool FtpServer::addUserAnonymous(const std::string &local_root_path, const Permission permissions)
   {
     return ftp_server_->addUserAnonymous(local_root_path, permissions);
   }
 
+  bool FtpServer::removeUser(const std::string &username)
+  {
+    return ftp_server_->removeUser(username);
+  }
+
+  bool FtpServer::setUserFile(const std::string &path)
+  {
+    return ftp_server_->setUserFile(path);
+  }
+
   bool FtpServer::start(size_t thread_count)
   {
     assert(thread_count > 0);
@@ -76,4 +98,59 @@ namespace fineftp
   {
     ftp_server_->setCommandCallback(callback);
   }
+
+  void FtpServer::setModeZCompressionLevel(int level)
+  {
+    ftp_server_->setModeZCompressionLevel(level);
+  }
+
+  void FtpServer::setUploadChecksumsEnabled(bool enabled)
+  {
+    ftp_server_->setUploadChecksumsEnabled(enabled);
+  }
+
+  void FtpServer::setAtomicUploadsEnabled(bool enabled)
+  {
+    ftp_server_->setAtomicUploadsEnabled(enabled);
+  }
+
+  void FtpServer::setUploadDurability(UploadDurability durability, std::uint64_t writeback_interval)
+  {
+    ftp_server_->setUploadDurability(durability, writeback_interval);
+  }
+
+  void FtpServer::setSpliceUploadsEnabled(bool enabled)
+  {
+    ftp_server_->setSpliceUploadsEnabled(enabled);
+  }
+
+  void FtpServer::setPasswordVerification(std::size_t thread_count, std::chrono::seconds cache_ttl)
+  {
+    ftp_server_->setPasswordVerification(thread_count, cache_ttl);
+  }
+
+  void FtpServer::setStorageQuota(const std::string &local_root_path, std::uint64_t max_bytes)
+  {
+    ftp_server_->setStorageQuota(local_root_path, max_bytes);
+  }
+
+  void FtpServer::setRootConfinementEnabled(bool enabled)
+  {
+    ftp_server_->setRootConfinementEnabled(enabled);
+  }
+
+  void FtpServer::setTimeouts(std::chrono::seconds idle_timeout, std::chrono::seconds login_timeout, std::chrono::seconds data_connect_timeout)
+  {
+    ftp_server_->setTimeouts(idle_timeout, login_timeout, data_connect_timeout);
+  }
+
+  void FtpServer::setSessionLimits(std::size_t max_sessions, std::size_t max_sessions_per_address, std::size_t max_sessions_per_user)
+  {
+    ftp_server_->setSessionLimits(max_sessions, max_sessions_per_address, max_sessions_per_user);
+  }
+
+  void FtpServer::setAcceptBatchSize(std::size_t batch_size)
+  {
+    ftp_server_->setAcceptBatchSize(batch_size);
+  }
 }
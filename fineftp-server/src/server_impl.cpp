@@ -1,7 +1,13 @@
 #include "server_impl.h"
 
+#include "block_pool.h"
 #include "ftp_session.h"
+#include "root_directory.h"
+#include "timer_wheel.h"
 
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
 #include <memory>
 #include <iostream>
 #include <string>
@@ -9,15 +15,45 @@
 #include <cstdint>
 #include <cstddef>
 
+#include <fineftp/durability.h>
 #include <fineftp/permissions.h>
 
 #include <asio.hpp> // IWYU pragma: keep
 
 namespace fineftp
 {
+  namespace
+  {
+    // The memory of up to this many closed sessions is kept for new sessions
+    constexpr std::size_t max_pooled_sessions = 1024;
+
+    // Timeouts are measured in whole seconds. A revolution of the wheel takes
+    // a few minutes, so common timeouts expire on their first visit.
+    constexpr std::chrono::seconds timer_wheel_tick(1);
+    constexpr std::size_t          timer_wheel_slots = 512;
+
+    // When the server runs out of file descriptors or buffers, accepting
+    // again right away would fail again. The clients wait in the backlog.
+    constexpr std::chrono::milliseconds accept_retry_delay(100);
+
+    // Replies to connections that are rejected in the accept loop. They are
+    // written once without waiting, as no session exists for the connection.
+    constexpr char too_many_sessions_reply[]              = "421 Too many sessions, try again later\r\n";
+    constexpr char too_many_sessions_from_address_reply[] = "421 Too many sessions from your address, try again later\r\n";
+
+    void rejectConnection(asio::ip::tcp::socket &socket, const asio::const_buffer &reply)
+    {
+      // The reply fits into the send buffer of the new socket
+      asio::error_code ec;
+      socket.non_blocking(true, ec);
+      socket.write_some(reply, ec);
+      socket.shutdown(asio::ip::tcp::socket::shutdown_both, ec);
+      socket.close(ec);
+    }
+  }
 
   FtpServerImpl::FtpServerImpl(const std::string &address, const uint16_t port, std::ostream &output, std::ostream &error)
-      : ftp_users_(output, error), port_(port), address_(address), acceptor_(io_context_), open_connection_count_(0), output_(output), error_(error)
+      : ftp_users_(output, error), admission_control_(settings_, ftp_users_), port_(port), address_(address), acceptor_(io_context_), accept_retry_timer_(io_context_), timer_wheel_(std::make_shared<TimerWheel>(io_context_, timer_wheel_tick, timer_wheel_slots)), session_pool_(std::make_shared<BlockPool>(max_pooled_sessions)), output_(output), error_(error)
   {
   }
 
@@ -31,15 +67,51 @@ namespace fineftp
     return ftp_users_.addUser(username, password, local_root_path, permissions);
   }
 
+  bool FtpServerImpl::addUserWithPasswordHash(const std::string &username, const std::string &password_hash, const std::string &local_root_path, const Permission permissions)
+  {
+    return ftp_users_.addUserWithPasswordHash(username, password_hash, local_root_path, permissions);
+  }
+
   bool FtpServerImpl::addUserAnonymous(const std::string &local_root_path, const Permission permissions)
   {
     return ftp_users_.addUser("anonymous", "", local_root_path, permissions);
   }
 
+  bool FtpServerImpl::removeUser(const std::string &username)
+  {
+    return ftp_users_.removeUser(username);
+  }
+
+  bool FtpServerImpl::setUserFile(const std::string &path)
+  {
+    if (!ftp_users_.loadUserFile(path))
+      return false;
+
+    user_file_path_ = path;
+    return true;
+  }
+
   bool FtpServerImpl::start(size_t thread_count)
   {
-    auto ftp_session = std::make_shared<FtpSession>(io_context_, ftp_users_, [this]()
-                                                    { open_connection_count_--; }, output_, error_);
+    worker_pool_      = std::make_unique<asio::thread_pool>(std::max<std::size_t>(1, settings_.worker_thread_count));
+    upload_committer_ = std::make_unique<UploadCommitter>(*worker_pool_, settings_.upload_durability);
+    password_verifier_ = std::make_unique<PasswordVerifier>(ftp_users_, std::max<std::size_t>(1, settings_.password_verification_thread_count), settings_.password_cache_ttl, error_);
+    quota_manager_    = std::make_unique<QuotaManager>(settings_.storage_quotas, error_);
+
+    // The quotas are only enforced once the initial scan has determined the usage
+    quota_manager_->startScan(*worker_pool_);
+
+    if (settings_.root_confinement_enabled && !RootDirectory::isSupported())
+      error_ << "Paths cannot be confined to the root directories: openat2() is not supported on this system" << std::endl;
+
+    timer_wheel_->start();
+
+    if (!user_file_path_.empty())
+    {
+      // A file that cannot be watched is not fatal, the users are loaded already
+      user_file_watcher_ = std::make_unique<UserFileWatcher>(io_context_, ftp_users_, user_file_path_, error_);
+      user_file_watcher_->start();
+    }
 
     // set up the acceptor to listen on the tcp port
     asio::error_code make_address_ec;
@@ -90,16 +162,24 @@ namespace fineftp
       }
     }
 
+    if (settings_.accept_batch_size > 1)
+    {
+      // The connections of a batch are accepted with synchronous calls that must not block
+      asio::error_code ec;
+      acceptor_.non_blocking(true, ec);
+      if (ec)
+      {
+        error_ << "Error setting acceptor to non-blocking mode: " << ec.message() << std::endl;
+        return false;
+      }
+    }
+
 #ifndef NDEBUG
     output_ << "FTP Server created." << std::endl
             << "Listening at address " << acceptor_.local_endpoint().address() << " on port " << acceptor_.local_endpoint().port() << ":" << std::endl;
 #endif // NDEBUG
 
-    acceptor_.async_accept(ftp_session->getSocket(), [this, ftp_session](auto ec)
-                           {
-                            open_connection_count_++;
-
-                            acceptFtpSession(ftp_session, ec); });
+    acceptFtpSession();
 
     for (size_t i = 0; i < thread_count; i++)
     {
@@ -118,37 +198,118 @@ namespace fineftp
       thread.join();
     }
     thread_pool_.clear();
+
+    // The timer must be destroyed before the io_context
+    timer_wheel_->stop();
+
+    if (worker_pool_)
+    {
+      // Abandon all checksums etc. that have not been started, yet
+      worker_pool_->stop();
+      worker_pool_->join();
+    }
+
+    if (password_verifier_)
+    {
+      password_verifier_->stop();
+    }
   }
 
-  void FtpServerImpl::acceptFtpSession(const std::shared_ptr<FtpSession> &ftp_session, asio::error_code const &error)
+  void FtpServerImpl::acceptFtpSession()
   {
-    if (error)
-    {
+    // The session is only created once a client has connected, so there is no idle session waiting for the next connection
+    acceptor_.async_accept([this](const asio::error_code &error, asio::ip::tcp::socket socket)
+                           {
+                             if (error)
+                             {
+                               // The acceptor has been closed
+                               if ((error == asio::error::operation_aborted) || !acceptor_.is_open())
+                                 return;
+
 #ifndef NDEBUG
-      error_ << "Error handling connection: " << error.message() << std::endl;
+                               error_ << "Error handling connection: " << error.message() << std::endl;
 #endif
+
+                               if ((error == asio::error::no_descriptors)
+                                   || (error == asio::error_code(ENFILE, asio::error::get_system_category()))
+                                   || (error == asio::error::no_buffer_space)
+                                   || (error == asio::error::no_memory))
+                               {
+                                 accept_retry_timer_.expires_after(accept_retry_delay);
+                                 accept_retry_timer_.async_wait([this](const asio::error_code &ec)
+                                                                {
+                                                                  if (!ec)
+                                                                    acceptFtpSession();
+                                                                });
+                                 return;
+                               }
+
+                               // Other errors only affect the connection (e.g. it has been aborted by the client)
+                               acceptFtpSession();
+                               return;
+                             }
+
+                             admitFtpSession(std::move(socket));
+
+                             // When many clients connect at once, the connections that
+                             // are pending already are accepted without going through
+                             // the io_context for each of them.
+                             for (std::size_t i = 1; i < settings_.accept_batch_size; i++)
+                             {
+                               asio::error_code accept_ec;
+                               asio::ip::tcp::socket pending_socket = acceptor_.accept(accept_ec);
+                               if (accept_ec)
+                                 break;
+
+                               admitFtpSession(std::move(pending_socket));
+                             }
+
+                             acceptFtpSession();
+                           });
+  }
+
+  void FtpServerImpl::admitFtpSession(asio::ip::tcp::socket socket)
+  {
+    asio::error_code ec;
+    const asio::ip::tcp::endpoint remote_endpoint = socket.remote_endpoint(ec);
+    if (ec)
+    {
+      // The client has disconnected already
+      socket.close(ec);
       return;
     }
 
+    // Rejected connections never get a session, so they cost nothing but the reply
+    switch (admission_control_.admitConnection(remote_endpoint.address()))
+    {
+    case AdmissionControl::Result::Admitted:
+      startFtpSession(std::move(socket), remote_endpoint.address());
+      break;
+    case AdmissionControl::Result::TooManySessions:
+      rejectConnection(socket, asio::buffer(too_many_sessions_reply, sizeof(too_many_sessions_reply) - 1));
+      break;
+    case AdmissionControl::Result::TooManySessionsFromAddress:
+      rejectConnection(socket, asio::buffer(too_many_sessions_from_address_reply, sizeof(too_many_sessions_from_address_reply) - 1));
+      break;
+    }
+  }
+
+  void FtpServerImpl::startFtpSession(asio::ip::tcp::socket socket, const asio::ip::address &remote_address)
+  {
 #ifndef NDEBUG
-    output_ << "FTP Client connected: " << ftp_session->getSocket().remote_endpoint().address().to_string() << ":" << ftp_session->getSocket().remote_endpoint().port() << std::endl;
+    output_ << "FTP Client connected: " << remote_address.to_string() << std::endl;
 #endif
 
+    auto ftp_session = std::allocate_shared<FtpSession>(PoolAllocator<FtpSession>(session_pool_), io_context_, std::move(socket), *worker_pool_, *upload_committer_, *password_verifier_, *quota_manager_, admission_control_, timer_wheel_, settings_, [this, remote_address]()
+                                                        { admission_control_.releaseConnection(remote_address); }, output_, error_);
+
     ftp_session->setCommandCallback(command_callback_);
     ftp_session->start();
-
-    auto new_session = std::make_shared<FtpSession>(io_context_, ftp_users_, [this]()
-                                                    { open_connection_count_--; }, output_, error_);
-
-    acceptor_.async_accept(new_session->getSocket(), [this, new_session](auto ec)
-                           {
-                            open_connection_count_++;
-                            acceptFtpSession(new_session, ec); });
   }
 
   int FtpServerImpl::getOpenConnectionCount()
   {
-    return open_connection_count_;
+    return admission_control_.connectionCount();
   }
 
   uint16_t FtpServerImpl::getPort()
@@ -165,4 +326,65 @@ namespace fineftp
   {
     command_callback_ = callback;
   }
+
+  void FtpServerImpl::setModeZCompressionLevel(int level)
+  {
+    settings_.mode_z_compression_level = std::max(0, std::min(9, level));
+  }
+
+  void FtpServerImpl::setUploadChecksumsEnabled(bool enabled)
+  {
+    settings_.upload_checksums_enabled = enabled;
+  }
+
+  void FtpServerImpl::setAtomicUploadsEnabled(bool enabled)
+  {
+    settings_.atomic_uploads_enabled = enabled;
+  }
+
+  void FtpServerImpl::setUploadDurability(UploadDurability durability, std::uint64_t writeback_interval)
+  {
+    settings_.upload_durability         = durability;
+    settings_.upload_writeback_interval = writeback_interval;
+  }
+
+  void FtpServerImpl::setSpliceUploadsEnabled(bool enabled)
+  {
+    settings_.splice_uploads_enabled = enabled;
+  }
+
+  void FtpServerImpl::setPasswordVerification(std::size_t thread_count, std::chrono::seconds cache_ttl)
+  {
+    settings_.password_verification_thread_count = thread_count;
+    settings_.password_cache_ttl                 = cache_ttl;
+  }
+
+  void FtpServerImpl::setStorageQuota(const std::string &local_root_path, std::uint64_t max_bytes)
+  {
+    settings_.storage_quotas[local_root_path] = max_bytes;
+  }
+
+  void FtpServerImpl::setRootConfinementEnabled(bool enabled)
+  {
+    settings_.root_confinement_enabled = enabled;
+  }
+
+  void FtpServerImpl::setTimeouts(std::chrono::seconds idle_timeout, std::chrono::seconds login_timeout, std::chrono::seconds data_connect_timeout)
+  {
+    settings_.idle_timeout         = std::max(std::chrono::seconds(0), idle_timeout);
+    settings_.login_timeout        = std::max(std::chrono::seconds(0), login_timeout);
+    settings_.data_connect_timeout = std::max(std::chrono::seconds(0), data_connect_timeout);
+  }
+
+  void FtpServerImpl::setSessionLimits(std::size_t max_sessions, std::size_t max_sessions_per_address, std::size_t max_sessions_per_user)
+  {
+    settings_.max_sessions             = max_sessions;
+    settings_.max_sessions_per_address = max_sessions_per_address;
+    settings_.max_sessions_per_user    = max_sessions_per_user;
+  }
+
+  void FtpServerImpl::setAcceptBatchSize(std::size_t batch_size)
+  {
+    settings_.accept_batch_size = std::max<std::size_t>(1, batch_size);
+  }
 }
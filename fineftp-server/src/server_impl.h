@@ -1,6 +1,6 @@
 #pragma once
 
-#include <atomic>
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
 #include <memory>
@@ -11,10 +11,19 @@
 
 #include <asio.hpp> // IWYU pragma: keep
 
+#include <fineftp/durability.h>
 #include <fineftp/permissions.h>
+#include <admission_control.h>
+#include <block_pool.h>
 #include <ftp_session.h>
 
+#include <server_settings.h>
+#include <storage_quota.h>
+#include <timer_wheel.h>
+#include <password_verifier.h>
+#include <upload_committer.h>
 #include <user_database.h>
+#include <user_file_watcher.h>
 #include <fineftp/callback_types.h>
 
 namespace fineftp
@@ -35,7 +44,10 @@ namespace fineftp
     ~FtpServerImpl();
 
     bool addUser(const std::string &username, const std::string &password, const std::string &local_root_path, Permission permissions);
+    bool addUserWithPasswordHash(const std::string &username, const std::string &password_hash, const std::string &local_root_path, Permission permissions);
     bool addUserAnonymous(const std::string &local_root_path, Permission permissions);
+    bool removeUser(const std::string &username);
+    bool setUserFile(const std::string &path);
 
     bool start(size_t thread_count = 1);
 
@@ -49,11 +61,37 @@ namespace fineftp
 
     void setCommandCallback(const FtpCommandCallback &callback);
 
+    void setModeZCompressionLevel(int level);
+
+    void setUploadChecksumsEnabled(bool enabled);
+
+    void setAtomicUploadsEnabled(bool enabled);
+
+    void setUploadDurability(UploadDurability durability, std::uint64_t writeback_interval);
+
+    void setSpliceUploadsEnabled(bool enabled);
+
+    void setPasswordVerification(std::size_t thread_count, std::chrono::seconds cache_ttl);
+
+    void setStorageQuota(const std::string &local_root_path, std::uint64_t max_bytes);
+    void setRootConfinementEnabled(bool enabled);
+
+    void setTimeouts(std::chrono::seconds idle_timeout, std::chrono::seconds login_timeout, std::chrono::seconds data_connect_timeout);
+
+    void setSessionLimits(std::size_t max_sessions, std::size_t max_sessions_per_address, std::size_t max_sessions_per_user);
+    void setAcceptBatchSize(std::size_t batch_size);
+
   private:
-    void acceptFtpSession(const std::shared_ptr<FtpSession> &ftp_session, asio::error_code const &error);
+    void acceptFtpSession();
+    void admitFtpSession(asio::ip::tcp::socket socket);
+    void startFtpSession(asio::ip::tcp::socket socket, const asio::ip::address &remote_address);
 
   private:
     UserDatabase ftp_users_;
+    ServerSettings settings_;
+
+    // Counts the sessions. Sessions may outlive the io_context, so it must be declared before it.
+    AdmissionControl admission_control_;
 
     const uint16_t port_;
     const std::string address_;
@@ -61,8 +99,23 @@ namespace fineftp
     std::vector<std::thread> thread_pool_;
     asio::io_context io_context_;
     asio::ip::tcp::acceptor acceptor_;
+    asio::steady_timer accept_retry_timer_;   // Delays accepting again when the server ran out of resources
+
+    // Worker threads for long running tasks (e.g. computing checksums), so
+    // they don't block the io_context. Created in start().
+    std::unique_ptr<asio::thread_pool> worker_pool_;
+    std::unique_ptr<UploadCommitter>   upload_committer_;
+    std::unique_ptr<PasswordVerifier>  password_verifier_;
+    std::unique_ptr<QuotaManager>      quota_manager_;
+
+    std::string                        user_file_path_;
+    std::unique_ptr<UserFileWatcher>   user_file_watcher_;
+
+    // Drives the timeouts of all sessions. Shared, as sessions may outlive the server in the io_context.
+    std::shared_ptr<TimerWheel>        timer_wheel_;
 
-    std::atomic<int> open_connection_count_;
+    // Recycles the memory of closed sessions
+    std::shared_ptr<BlockPool>         session_pool_;
 
     std::ostream &output_; /* Normal output log */
     std::ostream &error_;  /* Error output log */
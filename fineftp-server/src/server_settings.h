@@ -0,0 +1,40 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+
+#include <fineftp/durability.h>
+
+namespace fineftp
+{
+  /**
+   * @brief Server-wide settings that apply to all FTP sessions
+   *
+   * The settings are owned by the FtpServerImpl and handed to each session
+   * by reference. They must only be modified before the server is started.
+   */
+  struct ServerSettings
+  {
+    int         mode_z_compression_level = 6;   /**< Default zlib compression level for MODE Z transfers. Clients may change it with OPTS MODE Z LEVEL. */
+    bool        atomic_uploads_enabled   = false;   /**< Write STOR uploads to a hidden temporary file and rename it to the target path when complete. */
+    bool        upload_checksums_enabled = false;   /**< Compute the checksum of uploads while receiving them, so a HASH command does not have to read the file again. */
+    std::size_t worker_thread_count      = 2;   /**< Number of threads for CPU or disk heavy work (e.g. checksums) that must not block the io_context threads. */
+    UploadDurability upload_durability   = UploadDurability::None;   /**< When uploaded files are flushed to disk and the "226" reply is sent. */
+    std::uint64_t upload_writeback_interval = 8 * 1024 * 1024;   /**< Number of bytes after which the writeback of uploads is started with UploadDurability::PeriodicWriteback. */
+    bool        splice_uploads_enabled   = false;   /**< Receive STOR uploads with splice() on Linux, so the data is never copied to user space. */
+    std::size_t password_verification_thread_count = 1;   /**< Number of threads that verify password hashes. Limits the CPU time spent on logins. */
+    std::chrono::seconds password_cache_ttl   = std::chrono::seconds(60);   /**< How long a successful login with a password hash is cached. 0 disables the cache. */
+    std::map<std::string, std::uint64_t> storage_quotas;   /**< Maximum number of bytes that may be stored in a local root directory, by its path. */
+    bool        root_confinement_enabled = false;   /**< Resolve all paths beneath the user's root directory with openat2(RESOLVE_BENEATH) on Linux, so symlinks cannot lead out of it. */
+    std::chrono::seconds idle_timeout         = std::chrono::seconds(0);   /**< Close sessions of logged in users that have not sent a command for this time and have no transfer running. 0 disables the timeout. */
+    std::chrono::seconds login_timeout        = std::chrono::seconds(0);   /**< Close sessions that have not logged in within this time after connecting. 0 disables the timeout. */
+    std::chrono::seconds data_connect_timeout = std::chrono::seconds(0);   /**< Close the passive mode acceptor if the client has not connected within this time. 0 disables the timeout. */
+    std::size_t max_sessions             = 0;   /**< Maximum number of sessions. Further connections are rejected in the accept loop. 0 means unlimited. */
+    std::size_t max_sessions_per_address = 0;   /**< Maximum number of sessions from one client IP address. 0 means unlimited. */
+    std::size_t max_sessions_per_user    = 0;   /**< Maximum number of sessions that are logged in as the same user. 0 means unlimited. */
+    std::size_t accept_batch_size        = 1;   /**< Maximum number of pending connections accepted at once, before waiting for the next connection again. */
+  };
+}
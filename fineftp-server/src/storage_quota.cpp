@@ -0,0 +1,226 @@
+#include "storage_quota.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <asio.hpp> // IWYU pragma: keep
+
+#include "filesystem.h"
+
+namespace fineftp
+{
+  namespace
+  {
+    // Directory symlinks (or junctions) are followed, so a loop must not lead to an endless scan
+    constexpr std::size_t max_dir_depth = 64;
+
+    std::int64_t scanDirectory(const std::string& local_path, std::size_t depth, std::ostream& error)
+    {
+      if (depth >= max_dir_depth)
+      {
+        error << "Not counting the content of " << local_path << " for the quota: Directory tree too deep" << std::endl;
+        return 0;
+      }
+
+      std::int64_t size = 0;
+      for (const auto& entry : Filesystem::dirContent(local_path, error))
+      {
+        if ((entry.first == ".") || (entry.first == ".."))
+          continue;
+
+        if (entry.second.type() == Filesystem::FileType::RegularFile)
+          size += entry.second.fileSize();
+        else if (entry.second.type() == Filesystem::FileType::Dir)
+          size += scanDirectory(local_path + "/" + entry.first, depth + 1, error);
+      }
+      return size;
+    }
+
+    // Returns true if the path is the root directory or inside of it. Both paths must be clean.
+    bool isInside(const std::string& path, const std::string& root_path)
+    {
+      if (path.compare(0, root_path.size(), root_path) != 0)
+        return false;
+
+      if ((path.size() == root_path.size()) || (!root_path.empty() && ((root_path.back() == '/') || (root_path.back() == '\\'))))
+        return true;
+
+#ifdef WIN32
+      return ((path[root_path.size()] == '\\') || (path[root_path.size()] == '/'));
+#else
+      return (path[root_path.size()] == '/');
+#endif // WIN32
+    }
+  }
+
+  ////////////////////////////////////////////////////////
+  // StorageQuota
+  ////////////////////////////////////////////////////////
+
+  StorageQuota::StorageQuota(const std::string& local_root_path, std::uint64_t limit)
+    : local_root_path_(local_root_path)
+    , limit_          (limit)
+    , used_bytes_     (0)
+    , scanned_        (false)
+  {}
+
+  const std::string& StorageQuota::localRootPath() const
+  {
+    return local_root_path_;
+  }
+
+  std::uint64_t StorageQuota::limit() const
+  {
+    return limit_;
+  }
+
+  bool StorageQuota::scanned() const
+  {
+    return scanned_;
+  }
+
+  std::int64_t StorageQuota::usedBytes() const
+  {
+    return used_bytes_;
+  }
+
+  void StorageQuota::add(std::int64_t bytes)
+  {
+    used_bytes_ += bytes;
+  }
+
+  void StorageQuota::completeScan(std::int64_t scanned_bytes)
+  {
+    used_bytes_ += scanned_bytes;
+    scanned_     = true;
+  }
+
+  ////////////////////////////////////////////////////////
+  // QuotaSet
+  ////////////////////////////////////////////////////////
+
+  QuotaSet::QuotaSet(std::vector<std::shared_ptr<StorageQuota>> quotas)
+    : quotas_(std::move(quotas))
+  {}
+
+  bool QuotaSet::empty() const
+  {
+    return quotas_.empty();
+  }
+
+  std::int64_t QuotaSet::available() const
+  {
+    std::int64_t available = std::numeric_limits<std::int64_t>::max();
+    for (const auto& quota : quotas_)
+    {
+      if (quota->scanned())
+        available = std::min(available, static_cast<std::int64_t>(quota->limit()) - quota->usedBytes());
+    }
+    return available;
+  }
+
+  void QuotaSet::add(std::int64_t bytes)
+  {
+    if (bytes == 0)
+      return;
+
+    for (const auto& quota : quotas_)
+      quota->add(bytes);
+  }
+
+  QuotaSet QuotaSet::without(const QuotaSet& other) const
+  {
+    std::vector<std::shared_ptr<StorageQuota>> quotas;
+    for (const auto& quota : quotas_)
+    {
+      if (std::find(other.quotas_.begin(), other.quotas_.end(), quota) == other.quotas_.end())
+        quotas.push_back(quota);
+    }
+    return QuotaSet(std::move(quotas));
+  }
+
+  ////////////////////////////////////////////////////////
+  // UploadQuota
+  ////////////////////////////////////////////////////////
+
+  UploadQuota::UploadQuota(const QuotaSet& quotas, bool atomic, std::int64_t replaced_size)
+    : quotas_       (quotas)
+    , atomic_       (atomic)
+    , replaced_size_(replaced_size)
+    , written_size_ (0)
+    , committed_    (false)
+  {}
+
+  UploadQuota::~UploadQuota()
+  {
+    // The temporary file of an atomic upload that has not been committed is deleted
+    if (atomic_ && !committed_)
+      quotas_.add(-written_size_);
+  }
+
+  std::int64_t UploadQuota::available() const
+  {
+    return quotas_.available();
+  }
+
+  void UploadQuota::addWrittenBytes(std::uint64_t size)
+  {
+    quotas_.add(static_cast<std::int64_t>(size));
+    written_size_ += static_cast<std::int64_t>(size);
+  }
+
+  void UploadQuota::committed()
+  {
+    if (atomic_ && !committed_)
+      quotas_.add(-replaced_size_);
+    committed_ = true;
+  }
+
+  ////////////////////////////////////////////////////////
+  // QuotaManager
+  ////////////////////////////////////////////////////////
+
+  QuotaManager::QuotaManager(const std::map<std::string, std::uint64_t>& limits, std::ostream& error)
+    : error_(error)
+  {
+    quotas_.reserve(limits.size());
+    for (const auto& limit : limits)
+      quotas_.push_back(std::make_shared<StorageQuota>(Filesystem::cleanPathNative(limit.first), limit.second));
+  }
+
+  void QuotaManager::startScan(asio::thread_pool& worker_pool)
+  {
+    for (const auto& quota : quotas_)
+    {
+      asio::post(worker_pool, [quota, &error = error_]()
+                 {
+                   quota->completeScan(QuotaManager::directorySize(quota->localRootPath(), error));
+                 });
+    }
+  }
+
+  QuotaSet QuotaManager::quotasFor(const std::string& local_path) const
+  {
+    std::vector<std::shared_ptr<StorageQuota>> quotas;
+    for (const auto& quota : quotas_)
+    {
+      if (isInside(local_path, quota->localRootPath()))
+        quotas.push_back(quota);
+    }
+    return QuotaSet(std::move(quotas));
+  }
+
+  std::int64_t QuotaManager::directorySize(const std::string& local_path, std::ostream& error)
+  {
+    return scanDirectory(local_path, 0, error);
+  }
+}
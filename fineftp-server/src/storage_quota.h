@@ -0,0 +1,167 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <asio.hpp> // IWYU pragma: keep
+
+namespace fineftp
+{
+  /**
+   * @brief The storage quota of one local root directory
+   *
+   * The usage is determined once by scanning the directory tree and then
+   * updated with the changes made through the server. Until the scan has
+   * completed, the usage is unknown and the quota is not enforced. Changes
+   * made during the scan are counted in addition to the scan result, so
+   * the usage may be slightly off until the next start of the server.
+   * Changes made by other processes are not noticed.
+   *
+   * The StorageQuota is thread safe.
+   */
+  class StorageQuota
+  {
+  public:
+    StorageQuota(const std::string& local_root_path, std::uint64_t limit);
+
+    const std::string& localRootPath() const;
+    std::uint64_t      limit()         const;
+
+    bool         scanned()   const;
+    std::int64_t usedBytes() const;
+
+    /** @brief Adds the bytes to the usage. Negative values free space. */
+    void add(std::int64_t bytes);
+
+    /** @brief Adds the result of the initial scan and starts enforcing the quota */
+    void completeScan(std::int64_t scanned_bytes);
+
+  private:
+    const std::string         local_root_path_;
+    const std::uint64_t       limit_;
+    std::atomic<std::int64_t> used_bytes_;
+    std::atomic<bool>         scanned_;
+  };
+
+  /**
+   * @brief The quotas that apply to a path
+   *
+   * Root directories may be nested (e.g. one user's root is a subdirectory
+   * of another user's root), so a change may count for several quotas.
+   */
+  class QuotaSet
+  {
+  public:
+    QuotaSet() = default;
+    explicit QuotaSet(std::vector<std::shared_ptr<StorageQuota>> quotas);
+
+    bool empty() const;
+
+    /**
+     * @brief Returns the number of bytes that can be added without exceeding any of the quotas
+     *
+     * @return The available bytes (negative if a quota is exceeded already) or INT64_MAX if no quota is enforced
+     */
+    std::int64_t available() const;
+
+    /** @brief Adds the bytes to all quotas. Negative values free space. */
+    void add(std::int64_t bytes);
+
+    /** @brief Returns the quotas that are not contained in the other set */
+    QuotaSet without(const QuotaSet& other) const;
+
+  private:
+    std::vector<std::shared_ptr<StorageQuota>> quotas_;
+  };
+
+  /**
+   * @brief Accounts the data written by one upload
+   *
+   * The written bytes are added to the quotas as they arrive. The receiver
+   * checks the available space before writing each buffer, so concurrent
+   * uploads may exceed a quota by up to one buffer each. Atomic uploads
+   * replace an existing file only when they are committed, so the size of
+   * that file is freed then. If an atomic upload is not committed, its
+   * temporary file is deleted and the written bytes are freed again when the
+   * UploadQuota is destroyed.
+   *
+   * @note The implementation is NOT thread safe!
+   */
+  class UploadQuota
+  {
+  public:
+    /**
+     * @param quotas:        The quotas of the uploaded file
+     * @param atomic:        Whether the upload is written to a temporary file
+     * @param replaced_size: The size of the existing file that an atomic upload replaces when it is committed
+     */
+    UploadQuota(const QuotaSet& quotas, bool atomic, std::int64_t replaced_size);
+
+    // Copy and move disabled, as the destructor frees the bytes
+    UploadQuota(const UploadQuota&)            = delete;
+    UploadQuota& operator=(const UploadQuota&) = delete;
+    UploadQuota(UploadQuota&&)                 = delete;
+    UploadQuota& operator=(UploadQuota&&)      = delete;
+
+    ~UploadQuota();
+
+    /** @brief Returns the number of bytes that can still be written, see QuotaSet::available() */
+    std::int64_t available() const;
+
+    /** @brief Adds bytes that have been written */
+    void addWrittenBytes(std::uint64_t size);
+
+    /** @brief Must be called when the file has been committed successfully */
+    void committed();
+
+  private:
+    QuotaSet           quotas_;
+    const bool         atomic_;
+    const std::int64_t replaced_size_;
+    std::int64_t       written_size_;
+    bool               committed_;
+  };
+
+  /**
+   * @brief The storage quotas of all local root directories
+   *
+   * The quotas are configured before the server is started and are never
+   * changed afterwards, so looking them up needs no lock. The QuotaManager
+   * is shared by all sessions and thread safe.
+   */
+  class QuotaManager
+  {
+  public:
+    /**
+     * @param limits:  The maximum number of bytes per local root directory
+     * @param error:   Stream for logging errors of the initial scan
+     */
+    QuotaManager(const std::map<std::string, std::uint64_t>& limits, std::ostream& error);
+
+    // Copy and move disabled (as we are storing the this pointer in lambda captures)
+    QuotaManager(const QuotaManager&)            = delete;
+    QuotaManager& operator=(const QuotaManager&) = delete;
+    QuotaManager(QuotaManager&&)                 = delete;
+    QuotaManager& operator=(QuotaManager&&)      = delete;
+
+    ~QuotaManager() = default;
+
+    /** @brief Starts the initial scan of all root directories on the worker pool */
+    void startScan(asio::thread_pool& worker_pool);
+
+    /** @brief Returns the quotas of all root directories that contain the local path */
+    QuotaSet quotasFor(const std::string& local_path) const;
+
+    /** @brief Returns the total size of the regular files in the directory tree */
+    static std::int64_t directorySize(const std::string& local_path, std::ostream& error);
+
+  private:
+    std::vector<std::shared_ptr<StorageQuota>> quotas_;
+    std::ostream&                              error_;
+  };
+}
@@ -0,0 +1,590 @@
+#include "tar_extractor.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <fineftp/permissions.h>
+
+#include <file_man.h>
+
+#include "filesystem.h"
+#include "root_directory.h"
+
+namespace fineftp
+{
+  namespace
+  {
+    constexpr std::size_t block_size = 512;
+
+    // pax headers and GNU long names are kept in memory, so their size is limited
+    constexpr std::uint64_t max_extended_data_size = 64 * 1024;
+
+    // Field offsets and sizes of the ustar header
+    constexpr std::size_t name_offset     = 0;
+    constexpr std::size_t name_size       = 100;
+    constexpr std::size_t size_offset     = 124;
+    constexpr std::size_t mtime_offset    = 136;
+    constexpr std::size_t checksum_offset = 148;
+    constexpr std::size_t type_offset     = 156;
+    constexpr std::size_t magic_offset    = 257;
+    constexpr std::size_t prefix_offset   = 345;
+    constexpr std::size_t prefix_size     = 155;
+
+    std::size_t paddingSize(std::uint64_t size)
+    {
+      return static_cast<std::size_t>((block_size - (size % block_size)) % block_size);
+    }
+
+    // Returns the NUL terminated string of a header field, which may also use the full field size
+    std::string stringField(const char* field, std::size_t field_size)
+    {
+      return std::string(field, std::find(field, field + field_size, '\0'));
+    }
+
+    // Parses a numeric header field. It is either octal, or base-256 if the first bit is set (GNU extension for large values).
+    bool parseNumberField(const char* field, std::size_t field_size, std::uint64_t& value)
+    {
+      value = 0;
+
+      if ((static_cast<unsigned char>(field[0]) & 0x80U) != 0)
+      {
+        // Negative base-256 numbers are not supported
+        if ((static_cast<unsigned char>(field[0]) & 0x40U) != 0)
+          return false;
+
+        value = (static_cast<unsigned char>(field[0]) & 0x3FU);
+        for (std::size_t i = 1; i < field_size; i++)
+        {
+          if (value > (UINT64_MAX >> 8U))
+            return false;
+          value = (value << 8U) | static_cast<unsigned char>(field[i]);
+        }
+        return true;
+      }
+
+      std::size_t i = 0;
+      while ((i < field_size) && (field[i] == ' '))
+        i++;
+
+      for (; (i < field_size) && (field[i] != '\0') && (field[i] != ' '); i++)
+      {
+        if ((field[i] < '0') || (field[i] > '7'))
+          return false;
+        value = (value << 3U) | static_cast<std::uint64_t>(field[i] - '0');
+      }
+      return true;
+    }
+
+    // Parses a decimal number of a pax record
+    bool parseDecimal(const std::string& text, std::uint64_t& value)
+    {
+      value = 0;
+      if (text.empty() || (text.size() > 19))
+        return false;
+
+      for (const char c : text)
+      {
+        if ((c < '0') || (c > '9'))
+          return false;
+        value = (value * 10) + static_cast<std::uint64_t>(c - '0');
+      }
+      return true;
+    }
+
+    // Parses the pax mtime, i.e. seconds with an optional fraction
+    bool parsePaxTime(const std::string& text, std::int64_t& seconds, std::uint32_t& nanoseconds)
+    {
+      const std::size_t dot_pos = text.find('.');
+
+      std::uint64_t unsigned_seconds = 0;
+      if (!parseDecimal(text.substr(0, dot_pos), unsigned_seconds))
+        return false;
+
+      seconds     = static_cast<std::int64_t>(unsigned_seconds);
+      nanoseconds = 0;
+
+      if (dot_pos != std::string::npos)
+      {
+        std::string fraction = text.substr(dot_pos + 1, 9);
+        fraction.resize(9, '0');
+
+        std::uint64_t fraction_ns = 0;
+        if (!parseDecimal(fraction, fraction_ns))
+          return false;
+        nanoseconds = static_cast<std::uint32_t>(fraction_ns);
+      }
+      return true;
+    }
+
+    bool hasPermission(Permission permissions, Permission required)
+    {
+      return (static_cast<int>(permissions & required) != 0);
+    }
+  }
+
+  TarExtractor::TarExtractor(const std::string& local_dir_path, Permission permissions, const TempPathGenerator& create_temp_path, const QuotaSet& quotas, const std::shared_ptr<const RootDirectory>& root_directory, std::ostream& error)
+    : local_dir_path_       (local_dir_path)
+    , permissions_          (permissions)
+    , create_temp_path_     (create_temp_path)
+    , quotas_               (quotas)
+    , root_directory_       (root_directory)
+    , error_                (error)
+    , state_                (State::Header)
+    , zero_blocks_          (0)
+    , extended_type_        ('\0')
+    , remaining_size_       (0)
+    , padding_              (0)
+    , file_mtime_           (0)
+    , file_mtime_ns_        (0)
+    , file_quota_size_      (0)
+    , extracted_files_      (0)
+    , extracted_directories_(0)
+    , rejected_entries_     (0)
+  {
+    header_.reserve(block_size);
+  }
+
+  TarExtractor::~TarExtractor()
+  {
+    // A file that is still open has been cut off
+    releaseFileQuota();
+  }
+
+  bool TarExtractor::process(const char* data, std::size_t size)
+  {
+    while (size > 0)
+    {
+      std::size_t count = 0;
+
+      switch (state_)
+      {
+      case State::Header:
+        count = std::min(size, block_size - header_.size());
+        header_.insert(header_.end(), data, data + count);
+        if (header_.size() == block_size)
+        {
+          if (!processHeader())
+            return false;
+          header_.clear();
+        }
+        break;
+
+      case State::ExtendedData:
+        count = static_cast<std::size_t>(std::min<std::uint64_t>(size, remaining_size_));
+        extended_data_.append(data, count);
+        remaining_size_ -= count;
+        if (remaining_size_ == 0)
+        {
+          processExtendedData();
+          state_ = (padding_ > 0 ? State::Padding : State::Header);
+        }
+        break;
+
+      case State::FileData:
+        count = static_cast<std::size_t>(std::min<std::uint64_t>(size, remaining_size_));
+        if (file_)
+          file_->write(data, count);
+        remaining_size_ -= count;
+        if (remaining_size_ == 0)
+        {
+          endFileData();
+          state_ = (padding_ > 0 ? State::Padding : State::Header);
+        }
+        break;
+
+      case State::Padding:
+        count    = std::min(size, padding_);
+        padding_ -= count;
+        if (padding_ == 0)
+          state_ = State::Header;
+        break;
+
+      case State::End:
+        // Archives are usually padded to a multiple of 10 KiB after the end marker
+        return true;
+
+      case State::Failed:
+      default:
+        return false;
+      }
+
+      data += count;
+      size -= count;
+    }
+    return true;
+  }
+
+  bool TarExtractor::finish()
+  {
+    if (state_ == State::Failed)
+      return false;
+
+    // Some writers omit the end marker, which is fine as long as no entry has been cut off
+    if ((state_ == State::End) || ((state_ == State::Header) && header_.empty()))
+      return true;
+
+    return fail("The archive is truncated");
+  }
+
+  const std::string& TarExtractor::errorMessage() const
+  {
+    return error_message_;
+  }
+
+  std::size_t TarExtractor::extractedFiles() const
+  {
+    return extracted_files_;
+  }
+
+  std::size_t TarExtractor::extractedDirectories() const
+  {
+    return extracted_directories_;
+  }
+
+  std::size_t TarExtractor::rejectedEntries() const
+  {
+    return rejected_entries_;
+  }
+
+  bool TarExtractor::processHeader()
+  {
+    if (std::all_of(header_.begin(), header_.end(), [](char c) { return c == '\0'; }))
+    {
+      zero_blocks_++;
+      if (zero_blocks_ >= 2)
+        state_ = State::End;
+      return true;
+    }
+    zero_blocks_ = 0;
+
+    // The checksum is computed with the checksum field filled with spaces.
+    // Some old implementations used signed chars, so we accept that, too.
+    std::uint64_t stored_checksum = 0;
+    if (!parseNumberField(&header_[checksum_offset], 8, stored_checksum))
+      return fail("Invalid tar header");
+
+    std::int64_t unsigned_checksum = 8 * ' ';
+    std::int64_t signed_checksum   = 8 * ' ';
+    for (std::size_t i = 0; i < block_size; i++)
+    {
+      if ((i >= checksum_offset) && (i < checksum_offset + 8))
+        continue;
+      unsigned_checksum += static_cast<unsigned char>(header_[i]);
+      signed_checksum   += static_cast<signed char>(header_[i]);
+    }
+    if ((static_cast<std::int64_t>(stored_checksum) != unsigned_checksum) && (static_cast<std::int64_t>(stored_checksum) != signed_checksum))
+      return fail("Invalid tar header checksum");
+
+    std::uint64_t size = 0;
+    if (!parseNumberField(&header_[size_offset], 12, size))
+      return fail("Invalid tar header");
+
+    const char type_flag = header_[type_offset];
+
+    // Extended headers apply to the next entry
+    if ((type_flag == 'x') || (type_flag == 'L'))
+    {
+      if (size > max_extended_data_size)
+        return fail("Extended tar header too large");
+
+      extended_type_ = type_flag;
+      extended_data_.clear();
+      remaining_size_ = size;
+      padding_        = paddingSize(size);
+      state_          = (size > 0 ? State::ExtendedData : State::Header);
+      return true;
+    }
+
+    // Global pax headers are ignored
+    if (type_flag == 'g')
+    {
+      file_.reset();
+      remaining_size_ = size;
+      padding_        = paddingSize(size);
+      state_          = (size > 0 ? State::FileData : State::Header);
+      return true;
+    }
+
+    std::string archive_path = stringField(&header_[name_offset], name_size);
+    if (std::string(&header_[magic_offset], 5) == "ustar")
+    {
+      const std::string prefix = stringField(&header_[prefix_offset], prefix_size);
+      if (!prefix.empty())
+        archive_path = prefix + "/" + archive_path;
+    }
+
+    std::uint64_t mtime = 0;
+    parseNumberField(&header_[mtime_offset], 12, mtime);
+    file_mtime_    = static_cast<std::int64_t>(mtime);
+    file_mtime_ns_ = 0;
+
+    if (!next_path_.empty())
+      archive_path = next_path_;
+    if (!next_size_.empty() && !parseDecimal(next_size_, size))
+      return fail("Invalid size in pax header");
+    if (!next_mtime_.empty())
+      parsePaxTime(next_mtime_, file_mtime_, file_mtime_ns_);
+
+    next_path_.clear();
+    next_size_.clear();
+    next_mtime_.clear();
+
+    beginEntry(type_flag, archive_path, size);
+    return true;
+  }
+
+  void TarExtractor::processExtendedData()
+  {
+    if (extended_type_ == 'L')
+    {
+      next_path_ = extended_data_.substr(0, extended_data_.find('\0'));
+      return;
+    }
+
+    // pax records have the format "<length> <key>=<value>\n", where the length includes itself
+    std::size_t pos = 0;
+    while (pos < extended_data_.size())
+    {
+      const std::size_t space_pos = extended_data_.find(' ', pos);
+      if (space_pos == std::string::npos)
+        break;
+
+      std::uint64_t length = 0;
+      if (!parseDecimal(extended_data_.substr(pos, space_pos - pos), length) || (length <= space_pos - pos) || (pos + length > extended_data_.size()))
+        break;
+
+      const std::string record    = extended_data_.substr(space_pos + 1, static_cast<std::size_t>(pos + length - space_pos - 2));
+      const std::size_t equal_pos = record.find('=');
+      if (equal_pos != std::string::npos)
+      {
+        const std::string key   = record.substr(0, equal_pos);
+        const std::string value = record.substr(equal_pos + 1);
+
+        if (key == "path")
+          next_path_ = value;
+        else if (key == "size")
+          next_size_ = value;
+        else if (key == "mtime")
+          next_mtime_ = value;
+      }
+
+      pos += static_cast<std::size_t>(length);
+    }
+  }
+
+  void TarExtractor::beginEntry(char type_flag, const std::string& archive_path, std::uint64_t size)
+  {
+    file_.reset();
+    remaining_size_ = size;
+    padding_        = paddingSize(size);
+
+    std::string local_path;
+    if (!toLocalPath(archive_path, local_path))
+    {
+      reject(archive_path, "Path is outside of the target directory");
+    }
+    else if (root_directory_ && !root_directory_->isBeneath(local_path))
+    {
+      reject(archive_path, "Path is outside of the root directory");
+    }
+    else if (type_flag == '5')
+    {
+      const Filesystem::FileStatus status(local_path);
+      if (status.isOk())
+      {
+        if (status.type() == Filesystem::FileType::Dir)
+          extracted_directories_++;
+        else
+          reject(archive_path, "A file with that name already exists");
+      }
+      else if (!hasPermission(permissions_, Permission::DirCreate))
+      {
+        reject(archive_path, "Permission denied");
+      }
+      else if (!createParentDirectories(local_path) || !Filesystem::createDirectory(local_path))
+      {
+        reject(archive_path, "Error creating directory");
+      }
+      else
+      {
+        extracted_directories_++;
+      }
+    }
+    else if ((type_flag == '0') || (type_flag == '\0') || (type_flag == '7'))
+    {
+      const Filesystem::FileStatus status(local_path);
+      if (!hasPermission(permissions_, Permission::FileWrite))
+      {
+        reject(archive_path, "Permission denied");
+      }
+      else if (status.isOk() && (status.type() != Filesystem::FileType::RegularFile))
+      {
+        reject(archive_path, "Cannot create file. A directory with that name already exists.");
+      }
+      else if (status.isOk() && !hasPermission(permissions_, Permission::FileDelete))
+      {
+        reject(archive_path, "File already exists. Permission denied to overwrite file.");
+      }
+      else if (size > static_cast<std::uint64_t>(std::numeric_limits<std::int64_t>::max()))
+      {
+        // Sizes from base-256 or pax headers would turn negative in the quota computation
+        reject(archive_path, "File too large");
+      }
+      else if (static_cast<std::int64_t>(size) - (status.isOk() ? status.fileSize() : 0) > quotas_.available())
+      {
+        reject(archive_path, "Quota exceeded");
+      }
+      else if (!createParentDirectories(local_path))
+      {
+        reject(archive_path, "Error creating parent directory");
+      }
+      else
+      {
+        const std::string temp_path = (create_temp_path_ ? create_temp_path_(local_path) : std::string());
+        auto file = std::make_shared<WriteableFile>(local_path, temp_path, std::ios::binary);
+        if (file->good())
+        {
+          file_              = file;
+          file_path_         = local_path;
+          file_archive_path_ = archive_path;
+
+          // The space is taken before the data arrives, so concurrent uploads cannot take it
+          file_quota_size_   = static_cast<std::int64_t>(size) - (status.isOk() ? status.fileSize() : 0);
+          quotas_.add(file_quota_size_);
+        }
+        else
+        {
+          reject(archive_path, "Error opening file");
+        }
+      }
+    }
+    else
+    {
+      reject(archive_path, "Unsupported entry type");
+    }
+
+    if (remaining_size_ > 0)
+    {
+      state_ = State::FileData;
+    }
+    else
+    {
+      endFileData();
+      state_ = State::Header;
+    }
+  }
+
+  void TarExtractor::endFileData()
+  {
+    if (!file_)
+      return;
+
+    if (file_->commit())
+    {
+      Filesystem::setModificationTime(file_path_, file_mtime_, file_mtime_ns_);
+      extracted_files_++;
+    }
+    else
+    {
+      reject(file_archive_path_, "Error writing file");
+      releaseFileQuota();
+    }
+
+    file_.reset();
+  }
+
+  void TarExtractor::releaseFileQuota()
+  {
+    if (!file_)
+      return;
+
+    // The temporary file of an atomic upload is deleted and the old file is
+    // kept. Otherwise, the old file has been overwritten by the data that
+    // has been written so far.
+    if (create_temp_path_)
+      quotas_.add(-file_quota_size_);
+    else
+      quotas_.add(-static_cast<std::int64_t>(remaining_size_));
+
+    file_quota_size_ = 0;
+  }
+
+  bool TarExtractor::toLocalPath(const std::string& archive_path, std::string& local_path) const
+  {
+    local_path = local_dir_path_;
+
+    std::size_t component_start = 0;
+    while (component_start <= archive_path.size())
+    {
+#ifdef WIN32
+      std::size_t component_end = archive_path.find_first_of("/\\", component_start);
+#else
+      std::size_t component_end = archive_path.find('/', component_start);
+#endif // WIN32
+      if (component_end == std::string::npos)
+        component_end = archive_path.size();
+
+      const std::string component = archive_path.substr(component_start, component_end - component_start);
+      component_start = component_end + 1;
+
+      if (component.empty() || (component == "."))
+        continue;
+
+      if (component == "..")
+        return false;
+
+#ifdef WIN32
+      // Drive letters and alternate data streams
+      if (component.find(':') != std::string::npos)
+        return false;
+#endif // WIN32
+
+      // Absolute paths are extracted relative to the target directory, just like tar does
+      local_path += "/" + component;
+    }
+    return true;
+  }
+
+  bool TarExtractor::createParentDirectories(const std::string& local_path)
+  {
+    for (std::size_t separator_pos = local_path.find('/', local_dir_path_.size() + 1); separator_pos != std::string::npos; separator_pos = local_path.find('/', separator_pos + 1))
+    {
+      const std::string parent_path = local_path.substr(0, separator_pos);
+
+      const Filesystem::FileStatus status(parent_path);
+      if (status.isOk())
+      {
+        if (status.type() != Filesystem::FileType::Dir)
+          return false;
+        continue;
+      }
+
+      if (!hasPermission(permissions_, Permission::DirCreate) || !Filesystem::createDirectory(parent_path))
+        return false;
+    }
+    return true;
+  }
+
+  void TarExtractor::reject(const std::string& archive_path, const std::string& reason)
+  {
+    rejected_entries_++;
+    error_ << "Rejected tar entry \"" << archive_path << "\": " << reason << std::endl;
+  }
+
+  bool TarExtractor::fail(const std::string& message)
+  {
+    state_         = State::Failed;
+    error_message_ = message;
+
+    // An incomplete file is not committed. With atomic uploads, it is deleted.
+    releaseFileQuota();
+    file_.reset();
+    return false;
+  }
+}
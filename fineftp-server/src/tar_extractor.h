@@ -0,0 +1,148 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <fineftp/permissions.h>
+
+#include <file_man.h>
+
+#include "root_directory.h"
+#include "storage_quota.h"
+
+namespace fineftp
+{
+  /**
+   * @brief Extracts a tar archive (ustar, pax and GNU long names) while it is received
+   *
+   * The archive is fed chunk by chunk and each file is written as soon as
+   * its data arrives, so the archive is never stored completely. This lets
+   * clients upload many small files over a single data connection.
+   *
+   * Each entry is checked on its own: Paths that contain ".." and entries
+   * that the user is not permitted to create are skipped and counted as
+   * rejected. Absolute paths are extracted relative to the target
+   * directory. If a root directory is given, paths that lead out of it
+   * through a symlink are rejected as well. Regular files and directories are extracted, all other entry
+   * types (links, devices, ...) are rejected. A corrupt archive stops the
+   * extraction.
+   *
+   * The size of each file is added to the storage quotas before the file is
+   * written. Files that don't fit into the quota are rejected.
+   *
+   * @note The implementation is NOT thread safe!
+   */
+  class TarExtractor
+  {
+  public:
+    /** Returns the temporary path for an atomic upload of the given file */
+    using TempPathGenerator = std::function<std::string(const std::string&)>;
+
+    /**
+     * @param local_dir_path:   The existing directory to extract the archive into
+     * @param permissions:      The permissions of the user. FileWrite is needed for files, DirCreate for directories and FileDelete for replacing existing files.
+     * @param create_temp_path: If set, files are written to a temporary file and renamed when complete
+     * @param quotas:           The storage quotas of the target directory
+     * @param root_directory:   If set, only entries beneath this directory are extracted
+     * @param error:            Stream for logging rejected entries
+     */
+    TarExtractor(const std::string& local_dir_path, Permission permissions, const TempPathGenerator& create_temp_path, const QuotaSet& quotas, const std::shared_ptr<const RootDirectory>& root_directory, std::ostream& error);
+
+    // Copy and move disabled, as we own open files
+    TarExtractor(const TarExtractor&)            = delete;
+    TarExtractor& operator=(const TarExtractor&) = delete;
+    TarExtractor(TarExtractor&&)                 = delete;
+    TarExtractor& operator=(TarExtractor&&)      = delete;
+
+    ~TarExtractor();
+
+    /**
+     * @brief Extracts the next chunk of the archive
+     *
+     * @return False if the archive is corrupt. The extraction cannot be continued, then.
+     */
+    bool process(const char* data, std::size_t size);
+
+    /**
+     * @brief Checks that the archive has been received completely
+     *
+     * @return False if the archive is corrupt or ends in the middle of an entry
+     */
+    bool finish();
+
+    /** @brief A description of the reason why the extraction has failed */
+    const std::string& errorMessage() const;
+
+    std::size_t extractedFiles()       const;
+    std::size_t extractedDirectories() const;
+    std::size_t rejectedEntries()      const;
+
+  private:
+    enum class State
+    {
+      Header,        // Collecting a header block
+      ExtendedData,  // Collecting the records of a pax header or a GNU long name
+      FileData,      // Writing (or skipping) the data of an entry
+      Padding,       // Skipping the rest of the last data block
+      End,           // The archive has ended, trailing data is ignored
+      Failed,
+    };
+
+    bool processHeader();
+    void processExtendedData();
+
+    void beginEntry(char type_flag, const std::string& archive_path, std::uint64_t size);
+    void endFileData();
+
+    // Frees the space of the current file that has not been written, as it will never be complete
+    void releaseFileQuota();
+
+    // Converts the path of an entry to a local path. Returns false if it leaves the target directory.
+    bool toLocalPath(const std::string& archive_path, std::string& local_path) const;
+
+    // Creates the missing parent directories of an entry
+    bool createParentDirectories(const std::string& local_path);
+
+    void reject(const std::string& archive_path, const std::string& reason);
+    bool fail(const std::string& message);
+
+  private:
+    const std::string       local_dir_path_;
+    const Permission        permissions_;
+    const TempPathGenerator create_temp_path_;
+    QuotaSet                quotas_;
+    const std::shared_ptr<const RootDirectory> root_directory_;
+    std::ostream&           error_;
+
+    State                   state_;
+    std::string             error_message_;
+
+    std::vector<char>       header_;              // The current header block
+    std::size_t             zero_blocks_;         // Consecutive zero blocks. Two of them end the archive.
+
+    char                    extended_type_;       // 'x' (pax header) or 'L' (GNU long name)
+    std::string             extended_data_;
+    std::string             next_path_;           // Overrides the path of the next entry (pax / GNU long name)
+    std::string             next_size_;           // Overrides the size of the next entry (pax)
+    std::string             next_mtime_;          // Overrides the modification time of the next entry (pax)
+
+    std::uint64_t           remaining_size_;      // Remaining data of the current entry
+    std::size_t             padding_;             // Remaining padding of the current entry
+
+    std::shared_ptr<WriteableFile> file_;         // The file that is being extracted, or nullptr if the data is skipped
+    std::string             file_path_;
+    std::string             file_archive_path_;
+    std::int64_t            file_mtime_;
+    std::uint32_t           file_mtime_ns_;
+    std::int64_t            file_quota_size_;     // The space that the current file has added to the quotas
+
+    std::size_t             extracted_files_;
+    std::size_t             extracted_directories_;
+    std::size_t             rejected_entries_;
+  };
+}
@@ -0,0 +1,315 @@
+#include "tar_writer.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <file_man.h>
+
+#include "filesystem.h"
+#include "root_directory.h"
+
+#if defined(WIN32) && !defined(__GNUG__)
+  #include "win_str_convert.h"
+#endif
+
+namespace fineftp
+{
+  namespace
+  {
+    constexpr std::size_t block_size = 512;
+
+    // Directory symlinks (or junctions) are followed, so a loop would lead to an endless archive
+    constexpr std::size_t max_dir_depth = 64;
+
+    // Field offsets and sizes of the ustar header
+    constexpr std::size_t name_offset     = 0;
+    constexpr std::size_t name_size       = 100;
+    constexpr std::size_t mode_offset     = 100;
+    constexpr std::size_t uid_offset      = 108;
+    constexpr std::size_t gid_offset      = 116;
+    constexpr std::size_t size_offset     = 124;
+    constexpr std::size_t mtime_offset    = 136;
+    constexpr std::size_t checksum_offset = 148;
+    constexpr std::size_t type_offset     = 156;
+    constexpr std::size_t magic_offset    = 257;
+    constexpr std::size_t version_offset  = 263;
+    constexpr std::size_t prefix_offset   = 345;
+    constexpr std::size_t prefix_size     = 155;
+
+    // Writes the value as zero padded octal number with a terminating NUL. Returns false if it doesn't fit.
+    bool writeOctal(char* field, std::size_t field_size, std::uint64_t value)
+    {
+      field[field_size - 1] = '\0';
+      for (std::size_t i = field_size - 1; i > 0; i--)
+      {
+        field[i - 1] = static_cast<char>('0' + (value & 7U));
+        value >>= 3U;
+      }
+      return (value == 0);
+    }
+
+    // Creates a pax record "<length> <key>=<value>\n", where the length includes itself
+    std::string paxRecord(const std::string& key, const std::string& value)
+    {
+      const std::size_t payload_size = key.size() + value.size() + 3; // ' ', '=' and '\n'
+      std::size_t length = payload_size + 1;
+      while (std::to_string(length).size() + payload_size != length)
+        length = std::to_string(length).size() + payload_size;
+
+      return std::to_string(length) + " " + key + "=" + value + "\n";
+    }
+
+    // Splits the path into the prefix and name fields of the ustar header
+    bool splitUstarPath(const std::string& path, std::string& prefix, std::string& name)
+    {
+      if (path.size() <= name_size)
+      {
+        prefix.clear();
+        name = path;
+        return true;
+      }
+
+      // Directories end with '/', which must not be used for the split
+      for (std::size_t pos = path.find('/'); (pos != std::string::npos) && (pos < path.size() - 1); pos = path.find('/', pos + 1))
+      {
+        if ((pos <= prefix_size) && (path.size() - pos - 1 <= name_size))
+        {
+          prefix = path.substr(0, pos);
+          name   = path.substr(pos + 1);
+          return true;
+        }
+      }
+      return false;
+    }
+
+    // Fills a header block. The size must fit into the ustar field, larger sizes are stored in a pax header.
+    void fillHeader(char* header, const std::string& prefix, const std::string& name, std::uint32_t mode, std::uint64_t size, std::uint64_t mtime, char type_flag)
+    {
+      std::memset(header, 0, block_size);
+      std::memcpy(header + name_offset,   name.data(),   std::min(name.size(),   name_size));
+      std::memcpy(header + prefix_offset, prefix.data(), std::min(prefix.size(), prefix_size));
+      writeOctal(header + mode_offset,  8,  mode);
+      writeOctal(header + uid_offset,   8,  0);
+      writeOctal(header + gid_offset,   8,  0);
+      writeOctal(header + size_offset,  12, size);
+      writeOctal(header + mtime_offset, 12, mtime);
+      header[type_offset] = type_flag;
+      std::memcpy(header + magic_offset,   "ustar", 6);
+      std::memcpy(header + version_offset, "00",    2);
+
+      // The checksum is computed with the checksum field filled with spaces
+      unsigned int checksum = 8 * ' ';
+      for (std::size_t i = 0; i < block_size; i++)
+        checksum += static_cast<unsigned char>(header[i]);
+      writeOctal(header + checksum_offset, 7, checksum);
+      header[checksum_offset + 7] = ' ';
+    }
+
+    // FileStatus calls the permissions of the file owner "root" and the permissions of others "owner"
+    std::uint32_t fileMode(const Filesystem::FileStatus& status)
+    {
+      std::uint32_t mode = 0;
+      if (status.permissionRootRead())      mode |= 0400U;
+      if (status.permissionRootWrite())     mode |= 0200U;
+      if (status.permissionRootExecute())   mode |= 0100U;
+      if (status.permissionGroupRead())     mode |= 0040U;
+      if (status.permissionGroupWrite())    mode |= 0020U;
+      if (status.permissionGroupExecute())  mode |= 0010U;
+      if (status.permissionOwnerRead())     mode |= 0004U;
+      if (status.permissionOwnerWrite())    mode |= 0002U;
+      if (status.permissionOwnerExecute())  mode |= 0001U;
+      return mode;
+    }
+  }
+
+  TarWriter::TarWriter(const std::string& local_dir_path, const std::string& archive_root_name, const std::shared_ptr<const RootDirectory>& root_directory, std::ostream& error)
+    : root_directory_(root_directory)
+    , error_         (error)
+    , headers_offset_(0)
+    , file_offset_   (0)
+    , padding_       (0)
+    , end_written_   (false)
+    , finished_      (false)
+  {
+    if (archive_root_name.empty())
+    {
+      pushDir(local_dir_path, "");
+    }
+    else
+    {
+      const std::string archive_path = archive_root_name + "/";
+      addHeader(archive_path, '5', 0, Filesystem::FileStatus(local_dir_path));
+      pushDir(local_dir_path, archive_path);
+    }
+  }
+
+  void TarWriter::read(std::vector<char>& data, std::size_t max_size)
+  {
+    while (!finished_ && (data.size() < max_size))
+    {
+      const std::size_t free_space = max_size - data.size();
+
+      if (headers_offset_ < headers_.size())
+      {
+        const std::size_t count = std::min(free_space, headers_.size() - headers_offset_);
+        data.insert(data.end(), headers_.begin() + headers_offset_, headers_.begin() + headers_offset_ + count);
+        headers_offset_ += count;
+      }
+      else if (file_ && (file_offset_ < file_->size()))
+      {
+        const std::size_t count = std::min(free_space, file_->size() - file_offset_);
+        const char* chunk_start = reinterpret_cast<const char*>(file_->data()) + file_offset_;
+        data.insert(data.end(), chunk_start, chunk_start + count);
+        file_offset_ += count;
+      }
+      else if (padding_ > 0)
+      {
+        const std::size_t count = std::min(free_space, padding_);
+        data.insert(data.end(), count, '\0');
+        padding_ -= count;
+      }
+      else
+      {
+        // Release the mapping of the file as soon as it has been read
+        file_.reset();
+        finished_ = !nextEntry();
+      }
+    }
+  }
+
+  bool TarWriter::finished() const
+  {
+    return finished_;
+  }
+
+  void TarWriter::pushDir(const std::string& local_path, const std::string& archive_path)
+  {
+    if (dirs_.size() >= max_dir_depth)
+    {
+      error_ << "Not archiving the content of " << local_path << ": Directory tree too deep" << std::endl;
+      return;
+    }
+
+    DirLevel level{local_path, archive_path, {}, 0};
+
+    // The listing is sorted, so the archive is reproducible
+    auto content = Filesystem::dirContent(local_path, error_);
+    level.entries.reserve(content.size());
+    for (auto& entry : content)
+    {
+      if ((entry.first == ".") || (entry.first == ".."))
+        continue;
+      level.entries.emplace_back(entry.first, std::move(entry.second));
+    }
+
+    dirs_.push_back(std::move(level));
+  }
+
+  bool TarWriter::nextEntry()
+  {
+    headers_.clear();
+    headers_offset_ = 0;
+
+    while (!dirs_.empty())
+    {
+      DirLevel& level = dirs_.back();
+      if (level.next_entry >= level.entries.size())
+      {
+        dirs_.pop_back();
+        continue;
+      }
+
+      const auto&       entry        = level.entries[level.next_entry++];
+      const std::string local_path   = level.local_path + "/" + entry.first;
+      const std::string archive_path = level.archive_path + entry.first;
+
+      if (root_directory_ && !root_directory_->isBeneath(local_path))
+      {
+        error_ << "Not archiving " << local_path << ": Path is outside of the root directory" << std::endl;
+        continue;
+      }
+
+      if (entry.second.type() == Filesystem::FileType::Dir)
+      {
+        addHeader(archive_path + "/", '5', 0, entry.second);
+        pushDir(local_path, archive_path + "/"); // Invalidates level and entry
+        return true;
+      }
+      else if (entry.second.type() == Filesystem::FileType::RegularFile)
+      {
+#if defined(WIN32) && !defined(__GNUG__)
+        file_ = ReadableFile::get(StrConvert::Utf8ToWide(local_path));
+#else
+        file_ = ReadableFile::get(local_path);
+#endif
+        if (!file_)
+        {
+          error_ << "Not archiving " << local_path << ": Error opening file" << std::endl;
+          continue;
+        }
+
+        // The size of the mapping is used, as the file may have changed since the directory has been listed
+        addHeader(archive_path, '0', file_->size(), entry.second);
+        file_offset_ = 0;
+        padding_     = (block_size - (file_->size() % block_size)) % block_size;
+        return true;
+      }
+    }
+
+    if (!end_written_)
+    {
+      // The archive ends with two zero blocks
+      headers_.assign(2 * block_size, '\0');
+      end_written_ = true;
+      return true;
+    }
+
+    return false;
+  }
+
+  void TarWriter::addHeader(const std::string& archive_path, char type_flag, std::uint64_t size, const Filesystem::FileStatus& status)
+  {
+    std::string prefix;
+    std::string name;
+    std::string pax_records;
+
+    if (!splitUstarPath(archive_path, prefix, name))
+    {
+      pax_records += paxRecord("path", archive_path);
+      prefix.clear();
+      name = archive_path.substr(0, name_size);
+    }
+
+    char size_field[12];
+    const bool size_fits = writeOctal(size_field, sizeof(size_field), size);
+    if (!size_fits)
+    {
+      // Files of 8 GiB and more
+      pax_records += paxRecord("size", std::to_string(size));
+    }
+
+    const auto mtime = static_cast<std::uint64_t>(std::max<std::int64_t>(status.modificationTime(), 0));
+
+    char header[block_size];
+
+    // The extended header applies to the following entry and overrides its ustar fields
+    if (!pax_records.empty())
+    {
+      fillHeader(header, "", "././@PaxHeader", 0644, pax_records.size(), mtime, 'x');
+      headers_.insert(headers_.end(), header, header + block_size);
+      headers_.insert(headers_.end(), pax_records.begin(), pax_records.end());
+      headers_.insert(headers_.end(), (block_size - (pax_records.size() % block_size)) % block_size, '\0');
+    }
+
+    fillHeader(header, prefix, name, fileMode(status), (size_fits ? size : 0), mtime, type_flag);
+    headers_.insert(headers_.end(), header, header + block_size);
+  }
+}
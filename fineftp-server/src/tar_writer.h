@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <file_man.h>
+
+#include "filesystem.h"
+#include "root_directory.h"
+
+namespace fineftp
+{
+  /**
+   * @brief Generates a tar archive (POSIX.1-2001 / pax) of a directory tree on the fly
+   *
+   * The archive is produced chunk by chunk while it is sent, so neither a
+   * temporary file nor a buffer of the archive size is needed. The
+   * directories are read one at a time when the archive reaches them and the
+   * file contents are taken from the memory mapped files. Thus only the
+   * listings of the directories on the current path are kept in memory.
+   *
+   * Regular files and directories are archived, all other file types are
+   * skipped. Files that cannot be opened are skipped and logged. If a root
+   * directory is given, entries that lead out of it through a symlink are
+   * skipped and logged, too.
+   *
+   * @note The implementation is NOT thread safe!
+   */
+  class TarWriter
+  {
+  public:
+    /**
+     * @param local_dir_path:    The directory to archive
+     * @param archive_root_name: The name of the directory in the archive. If empty, the content is stored at the top level of the archive.
+     * @param root_directory:    If set, only entries beneath this directory are archived
+     * @param error:             Stream for logging files that cannot be archived
+     */
+    TarWriter(const std::string& local_dir_path, const std::string& archive_root_name, const std::shared_ptr<const RootDirectory>& root_directory, std::ostream& error);
+
+    /**
+     * @brief Appends the next part of the archive to the data
+     *
+     * @param data:     The buffer to append to
+     * @param max_size: Data is appended until the buffer has this size or the archive is complete
+     */
+    void read(std::vector<char>& data, std::size_t max_size);
+
+    /**
+     * @brief Returns true if the whole archive has been read
+     */
+    bool finished() const;
+
+  private:
+    struct DirLevel
+    {
+      std::string                                                  local_path;
+      std::string                                                  archive_path;   // Including the trailing '/', or empty for the top level
+      std::vector<std::pair<std::string, Filesystem::FileStatus>>  entries;
+      std::size_t                                                  next_entry;
+    };
+
+    void pushDir(const std::string& local_path, const std::string& archive_path);
+
+    // Prepares the headers of the next entry, or the end of the archive. Returns false if there is nothing left.
+    bool nextEntry();
+
+    void addHeader(const std::string& archive_path, char type_flag, std::uint64_t size, const Filesystem::FileStatus& status);
+
+  private:
+    const std::shared_ptr<const RootDirectory> root_directory_;
+    std::ostream&          error_;
+    std::vector<DirLevel>  dirs_;
+
+    std::vector<char>      headers_;          // The header blocks of the current entry
+    std::size_t            headers_offset_;
+
+    std::shared_ptr<ReadableFile> file_;      // The file of the current entry
+    std::size_t                   file_offset_;
+    std::size_t                   padding_;   // Zero bytes that fill up the last block of the file
+
+    bool                   end_written_;
+    bool                   finished_;
+  };
+}
@@ -0,0 +1,191 @@
+#include "timer_wheel.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <asio.hpp> // IWYU pragma: keep
+
+namespace fineftp
+{
+  ////////////////////////////////////////////////////////
+  // Timer
+  ////////////////////////////////////////////////////////
+
+  TimerWheel::Timer::Timer(std::shared_ptr<TimerWheel> wheel)
+    : wheel_      (std::move(wheel))
+    , prev_       (nullptr)
+    , next_       (nullptr)
+    , expiry_tick_(0)
+    , generation_ (0)
+    , scheduled_  (false)
+  {}
+
+  TimerWheel::Timer::~Timer()
+  {
+    cancel();
+  }
+
+  void TimerWheel::Timer::expiresAfter(std::chrono::steady_clock::duration timeout)
+  {
+    const auto now = std::chrono::steady_clock::now();
+
+    // Round up, so the timer never expires early
+    const auto ticks = static_cast<std::uint64_t>((timeout + wheel_->tick_ - std::chrono::steady_clock::duration(1)) / wheel_->tick_);
+
+    const std::lock_guard<std::mutex> lock(wheel_->mutex_);
+
+    if (scheduled_)
+      wheel_->unlink(this);
+
+    generation_++;
+
+    // The slots up to the processed tick have been visited already
+    expiry_tick_ = std::max(wheel_->currentTick(now) + ticks, wheel_->processed_tick_ + 1);
+    wheel_->link(this);
+  }
+
+  void TimerWheel::Timer::cancel()
+  {
+    const std::lock_guard<std::mutex> lock(wheel_->mutex_);
+
+    if (scheduled_)
+      wheel_->unlink(this);
+
+    generation_++;
+  }
+
+  bool TimerWheel::Timer::hasExpired(std::uint64_t generation) const
+  {
+    const std::lock_guard<std::mutex> lock(wheel_->mutex_);
+
+    return (!scheduled_ && (generation_ == generation));
+  }
+
+  ////////////////////////////////////////////////////////
+  // TimerWheel
+  ////////////////////////////////////////////////////////
+
+  TimerWheel::TimerWheel(asio::io_context& io_context, std::chrono::steady_clock::duration tick, std::size_t slot_count)
+    : io_context_    (io_context)
+    , tick_          (tick)
+    , start_time_    (std::chrono::steady_clock::now())
+    , slots_         (std::max<std::size_t>(1, slot_count), nullptr)
+    , processed_tick_(0)
+  {}
+
+  TimerWheel::~TimerWheel()
+  {
+    stop();
+  }
+
+  void TimerWheel::start()
+  {
+    tick_timer_ = std::make_unique<asio::steady_timer>(io_context_);
+    waitForNextTick();
+  }
+
+  void TimerWheel::stop()
+  {
+    tick_timer_.reset();
+  }
+
+  std::uint64_t TimerWheel::currentTick(std::chrono::steady_clock::time_point now) const
+  {
+    return static_cast<std::uint64_t>((now - start_time_) / tick_);
+  }
+
+  void TimerWheel::waitForNextTick()
+  {
+    std::uint64_t next_tick = 0;
+    {
+      const std::lock_guard<std::mutex> lock(mutex_);
+      next_tick = processed_tick_ + 1;
+    }
+
+    // Waiting for an absolute time point keeps the ticks from drifting
+    tick_timer_->expires_at(start_time_ + tick_ * static_cast<std::chrono::steady_clock::rep>(next_tick));
+    tick_timer_->async_wait([this](const asio::error_code& ec)
+                            {
+                              if (ec)
+                                return;
+
+                              advance();
+                              waitForNextTick();
+                            });
+  }
+
+  void TimerWheel::advance()
+  {
+    {
+      const std::lock_guard<std::mutex> lock(mutex_);
+
+      const std::uint64_t current_tick = currentTick(std::chrono::steady_clock::now());
+
+      // If the io_context has been busy for a while, several ticks are due at
+      // once. Each slot has to be visited only once for all of them.
+      const std::uint64_t due_ticks = std::min<std::uint64_t>(current_tick - std::min(current_tick, processed_tick_), slots_.size());
+
+      for (std::uint64_t tick = processed_tick_ + 1; tick <= processed_tick_ + due_ticks; tick++)
+      {
+        Timer* timer = slots_[tick % slots_.size()];
+        while (timer != nullptr)
+        {
+          Timer* const next = timer->next_;
+          if (timer->expiry_tick_ <= current_tick)
+          {
+            unlink(timer);
+
+            // The callback is called without the lock, so the owner of the
+            // timer may destroy it in the meantime
+            expired_callbacks_.emplace_back(timer->callback_, timer->generation_);
+          }
+          timer = next;
+        }
+      }
+
+      processed_tick_ = std::max(processed_tick_, current_tick);
+    }
+
+    for (const auto& expired_callback : expired_callbacks_)
+    {
+      if (expired_callback.first)
+        expired_callback.first(expired_callback.second);
+    }
+    expired_callbacks_.clear();
+  }
+
+  void TimerWheel::link(Timer* timer)
+  {
+    Timer*& head = slots_[timer->expiry_tick_ % slots_.size()];
+
+    timer->prev_ = nullptr;
+    timer->next_ = head;
+    if (head != nullptr)
+      head->prev_ = timer;
+    head = timer;
+
+    timer->scheduled_ = true;
+  }
+
+  void TimerWheel::unlink(Timer* timer)
+  {
+    if (timer->prev_ != nullptr)
+      timer->prev_->next_ = timer->next_;
+    else
+      slots_[timer->expiry_tick_ % slots_.size()] = timer->next_;
+
+    if (timer->next_ != nullptr)
+      timer->next_->prev_ = timer->prev_;
+
+    timer->prev_      = nullptr;
+    timer->next_      = nullptr;
+    timer->scheduled_ = false;
+  }
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <asio.hpp> // IWYU pragma: keep
+
+namespace fineftp
+{
+  /**
+   * @brief Coarse timeouts for many sessions, driven by a single steady_timer
+   *
+   * Every session needs a few timeouts (e.g. idle, login) that are restarted
+   * all the time and hardly ever expire. With one asio::steady_timer per
+   * timeout, each restart cancels an operation and pushes a new one into the
+   * timer heap of the io_context. The TimerWheel instead hashes its timers
+   * into slots by their expiry tick. Restarting a timer only moves it to
+   * another slot, which neither allocates memory nor touches the io_context.
+   * A single steady_timer advances the wheel once per tick and expires the
+   * timers in the current slot. Timers that are scheduled more than one
+   * revolution ahead stay in their slot until their tick has come.
+   *
+   * Timeouts are rounded up to full ticks, so they expire up to one tick
+   * late. The TimerWheel is thread safe. The callbacks are called on the
+   * io_context without holding any lock, so they may restart their timer.
+   */
+  class TimerWheel
+  {
+  public:
+    /**
+     * @brief A timeout in a TimerWheel
+     *
+     * The callback is called once when the timeout has expired. It is not
+     * called after the timer has been cancelled or restarted, unless it has
+     * been collected for expiry already. Thus the callback must not refer
+     * to its owner without checking that it is still alive (e.g. through a
+     * weak_ptr).
+     *
+     * Each start and cancellation creates a new generation of the timer.
+     * The callback gets the generation that has expired, so the owner can
+     * use hasExpired() to ignore an expiry that has been collected before
+     * the timer was restarted or cancelled.
+     */
+    class Timer
+    {
+    public:
+      explicit Timer(std::shared_ptr<TimerWheel> wheel);
+
+      // Copy and move disabled, as the wheel links to the timer
+      Timer(const Timer&)            = delete;
+      Timer& operator=(const Timer&) = delete;
+      Timer(Timer&&)                 = delete;
+      Timer& operator=(Timer&&)      = delete;
+
+      ~Timer();
+
+      using Callback = std::function<void(std::uint64_t generation)>;
+
+      // Must be set before the timer is started for the first time
+      void setCallback(const Callback& callback) { callback_ = callback; }
+
+      // (Re)starts the timer. Cancels the previous timeout.
+      void expiresAfter(std::chrono::steady_clock::duration timeout);
+
+      void cancel();
+
+      // Returns true if the given generation has expired and the timer has not been restarted or cancelled since then
+      bool hasExpired(std::uint64_t generation) const;
+
+    private:
+      friend class TimerWheel;
+
+      const std::shared_ptr<TimerWheel> wheel_;
+      Callback                          callback_;
+
+      // Protected by the mutex of the wheel
+      Timer*        prev_;
+      Timer*        next_;
+      std::uint64_t expiry_tick_;
+      std::uint64_t generation_;
+      bool          scheduled_;
+    };
+
+  public:
+    TimerWheel(asio::io_context& io_context, std::chrono::steady_clock::duration tick, std::size_t slot_count);
+
+    // Copy and move disabled (as we are storing the this pointer in lambda captures)
+    TimerWheel(const TimerWheel&)            = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+    TimerWheel(TimerWheel&&)                 = delete;
+    TimerWheel& operator=(TimerWheel&&)      = delete;
+
+    ~TimerWheel();
+
+    void start();
+
+    /**
+     * @brief Stops advancing the wheel
+     *
+     * Must be called after the io_context has been stopped and before it
+     * is destroyed, as timers may outlive the io_context in their sessions.
+     */
+    void stop();
+
+  private:
+    std::uint64_t currentTick(std::chrono::steady_clock::time_point now) const;
+
+    void waitForNextTick();
+    void advance();
+
+    // Must be called with the mutex locked
+    void link(Timer* timer);
+    void unlink(Timer* timer);
+
+  private:
+    asio::io_context&                          io_context_;
+    const std::chrono::steady_clock::duration  tick_;
+    const std::chrono::steady_clock::time_point start_time_;
+    std::unique_ptr<asio::steady_timer>        tick_timer_;       // Created in start(), destroyed in stop()
+
+    std::mutex          mutex_;
+    std::vector<Timer*> slots_;           // Heads of doubly linked lists of timers
+    std::uint64_t       processed_tick_;  // All timers up to this tick have expired
+
+    std::vector<std::pair<Timer::Callback, std::uint64_t>> expired_callbacks_;   // With the expired generation. Only used by advance(), which is never called concurrently
+  };
+}
@@ -2,8 +2,12 @@
 
 #include "file_man.h"
 
+#include <cerrno>
+#include <cstddef>
 #include <cstdint>
+#include <cstdio>
 #include <fcntl.h>
+#include <ios>
 #include <map>
 #include <memory>
 #include <mutex>
@@ -84,4 +88,296 @@ namespace fineftp
     files[readable_file_ptr->path_] = readable_file_ptr;
     return readable_file_ptr;
   }
+
+  WriteableFile::WriteableFile(const std::string& filename, std::ios::openmode mode)
+    : WriteableFile(filename, "", mode)
+  {}
+
+  WriteableFile::WriteableFile(const std::string& filename, const std::string& temp_filename, std::ios::openmode mode)
+    : filename_(filename)
+    , temp_filename_(temp_filename)
+  {
+    // Append to existing files or create a new (empty) file
+    int flags = O_WRONLY | O_CREAT | O_CLOEXEC;
+    append_ = ((mode & std::ios::app) == std::ios::app);
+    flags |= (append_ ? O_APPEND : O_TRUNC);
+
+    const std::string& path = (temp_filename_.empty() ? filename_ : temp_filename_);
+    do
+    {
+      fd_ = ::open(path.c_str(), flags, 0666);
+    } while ((fd_ == -1) && (errno == EINTR));
+  }
+
+  WriteableFile::~WriteableFile()
+  {
+    close();
+
+    if (!temp_filename_.empty() && !committed_)
+    {
+      (void)::unlink(temp_filename_.c_str());
+    }
+  }
+
+  void WriteableFile::write(const char* data, std::size_t sz)
+  {
+    if (!good())
+      return;
+
+    // A write to a regular file may be short (e.g. when the disk is full or
+    // due to a signal), so we retry until we get an error.
+    while (sz > 0)
+    {
+      const ssize_t written = ::write(fd_, data, sz);
+      if (written < 0)
+      {
+        if (errno == EINTR)
+          continue;
+
+        write_error_ = true;
+        return;
+      }
+
+      data += written;
+      sz   -= static_cast<std::size_t>(written);
+      unsynced_bytes_ += static_cast<std::uint64_t>(written);
+    }
+
+    startWritebackIfDue();
+  }
+
+  void WriteableFile::startWritebackIfDue()
+  {
+#ifdef __linux__
+    if ((writeback_interval_ > 0) && (unsynced_bytes_ >= writeback_interval_))
+    {
+      // Only initiate the writeback of all dirty pages, without waiting for
+      // it. Pages that are under writeback already are skipped by the kernel.
+      (void)::sync_file_range(fd_, 0, 0, SYNC_FILE_RANGE_WRITE);
+      unsynced_bytes_ = 0;
+    }
+#endif // __linux__
+  }
+
+#ifdef __linux__
+  bool WriteableFile::supportsSplice() const
+  {
+    return !append_;
+  }
+
+  ssize_t WriteableFile::spliceFromSocket(int socket_fd, std::size_t max_size)
+  {
+    if (!good())
+    {
+      errno = EBADF;
+      return -1;
+    }
+
+    if (-1 == pipe_fds_[0])
+    {
+      if (::pipe2(pipe_fds_, O_CLOEXEC) != 0)
+      {
+        pipe_fds_[0] = -1;
+        pipe_fds_[1] = -1;
+        write_error_ = true;
+        return -1;
+      }
+
+      // A larger pipe moves more data per call. Unprivileged processes may
+      // be limited to a smaller size by /proc/sys/fs/pipe-max-size.
+      (void)::fcntl(pipe_fds_[1], F_SETPIPE_SZ, 1024 * 1024);
+    }
+
+    const ssize_t received = ::splice(socket_fd, nullptr, pipe_fds_[1], nullptr, max_size, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (received <= 0)
+      return received;
+
+    // The pipe is always drained completely, so it never holds data between calls
+    std::size_t remaining = static_cast<std::size_t>(received);
+    while (remaining > 0)
+    {
+      const ssize_t written = ::splice(pipe_fds_[0], nullptr, fd_, nullptr, remaining, SPLICE_F_MOVE);
+      if (written <= 0)
+      {
+        if ((written < 0) && (errno == EINTR))
+          continue;
+
+        if (written == 0)
+          errno = EIO;
+
+        write_error_ = true;
+        return -1;
+      }
+      remaining -= static_cast<std::size_t>(written);
+    }
+
+    unsynced_bytes_ += static_cast<std::uint64_t>(received);
+    startWritebackIfDue();
+
+    return received;
+  }
+#endif // __linux__
+
+  void WriteableFile::close()
+  {
+    if (-1 == fd_)
+      return;
+
+    if (preallocated_)
+    {
+      // Release the preallocated space that has not been used. Truncating
+      // to the current size frees all blocks behind the end of the file.
+      struct stat file_status {};
+      if (::fstat(fd_, &file_status) == 0)
+      {
+        (void)::ftruncate(fd_, file_status.st_size);
+      }
+      preallocated_ = false;
+    }
+
+    if (-1 != pipe_fds_[0])
+    {
+      ::close(pipe_fds_[0]);
+      ::close(pipe_fds_[1]);
+      pipe_fds_[0] = -1;
+      pipe_fds_[1] = -1;
+    }
+
+    // Errors of close() may indicate that data has not been written (e.g. on
+    // NFS). On EINTR the descriptor is closed anyway and must not be closed again.
+    if ((::close(fd_) != 0) && (errno != EINTR))
+    {
+      write_error_ = true;
+    }
+    fd_ = -1;
+  }
+
+  bool WriteableFile::preallocate(std::uint64_t size)
+  {
+#ifdef __linux__
+    if (-1 == fd_)
+      return true;
+
+    struct stat file_status {};
+    if (::fstat(fd_, &file_status) != 0)
+      return true;
+
+    if (::fallocate(fd_, FALLOC_FL_KEEP_SIZE, file_status.st_size, static_cast<off_t>(size)) != 0)
+    {
+      // EOPNOTSUPP etc. only mean that we cannot preallocate
+      return ((errno != ENOSPC) && (errno != EFBIG) && (errno != EDQUOT));
+    }
+
+    preallocated_ = true;
+    return true;
+#else
+    (void)size;
+    return true;
+#endif // __linux__
+  }
+
+  void WriteableFile::setWritebackInterval(std::uint64_t interval)
+  {
+    writeback_interval_ = interval;
+  }
+
+  bool WriteableFile::sync()
+  {
+    if (!good())
+      return false;
+
+    int result = 0;
+    do
+    {
+#if defined(__APPLE__)
+      // fsync() does not flush the cache of the drive on macOS
+      result = ::fcntl(fd_, F_FULLFSYNC);
+      if ((result != 0) && (errno != EINTR))
+        result = ::fsync(fd_);
+#elif defined(__linux__)
+      result = ::fdatasync(fd_);
+#else
+      result = ::fsync(fd_);
+#endif
+    } while ((result != 0) && (errno == EINTR));
+
+    if (result != 0)
+      write_error_ = true;
+
+    return good();
+  }
+
+  bool WriteableFile::syncFilesystem()
+  {
+#ifdef __linux__
+    if (!good())
+      return false;
+
+    return (::syncfs(fd_) == 0);
+#else
+    return false;
+#endif // __linux__
+  }
+
+  std::uint64_t WriteableFile::filesystemId() const
+  {
+    struct stat file_status {};
+    if ((-1 == fd_) || (::fstat(fd_, &file_status) != 0))
+      return 0;
+
+    return static_cast<std::uint64_t>(file_status.st_dev);
+  }
+
+  bool WriteableFile::commit(bool durable)
+  {
+    const bool opened = (-1 != fd_);
+    close();
+
+    if (!opened || write_error_)
+      return false;
+
+    if (!temp_filename_.empty())
+    {
+      if (::rename(temp_filename_.c_str(), filename_.c_str()) != 0)
+        return false;
+    }
+
+    committed_ = true;
+
+    if (durable)
+    {
+      // The directory entry of a new or renamed file is only durable after
+      // the directory itself has been flushed.
+      const std::string::size_type separator_pos = filename_.find_last_of('/');
+      std::string parent_dir;
+      if (separator_pos == std::string::npos)
+        parent_dir = ".";
+      else if (separator_pos == 0)
+        parent_dir = "/";
+      else
+        parent_dir = filename_.substr(0, separator_pos);
+
+      int dir_fd = -1;
+      do
+      {
+        dir_fd = ::open(parent_dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+      } while ((dir_fd == -1) && (errno == EINTR));
+
+      if (dir_fd == -1)
+        return false;
+
+      int result = 0;
+      do
+      {
+        result = ::fsync(dir_fd);
+      } while ((result != 0) && (errno == EINTR));
+
+      // Some filesystems don't support flushing directories (EINVAL)
+      const bool dir_ok = ((result == 0) || (errno == EINVAL));
+      ::close(dir_fd);
+      return dir_ok;
+    }
+
+    return true;
+  }
 }
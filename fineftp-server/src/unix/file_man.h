@@ -5,11 +5,11 @@
 
 #include <cstddef>
 #include <cstdint>
-#include <fstream>
 #include <ios>
 #include <memory>
 #include <string>
-#include <vector>
+
+#include <sys/types.h>
 
 namespace fineftp
 {
@@ -57,20 +57,33 @@ private:
 };
 
 
-/// @brief A writeable file tailored for the Win32 environment.
+/// @brief A writeable file that writes the data directly to its file descriptor.
+///
+/// There is no additional buffering (the data written is already buffered
+/// in large chunks by the caller), so each write() results in one or more
+/// write() system calls without copying the data.
+///
+/// @note The implementation is NOT thread safe!
 class WriteableFile
 {
 public:
   /// @brief Constructor.
   ///
   /// @param filename  The (UTF-8 encoded) name of the file.
-  /// @param mode      The open mode to use for the file (std::ios::out is implied).
-  WriteableFile(const std::string& filename, std::ios::openmode mode)
-    : file_stream_(filename, std::ios::out | mode)
-    , stream_buffer_(1024 * 1024)
-  {
-    file_stream_.rdbuf()->pubsetbuf(stream_buffer_.data(), static_cast<std::streamsize>(stream_buffer_.size()));
-  }
+  /// @param mode      The open mode to use for the file (std::ios::out is implied). Only std::ios::app is evaluated, std::ios::binary has no effect on POSIX systems.
+  WriteableFile(const std::string& filename, std::ios::openmode mode);
+
+  /// @brief Constructor for atomic uploads.
+  ///
+  /// The data is written to the temporary file, which is renamed to the
+  /// final filename by commit(). If the file is destroyed without being
+  /// committed, the temporary file is deleted. Readers therefore never see
+  /// an incomplete file.
+  ///
+  /// @param filename       The (UTF-8 encoded) final name of the file.
+  /// @param temp_filename  The (UTF-8 encoded) name of the temporary file. Must be on the same filesystem as filename. If empty, filename is written directly.
+  /// @param mode           The open mode to use for the file (std::ios::out is implied).
+  WriteableFile(const std::string& filename, const std::string& temp_filename, std::ios::openmode mode);
 
   // Copy disabled
   WriteableFile(const WriteableFile&)            = delete;
@@ -80,29 +93,92 @@ public:
   WriteableFile& operator=(WriteableFile&&)      = delete;
   WriteableFile(WriteableFile&&)                 = delete;
 
-  ~WriteableFile()
-  {
-    close();
-  }
-
-  void write(const char* data, std::size_t sz)
-  {
-    file_stream_.write(data, static_cast<std::streamsize>(sz));
-  }
-
-  void close()
-  {
-    file_stream_.flush();
-    file_stream_.close();
-  }
-
-  bool good() const
-  {
-    return file_stream_.good();
-  }
-
-  std::fstream      file_stream_;
-  std::vector<char> stream_buffer_;
+  ~WriteableFile();
+
+  void write(const char* data, std::size_t sz);
+  void close();
+  bool good() const;
+
+  /// @brief Reserves disk space for data that will be written to the end of the file.
+  ///
+  /// Preallocating lets the filesystem place the file in contiguous extents
+  /// and makes a lack of disk space visible before any data is transferred.
+  /// The file size is not changed. If the filesystem does not support
+  /// preallocation, nothing happens.
+  ///
+  /// @param size  The number of bytes that will be appended to the file.
+  ///
+  /// @return false if there is not enough disk space.
+  bool preallocate(std::uint64_t size);
+
+  /// @brief Starts the writeback of the written data every interval bytes.
+  ///
+  /// The writeback is only initiated (sync_file_range on Linux), write()
+  /// does not wait for it. This keeps the amount of dirty pages of large
+  /// uploads low, so a final sync() has little work left. On other systems,
+  /// this has no effect.
+  ///
+  /// @param interval  Number of bytes after which the writeback is started. 0 disables it.
+  void setWritebackInterval(std::uint64_t interval);
+
+  /// @brief Flushes the data of the file to the storage device (fdatasync).
+  ///
+  /// This may block for a long time and should not be called from the io_context threads.
+  ///
+  /// @return false if the data could not be written.
+  bool sync();
+
+  /// @brief Flushes all files of the filesystem that contains this file (syncfs).
+  ///
+  /// Flushing a whole filesystem once is cheaper than flushing many files
+  /// on it one by one. This is only supported on Linux.
+  ///
+  /// @return false if the filesystem could not be flushed or it is not supported. sync() has to be used then.
+  bool syncFilesystem();
+
+  /// @brief Returns an ID of the filesystem that contains the file (the device ID)
+  std::uint64_t filesystemId() const;
+
+#ifdef __linux__
+  /// @brief Returns whether spliceFromSocket() can be used. Files opened for appending cannot be the target of splice().
+  bool supportsSplice() const;
+
+  /// @brief Receives data from a socket and writes it to the file without copying it to user space.
+  ///
+  /// The data is moved from the socket to a pipe and from the pipe to the
+  /// file with splice(). The pipe is created on the first call and closed
+  /// with the file.
+  ///
+  /// @param socket_fd  A non-blocking socket.
+  /// @param max_size   The maximum number of bytes to receive.
+  ///
+  /// @return The number of bytes written to the file, 0 on EOF or -1 with
+  ///         errno set on errors (EAGAIN if no data is available). After a
+  ///         write error, good() returns false.
+  ssize_t spliceFromSocket(int socket_fd, std::size_t max_size);
+#endif // __linux__
+
+  /// @brief Closes the file and moves it to its final name, if it has been written to a temporary file.
+  ///
+  /// @param durable  Flush the parent directory after the file has been created or renamed, so the directory entry is durable, too.
+  ///
+  /// @return false if not all data could be written or the file could not be renamed.
+  bool commit(bool durable = false);
+
+private:
+  void startWritebackIfDue();
+
+private:
+  std::string   filename_;
+  std::string   temp_filename_;
+  int           fd_                 = -1;
+  bool          write_error_        = false;
+  bool          committed_          = false;
+  bool          preallocated_       = false;
+  std::uint64_t writeback_interval_ = 0;
+  std::uint64_t unsynced_bytes_     = 0;
+  bool          append_             = false;
+  int           pipe_fds_[2]        = {-1, -1};   // Pipe for spliceFromSocket()
 };
 
 
@@ -121,6 +197,11 @@ inline const std::string& ReadableFile::path() const
   return path_;
 }
 
+inline bool WriteableFile::good() const
+{
+  return (-1 != fd_) && !write_error_;
+}
+
 }
 
 #endif  // FINEFTP_SERVER_SRC_UNIX_FILE_MAN_H_
@@ -0,0 +1,98 @@
+#include "upload_committer.h"
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include <asio.hpp> // IWYU pragma: keep
+
+#include <fineftp/durability.h>
+
+#include <file_man.h>
+
+namespace fineftp
+{
+  UploadCommitter::UploadCommitter(asio::thread_pool& worker_pool, UploadDurability durability)
+    : worker_pool_         (worker_pool)
+    , durability_          (durability)
+    , group_commit_running_(false)
+  {}
+
+  UploadDurability UploadCommitter::durability() const
+  {
+    return durability_;
+  }
+
+  void UploadCommitter::commit(const std::shared_ptr<WriteableFile>& file, const CompletionHandler& completion_handler)
+  {
+    switch (durability_)
+    {
+    case UploadDurability::None:
+      completion_handler(file->commit());
+      return;
+
+    case UploadDurability::GroupCommit:
+    {
+      const std::lock_guard<std::mutex> lock(group_commit_mutex_);
+      group_commit_queue_.emplace_back(file, completion_handler);
+
+      // If a group commit is running, it will pick up the file when it is done
+      if (!group_commit_running_)
+      {
+        group_commit_running_ = true;
+        asio::post(worker_pool_, [this]() { runGroupCommit(); });
+      }
+      return;
+    }
+
+    default:
+      asio::post(worker_pool_, [file, completion_handler]()
+                              {
+                                // A failed sync lets the commit fail, too
+                                file->sync();
+                                completion_handler(file->commit(true));
+                              });
+      return;
+    }
+  }
+
+  void UploadCommitter::runGroupCommit()
+  {
+    for (;;)
+    {
+      std::vector<std::pair<std::shared_ptr<WriteableFile>, CompletionHandler>> group;
+      {
+        const std::lock_guard<std::mutex> lock(group_commit_mutex_);
+        if (group_commit_queue_.empty())
+        {
+          group_commit_running_ = false;
+          return;
+        }
+        group.swap(group_commit_queue_);
+      }
+
+      // Flush each filesystem only once. If that is not supported, the files
+      // have to be flushed one by one.
+      std::set<std::uint64_t> synced_filesystems;
+      for (auto& upload : group)
+      {
+        const std::uint64_t filesystem_id = upload.first->filesystemId();
+        if (synced_filesystems.find(filesystem_id) != synced_filesystems.end())
+          continue;
+
+        if (upload.first->syncFilesystem())
+          synced_filesystems.insert(filesystem_id);
+        else
+          upload.first->sync();
+      }
+
+      for (auto& upload : group)
+      {
+        upload.second(upload.first->commit(true));
+      }
+    }
+  }
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <asio.hpp> // IWYU pragma: keep
+
+#include <fineftp/durability.h>
+
+#include <file_man.h>
+
+namespace fineftp
+{
+  /**
+   * @brief Closes uploaded files according to the UploadDurability policy
+   *
+   * Flushing files may block for a long time, so it is executed on the
+   * worker threads. With UploadDurability::GroupCommit, all uploads that
+   * finish while a flush is running are collected and flushed together
+   * afterwards, so many concurrent uploads share one syncfs() instead of
+   * waiting for each other's fdatasync().
+   *
+   * The UploadCommitter is shared by all sessions and thread safe.
+   */
+  class UploadCommitter
+  {
+  public:
+    using CompletionHandler = std::function<void(bool)>;
+
+    UploadCommitter(asio::thread_pool& worker_pool, UploadDurability durability);
+
+    // Copy and move disabled (as we are storing the this pointer in lambda captures)
+    UploadCommitter(const UploadCommitter&)            = delete;
+    UploadCommitter& operator=(const UploadCommitter&) = delete;
+    UploadCommitter(UploadCommitter&&)                 = delete;
+    UploadCommitter& operator=(UploadCommitter&&)      = delete;
+
+    ~UploadCommitter() = default;
+
+    UploadDurability durability() const;
+
+    /**
+     * @brief Flushes the file if required by the policy and commits it
+     *
+     * With UploadDurability::None, the file is committed and the completion
+     * handler is called before this function returns. Otherwise, the
+     * completion handler is called from a worker thread.
+     *
+     * @param file:               The completely received file
+     * @param completion_handler: Called with the result of WriteableFile::commit()
+     */
+    void commit(const std::shared_ptr<WriteableFile>& file, const CompletionHandler& completion_handler);
+
+  private:
+    void runGroupCommit();
+
+  private:
+    asio::thread_pool&     worker_pool_;
+    const UploadDurability durability_;
+
+    std::mutex                                                                  group_commit_mutex_;
+    std::vector<std::pair<std::shared_ptr<WriteableFile>, CompletionHandler>>  group_commit_queue_;
+    bool                                                                        group_commit_running_;
+  };
+}
@@ -1,18 +1,83 @@
 #include "user_database.h"
 
+#include <algorithm>
+#include <fstream>
 #include <iostream>
 #include <mutex>
-#include <map>
 #include <string>
 #include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
 #include "ftp_user.h"
+#include "password_hash.h"
 #include <fineftp/permissions.h>
 
+#if defined(WIN32) && !defined(__GNUG__)
+  #include "win_str_convert.h"
+#endif
+
 namespace fineftp
 {
+  namespace
+  {
+    // Parses permission names separated by '|', e.g. "FileRead|DirList"
+    bool parsePermissions(const std::string& permissions_string, Permission& permissions)
+    {
+      static const std::pair<const char*, Permission> permission_names[] =
+      {
+        { "FileRead",   Permission::FileRead },
+        { "FileWrite",  Permission::FileWrite },
+        { "FileAppend", Permission::FileAppend },
+        { "FileDelete", Permission::FileDelete },
+        { "FileRename", Permission::FileRename },
+        { "DirList",    Permission::DirList },
+        { "DirCreate",  Permission::DirCreate },
+        { "DirDelete",  Permission::DirDelete },
+        { "DirRename",  Permission::DirRename },
+        { "All",        Permission::All },
+        { "ReadOnly",   Permission::ReadOnly },
+        { "None",       Permission::None },
+      };
+
+      permissions = Permission::None;
+
+      std::size_t start = 0;
+      for (;;)
+      {
+        const std::size_t end = permissions_string.find('|', start);
+        std::string name = permissions_string.substr(start, (end == std::string::npos ? std::string::npos : end - start));
+
+        // Spaces around the names are allowed
+        name.erase(0, std::min(name.size(), name.find_first_not_of(" \t")));
+        name.erase(name.find_last_not_of(" \t") + 1);
+
+        bool found = false;
+        for (const auto& permission_name : permission_names)
+        {
+          if (name == permission_name.first)
+          {
+            permissions |= permission_name.second;
+            found = true;
+            break;
+          }
+        }
+        if (!found)
+          return false;
+
+        if (end == std::string::npos)
+          break;
+        start = end + 1;
+      }
+      return true;
+    }
+  }
+
   UserDatabase::UserDatabase(std::ostream& output, std::ostream& error)
-    : output_(output)
+    : snapshot_(std::make_shared<const Snapshot>())
+    , output_(output)
     , error_(error)
   {
 #ifdef NDEBUG
@@ -23,18 +88,39 @@ namespace fineftp
 
   bool UserDatabase::addUser(const std::string& username, const std::string& password, const std::string& local_root_path, Permission permissions)
   {
-    const std::lock_guard<decltype(database_mutex_)> database_lock(database_mutex_);
+    return addFtpUser(username, std::make_shared<FtpUser>(password, local_root_path, permissions));
+  }
+
+  bool UserDatabase::addUserWithPasswordHash(const std::string& username, const std::string& password_hash, const std::string& local_root_path, Permission permissions)
+  {
+    auto parsed_password_hash = PasswordHash::parse(password_hash);
+    if (!parsed_password_hash)
+    {
+      error_ << "Error adding user with username \"" << username << "\". The password hash is invalid." << std::endl;
+      return false;
+    }
+
+    return addFtpUser(username, std::make_shared<FtpUser>(parsed_password_hash, local_root_path, permissions));
+  }
+
+  bool UserDatabase::addFtpUser(const std::string& username, const std::shared_ptr<FtpUser>& user)
+  {
+    const std::lock_guard<decltype(write_mutex_)> write_lock(write_mutex_);
+
+    const std::shared_ptr<const Snapshot> old_snapshot = std::atomic_load(&snapshot_);
 
     if (isUsernameAnonymousUser(username))
     {
-      if (anonymous_user_)
+      if (old_snapshot->anonymous_user)
       {
         error_ << "Error adding user with username \"" << username << "\". The username denotes the anonymous user, which is already present." << std::endl;
         return false;
       }
       else
       {
-        anonymous_user_ = std::make_shared<FtpUser>(password, local_root_path, permissions);
+        auto new_snapshot = std::make_shared<Snapshot>(*old_snapshot);
+        new_snapshot->anonymous_user = user;
+        std::atomic_store(&snapshot_, std::shared_ptr<const Snapshot>(std::move(new_snapshot)));
 #ifndef NDEBUG
         output_ << "Successfully added anonymous user." << std::endl;
 #endif // !NDEBUG
@@ -43,10 +129,11 @@ namespace fineftp
     }
     else
     {
-      auto user_it = database_.find(username);
-      if (user_it == database_.end())
+      if (old_snapshot->users.find(username) == old_snapshot->users.end())
       {
-        database_.emplace(username, std::make_shared<FtpUser>(password, local_root_path, permissions));
+        auto new_snapshot = std::make_shared<Snapshot>(*old_snapshot);
+        new_snapshot->users.emplace(username, user);
+        std::atomic_store(&snapshot_, std::shared_ptr<const Snapshot>(std::move(new_snapshot)));
 #ifndef NDEBUG
         output_ << "Successfully added user \"" << username << "\"." << std::endl;
 #endif // !NDEBUG
@@ -60,29 +147,197 @@ namespace fineftp
     }
   }
 
-  std::shared_ptr<FtpUser> UserDatabase::getUser(const std::string& username, const std::string& password) const
+  bool UserDatabase::removeUser(const std::string& username)
   {
-    const std::lock_guard<decltype(database_mutex_)> database_lock(database_mutex_);
+    const std::lock_guard<decltype(write_mutex_)> write_lock(write_mutex_);
+
+    const std::shared_ptr<const Snapshot> old_snapshot = std::atomic_load(&snapshot_);
 
     if (isUsernameAnonymousUser(username))
     {
-      return anonymous_user_;
+      if (!old_snapshot->anonymous_user)
+      {
+        error_ << "Error removing anonymous user. The user does not exist." << std::endl;
+        return false;
+      }
+
+      auto new_snapshot = std::make_shared<Snapshot>(*old_snapshot);
+      new_snapshot->anonymous_user.reset();
+      new_snapshot->file_usernames.erase("anonymous");
+      std::atomic_store(&snapshot_, std::shared_ptr<const Snapshot>(std::move(new_snapshot)));
+#ifndef NDEBUG
+      output_ << "Successfully removed anonymous user." << std::endl;
+#endif // !NDEBUG
+      return true;
     }
     else
     {
-      auto user_it = database_.find(username);
-      if (user_it == database_.end())
+      if (old_snapshot->users.find(username) == old_snapshot->users.end())
+      {
+        error_ << "Error removing user with username \"" << username << "\". The user does not exist." << std::endl;
+        return false;
+      }
+
+      auto new_snapshot = std::make_shared<Snapshot>(*old_snapshot);
+      new_snapshot->users.erase(username);
+      new_snapshot->file_usernames.erase(username);
+      std::atomic_store(&snapshot_, std::shared_ptr<const Snapshot>(std::move(new_snapshot)));
+#ifndef NDEBUG
+      output_ << "Successfully removed user \"" << username << "\"." << std::endl;
+#endif // !NDEBUG
+      return true;
+    }
+  }
+
+  bool UserDatabase::loadUserFile(const std::string& path)
+  {
+#if defined(WIN32) && !defined(__GNUG__)
+    std::ifstream file(StrConvert::Utf8ToWide(path));
+#else
+    std::ifstream file(path);
+#endif
+    if (!file.is_open())
+    {
+      error_ << "Error loading user file " << path << ": Error opening file" << std::endl;
+      return false;
+    }
+
+    // Parse the whole file first, so an invalid file doesn't leave us with only half of the users
+    std::vector<std::pair<std::string, std::shared_ptr<FtpUser>>> file_users;
+    std::unordered_set<std::string>                                file_usernames;
+
+    std::string line;
+    for (int line_number = 1; std::getline(file, line); line_number++)
+    {
+      if (!line.empty() && (line.back() == '\r'))
+        line.pop_back();
+
+      if (line.empty() || (line.front() == '#'))
+        continue;
+
+      const std::size_t username_end    = line.find(':');
+      const std::size_t hash_end        = (username_end == std::string::npos ? std::string::npos : line.find(':', username_end + 1));
+      const std::size_t permissions_end = (hash_end     == std::string::npos ? std::string::npos : line.find(':', hash_end + 1));
+      if (permissions_end == std::string::npos)
       {
-        return nullptr;
+        error_ << "Error loading user file " << path << ": Line " << line_number << " must have the format username:password_hash:permissions:local_root_path" << std::endl;
+        return false;
+      }
+
+      const std::string username           = line.substr(0, username_end);
+      const std::string password_hash      = line.substr(username_end + 1, hash_end - username_end - 1);
+      const std::string permissions_string = line.substr(hash_end + 1, permissions_end - hash_end - 1);
+      const std::string local_root_path    = line.substr(permissions_end + 1);
+
+      Permission permissions = Permission::None;
+      if (!parsePermissions(permissions_string, permissions))
+      {
+        error_ << "Error loading user file " << path << ": Line " << line_number << " contains invalid permissions \"" << permissions_string << "\"" << std::endl;
+        return false;
+      }
+
+      if (local_root_path.empty())
+      {
+        error_ << "Error loading user file " << path << ": Line " << line_number << " has no local root path" << std::endl;
+        return false;
+      }
+
+      const std::string key = (isUsernameAnonymousUser(username) ? "anonymous" : username);
+      if (!file_usernames.insert(key).second)
+      {
+        error_ << "Error loading user file " << path << ": Line " << line_number << " contains the user \"" << username << "\" again" << std::endl;
+        return false;
+      }
+
+      if (key == "anonymous")
+      {
+        file_users.emplace_back(key, std::make_shared<FtpUser>("", local_root_path, permissions));
       }
       else
       {
-        if (user_it->second->password_ == password)
-          return user_it->second;
-        else
-          return nullptr;
+        auto parsed_password_hash = PasswordHash::parse(password_hash);
+        if (!parsed_password_hash)
+        {
+          error_ << "Error loading user file " << path << ": Line " << line_number << " contains an invalid password hash" << std::endl;
+          return false;
+        }
+        file_users.emplace_back(key, std::make_shared<FtpUser>(parsed_password_hash, local_root_path, permissions));
       }
     }
+
+    if (file.bad())
+    {
+      error_ << "Error loading user file " << path << ": Error reading file" << std::endl;
+      return false;
+    }
+
+    const std::lock_guard<decltype(write_mutex_)> write_lock(write_mutex_);
+
+    const std::shared_ptr<const Snapshot> old_snapshot = std::atomic_load(&snapshot_);
+
+    // Users that have been added by code must not be replaced by the file
+    for (const auto& file_user : file_users)
+    {
+      if (old_snapshot->file_usernames.count(file_user.first) != 0)
+        continue;
+
+      const bool exists = (file_user.first == "anonymous" ? (old_snapshot->anonymous_user != nullptr) : (old_snapshot->users.count(file_user.first) != 0));
+      if (exists)
+      {
+        error_ << "Error loading user file " << path << ": The user \"" << file_user.first << "\" already exists" << std::endl;
+        return false;
+      }
+    }
+
+    auto new_snapshot = std::make_shared<Snapshot>(*old_snapshot);
+
+    for (const auto& old_username : old_snapshot->file_usernames)
+    {
+      if (old_username == "anonymous")
+        new_snapshot->anonymous_user.reset();
+      else
+        new_snapshot->users.erase(old_username);
+    }
+
+    for (auto& file_user : file_users)
+    {
+      if (file_user.first == "anonymous")
+        new_snapshot->anonymous_user = std::move(file_user.second);
+      else
+        new_snapshot->users[file_user.first] = std::move(file_user.second);
+    }
+    new_snapshot->file_usernames = std::move(file_usernames);
+
+    std::atomic_store(&snapshot_, std::shared_ptr<const Snapshot>(std::move(new_snapshot)));
+#ifndef NDEBUG
+    output_ << "Successfully loaded " << file_users.size() << " users from " << path << "." << std::endl;
+#endif // !NDEBUG
+    return true;
+  }
+
+  std::shared_ptr<FtpUser> UserDatabase::getUser(const std::string& username, const std::string& password) const
+  {
+    auto user = findUser(username);
+    if (!user || isUsernameAnonymousUser(username))
+      return user;
+
+    const bool password_ok = (user->password_hash_ ? user->password_hash_->verify(password) : (user->password_ == password));
+    return (password_ok ? user : nullptr);
+  }
+
+  std::shared_ptr<FtpUser> UserDatabase::findUser(const std::string& username) const
+  {
+    const std::shared_ptr<const Snapshot> snapshot = std::atomic_load(&snapshot_);
+
+    if (isUsernameAnonymousUser(username))
+    {
+      return snapshot->anonymous_user;
+    }
+    else
+    {
+      auto user_it = snapshot->users.find(username);
+      return (user_it == snapshot->users.end() ? nullptr : user_it->second);
+    }
   }
 
   bool UserDatabase::isUsernameAnonymousUser(const std::string& username) const // NOLINT(readability-convert-member-functions-to-static) Reason: I don't want to break the API. Otherwise this is a good finding and should be accepted.
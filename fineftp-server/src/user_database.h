@@ -1,15 +1,35 @@
 #pragma once
 
 #include <mutex>
-#include <map>
 #include <string>
 #include <memory>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "ftp_user.h"
 #include <fineftp/permissions.h>
 
 namespace fineftp
 {
+  /**
+   * @brief The users that can log in to the server
+   *
+   * The users are stored in an immutable snapshot. Logins only copy the
+   * pointer to the current snapshot with std::atomic_load() and look up the
+   * user without any lock. Modifications copy the snapshot, change the copy
+   * and publish it (copy-on-write), so they never block logins for longer
+   * than that pointer copy. Sessions that are logged in keep their FtpUser,
+   * even if the user is removed.
+   *
+   * Note that std::atomic_load() on a shared_ptr is not lock-free: the
+   * common standard libraries protect it with a small global pool of
+   * mutexes (or a spin lock), which is only held while the reference count
+   * is incremented.
+   *
+   * Users can also be loaded from a user file, see loadUserFile(). Loading
+   * the file again replaces the users of the previous version of the file,
+   * users that have been added by code are kept.
+   */
   class UserDatabase
   {
   public:
@@ -17,16 +37,66 @@ namespace fineftp
 
     bool addUser(const std::string& username, const std::string& password, const std::string& local_root_path, Permission permissions);
 
+    /**
+     * @brief Adds a user whose password is stored as hash, see PasswordHash
+     *
+     * @return False if the user exists already or the hash is invalid
+     */
+    bool addUserWithPasswordHash(const std::string& username, const std::string& password_hash, const std::string& local_root_path, Permission permissions);
+
+    bool removeUser(const std::string& username);
+
+    /**
+     * @brief Replaces the users of the user file with the users in the file at the given path
+     *
+     * Each line of the file describes one user:
+     *
+     *   username:password_hash:permissions:local_root_path
+     *
+     * The permissions are names of Permission flags separated by '|' (e.g.
+     * "FileRead|DirList" or "All"). The password hash of the anonymous user
+     * is ignored and may be empty. Empty lines and lines starting with '#'
+     * are ignored.
+     *
+     * The file is applied as a whole: If any line is invalid, the users
+     * stay unchanged.
+     *
+     * @return False if the file cannot be read or is invalid
+     */
+    bool loadUserFile(const std::string& path);
+
+    /**
+     * @brief Returns the user if the password is correct
+     *
+     * Verifying a password hash is slow. Logins should use the PasswordVerifier.
+     */
     std::shared_ptr<FtpUser> getUser(const std::string& username, const std::string& password) const;
 
-  private:
+    /**
+     * @brief Returns the user without checking the password
+     *
+     * @return The user or nullptr, if it doesn't exist
+     */
+    std::shared_ptr<FtpUser> findUser(const std::string& username) const;
+
     bool isUsernameAnonymousUser(const std::string& username) const;
 
-    mutable std::mutex                              database_mutex_;
-    std::map<std::string, std::shared_ptr<FtpUser>> database_;
-    std::shared_ptr<FtpUser>                        anonymous_user_;
+  private:
+    struct Snapshot
+    {
+      std::unordered_map<std::string, std::shared_ptr<FtpUser>> users;
+      std::shared_ptr<FtpUser>                                  anonymous_user;
+      std::unordered_set<std::string>                           file_usernames;   // The users loaded from the user file. The anonymous user is stored as "anonymous".
+    };
+
+    bool addFtpUser(const std::string& username, const std::shared_ptr<FtpUser>& user);
+
+    // Only accessed with std::atomic_load() / std::atomic_store(), as std::atomic<std::shared_ptr> requires C++20
+    std::shared_ptr<const Snapshot> snapshot_;
+
+    std::mutex                      write_mutex_;   // Serializes the modifications, so none of them gets lost
 
     std::ostream& output_;  /* Normal output log */
     std::ostream& error_;   /* Error output log */
   };
-}
\ No newline at end of file
+}
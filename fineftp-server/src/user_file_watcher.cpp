@@ -0,0 +1,160 @@
+#include "user_file_watcher.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <string>
+
+#include <asio.hpp> // IWYU pragma: keep
+
+#include "filesystem.h"
+#include "user_database.h"
+
+#ifdef __linux__
+  #include <sys/inotify.h>
+  #include <unistd.h>
+#endif // __linux__
+
+namespace fineftp
+{
+#ifdef __linux__
+
+  UserFileWatcher::UserFileWatcher(asio::io_context& io_context, UserDatabase& user_database, const std::string& path, std::ostream& error)
+    : user_database_     (user_database)
+    , path_              (path)
+    , error_             (error)
+    , inotify_descriptor_(io_context)
+    , event_buffer_      {}
+  {
+    // The directory is watched, as the file itself may be replaced by a rename
+    const std::size_t last_slash = path_.find_last_of('/');
+    if (last_slash == std::string::npos)
+    {
+      dir_path_  = ".";
+      file_name_ = path_;
+    }
+    else
+    {
+      dir_path_  = (last_slash == 0 ? "/" : path_.substr(0, last_slash));
+      file_name_ = path_.substr(last_slash + 1);
+    }
+  }
+
+  UserFileWatcher::~UserFileWatcher() = default;
+
+  bool UserFileWatcher::start()
+  {
+    const int inotify_fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd < 0)
+    {
+      error_ << "Error watching user file " << path_ << ": " << std::strerror(errno) << std::endl;
+      return false;
+    }
+
+    if (::inotify_add_watch(inotify_fd, dir_path_.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+    {
+      error_ << "Error watching user file " << path_ << ": " << std::strerror(errno) << std::endl;
+      ::close(inotify_fd);
+      return false;
+    }
+
+    asio::error_code ec;
+    inotify_descriptor_.assign(inotify_fd, ec);
+    if (ec)
+    {
+      error_ << "Error watching user file " << path_ << ": " << ec.message() << std::endl;
+      ::close(inotify_fd);
+      return false;
+    }
+
+    readEvents();
+    return true;
+  }
+
+  void UserFileWatcher::readEvents()
+  {
+    inotify_descriptor_.async_read_some(asio::buffer(event_buffer_, sizeof(event_buffer_))
+                                      , [this](const asio::error_code& ec, std::size_t bytes_read)
+                                        {
+                                          if (ec)
+                                          {
+                                            if (ec != asio::error::operation_aborted)
+                                              error_ << "Error watching user file " << path_ << ": " << ec.message() << std::endl;
+                                            return;
+                                          }
+
+                                          // All events that have piled up only cause a single reload
+                                          bool file_changed = false;
+                                          for (std::size_t offset = 0; offset + sizeof(struct inotify_event) <= bytes_read; )
+                                          {
+                                            const auto* event = reinterpret_cast<const struct inotify_event*>(event_buffer_ + offset);
+                                            if ((event->mask & IN_Q_OVERFLOW) != 0)
+                                              file_changed = true;
+                                            else if ((event->len > 0) && (std::strcmp(event->name, file_name_.c_str()) == 0))
+                                              file_changed = true;
+
+                                            offset += sizeof(struct inotify_event) + event->len;
+                                          }
+
+                                          if (file_changed)
+                                            reload();
+
+                                          readEvents();
+                                        });
+  }
+
+#else // __linux__
+
+  UserFileWatcher::UserFileWatcher(asio::io_context& io_context, UserDatabase& user_database, const std::string& path, std::ostream& error)
+    : user_database_         (user_database)
+    , path_                  (path)
+    , error_                 (error)
+    , poll_timer_            (io_context)
+    , last_modification_time_(0)
+    , last_size_             (0)
+  {}
+
+  UserFileWatcher::~UserFileWatcher() = default;
+
+  bool UserFileWatcher::start()
+  {
+    const Filesystem::FileStatus status(path_);
+    last_modification_time_ = (status.isOk() ? status.modificationTime() : 0);
+    last_size_              = (status.isOk() ? status.fileSize()         : 0);
+
+    waitForNextPoll();
+    return true;
+  }
+
+  void UserFileWatcher::waitForNextPoll()
+  {
+    poll_timer_.expires_after(std::chrono::seconds(2));
+    poll_timer_.async_wait([this](const asio::error_code& ec)
+                           {
+                             if (ec)
+                               return;
+
+                             // The modification time only has a resolution of seconds, so the size is compared, too
+                             const Filesystem::FileStatus status(path_);
+                             if (status.isOk()
+                                 && ((status.modificationTime() != last_modification_time_) || (status.fileSize() != last_size_)))
+                             {
+                               last_modification_time_ = status.modificationTime();
+                               last_size_              = status.fileSize();
+                               reload();
+                             }
+
+                             waitForNextPoll();
+                           });
+  }
+
+#endif // __linux__
+
+  void UserFileWatcher::reload()
+  {
+    if (!user_database_.loadUserFile(path_))
+      error_ << "Keeping the previous users, as the user file " << path_ << " could not be loaded." << std::endl;
+  }
+}
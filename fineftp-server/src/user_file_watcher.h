@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+#include <asio.hpp> // IWYU pragma: keep
+
+#ifdef __linux__
+  #include <sys/inotify.h>
+#endif // __linux__
+
+#include "user_database.h"
+
+namespace fineftp
+{
+  /**
+   * @brief Reloads the user file into the UserDatabase whenever it changes
+   *
+   * On Linux the directory of the file is watched with inotify. Editors
+   * often save a file by writing a new file and renaming it, so both
+   * closing a file after writing and renaming a file to the watched name
+   * trigger a reload. On other operating systems the modification time and
+   * size of the file are polled.
+   *
+   * If the new version of the file is invalid, the error is logged and the
+   * users stay unchanged. Sessions that are logged in keep their user.
+   *
+   * All work is done on the given io_context.
+   */
+  class UserFileWatcher
+  {
+  public:
+    UserFileWatcher(asio::io_context& io_context, UserDatabase& user_database, const std::string& path, std::ostream& error);
+
+    // Copy and move disabled (as we are storing the this pointer in lambda captures)
+    UserFileWatcher(const UserFileWatcher&)            = delete;
+    UserFileWatcher& operator=(const UserFileWatcher&) = delete;
+    UserFileWatcher(UserFileWatcher&&)                 = delete;
+    UserFileWatcher& operator=(UserFileWatcher&&)      = delete;
+
+    ~UserFileWatcher();
+
+    /**
+     * @brief Starts watching the file
+     *
+     * @return False if the file cannot be watched
+     */
+    bool start();
+
+  private:
+    void reload();
+
+#ifdef __linux__
+    void readEvents();
+#else
+    void waitForNextPoll();
+#endif // __linux__
+
+  private:
+    UserDatabase&     user_database_;
+    const std::string path_;
+    std::ostream&     error_;
+
+#ifdef __linux__
+    std::string                    dir_path_;
+    std::string                    file_name_;
+    asio::posix::stream_descriptor inotify_descriptor_;
+    alignas(struct inotify_event) char event_buffer_[4096];   // Large enough for at least one event with a name of NAME_MAX
+#else
+    asio::steady_timer             poll_timer_;
+    std::int64_t                   last_modification_time_;
+    std::int64_t                   last_size_;
+#endif // __linux__
+  };
+}
@@ -155,6 +155,12 @@ std::shared_ptr<ReadableFile> ReadableFile::get(const Str& file_path)
 }
   
 WriteableFile::WriteableFile(const std::string& filename, std::ios::openmode mode)
+  : WriteableFile(filename, "", mode)
+{}
+
+WriteableFile::WriteableFile(const std::string& filename, const std::string& temp_filename, std::ios::openmode mode)
+  : filename_(filename)
+  , temp_filename_(temp_filename)
 {
   // std::ios::binary is ignored in mode because, on Windows, even ASCII files have to be stored as
   // binary files as they come in with the right line endings.
@@ -175,12 +181,16 @@ WriteableFile::WriteableFile(const std::string& filename, std::ios::openmode mod
     dwCreationDisposition = CREATE_ALWAYS;   // Not Append => Create new file
   }
 
+  // Temporary files of atomic uploads are hidden
+  const std::string& open_filename       = (temp_filename_.empty() ? filename_ : temp_filename_);
+  const DWORD        dwFlagsAndAttributes = (temp_filename_.empty() ? FILE_ATTRIBUTE_NORMAL : FILE_ATTRIBUTE_HIDDEN);
+
   // https://learn.microsoft.com/en-us/windows/win32/api/fileapi/nf-fileapi-createfilew
 #if !defined(__GNUG__)
-  auto wfilename = StrConvert::Utf8ToWide(filename);
-  handle_ = ::CreateFileW(wfilename.c_str(), dwDesiredAccess, FILE_SHARE_DELETE, nullptr, dwCreationDisposition, FILE_ATTRIBUTE_NORMAL, nullptr);
+  auto wfilename = StrConvert::Utf8ToWide(open_filename);
+  handle_ = ::CreateFileW(wfilename.c_str(), dwDesiredAccess, FILE_SHARE_DELETE, nullptr, dwCreationDisposition, dwFlagsAndAttributes, nullptr);
 #else
-  handle_ = ::CreateFileA(filename.c_str(), dwDesiredAccess, FILE_SHARE_DELETE, nullptr, dwCreationDisposition, FILE_ATTRIBUTE_NORMAL, nullptr);
+  handle_ = ::CreateFileA(open_filename.c_str(), dwDesiredAccess, FILE_SHARE_DELETE, nullptr, dwCreationDisposition, dwFlagsAndAttributes, nullptr);
 #endif
 
   if (INVALID_HANDLE_VALUE != handle_ && (mode & std::ios::app) == std::ios::app)
@@ -195,6 +205,15 @@ WriteableFile::WriteableFile(const std::string& filename, std::ios::openmode mod
 WriteableFile::~WriteableFile()
 {
   close();
+
+  if (!temp_filename_.empty() && !committed_)
+  {
+#if !defined(__GNUG__)
+    (void)::DeleteFileW(StrConvert::Utf8ToWide(temp_filename_).c_str());
+#else
+    (void)::DeleteFileA(temp_filename_.c_str());
+#endif
+  }
 }
   
 void WriteableFile::close()
@@ -208,8 +227,86 @@ void WriteableFile::close()
   
 void WriteableFile::write(const char* data, std::size_t sz)
 {
-  DWORD bytes_written{}; // Unused, but required according to https://learn.microsoft.com/en-us/windows/win32/api/fileapi/nf-fileapi-writefile
-  (void)::WriteFile(handle_, data, static_cast<DWORD>(sz), &bytes_written, nullptr);
+  DWORD bytes_written{}; // Required according to https://learn.microsoft.com/en-us/windows/win32/api/fileapi/nf-fileapi-writefile
+  if (!::WriteFile(handle_, data, static_cast<DWORD>(sz), &bytes_written, nullptr) || (bytes_written != sz))
+  {
+    write_error_ = true;
+  }
+}
+
+bool WriteableFile::preallocate(std::uint64_t size)
+{
+  LARGE_INTEGER file_size{};
+  if (!good() || !::GetFileSizeEx(handle_, &file_size))
+    return true;
+
+  // The allocation size is the total size of the file, including the existing data
+  FILE_ALLOCATION_INFO allocation_info{};
+  allocation_info.AllocationSize.QuadPart = file_size.QuadPart + static_cast<LONGLONG>(size);
+
+  if (!::SetFileInformationByHandle(handle_, FileAllocationInfo, &allocation_info, sizeof(allocation_info)))
+  {
+    const DWORD error = ::GetLastError();
+    return ((error != ERROR_DISK_FULL) && (error != ERROR_HANDLE_DISK_FULL));
+  }
+  return true;
+}
+
+void WriteableFile::setWritebackInterval(std::uint64_t /*interval*/)
+{}
+
+bool WriteableFile::sync()
+{
+  if (!good() || write_error_)
+    return false;
+
+  if (!::FlushFileBuffers(handle_))
+    write_error_ = true;
+
+  return !write_error_;
+}
+
+bool WriteableFile::syncFilesystem()
+{
+  return false;
+}
+
+std::uint64_t WriteableFile::filesystemId() const
+{
+  BY_HANDLE_FILE_INFORMATION file_information{};
+  if (!good() || !::GetFileInformationByHandle(handle_, &file_information))
+    return 0;
+
+  return file_information.dwVolumeSerialNumber;
+}
+
+bool WriteableFile::commit(bool durable)
+{
+  const bool write_ok = good() && !write_error_;
+  close();
+
+  if (!write_ok)
+    return false;
+
+  if (!temp_filename_.empty())
+  {
+    const DWORD move_flags = MOVEFILE_REPLACE_EXISTING | (durable ? MOVEFILE_WRITE_THROUGH : 0);
+
+    // The final file is not hidden
+#if !defined(__GNUG__)
+    const std::wstring wtemp_filename = StrConvert::Utf8ToWide(temp_filename_);
+    (void)::SetFileAttributesW(wtemp_filename.c_str(), FILE_ATTRIBUTE_NORMAL);
+    if (!::MoveFileExW(wtemp_filename.c_str(), StrConvert::Utf8ToWide(filename_).c_str(), move_flags))
+      return false;
+#else
+    (void)::SetFileAttributesA(temp_filename_.c_str(), FILE_ATTRIBUTE_NORMAL);
+    if (!::MoveFileExA(temp_filename_.c_str(), filename_.c_str(), move_flags))
+      return false;
+#endif
+  }
+
+  committed_ = true;
+  return true;
 }
 
 }
@@ -74,6 +74,18 @@ public:
   /// @param mode      The open mode to use for the file (std::ios::out is implied).
   WriteableFile(const std::string& filename, std::ios::openmode mode);
 
+  /// @brief Constructor for atomic uploads.
+  ///
+  /// The data is written to the (hidden) temporary file, which is renamed to
+  /// the final filename by commit(). If the file is destroyed without being
+  /// committed, the temporary file is deleted. Readers therefore never see
+  /// an incomplete file.
+  ///
+  /// @param filename       The (UTF-8 encoded) final name of the file.
+  /// @param temp_filename  The (UTF-8 encoded) name of the temporary file. Must be on the same volume as filename. If empty, filename is written directly.
+  /// @param mode           The open mode to use for the file (std::ios::out is implied).
+  WriteableFile(const std::string& filename, const std::string& temp_filename, std::ios::openmode mode);
+
   // Copy disable
   WriteableFile(const WriteableFile&)            = delete;
   WriteableFile& operator=(const WriteableFile&) = delete;
@@ -88,8 +100,52 @@ public:
   void close();
   bool good() const;
 
+  /// @brief Reserves disk space for data that will be written to the end of the file.
+  ///
+  /// Preallocating lets the filesystem place the file in contiguous extents
+  /// and makes a lack of disk space visible before any data is transferred.
+  /// The file size is not changed.
+  ///
+  /// @param size  The number of bytes that will be appended to the file.
+  ///
+  /// @return false if there is not enough disk space.
+  bool preallocate(std::uint64_t size);
+
+  /// @brief Starts the writeback of the written data every interval bytes.
+  ///
+  /// Windows has no API to only initiate the writeback, so this has no effect.
+  void setWritebackInterval(std::uint64_t interval);
+
+  /// @brief Flushes the data of the file to the storage device (FlushFileBuffers).
+  ///
+  /// This may block for a long time and should not be called from the io_context threads.
+  ///
+  /// @return false if the data could not be written.
+  bool sync();
+
+  /// @brief Flushes all files of the filesystem that contains this file.
+  ///
+  /// Flushing a volume requires administrative privileges on Windows, so this is not supported.
+  ///
+  /// @return Always false. sync() has to be used instead.
+  bool syncFilesystem();
+
+  /// @brief Returns an ID of the filesystem that contains the file (the volume serial number)
+  std::uint64_t filesystemId() const;
+
+  /// @brief Closes the file and moves it to its final name, if it has been written to a temporary file.
+  ///
+  /// @param durable  Do not return before the file has been renamed on disk (MOVEFILE_WRITE_THROUGH).
+  ///
+  /// @return false if not all data could be written or the file could not be renamed.
+  bool commit(bool durable = false);
+
 private:
-  HANDLE handle_ = INVALID_HANDLE_VALUE;
+  std::string filename_;
+  std::string temp_filename_;
+  bool        committed_   = false;
+  bool        write_error_ = false;
+  HANDLE      handle_      = INVALID_HANDLE_VALUE;
 };
 
 
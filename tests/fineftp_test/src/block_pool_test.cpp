@@ -0,0 +1,60 @@
+#include <gtest/gtest.h>
+
+#include <block_pool.h>
+
+#include <cstddef>
+#include <memory>
+#include <set>
+#include <vector>
+
+namespace
+{
+  // Stands in for a session, which is created with std::allocate_shared from the pool of the server
+  struct PooledObject
+  {
+    char data[700];
+  };
+}
+
+#if 1
+TEST(BlockPoolTest, ReusesMemoryOfDestroyedObjects)
+{
+  const auto pool = std::make_shared<fineftp::BlockPool>(4);
+
+  std::vector<std::shared_ptr<PooledObject>> objects;
+  std::set<PooledObject*>                    first_addresses;
+  for (int i = 0; i < 4; i++)
+  {
+    objects.push_back(std::allocate_shared<PooledObject>(fineftp::PoolAllocator<PooledObject>(pool)));
+    first_addresses.insert(objects.back().get());
+  }
+
+  // Destroying the objects returns their memory to the pool instead of the heap
+  objects.clear();
+
+  // New objects get exactly the memory of the destroyed ones
+  for (int i = 0; i < 4; i++)
+  {
+    objects.push_back(std::allocate_shared<PooledObject>(fineftp::PoolAllocator<PooledObject>(pool)));
+    ASSERT_EQ(first_addresses.count(objects.back().get()), 1U);
+  }
+}
+#endif
+
+#if 1
+TEST(BlockPoolTest, OtherSizesArePassedThrough)
+{
+  fineftp::BlockPool pool(4);
+
+  // The first allocation determines the block size
+  void* block = pool.allocate(64);
+  pool.deallocate(block, 64);
+  ASSERT_EQ(pool.allocate(64), block);
+
+  // Other sizes come from the heap and are not pooled
+  void* other_block = pool.allocate(128);
+  ASSERT_NE(other_block, block);
+  pool.deallocate(other_block, 128);
+  pool.deallocate(block, 64);
+}
+#endif
@@ -0,0 +1,1232 @@
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <gtest/gtest.h>
+
+#include <fineftp/server.h>
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif // __linux__
+
+namespace
+{
+  // Custom system command that returns the actual return value of the command, even on POSIX Systems.
+  int system_execute(const std::string& command)
+  {
+    const int status = std::system(command.c_str());
+#ifdef WIN32
+    return status;
+#else  // WIN32
+    if (WIFEXITED(status))
+    {
+      // Program has exited normally
+      return WEXITSTATUS(status);
+    }
+    else
+    {
+      // Program has exited abnormally
+      return -1;
+    }
+#endif // WIN32
+  }
+
+  std::string read_file(const std::filesystem::path& path)
+  {
+    std::ifstream ifs(path.string(), std::ios::binary);
+    return std::string((std::istreambuf_iterator<char>(ifs)), (std::istreambuf_iterator<char>()));
+  }
+
+  // Creates a ustar entry (header and padded data) of a regular file ('0') or directory ('5')
+  std::string tar_entry(const std::string& name, const std::string& content, char type_flag = '0')
+  {
+    char size_field[12];
+    std::snprintf(size_field, sizeof(size_field), "%011o", static_cast<unsigned int>(content.size()));
+
+    std::string header(512, '\0');
+    header.replace(0, name.size(), name);
+    header.replace(100, 7, "0000644");
+    header.replace(124, 11, size_field);
+    header.replace(136, 11, "00000000000");
+    header[156] = type_flag;
+    header.replace(257, 6, std::string("ustar\0", 6));
+    header.replace(263, 2, "00");
+
+    unsigned int checksum = 8 * ' ';
+    for (const char c : header)
+      checksum += static_cast<unsigned char>(c);
+    char checksum_field[8];
+    std::snprintf(checksum_field, sizeof(checksum_field), "%06o", checksum);
+    header.replace(148, 8, std::string(checksum_field, 7) + " ");
+
+    return header + content + std::string((512 - (content.size() % 512)) % 512, '\0');
+  }
+
+  struct CommandTestDirs
+  {
+    CommandTestDirs()
+    {
+      std::error_code ec;
+      std::filesystem::remove_all(local_ftp_root_dir, ec);
+      std::filesystem::remove_all(local_root_dir, ec);
+
+      std::filesystem::create_directories(local_ftp_root_dir);
+      std::filesystem::create_directories(local_root_dir);
+
+      std::ofstream(local_ftp_root_dir / "hello.txt", std::ios::binary) << hello_content;
+    }
+
+    ~CommandTestDirs()
+    {
+      std::error_code ec;
+      std::filesystem::remove_all(local_root_dir, ec);
+      std::filesystem::remove_all(local_ftp_root_dir, ec);
+    }
+
+    // Disable copy and move
+    CommandTestDirs(const CommandTestDirs&)            = delete;
+    CommandTestDirs& operator=(const CommandTestDirs&) = delete;
+    CommandTestDirs(CommandTestDirs&&)                 = delete;
+    CommandTestDirs& operator=(CommandTestDirs&&)      = delete;
+
+    // Runs curl with the given arguments and writes the verbose protocol log to the curl_log file
+    int curl(uint16_t port, const std::string& ftp_path, const std::string& arguments) const
+    {
+      const std::string curl_command = "curl -s -S -v \"ftp://localhost:" + std::to_string(port) + "/" + ftp_path + "\" "
+                                     + arguments
+                                     + " 2> \"" + curl_log.string() + "\"";
+      return system_execute(curl_command);
+    }
+
+    // Returns whether the server has sent the given reply line (e.g. "226 ABOR command successful")
+    bool serverReplied(const std::string& reply) const
+    {
+      return read_file(curl_log).find("< " + reply) != std::string::npos;
+    }
+
+    // Waits up to 5 seconds for the background scan of the storage quota.
+    // Until the scan has completed, the quota is not enforced and an upload
+    // that announces more than any disk can hold fails the disk space check
+    // instead. Neither check creates the file.
+    bool waitForQuotaScan(uint16_t port) const
+    {
+      const std::filesystem::path empty_file = local_root_dir / "empty.bin";
+      std::ofstream(empty_file, std::ios::binary);
+
+      for (int i = 0; i < 100; i++)
+      {
+        curl(port, "quota_probe.bin", "-T \"" + empty_file.string() + "\" -Q \"ALLO 999999999999999999\"");
+        if (serverReplied("452 Quota exceeded"))
+          return true;
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+      }
+      return false;
+    }
+
+    const std::filesystem::path test_working_dir   = std::filesystem::current_path();
+    const std::filesystem::path local_ftp_root_dir = test_working_dir / "ftp_root";
+    const std::filesystem::path local_root_dir     = test_working_dir / "local_root";
+    const std::filesystem::path curl_log           = local_root_dir / "curl_log.txt";
+    const std::filesystem::path curl_output        = local_root_dir / "curl_out.txt";
+
+    const std::string hello_content = "Hello World";
+  };
+
+#if defined(__linux__)
+  // Connects a blocking TCP socket to the given port on localhost. Reads time out after 10 seconds.
+  int connect_to_localhost(uint16_t port)
+  {
+    const int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+
+    timeval timeout{};
+    timeout.tv_sec = 10;
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    sockaddr_in address{};
+    address.sin_family      = AF_INET;
+    address.sin_port        = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (::connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0)
+    {
+      ::close(fd);
+      return -1;
+    }
+    return fd;
+  }
+
+  // Reads from the socket until the peer has closed it. Returns false if that didn't happen in time.
+  bool wait_for_close(int fd)
+  {
+    char buffer[64 * 1024];
+    for (;;)
+    {
+      const ssize_t bytes_read = ::recv(fd, buffer, sizeof(buffer), 0);
+      if (bytes_read == 0)
+        return true;
+      if (bytes_read < 0)
+        return (errno == ECONNRESET);
+    }
+  }
+
+  // A control connection for tests that have to send commands at a specific time (e.g. during a transfer)
+  class ControlConnection
+  {
+  public:
+    explicit ControlConnection(uint16_t port)
+      : fd_(connect_to_localhost(port))
+    {}
+
+    ~ControlConnection()
+    {
+      if (fd_ >= 0)
+        ::close(fd_);
+    }
+
+    // Disable copy and move
+    ControlConnection(const ControlConnection&)            = delete;
+    ControlConnection& operator=(const ControlConnection&) = delete;
+    ControlConnection(ControlConnection&&)                 = delete;
+    ControlConnection& operator=(ControlConnection&&)      = delete;
+
+    bool isConnected() const { return fd_ >= 0; }
+
+    void send(const std::string& commands) const
+    {
+      ::send(fd_, commands.data(), commands.size(), MSG_NOSIGNAL);
+    }
+
+    // Returns the next reply line without the CRLF or an empty string if the connection has been closed or the read timed out
+    std::string readReply()
+    {
+      for (;;)
+      {
+        const std::size_t end_of_line = buffer_.find("\r\n");
+        if (end_of_line != std::string::npos)
+        {
+          std::string reply = buffer_.substr(0, end_of_line);
+          buffer_.erase(0, end_of_line + 2);
+          return reply;
+        }
+
+        char data[1024];
+        const ssize_t bytes_read = ::recv(fd_, data, sizeof(data), 0);
+        if (bytes_read <= 0)
+          return "";
+        buffer_.append(data, static_cast<std::size_t>(bytes_read));
+      }
+    }
+
+    // Returns the reply code of the next reply
+    std::string readReplyCode()
+    {
+      return readReply().substr(0, 3);
+    }
+
+    // Logs in as anonymous user
+    bool login()
+    {
+      send("USER anonymous\r\nPASS x\r\n");
+      return (readReplyCode() == "220") && (readReplyCode() == "331") && (readReplyCode() == "230");
+    }
+
+    // Enters passive mode and connects the data socket. Returns -1 on failure.
+    int openDataConnection()
+    {
+      send("PASV\r\n");
+      const std::string reply = readReply();
+      unsigned int h1 = 0, h2 = 0, h3 = 0, h4 = 0, p1 = 0, p2 = 0;
+      const std::size_t parenthesis = reply.find('(');
+      if ((reply.substr(0, 3) != "227") || (parenthesis == std::string::npos)
+          || (std::sscanf(reply.c_str() + parenthesis, "(%u,%u,%u,%u,%u,%u)", &h1, &h2, &h3, &h4, &p1, &p2) != 6))
+      {
+        return -1;
+      }
+      return connect_to_localhost(static_cast<uint16_t>((p1 << 8) | p2));
+    }
+
+  private:
+    const int   fd_;
+    std::string buffer_;
+  };
+#endif // __linux__
+}
+
+#if 1
+TEST(CommandTest, AbortWithoutTransfer)
+{
+  const CommandTestDirs dirs;
+
+  fineftp::FtpServer server(0);
+  server.start(1);
+  server.addUserAnonymous(dirs.local_ftp_root_dir.string(), fineftp::Permission::All);
+
+  // Without a running transfer, ABOR must only be answered with 226
+  const auto curl_result = dirs.curl(server.getPort(), "", "-Q \"ABOR\" -o \"" + dirs.curl_output.string() + "\"");
+  ASSERT_EQ(curl_result, 0);
+  ASSERT_TRUE(dirs.serverReplied("226 ABOR command successful"));
+  ASSERT_FALSE(dirs.serverReplied("426"));
+
+  // The session must still be usable after the ABOR
+  const auto download_result = dirs.curl(server.getPort(), "hello.txt", "-Q \"ABOR\" -o \"" + dirs.curl_output.string() + "\"");
+  ASSERT_EQ(download_result, 0);
+  ASSERT_EQ(read_file(dirs.curl_output), dirs.hello_content);
+
+  server.stop();
+}
+#endif
+
+#if defined(__linux__)
+TEST(CommandTest, AbortRunningDownload)
+{
+  const CommandTestDirs dirs;
+
+  // Large enough that the transfer cannot complete while the client doesn't read
+  const std::string big_content(64 * 1024 * 1024, 'x');
+  std::ofstream(dirs.local_ftp_root_dir / "big.bin", std::ios::binary) << big_content;
+
+  fineftp::FtpServer server(0);
+  server.start(4);   // Several threads, so replies from different strands could overtake each other
+  server.addUserAnonymous(dirs.local_ftp_root_dir.string(), fineftp::Permission::All);
+
+  ControlConnection control(server.getPort());
+  ASSERT_TRUE(control.isConnected());
+  ASSERT_TRUE(control.login());
+
+  const int data_fd = control.openDataConnection();
+  ASSERT_GE(data_fd, 0);
+  control.send("TYPE I\r\nRETR big.bin\r\n");
+  ASSERT_EQ(control.readReplyCode(), "200");
+  ASSERT_EQ(control.readReplyCode(), "150");
+
+  // The command after the ABOR must be answered after the replies of the ABOR
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  control.send("ABOR\r\nPWD\r\n");
+  ASSERT_EQ(control.readReplyCode(), "426");
+  ASSERT_EQ(control.readReplyCode(), "226");
+  ASSERT_EQ(control.readReplyCode(), "257");
+
+  // The server has closed the data connection without sending the whole file
+  ASSERT_TRUE(wait_for_close(data_fd));
+  ::close(data_fd);
+
+  server.stop();
+}
+#endif // __linux__
+
+#if defined(__linux__)
+TEST(CommandTest, AbortRunningUpload)
+{
+  const CommandTestDirs dirs;
+
+  fineftp::FtpServer server(0);
+  server.start(4);   // Several threads, so replies from different strands could overtake each other
+  server.addUserAnonymous(dirs.local_ftp_root_dir.string(), fineftp::Permission::All);
+
+  ControlConnection control(server.getPort());
+  ASSERT_TRUE(control.isConnected());
+  ASSERT_TRUE(control.login());
+
+  const int data_fd = control.openDataConnection();
+  ASSERT_GE(data_fd, 0);
+  control.send("TYPE I\r\nSTOR upload.bin\r\n");
+  ASSERT_EQ(control.readReplyCode(), "200");
+  ASSERT_EQ(control.readReplyCode(), "150");
+
+  // Send some data, but keep the data connection open
+  const std::string data(64 * 1024, 'x');
+  ASSERT_EQ(::send(data_fd, data.data(), data.size(), MSG_NOSIGNAL), static_cast<ssize_t>(data.size()));
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+  control.send("ABOR\r\nPWD\r\n");
+  ASSERT_EQ(control.readReplyCode(), "426");
+  ASSERT_EQ(control.readReplyCode(), "226");
+  ASSERT_EQ(control.readReplyCode(), "257");
+
+  ASSERT_TRUE(wait_for_close(data_fd));
+  ::close(data_fd);
+
+  server.stop();
+}
+#endif // __linux__
+
+#if 1
+TEST(CommandTest, TransferModeSwitch)
+{
+  const CommandTestDirs dirs;
+
+  fineftp::FtpServer server(0);
+  server.start(1);
+  server.addUserAnonymous(dirs.local_ftp_root_dir.string(), fineftp::Permission::All);
+
+  // curl can only transfer in stream mode, so we switch to MODE Z and back
+  // again before downloading. Block mode is not supported at all.
+  const auto curl_result = dirs.curl(server.getPort(), "hello.txt", "-Q \"MODE Z\" -Q \"MODE S\" -o \"" + dirs.curl_output.string() + "\"");
+  if (curl_result != 0 && dirs.serverReplied("504"))
+  {
+    server.stop();
+    GTEST_SKIP() << "fineftp-server has been built without MODE Z support";
+  }
+  ASSERT_EQ(curl_result, 0);
+  ASSERT_TRUE(dirs.serverReplied("200 Switching to deflate mode"));
+  ASSERT_TRUE(dirs.serverReplied("200 Switching to stream mode"));
+  ASSERT_EQ(read_file(dirs.curl_output), dirs.hello_content);
+
+  const auto block_mode_result = dirs.curl(server.getPort(), "", "-Q \"MODE B\" -o \"" + dirs.curl_output.string() + "\"");
+  ASSERT_NE(block_mode_result, 0);
+  ASSERT_TRUE(dirs.serverReplied("504"));
+
+  server.stop();
+}
+#endif
+
+#if defined(__linux__)
+TEST(CommandTest, CompressedUploadExpandsHugely)
+{
+  const CommandTestDirs dirs;
+
+  // Zeros compress by a factor of about 1000, so the compressed stream fits into a single receive buffer
+  const std::uintmax_t zeros_size = 64 * 1024 * 1024;
+  std::ofstream(dirs.local_ftp_root_dir / "zeros.bin", std::ios::binary).close();
+  std::filesystem::resize_file(dirs.local_ftp_root_dir / "zeros.bin", zeros_size);
+
+  fineftp::FtpServer server(0);
+  server.start(1);
+  server.addUserAnonymous(dirs.local_ftp_root_dir.string(), fineftp::Permission::All);
+
+  ControlConnection control(server.getPort());
+  ASSERT_TRUE(control.isConnected());
+  ASSERT_TRUE(control.login());
+
+  control.send("TYPE I\r\nMODE Z\r\n");
+  ASSERT_EQ(control.readReplyCode(), "200");
+  if (control.readReplyCode() != "200")
+  {
+    server.stop();
+    GTEST_SKIP() << "fineftp-server has been built without MODE Z support";
+  }
+
+  // Let the server compress the stream
+  std::string compressed;
+  {
+    const int data_fd = control.openDataConnection();
+    ASSERT_GE(data_fd, 0);
+    control.send("RETR zeros.bin\r\n");
+    ASSERT_EQ(control.readReplyCode(), "150");
+
+    char buffer[64 * 1024];
+    ssize_t bytes_read = 0;
+    while ((bytes_read = ::recv(data_fd, buffer, sizeof(buffer), 0)) > 0)
+      compressed.append(buffer, static_cast<std::size_t>(bytes_read));
+    ::close(data_fd);
+    ASSERT_EQ(bytes_read, 0);
+    ASSERT_EQ(control.readReplyCode(), "226");
+  }
+  ASSERT_LT(compressed.size(), 1024 * 1024);
+
+  // The server decompresses the upload piece by piece, not all at once
+  {
+    const int data_fd = control.openDataConnection();
+    ASSERT_GE(data_fd, 0);
+    control.send("STOR expanded.bin\r\n");
+    ASSERT_EQ(control.readReplyCode(), "150");
+    ASSERT_EQ(::send(data_fd, compressed.data(), compressed.size(), MSG_NOSIGNAL), static_cast<ssize_t>(compressed.size()));
+    ::close(data_fd);
+    ASSERT_EQ(control.readReplyCode(), "226");
+  }
+  ASSERT_EQ(std::filesystem::file_size(dirs.local_ftp_root_dir / "expanded.bin"), zeros_size);
+  {
+    std::ifstream expanded(dirs.local_ftp_root_dir / "expanded.bin", std::ios::binary);
+    std::vector<char> buffer(1024 * 1024);
+    while (expanded.read(buffer.data(), static_cast<std::streamsize>(buffer.size())) || (expanded.gcount() > 0))
+      ASSERT_TRUE(std::all_of(buffer.begin(), buffer.begin() + expanded.gcount(), [](char c) { return c == '\0'; }));
+  }
+
+  server.stop();
+}
+#endif // __linux__
+
+#if 1
+TEST(CommandTest, AsciiTransfer)
+{
+  const CommandTestDirs dirs;
+
+  fineftp::FtpServer server(0);
+  server.start(1);
+  server.addUserAnonymous(dirs.local_ftp_root_dir.string(), fineftp::Permission::All);
+
+#ifdef WIN32
+  const std::string local_text = "line 1\r\nline 2\r\n";
+#else
+  const std::string local_text = "line 1\nline 2\n";
+#endif
+  const std::string wire_text  = "line 1\r\nline 2\r\n";
+
+  // curl converts the line endings of the upload to CRLF. The file must be stored with local line endings.
+  const std::filesystem::path upload_file = dirs.local_root_dir / "upload.txt";
+  std::ofstream(upload_file, std::ios::binary) << "line 1\nline 2\n";
+
+  const auto upload_result = dirs.curl(server.getPort(), "text.txt", "--use-ascii -T \"" + upload_file.string() + "\"");
+  ASSERT_EQ(upload_result, 0);
+  ASSERT_EQ(read_file(dirs.local_ftp_root_dir / "text.txt"), local_text);
+
+  // The data has CRLF line endings on the wire, so the ASCII size differs from
+  // the binary size. The line endings have not been counted, yet, so SIZE
+  // has to count them.
+  const auto uncounted_size_result = dirs.curl(server.getPort(), "", "-Q \"TYPE A\" -Q \"SIZE text.txt\" -o \"" + dirs.curl_output.string() + "\"");
+  ASSERT_EQ(uncounted_size_result, 0);
+  ASSERT_TRUE(dirs.serverReplied("213 " + std::to_string(wire_text.size())));
+
+  // A changed file must not be answered from the counted line endings of the previous version
+  std::ofstream(dirs.local_ftp_root_dir / "text.txt", std::ios::binary | std::ios::app) << local_text;
+
+  // curl converts the downloaded data back to local line endings
+  const auto download_result = dirs.curl(server.getPort(), "text.txt", "--use-ascii -o \"" + dirs.curl_output.string() + "\"");
+  ASSERT_EQ(download_result, 0);
+  ASSERT_EQ(read_file(dirs.curl_output), "line 1\nline 2\nline 1\nline 2\n");
+
+  // The download has counted the line endings of the changed file
+  const auto size_result = dirs.curl(server.getPort(), "", "-Q \"TYPE A\" -Q \"SIZE text.txt\" -Q \"TYPE I\" -Q \"SIZE text.txt\" -o \"" + dirs.curl_output.string() + "\"");
+  ASSERT_EQ(size_result, 0);
+  ASSERT_TRUE(dirs.serverReplied("213 " + std::to_string(2 * wire_text.size())));
+  ASSERT_TRUE(dirs.serverReplied("213 " + std::to_string(2 * local_text.size())));
+
+  server.stop();
+}
+#endif
+
+#if 1
+TEST(CommandTest, SizeAndModificationTime)
+{
+  const CommandTestDirs dirs;
+
+  fineftp::FtpServer server(0);
+  server.start(1);
+  server.addUserAnonymous(dirs.local_ftp_root_dir.string(), fineftp::Permission::All);
+
+  const auto size_result = dirs.curl(server.getPort(), "", "-Q \"TYPE I\" -Q \"SIZE hello.txt\" -Q \"MDTM hello.txt\" -o \"" + dirs.curl_output.string() + "\"");
+  ASSERT_EQ(size_result, 0);
+  ASSERT_TRUE(dirs.serverReplied("213 " + std::to_string(dirs.hello_content.size())));
+
+  // curl -R uses MDTM to apply the modification time to the downloaded file
+  const auto download_result = dirs.curl(server.getPort(), "hello.txt", "-R -o \"" + dirs.curl_output.string() + "\"");
+  ASSERT_EQ(download_result, 0);
+  const auto remote_time = std::filesystem::last_write_time(dirs.local_ftp_root_dir / "hello.txt");
+  const auto local_time  = std::filesystem::last_write_time(dirs.curl_output);
+  ASSERT_EQ(std::chrono::floor<std::chrono::seconds>(remote_time), std::chrono::floor<std::chrono::seconds>(local_time));
+
+  // Set the modification time and read it back
+  const auto mfmt_result = dirs.curl(server.getPort(), "", "-Q \"MFMT 20200102030405.5 hello.txt\" -Q \"MDTM hello.txt\" -o \"" + dirs.curl_output.string() + "\"");
+  ASSERT_EQ(mfmt_result, 0);
+#ifdef WIN32
+  ASSERT_TRUE(dirs.serverReplied("213 20200102030405"));
+#else
+  ASSERT_TRUE(dirs.serverReplied("213 Modify=20200102030405.5; hello.txt"));
+  ASSERT_TRUE(dirs.serverReplied("213 20200102030405.5"));
+#endif
+
+  // MDTM of a file that doesn't exist
+  const auto missing_result = dirs.curl(server.getPort(), "", "-Q \"MDTM missing.txt\" -o \"" + dirs.curl_output.string() + "\"");
+  ASSERT_NE(missing_result, 0);
+  ASSERT_TRUE(dirs.serverReplied("550"));
+
+  server.stop();
+}
+#endif
+
+#if 1
+TEST(CommandTest, ServerSideCopy)
+{
+  const CommandTestDirs dirs;
+
+  fineftp::FtpServer server(0);
+  server.start(1);
+  server.addUserAnonymous(dirs.local_ftp_root_dir.string(), fineftp::Permission::All);
+
+  const auto copy_result = dirs.curl(server.getPort(), "", "-Q \"SITE CPFR hello.txt\" -Q \"SITE CPTO copy.txt\" -o \"" + dirs.curl_output.string() + "\"");
+  ASSERT_EQ(copy_result, 0);
+  ASSERT_TRUE(dirs.serverReplied("250"));
+  ASSERT_EQ(read_file(dirs.local_ftp_root_dir / "copy.txt"), dirs.hello_content);
+  ASSERT_EQ(read_file(dirs.local_ftp_root_dir / "hello.txt"), dirs.hello_content);
+
+  // Existing files are not overwritten
+  const auto overwrite_result = dirs.curl(server.getPort(), "", "-Q \"SITE CPFR hello.txt\" -Q \"SITE CPTO copy.txt\" -o \"" + dirs.curl_output.string() + "\"");
+  ASSERT_NE(overwrite_result, 0);
+
+  server.stop();
+}
+#endif
+
+#if 1
+TEST(CommandTest, ServerSideCopyPermissions)
+{
+  const CommandTestDirs dirs;
+
+  fineftp::FtpServer server(0);
+  server.start(1);
+  server.addUserAnonymous(dirs.local_ftp_root_dir.string(), fineftp::Permission::ReadOnly);
+
+  const auto copy_result = dirs.curl(server.getPort(), "", "-Q \"SITE CPFR hello.txt\" -Q \"SITE CPTO copy.txt\" -o \"" + dirs.curl_output.string() + "\"");
+  ASSERT_NE(copy_result, 0);
+  ASSERT_FALSE(std::filesystem::exists(dirs.local_ftp_root_dir / "copy.txt"));
+
+  server.stop();
+}
+#endif
+
+#if 1
+TEST(CommandTest, DirectoryTarDownload)
+{
+  const CommandTestDirs dirs;
+
+  std::filesystem::create_directories(dirs.local_ftp_root_dir / "dir" / "sub");
+  std::ofstream(dirs.local_ftp_root_dir / "dir" / "sub" / "hello.txt", std::ios::binary) << dirs.hello_content;
+  std::ofstream(dirs.local_ftp_root_dir / "dir" / "big.bin", std::ios::binary) << std::string(3000000, 'x');
+
+  fineftp::FtpServer server(0);
+  server.start(1);
+  server.addUserAnonymous(dirs.local_ftp_root_dir.string(), fineftp::Permission::All);
+
+  const auto curl_result = dirs.curl(server.getPort(), "dir.tar", "-o \"" + dirs.curl_output.string() + "\"");
+  ASSERT_EQ(curl_result, 0);
+
+  // Parse the ustar headers and collect the entries with their content
+  const std::string archive = read_file(dirs.curl_output);
+  std::map<std::string, std::string> entries;
+  std::size_t offset = 0;
+  while ((offset + 512 <= archive.size()) && (archive[offset] != '\0'))
+  {
+    const std::string name = archive.substr(offset, 100).c_str();
+    const std::size_t size = std::stoul(archive.substr(offset + 124, 11), nullptr, 8);
+    entries[name]          = archive.substr(offset + 512, size);
+    offset += 512 + ((size + 511) / 512) * 512;
+  }
+
+  ASSERT_EQ(archive.size() % 512, 0);
+  ASSERT_EQ(archive.size(), offset + 1024);
+  ASSERT_EQ(entries.size(), 4);
+  ASSERT_EQ(entries.count("dir/"), 1);
+  ASSERT_EQ(entries.count("dir/sub/"), 1);
+  ASSERT_EQ(entries["dir/sub/hello.txt"], dirs.hello_content);
+  ASSERT_EQ(entries["dir/big.bin"], std::string(3000000, 'x'));
+
+  server.stop();
+}
+#endif
+
+#if 1
+TEST(CommandTest, TarArchiveUpload)
+{
+  const CommandTestDirs dirs;
+
+  std::filesystem::create_directories(dirs.local_ftp_root_dir / "target");
+
+  const std::string archive = tar_entry("sub/", "", '5')
+                            + tar_entry("sub/a.txt", dirs.hello_content)
+                            + tar_entry("b.txt", std::string(2000, 'b'))
+                            + std::string(1024, '\0');
+  std::ofstream(dirs.local_root_dir / "archive.tar", std::ios::binary) << archive;
+
+  fineftp::FtpServer server(0);
+  server.start(1);
+  server.addUserAnonymous(dirs.local_ftp_root_dir.string(), fineftp::Permission::All);
+
+  const auto curl_result = dirs.curl(server.getPort(), "target.untar", "-T \"" + (dirs.local_root_dir / "archive.tar").string() + "\"");
+  ASSERT_EQ(curl_result, 0);
+  ASSERT_TRUE(dirs.serverReplied("226 Done: 2 files and 1 directories extracted"));
+  ASSERT_EQ(read_file(dirs.local_ftp_root_dir / "target" / "sub" / "a.txt"), dirs.hello_content);
+  ASSERT_EQ(read_file(dirs.local_ftp_root_dir / "target" / "b.txt"), std::string(2000, 'b'));
+  ASSERT_FALSE(std::filesystem::exists(dirs.local_ftp_root_dir / "target.untar"));
+
+  server.stop();
+}
+#endif
+
+#if 1
+TEST(CommandTest, TarArchiveUploadPermissions)
+{
+  const CommandTestDirs dirs;
+
+  std::filesystem::create_directories(dirs.local_ftp_root_dir / "target");
+
+  // Without the DirCreate permission, only files in existing directories can be extracted
+  const std::string archive = tar_entry("new/c.txt", dirs.hello_content)
+                            + tar_entry("../escape.txt", dirs.hello_content)
+                            + tar_entry("d.txt", dirs.hello_content)
+                            + std::string(1024, '\0');
+  std::ofstream(dirs.local_root_dir / "archive.tar", std::ios::binary) << archive;
+
+  fineftp::FtpServer server(0);
+  server.start(1);
+  server.addUserAnonymous(dirs.local_ftp_root_dir.string(), fineftp::Permission::FileWrite);
+
+  const auto curl_result = dirs.curl(server.getPort(), "target.untar", "-T \"" + (dirs.local_root_dir / "archive.tar").string() + "\"");
+  ASSERT_NE(curl_result, 0);
+  ASSERT_TRUE(dirs.serverReplied("451 Extraction incomplete: 1 files and 0 directories extracted, 2 entries rejected"));
+  ASSERT_EQ(read_file(dirs.local_ftp_root_dir / "target" / "d.txt"), dirs.hello_content);
+  ASSERT_FALSE(std::filesystem::exists(dirs.local_ftp_root_dir / "target" / "new"));
+  ASSERT_FALSE(std::filesystem::exists(dirs.local_ftp_root_dir / "escape.txt"));
+
+  server.stop();
+}
+#endif
+
+#if 1
+TEST(CommandTest, TarArchiveUploadTruncated)
+{
+  const CommandTestDirs dirs;
+
+  std::filesystem::create_directories(dirs.local_ftp_root_dir / "target");
+
+  // The archive ends within the data of a 1 MiB file
+  const std::string one_mib(1024 * 1024, 'x');
+  const std::string archive = tar_entry("big.bin", one_mib).substr(0, 512 + 1024);
+  std::ofstream(dirs.local_root_dir / "archive.tar", std::ios::binary) << archive;
+  std::ofstream(dirs.local_root_dir / "upload.bin", std::ios::binary) << one_mib;
+
+  fineftp::FtpServer server(0);
+  server.setStorageQuota(dirs.local_ftp_root_dir.string(), 3 * one_mib.size() / 2);
+  server.start(1);
+  server.addUserAnonymous(dirs.local_ftp_root_dir.string(), fineftp::Permission::All);
+
+  ASSERT_TRUE(dirs.waitForQuotaScan(server.getPort()));
+
+  const auto untar_result = dirs.curl(server.getPort(), "target.untar", "-T \"" + (dirs.local_root_dir / "archive.tar").string() + "\"");
+  ASSERT_NE(untar_result, 0);
+
+  // The space that was taken for the cut off file must be free again
+  const auto upload_result = dirs.curl(server.getPort(), "upload.bin", "-T \"" + (dirs.local_root_dir / "upload.bin").string() + "\"");
+  ASSERT_EQ(upload_result, 0);
+  ASSERT_EQ(std::filesystem::file_size(dirs.local_ftp_root_dir / "upload.bin"), one_mib.size());
+
+  server.stop();
+}
+#endif
+
+#if 1
+TEST(CommandTest, TarArchiveUploadHugeSize)
+{
+  const CommandTestDirs dirs;
+
+  std::filesystem::create_directories(dirs.local_ftp_root_dir / "target");
+
+  // A pax header announces a size beyond the range of a signed 64 bit integer
+  const std::string pax_record = "28 size=9999999999999999999\n";
+  const std::string archive = tar_entry("pax", pax_record, 'x')
+                            + tar_entry("huge.bin", "")
+                            + std::string(1024, '\0');
+  std::ofstream(dirs.local_root_dir / "archive.tar", std::ios::binary) << archive;
+
+  fineftp::FtpServer server(0);
+  server.setStorageQuota(dirs.local_ftp_root_dir.string(), 1024 * 1024);
+  server.start(1);
+  server.addUserAnonymous(dirs.local_ftp_root_dir.string(), fineftp::Permission::All);
+
+  // The entry must be rejected instead of passing the quota check with a negative size
+  const auto untar_result = dirs.curl(server.getPort(), "target.untar", "-T \"" + (dirs.local_root_dir / "archive.tar").string() + "\"");
+  ASSERT_NE(untar_result, 0);
+  ASSERT_FALSE(std::filesystem::exists(dirs.local_ftp_root_dir / "target" / "huge.bin"));
+
+  server.stop();
+}
+#endif
+
+#if 1
+TEST(CommandTest, Checksums)
+{
+  const CommandTestDirs dirs;
+
+  fineftp::FtpServer server(0);
+  server.start(1);
+  server.addUserAnonymous(dirs.local_ftp_root_dir.string(), fineftp::Permission::All);
+
+  const auto curl_result = dirs.curl(server.getPort(), ""
+                                    , "-Q \"HASH hello.txt\""
+                                      " -Q \"XCRC hello.txt\""
+                                      " -Q \"XMD5 hello.txt\""
+                                      " -Q \"OPTS HASH CRC32\""
+                                      " -Q \"RANG 6 10\""
+                                      " -Q \"XSHA256 hello.txt\""
+                                      " -o \"" + dirs.curl_output.string() + "\"");
+  ASSERT_EQ(curl_result, 0);
+  ASSERT_TRUE(dirs.serverReplied("213 SHA-256 0-11 a591a6d40bf420404a011733cfb7b190d62c65bf0bcda32b57b277d9ad9f146e hello.txt"));
+  ASSERT_TRUE(dirs.serverReplied("250 4a17b156"));
+  ASSERT_TRUE(dirs.serverReplied("250 b10a8db164e0754105b7a99be72e3fe5"));
+  ASSERT_TRUE(dirs.serverReplied("200 CRC32"));
+
+  // The range only covers "World"
+  ASSERT_TRUE(dirs.serverReplied("250 78ae647dc5544d227130a0682a51e30bc7777fbb6d8a8f17007463a3ecd1d524"));
+
+  // Checksums of non-existing files must fail
+  const auto missing_file_result = dirs.curl(server.getPort(), "", "-Q \"HASH missing.txt\" -o \"" + dirs.curl_output.string() + "\"");
+  ASSERT_NE(missing_file_result, 0);
+  ASSERT_TRUE(dirs.serverReplied("550"));
+
+  server.stop();
+}
+#endif
+
+#if 1
+TEST(CommandTest, UploadChecksums)
+{
+  const CommandTestDirs dirs;
+
+  fineftp::FtpServer server(0);
+  server.setUploadChecksumsEnabled(true);
+  server.start(1);
+  server.addUserAnonymous(dirs.local_ftp_root_dir.string(), fineftp::Permission::All);
+
+  const std::filesystem::path local_file = dirs.local_root_dir / "upload.txt";
+  std::ofstream(local_file, std::ios::binary) << dirs.hello_content;
+
+  // Upload the file with its checksum computed on the fly and ask for it afterwards
+  const auto curl_result = dirs.curl(server.getPort(), "upload.txt", "-T \"" + local_file.string() + "\" -Q \"-HASH upload.txt\"");
+  ASSERT_EQ(curl_result, 0);
+  ASSERT_EQ(read_file(dirs.local_ftp_root_dir / "upload.txt"), dirs.hello_content);
+  ASSERT_TRUE(dirs.serverReplied("213 SHA-256 0-11 a591a6d40bf420404a011733cfb7b190d62c65bf0bcda32b57b277d9ad9f146e upload.txt"));
+
+  server.stop();
+}
+#endif
+
+#if 1
+TEST(CommandTest, AtomicUpload)
+{
+  const CommandTestDirs dirs;
+
+  fineftp::FtpServer server(0);
+  server.setAtomicUploadsEnabled(true);
+  server.start(1);
+  server.addUserAnonymous(dirs.local_ftp_root_dir.string(), fineftp::Permission::All);
+
+  const std::string new_content = "Hello New World";
+  const std::filesystem::path local_file = dirs.local_root_dir / "upload.txt";
+  std::ofstream(local_file, std::ios::binary) << new_content;
+
+  // Overwrite the existing file
+  const auto curl_result = dirs.curl(server.getPort(), "hello.txt", "-T \"" + local_file.string() + "\"");
+  ASSERT_EQ(curl_result, 0);
+  ASSERT_EQ(read_file(dirs.local_ftp_root_dir / "hello.txt"), new_content);
+
+  // The temporary file must have been renamed
+  size_t file_count = 0;
+  for (const auto& entry : std::filesystem::directory_iterator(dirs.local_ftp_root_dir))
+  {
+    (void)entry;
+    file_count++;
+  }
+  ASSERT_EQ(file_count, 1);
+
+  server.stop();
+}
+#endif
+
+#if 1
+TEST(CommandTest, UploadDurability)
+{
+  const CommandTestDirs dirs;
+
+  const std::filesystem::path local_file = dirs.local_root_dir / "upload.txt";
+  std::ofstream(local_file, std::ios::binary) << dirs.hello_content;
+
+  for (const auto durability : { fineftp::UploadDurability::SyncOnClose, fineftp::UploadDurability::PeriodicWriteback, fineftp::UploadDurability::GroupCommit })
+  {
+    fineftp::FtpServer server(0);
+    server.setUploadDurability(durability, 4);
+    server.setAtomicUploadsEnabled(true);
+    server.start(1);
+    server.addUserAnonymous(dirs.local_ftp_root_dir.string(), fineftp::Permission::All);
+
+    // The upload must only be confirmed after it has been flushed
+    const auto curl_result = dirs.curl(server.getPort(), "upload.txt", "-T \"" + local_file.string() + "\"");
+    ASSERT_EQ(curl_result, 0);
+    ASSERT_TRUE(dirs.serverReplied("226"));
+    ASSERT_EQ(read_file(dirs.local_ftp_root_dir / "upload.txt"), dirs.hello_content);
+
+    std::filesystem::remove(dirs.local_ftp_root_dir / "upload.txt");
+    server.stop();
+  }
+}
+#endif
+
+#if 1
+TEST(CommandTest, SpliceUpload)
+{
+  const CommandTestDirs dirs;
+
+  fineftp::FtpServer server(0);
+  server.setSpliceUploadsEnabled(true);
+  server.start(1);
+  server.addUserAnonymous(dirs.local_ftp_root_dir.string(), fineftp::Permission::All);
+
+  std::string content;
+  for (int i = 0; i < 100000; i++)
+    content += std::to_string(i) + "\n";
+
+  const std::filesystem::path local_file = dirs.local_root_dir / "upload.txt";
+  std::ofstream(local_file, std::ios::binary) << content;
+
+  const auto upload_result = dirs.curl(server.getPort(), "upload.txt", "-T \"" + local_file.string() + "\"");
+  ASSERT_EQ(upload_result, 0);
+  ASSERT_EQ(read_file(dirs.local_ftp_root_dir / "upload.txt"), content);
+
+  // APPE cannot be spliced and must fall back to the buffered path
+  const auto append_result = dirs.curl(server.getPort(), "upload.txt", "--append -T \"" + local_file.string() + "\"");
+  ASSERT_EQ(append_result, 0);
+  ASSERT_EQ(read_file(dirs.local_ftp_root_dir / "upload.txt"), content + content);
+
+  server.stop();
+}
+#endif
+
+#if 1
+TEST(CommandTest, AllocateBeforeUpload)
+{
+  const CommandTestDirs dirs;
+
+  fineftp::FtpServer server(0);
+  server.start(1);
+  server.addUserAnonymous(dirs.local_ftp_root_dir.string(), fineftp::Permission::All);
+
+  const std::filesystem::path local_file = dirs.local_root_dir / "upload.txt";
+  std::ofstream(local_file, std::ios::binary) << dirs.hello_content;
+
+  // Announce more data than we actually send. The file must still have the correct size.
+  const auto curl_result = dirs.curl(server.getPort(), "upload.txt", "-T \"" + local_file.string() + "\" -Q \"ALLO 1048576\"");
+  ASSERT_EQ(curl_result, 0);
+  ASSERT_TRUE(dirs.serverReplied("200"));
+  ASSERT_EQ(read_file(dirs.local_ftp_root_dir / "upload.txt"), dirs.hello_content);
+
+  // No disk can hold 1 EiB. The upload is rejected before the existing file is truncated.
+  const auto too_large_result = dirs.curl(server.getPort(), "upload.txt", "-T \"" + local_file.string() + "\" -Q \"ALLO 1152921504606846976\"");
+  ASSERT_NE(too_large_result, 0);
+  ASSERT_TRUE(dirs.serverReplied("452 Insufficient storage space"));
+  ASSERT_EQ(read_file(dirs.local_ftp_root_dir / "upload.txt"), dirs.hello_content);
+
+  const auto invalid_result = dirs.curl(server.getPort(), "", "-Q \"ALLO -1\" -o \"" + dirs.curl_output.string() + "\"");
+  ASSERT_NE(invalid_result, 0);
+  ASSERT_TRUE(dirs.serverReplied("501 Invalid size"));
+
+  server.stop();
+}
+#endif
+
+#if 1
+TEST(CommandTest, StorageQuota)
+{
+  const CommandTestDirs dirs;
+
+  // The existing data is found by the initial scan
+  const std::string one_mib(1024 * 1024, 'x');
+  std::ofstream(dirs.local_ftp_root_dir / "existing.bin", std::ios::binary) << one_mib << one_mib;
+
+  fineftp::FtpServer server(0);
+  server.setStorageQuota(dirs.local_ftp_root_dir.string(), 4 * 1024 * 1024 + 1024);
+  server.start(1);
+  server.addUserAnonymous(dirs.local_ftp_root_dir.string(), fineftp::Permission::All);
+
+  ASSERT_TRUE(dirs.waitForQuotaScan(server.getPort()));
+
+  const std::filesystem::path small_file = dirs.local_root_dir / "small.bin";
+  const std::filesystem::path large_file = dirs.local_root_dir / "large.bin";
+  std::ofstream(small_file, std::ios::binary) << one_mib;
+  std::ofstream(large_file, std::ios::binary) << one_mib << one_mib << one_mib;
+
+  // 2 MiB + 11 bytes are used, so 1 MiB fits
+  const auto small_result = dirs.curl(server.getPort(), "small.bin", "-T \"" + small_file.string() + "\"");
+  ASSERT_EQ(small_result, 0);
+
+  // The upload is aborted when it exceeds the quota. curl may fail on the
+  // closed data connection before it reads the reply, so we check the file.
+  const auto large_result = dirs.curl(server.getPort(), "large.bin", "-T \"" + large_file.string() + "\"");
+  ASSERT_NE(large_result, 0);
+  ASSERT_LT(std::filesystem::file_size(dirs.local_ftp_root_dir / "large.bin"), 3 * one_mib.size());
+
+  // Deleting files frees their space
+  const auto delete_result = dirs.curl(server.getPort(), "", "-Q \"DELE existing.bin\" -Q \"DELE large.bin\" -o \"" + dirs.curl_output.string() + "\"");
+  ASSERT_EQ(delete_result, 0);
+
+  // Uploads that announce more than the available space are rejected before any data is sent
+  const auto allo_result = dirs.curl(server.getPort(), "large.bin", "-T \"" + large_file.string() + "\" -Q \"ALLO 4194304\"");
+  ASSERT_NE(allo_result, 0);
+  ASSERT_TRUE(dirs.serverReplied("452 Quota exceeded"));
+
+  const auto retry_result = dirs.curl(server.getPort(), "large.bin", "-T \"" + large_file.string() + "\"");
+  ASSERT_EQ(retry_result, 0);
+  ASSERT_EQ(std::filesystem::file_size(dirs.local_ftp_root_dir / "large.bin"), 3 * one_mib.size());
+
+  // The quota is full now, even a copy of the small file does not fit
+  const auto copy_result = dirs.curl(server.getPort(), "", "-Q \"SITE CPFR small.bin\" -Q \"SITE CPTO copy.bin\" -o \"" + dirs.curl_output.string() + "\"");
+  ASSERT_NE(copy_result, 0);
+  ASSERT_TRUE(dirs.serverReplied("452 Quota exceeded"));
+
+  server.stop();
+}
+#endif
+
+#if defined(__linux__)
+TEST(CommandTest, RootConfinement)
+{
+  const CommandTestDirs dirs;
+
+  // A symlink inside the ftp root that points to a directory outside of it
+  const std::filesystem::path outside_dir = dirs.local_root_dir / "outside";
+  std::filesystem::create_directories(outside_dir);
+  std::ofstream(outside_dir / "secret.txt", std::ios::binary) << "secret";
+  std::filesystem::create_directory_symlink(outside_dir, dirs.local_ftp_root_dir / "escape");
+
+  // Symlinks that stay inside of the root directory keep working
+  std::filesystem::create_symlink("hello.txt", dirs.local_ftp_root_dir / "link.txt");
+
+  fineftp::FtpServer server(0);
+  server.setRootConfinementEnabled(true);
+  server.start(1);
+  server.addUserAnonymous(dirs.local_ftp_root_dir.string(), fineftp::Permission::All);
+
+  const auto link_result = dirs.curl(server.getPort(), "link.txt", "-o \"" + dirs.curl_output.string() + "\"");
+  ASSERT_EQ(link_result, 0);
+  ASSERT_EQ(read_file(dirs.curl_output), dirs.hello_content);
+
+  const auto retr_result = dirs.curl(server.getPort(), "escape/secret.txt", "--ftp-method nocwd -o \"" + dirs.curl_output.string() + "\"");
+  ASSERT_NE(retr_result, 0);
+  ASSERT_TRUE(dirs.serverReplied("550 Permission denied"));
+
+  // Files that don't exist yet are confined by their parent directory
+  const std::filesystem::path upload_file = dirs.local_root_dir / "upload.txt";
+  std::ofstream(upload_file, std::ios::binary) << dirs.hello_content;
+  const auto stor_result = dirs.curl(server.getPort(), "escape/new.txt", "--ftp-method nocwd -T \"" + upload_file.string() + "\"");
+  ASSERT_NE(stor_result, 0);
+  ASSERT_TRUE(dirs.serverReplied("550 Permission denied"));
+  ASSERT_FALSE(std::filesystem::exists(outside_dir / "new.txt"));
+
+  const auto cwd_result = dirs.curl(server.getPort(), "", "-Q \"CWD escape\" -o \"" + dirs.curl_output.string() + "\"");
+  ASSERT_NE(cwd_result, 0);
+  ASSERT_TRUE(dirs.serverReplied("550 Permission denied"));
+
+  // The symlink is skipped when the root directory is downloaded as tar archive
+  const auto tar_result = dirs.curl(server.getPort(), "..tar", "--ftp-method nocwd -o \"" + dirs.curl_output.string() + "\"");
+  ASSERT_EQ(tar_result, 0);
+  const std::string archive = read_file(dirs.curl_output);
+  ASSERT_NE(archive.find("hello.txt"), std::string::npos);
+  ASSERT_EQ(archive.find("secret.txt"), std::string::npos);
+
+  server.stop();
+}
+#endif // __linux__
+
+#if defined(__linux__)
+TEST(CommandTest, Timeouts)
+{
+  const CommandTestDirs dirs;
+
+  fineftp::FtpServer server(0);
+  server.setTimeouts(std::chrono::seconds(2), std::chrono::seconds(1), std::chrono::seconds(1));
+  server.start(1);
+  server.addUserAnonymous(dirs.local_ftp_root_dir.string(), fineftp::Permission::All);
+
+  // Sends the input, keeps the connection open for a few seconds and returns the reply codes
+  const auto reply_codes = [&dirs, &server](const std::string& input)
+  {
+    system_execute("(printf '" + input + "'; sleep 4) | curl -s --max-time 4 \"telnet://localhost:" + std::to_string(server.getPort()) + "\""
+                   + " -o \"" + dirs.curl_output.string() + "\"");
+
+    std::vector<std::string> codes;
+    std::istringstream output(read_file(dirs.curl_output));
+    for (std::string line; std::getline(output, line);)
+      codes.push_back(line.substr(0, 3));
+    return codes;
+  };
+
+  // Login timeout
+  ASSERT_EQ(reply_codes(""), (std::vector<std::string>{"220", "421"}));
+
+  // Idle timeout
+  ASSERT_EQ(reply_codes("USER anonymous\r\nPASS x\r\nNOOP\r\n"), (std::vector<std::string>{"220", "331", "230", "200", "421"}));
+
+  // Data connect timeout. The idle timeout closes the session afterwards.
+  const auto data_connect_codes = reply_codes("USER anonymous\r\nPASS x\r\nPASV\r\nRETR hello.txt\r\n");
+  ASSERT_GE(data_connect_codes.size(), 6U);
+  ASSERT_EQ(std::vector<std::string>(data_connect_codes.begin(), data_connect_codes.begin() + 6), (std::vector<std::string>{"220", "331", "230", "227", "150", "426"}));
+
+  // The timed out sessions are gone
+  ASSERT_EQ(server.getOpenConnectionCount(), 0);
+
+  server.stop();
+}
+#endif // __linux__
+
+#if defined(__linux__)
+TEST(CommandTest, DataConnectTimeout)
+{
+  const CommandTestDirs dirs;
+
+  fineftp::FtpServer server(0);
+  server.setTimeouts(std::chrono::seconds(0), std::chrono::seconds(0), std::chrono::seconds(1));
+  server.start(1);
+  server.addUserAnonymous(dirs.local_ftp_root_dir.string(), fineftp::Permission::All);
+
+  ControlConnection control(server.getPort());
+  ASSERT_TRUE(control.isConnected());
+  ASSERT_TRUE(control.login());
+
+  // The client connects in time
+  const int data_fd = control.openDataConnection();
+  ASSERT_GE(data_fd, 0);
+  control.send("RETR hello.txt\r\n");
+  ASSERT_EQ(control.readReplyCode(), "150");
+  ASSERT_TRUE(wait_for_close(data_fd));
+  ::close(data_fd);
+  ASSERT_EQ(control.readReplyCode(), "226");
+
+  // The timeout of that transfer must not close the passive mode acceptor afterwards
+  std::this_thread::sleep_for(std::chrono::milliseconds(2500));
+  control.send("RETR hello.txt\r\n");
+  ASSERT_EQ(control.readReplyCode(), "150");
+
+  // This time the client doesn't connect, so the timeout aborts the transfer
+  const auto start = std::chrono::steady_clock::now();
+  ASSERT_EQ(control.readReplyCode(), "426");
+  ASSERT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(3));
+
+  server.stop();
+}
+#endif // __linux__
+
+#if defined(__linux__)
+TEST(CommandTest, AcceptRecoversFromErrors)
+{
+  fineftp::FtpServer server(0);
+  server.start(1);
+
+  // The client socket is created before the server runs out of file descriptors
+  const int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  ASSERT_GE(fd, 0);
+  timeval timeout{};
+  timeout.tv_sec = 10;
+  ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  // Limit the process to the file descriptors that are open already, so accepting the connection fails with EMFILE
+  rlimit original_limit{};
+  ASSERT_EQ(::getrlimit(RLIMIT_NOFILE, &original_limit), 0);
+  const int lowest_free_fd = ::dup(0);
+  ASSERT_GE(lowest_free_fd, 0);
+  ::close(lowest_free_fd);
+
+  rlimit exhausted_limit = original_limit;
+  exhausted_limit.rlim_cur = static_cast<rlim_t>(lowest_free_fd);
+  ASSERT_EQ(::setrlimit(RLIMIT_NOFILE, &exhausted_limit), 0);
+
+  sockaddr_in address{};
+  address.sin_family      = AF_INET;
+  address.sin_port        = htons(server.getPort());
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  const int connect_result = ::connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address));
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+  ASSERT_EQ(::setrlimit(RLIMIT_NOFILE, &original_limit), 0);
+  ASSERT_EQ(connect_result, 0);
+
+  // The server keeps accepting once file descriptors are available again
+  char welcome[4] {};
+  ASSERT_EQ(::recv(fd, welcome, 3, MSG_WAITALL), 3);
+  ASSERT_EQ(std::string(welcome), "220");
+  ::close(fd);
+
+  server.stop();
+}
+#endif // __linux__
+
+#if defined(__linux__)
+TEST(CommandTest, SessionLimits)
+{
+  const CommandTestDirs dirs;
+
+  fineftp::FtpServer server(0);
+  server.setSessionLimits(0, 2, 1);
+  server.setAcceptBatchSize(16);
+  server.start(1);
+  server.addUserAnonymous(dirs.local_ftp_root_dir.string(), fineftp::Permission::All);
+
+  // Sends the input over a control connection that is kept open for the given time and returns the replies
+  const auto session = [&server](const std::string& input, int seconds, const std::filesystem::path& output_file)
+  {
+    system_execute("(printf '" + input + "'; sleep " + std::to_string(seconds) + ") | curl -s --max-time " + std::to_string(seconds) + " \"telnet://localhost:" + std::to_string(server.getPort()) + "\""
+                   + " -o \"" + output_file.string() + "\"");
+    return read_file(output_file);
+  };
+
+  // The first session stays logged in
+  std::thread first_session([&session, &dirs]() { session("USER anonymous\r\nPASS x\r\n", 4, dirs.local_root_dir / "first_session.txt"); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+  // A second login as the same user is rejected
+  const std::string second_user_replies = session("USER ftp\r\nPASS x\r\n", 1, dirs.local_root_dir / "second_session.txt");
+  ASSERT_NE(second_user_replies.find("421 Too many sessions for this user"), std::string::npos);
+
+  // A third connection from the same address is rejected before a session is created
+  std::thread idle_session([&session, &dirs]() { session("", 2, dirs.local_root_dir / "idle_session.txt"); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+  const std::string third_replies = session("", 1, dirs.local_root_dir / "third_session.txt");
+  ASSERT_EQ(third_replies, "421 Too many sessions from your address, try again later\r\n");
+
+  idle_session.join();
+  first_session.join();
+
+  ASSERT_EQ(read_file(dirs.local_root_dir / "first_session.txt").find("421"), std::string::npos);
+
+  // The limits are released with the sessions, once the server has noticed that the clients have disconnected
+  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+  ASSERT_EQ(server.getOpenConnectionCount(), 0);
+  const auto download_result = dirs.curl(server.getPort(), "hello.txt", "-o \"" + dirs.curl_output.string() + "\"");
+  ASSERT_EQ(download_result, 0);
+  ASSERT_EQ(read_file(dirs.curl_output), dirs.hello_content);
+
+  server.stop();
+}
+#endif // __linux__
+
+#if defined(__linux__)
+TEST(CommandTest, PipelinedAsyncReplies)
+{
+  const CommandTestDirs dirs;
+
+  fineftp::FtpServer server(0);
+  server.start(1);
+  ASSERT_TRUE(server.addUserWithPasswordHash("myuser", fineftp::FtpServer::createPasswordHash("mypass", 100000), dirs.local_ftp_root_dir.string(), fineftp::Permission::All));
+
+  // PASS, HASH and SITE CPTO are answered from other threads. The commands
+  // after them must not be handled before, or the replies would be mixed up.
+  const std::string input = "USER myuser\r\nPASS mypass\r\nPWD\r\nHASH hello.txt\r\nSITE CPFR hello.txt\r\nSITE CPTO copy.txt\r\nNOOP\r\nQUIT\r\n";
+  const auto result = system_execute("(printf '" + input + "'; sleep 3) | curl -s --max-time 3 \"telnet://localhost:" + std::to_string(server.getPort()) + "\""
+                                     + " -o \"" + dirs.curl_output.string() + "\"");
+  ASSERT_EQ(result, 0);
+
+  std::vector<std::string> reply_codes;
+  std::istringstream output(read_file(dirs.curl_output));
+  for (std::string line; std::getline(output, line);)
+    reply_codes.push_back(line.substr(0, 3));
+
+  ASSERT_EQ(reply_codes, (std::vector<std::string>{"220", "331", "230", "257", "213", "350", "250", "200", "221"}));
+  ASSERT_EQ(read_file(dirs.local_ftp_root_dir / "copy.txt"), dirs.hello_content);
+
+  server.stop();
+}
+#endif // __linux__
@@ -0,0 +1,145 @@
+#include <gtest/gtest.h>
+
+#include <file_man.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <ios>
+#include <iterator>
+#include <string>
+#include <system_error>
+
+namespace
+{
+  std::string read_file(const std::filesystem::path& path)
+  {
+    std::ifstream file(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  }
+
+  struct FileManTestDirs
+  {
+    FileManTestDirs()
+    {
+      std::error_code ec;
+      std::filesystem::remove_all(local_root_dir, ec);
+      std::filesystem::create_directories(local_root_dir);
+    }
+
+    ~FileManTestDirs()
+    {
+      std::error_code ec;
+      std::filesystem::remove_all(local_root_dir, ec);
+    }
+
+    // Disable copy and move
+    FileManTestDirs(const FileManTestDirs&)            = delete;
+    FileManTestDirs& operator=(const FileManTestDirs&) = delete;
+    FileManTestDirs(FileManTestDirs&&)                 = delete;
+    FileManTestDirs& operator=(FileManTestDirs&&)      = delete;
+
+    const std::filesystem::path local_root_dir = std::filesystem::current_path() / "file_man_root";
+  };
+}
+
+#if 1
+TEST(FileManTest, WriteAcrossBufferSize)
+{
+  const FileManTestDirs dirs;
+  const std::filesystem::path path = dirs.local_root_dir / "upload.bin";
+
+  // The session receives the data in 1 MiB buffers. Writing chunks of odd
+  // sizes crosses that boundary at arbitrary offsets.
+  const std::size_t buffer_size = 1024 * 1024;
+  std::string content;
+  for (std::size_t i = 0; content.size() < (3 * buffer_size + 17); i++)
+    content += static_cast<char>('a' + (i % 26));
+
+  {
+    fineftp::WriteableFile file(path.string(), std::ios::binary);
+    ASSERT_TRUE(file.good());
+
+    // Start the writeback every 100 KiB, so that path is exercised as well
+    file.setWritebackInterval(100 * 1024);
+
+    const std::size_t chunk_sizes[] = { 1, buffer_size - 1, buffer_size + 1, 4095, buffer_size };
+    std::size_t offset = 0;
+    for (std::size_t i = 0; offset < content.size(); i++)
+    {
+      const std::size_t chunk_size = std::min(chunk_sizes[i % (sizeof(chunk_sizes) / sizeof(chunk_sizes[0]))], content.size() - offset);
+      file.write(content.data() + offset, chunk_size);
+      offset += chunk_size;
+    }
+
+    ASSERT_TRUE(file.good());
+    ASSERT_TRUE(file.commit());
+  }
+
+  ASSERT_EQ(read_file(path), content);
+}
+#endif
+
+#if 1
+TEST(FileManTest, AtomicCommit)
+{
+  const FileManTestDirs dirs;
+  const std::filesystem::path path      = dirs.local_root_dir / "upload.txt";
+  const std::filesystem::path temp_path = dirs.local_root_dir / ".upload.txt.tmp";
+
+  std::ofstream(path, std::ios::binary) << "old";
+
+  {
+    // Readers see the old file until the new one is committed
+    fineftp::WriteableFile file(path.string(), temp_path.string(), std::ios::binary);
+    file.write("new", 3);
+    ASSERT_EQ(read_file(path), "old");
+    ASSERT_TRUE(file.commit(true));
+  }
+  ASSERT_EQ(read_file(path), "new");
+  ASSERT_FALSE(std::filesystem::exists(temp_path));
+
+  {
+    // A file that is not committed is discarded
+    fineftp::WriteableFile file(path.string(), temp_path.string(), std::ios::binary);
+    file.write("discarded", 9);
+  }
+  ASSERT_EQ(read_file(path), "new");
+  ASSERT_FALSE(std::filesystem::exists(temp_path));
+}
+#endif
+
+#if 1
+TEST(FileManTest, OpenErrorFailsCommit)
+{
+  const FileManTestDirs dirs;
+
+  // A directory cannot be opened for writing
+  fineftp::WriteableFile file(dirs.local_root_dir.string(), std::ios::binary);
+  ASSERT_FALSE(file.good());
+
+  // Writing to a file that could not be opened is ignored
+  file.write("data", 4);
+  ASSERT_FALSE(file.good());
+  ASSERT_FALSE(file.commit());
+}
+#endif
+
+#if defined(__linux__)
+TEST(FileManTest, WriteErrorFailsCommit)
+{
+  // Every write to /dev/full fails with ENOSPC, like on a full disk
+  fineftp::WriteableFile file("/dev/full", std::ios::binary);
+  ASSERT_TRUE(file.good());
+
+  const std::string data(64 * 1024, 'x');
+  file.write(data.data(), data.size());
+  ASSERT_FALSE(file.good());
+
+  // Later writes must not hide the error
+  file.write(data.data(), data.size());
+  ASSERT_FALSE(file.good());
+  ASSERT_FALSE(file.commit());
+}
+#endif
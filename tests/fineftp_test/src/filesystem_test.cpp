@@ -0,0 +1,215 @@
+#include <gtest/gtest.h>
+
+#include <filesystem.h>
+
+#include <cstddef>
+#include <list>
+#include <random>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+  // The previous implementation of Filesystem::cleanPath, which split the
+  // path into a list of strings. The current implementation must produce
+  // exactly the same results.
+  std::string referenceCleanPath(const std::string& path, bool path_is_windows_path, const char output_separator)
+  {
+    if (path.empty())
+    {
+      return ".";
+    }
+
+    // Find the root for absolute paths
+
+    std::string absolute_root;
+
+    if (path_is_windows_path)
+    {
+      /* On Windows, a root folder can be:
+       *    C:\
+       *    //Host
+       *    \\Host
+       */
+
+      const std::regex win_local_drive(R"(^[a-zA-Z]\:)");             // Local drive
+      const std::regex win_network_drive(R"(^[/\\]{2}[^/\\]+)");      // Network path starting with two slashes or backslashes followed by a hostname
+
+      if (std::regex_search(path, win_local_drive))
+      {
+        // Windows local drive, consisting of drive-letter and colon
+        absolute_root = path.substr(0, 2);
+      }
+      else if (std::regex_search(path, win_network_drive))
+      {
+        // Window network drive, consisting of \\ and hostname
+        const size_t sep_pos = path.find_first_of("/\\", 2);
+        absolute_root = path.substr(0, sep_pos); // If no seperator was found, this will return the entire string
+      }
+    }
+    else
+    {
+      // On Unix there is only one root and it is '/'
+      if (path[0] == '/')
+      {
+        absolute_root = '/';
+      }
+    }
+
+    // Split the path
+    std::list<std::string> components;
+
+    if (path.size() >= (absolute_root.size() + 1))
+    {
+      size_t start = 0;
+      size_t end   = 0;
+      
+      if (absolute_root.empty())
+        start = 0;
+      else
+        start = absolute_root.size();
+
+      do
+      {
+        if (path_is_windows_path)
+          end = path.find_first_of("/\\", start);
+        else
+          end = path.find_first_of('/', start);
+
+        std::string this_component;
+        if (end == std::string::npos)
+          this_component = path.substr(start);
+        else
+          this_component = path.substr(start, end - start);
+        
+        // The components-stack that will increase and shrink depending on the folders and .. elements in the splitted path
+        if (this_component.empty() || (this_component == "."))
+        {
+        }
+        else if (this_component == "..")
+        {
+          if (!absolute_root.empty())
+          {
+            if (!components.empty())
+            {
+              // Move one folder up if we are not already at the root
+              components.pop_back();
+            }
+          }
+          else
+          {
+            if (!components.empty() && (components.back() != ".."))
+            {
+              // Move one folder up by removing it. We must not remove ".." elements that we were not able to resolve previously.
+              components.pop_back();
+            }
+            else
+            {
+              components.emplace_back("..");
+            }
+          }
+        }
+        else
+        {
+          components.push_back(this_component);
+        }
+
+        if (end == std::string::npos)
+          break;
+        else
+          start = end + 1;
+
+      } while (start < path.size());
+
+      // Join the components again
+      if (components.empty() && absolute_root.empty())
+      {
+          return ".";
+      }
+    }
+
+    std::stringstream path_ss;
+    path_ss << absolute_root;
+
+    if (path_is_windows_path && !absolute_root.empty())
+    {
+      path_ss << output_separator; // The windows drive must be followed by a separator. When referencing a network drive.
+    }
+
+    auto comp_it = components.begin();
+    while (comp_it != components.end())
+    {
+      if (comp_it != components.begin())
+        path_ss << output_separator;
+      
+      path_ss << *comp_it;
+
+      comp_it++;
+    }
+
+    return path_ss.str();
+  }
+
+  // Builds a random path from components that exercise all special cases
+  std::string randomPath(std::mt19937& generator)
+  {
+    static const std::vector<std::string> prefixes   = { "", "", "", "/", "//", "\\", "\\\\", "C:", "c:\\", "//host", "\\\\host\\", "1:" };
+    static const std::vector<std::string> components = { "", ".", "..", "...", "a", "bc", "..a", "a.", "C:", "host" };
+    static const std::vector<std::string> separators = { "/", "/", "\\", "//", "\\/" };
+
+    std::uniform_int_distribution<std::size_t> prefix_dist   (0, prefixes.size() - 1);
+    std::uniform_int_distribution<std::size_t> component_dist(0, components.size() - 1);
+    std::uniform_int_distribution<std::size_t> separator_dist(0, separators.size() - 1);
+    std::uniform_int_distribution<std::size_t> count_dist    (0, 40);
+
+    std::string path = prefixes[prefix_dist(generator)];
+    const std::size_t count = count_dist(generator);
+    for (std::size_t i = 0; i < count; i++)
+    {
+      if (i > 0)
+        path += separators[separator_dist(generator)];
+      path += components[component_dist(generator)];
+    }
+    return path;
+  }
+}
+
+#if 1
+TEST(FilesystemTest, CleanPath)
+{
+  EXPECT_EQ(fineftp::Filesystem::cleanPath("",                    false, '/'),  ".");
+  EXPECT_EQ(fineftp::Filesystem::cleanPath("/",                   false, '/'),  "/");
+  EXPECT_EQ(fineftp::Filesystem::cleanPath("/../a/./b//c/..",     false, '/'),  "/a/b");
+  EXPECT_EQ(fineftp::Filesystem::cleanPath("a/../..",             false, '/'),  "..");
+  EXPECT_EQ(fineftp::Filesystem::cleanPath("../a/../../b",        false, '/'),  "../../b");
+  EXPECT_EQ(fineftp::Filesystem::cleanPath("a\\b/..",             false, '/'),  ".");
+  EXPECT_EQ(fineftp::Filesystem::cleanPath("a\\b/../c",           false, '\\'), "c");
+  EXPECT_EQ(fineftp::Filesystem::cleanPath("C:",                  true,  '\\'), "C:\\");
+  EXPECT_EQ(fineftp::Filesystem::cleanPath("C:/a/../..\\b",       true,  '\\'), "C:\\b");
+  EXPECT_EQ(fineftp::Filesystem::cleanPath("\\\\host/share/../x", true,  '/'),  "\\\\host/x");
+}
+#endif
+
+#if 1
+TEST(FilesystemTest, CleanPathMatchesReference)
+{
+  std::mt19937 generator(42);
+
+  for (int i = 0; i < 2000; i++)
+  {
+    const std::string path = randomPath(generator);
+
+    for (const bool path_is_windows_path : { false, true })
+    {
+      for (const char output_separator : { '/', '\\' })
+      {
+        ASSERT_EQ(fineftp::Filesystem::cleanPath(path, path_is_windows_path, output_separator),
+                  referenceCleanPath(path, path_is_windows_path, output_separator))
+            << "Path: \"" << path << "\", windows: " << path_is_windows_path << ", separator: " << output_separator;
+      }
+    }
+  }
+}
+#endif
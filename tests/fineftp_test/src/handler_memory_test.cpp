@@ -0,0 +1,167 @@
+#include <gtest/gtest.h>
+
+#include <handler_memory.h>
+
+#include <asio.hpp>
+
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace
+{
+  constexpr std::size_t chunk_size  = 64 * 1024;
+  constexpr int         chunk_count = 256;
+
+  // Sends and receives the chunks like the data path of a session does
+  // during a RETR (async_write) and a STOR (async_read). Each completion
+  // starts the next operation, so the transfer reaches a steady state.
+  class Transfer
+  {
+  public:
+    Transfer(asio::io_context& io_context, fineftp::HandlerMemory& handler_memory)
+      : handler_memory_     (handler_memory)
+      , data_socket_strand_ (io_context)
+      , sender_             (io_context)
+      , receiver_           (io_context)
+      , send_buffer_        (chunk_size, 'x')
+      , receive_buffer_     (chunk_size)
+      , sent_chunks_        (0)
+      , received_bytes_     (0)
+    {
+      asio::ip::tcp::acceptor acceptor(io_context, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+      sender_.connect(acceptor.local_endpoint());
+      acceptor.accept(receiver_);
+    }
+
+    void start()
+    {
+      sendChunk();
+      receiveChunk();
+    }
+
+    std::size_t receivedBytes() const { return received_bytes_; }
+
+  private:
+    void sendChunk()
+    {
+      asio::async_write(sender_, asio::buffer(send_buffer_), fineftp::makeAllocHandler(handler_memory_, data_socket_strand_.wrap([this](asio::error_code ec, std::size_t /*bytes_transferred*/)
+                        {
+                          ASSERT_FALSE(ec);
+                          if (++sent_chunks_ < chunk_count)
+                            sendChunk();
+                          else
+                            sender_.shutdown(asio::ip::tcp::socket::shutdown_send);
+                        })));
+    }
+
+    void receiveChunk()
+    {
+      asio::async_read(receiver_, asio::buffer(receive_buffer_), asio::transfer_at_least(receive_buffer_.size()), fineftp::makeAllocHandler(handler_memory_, data_socket_strand_.wrap([this](asio::error_code ec, std::size_t length)
+                       {
+                         received_bytes_ += length;
+                         if (!ec)
+                           receiveChunk();
+                       })));
+    }
+
+  private:
+    fineftp::HandlerMemory&  handler_memory_;
+    asio::io_context::strand data_socket_strand_;
+    asio::ip::tcp::socket    sender_;
+    asio::ip::tcp::socket    receiver_;
+    std::vector<char>        send_buffer_;
+    std::vector<char>        receive_buffer_;
+    int                      sent_chunks_;
+    std::size_t              received_bytes_;
+  };
+
+#if !defined(ASIO_NO_DEPRECATED) && (ASIO_VERSION < 102900)
+  // A handler with its own invocation hook, like the ones created by strand::wrap()
+  struct HookedHandler
+  {
+    int* invocations;
+
+    void operator()(asio::error_code /*ec*/, std::size_t /*length*/) {}
+  };
+
+  template <typename Function>
+  void asio_handler_invoke(Function& function, HookedHandler* handler)
+  {
+    ++(*handler->invocations);
+    function();
+  }
+
+  template <typename Function>
+  void asio_handler_invoke(const Function& function, HookedHandler* handler)
+  {
+    ++(*handler->invocations);
+    function();
+  }
+#endif // !ASIO_NO_DEPRECATED && ASIO_VERSION < 102900
+}
+
+#if 1
+TEST(HandlerMemoryTest, SteadyStateTransferDoesNotFallBack)
+{
+  asio::io_context       io_context;
+  fineftp::HandlerMemory handler_memory;
+
+  Transfer transfer(io_context, handler_memory);
+  transfer.start();
+  io_context.run();
+
+  ASSERT_EQ(transfer.receivedBytes(), chunk_size * chunk_count);
+
+  // The read and the write are in flight at the same time, each of them
+  // uses one slot. The strand hop of the wrapped handlers doesn't use the
+  // HandlerMemory at all (see handler_memory.h).
+  ASSERT_EQ(handler_memory.fallbackAllocations(), 0U);
+}
+#endif
+
+#if 1
+TEST(HandlerMemoryTest, LargeHandlersFallBack)
+{
+  asio::io_context       io_context;
+  fineftp::HandlerMemory handler_memory;
+
+  // Handlers that don't fit into a slot come from the heap
+  const std::array<char, 1024> large_capture {};
+  bool called = false;
+  asio::post(io_context, fineftp::makeAllocHandler(handler_memory, [&called, large_capture]() { called = (large_capture.size() == 1024); }));
+  io_context.run();
+
+  ASSERT_TRUE(called);
+  ASSERT_EQ(handler_memory.fallbackAllocations(), 1U);
+}
+#endif
+
+#if !defined(ASIO_NO_DEPRECATED) && (ASIO_VERSION < 102900)
+TEST(HandlerMemoryTest, InvocationHooksAreForwarded)
+{
+  asio::io_context       io_context;
+  fineftp::HandlerMemory handler_memory;
+
+  asio::ip::tcp::acceptor acceptor(io_context, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+  asio::ip::tcp::socket   sender  (io_context);
+  asio::ip::tcp::socket   receiver(io_context);
+  sender.connect(acceptor.local_endpoint());
+  acceptor.accept(receiver);
+
+  // The data arrives in two parts, so async_read needs an intermediate handler
+  std::array<char, 8> buffer {};
+  int invocations = 0;
+  asio::async_read(receiver, asio::buffer(buffer), fineftp::makeAllocHandler(handler_memory, HookedHandler{&invocations}));
+
+  asio::write(sender, asio::buffer("abcd", 4));
+  io_context.poll();
+  asio::write(sender, asio::buffer("efgh", 4));
+  io_context.run();
+
+  // Both reads of the composed operation must complete through the hook of the wrapped handler
+  ASSERT_GE(invocations, 2);
+}
+#endif // !ASIO_NO_DEPRECATED && ASIO_VERSION < 102900